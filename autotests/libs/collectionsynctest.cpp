@@ -82,7 +82,18 @@ private:
         return c;
     }
 
-    Collection::List prepareBenchmark()
+    void makeBenchmarkData()
+    {
+        QTest::addColumn<int>("count");
+
+        QTest::newRow("1k collections") << 1000;
+        QTest::newRow("10k collections") << 10000;
+        QTest::newRow("50k collections") << 50000;
+    }
+
+    // Builds a synthetic tree of roughly @p count collections: a wide shared
+    // folder where every child has 6 subfolders
+    Collection::List prepareBenchmark(int count)
     {
         Collection::List collections = fetchCollections(QStringLiteral("akonadi_knut_resource_0"));
 
@@ -109,7 +120,7 @@ private:
         const Collection shared = createCollection(QStringLiteral("Shared collections"), QStringLiteral("/shared"), root);
         baseCollections << shared;
         collections << shared;
-        for (int i = 0; i < 10000; ++i) {
+        for (int i = 0; i < count / 7; ++i) {
             const Collection col = createCollection(QStringLiteral("Shared Col %1").arg(i), QStringLiteral("/shared%1").arg(i), shared);
             collections << col;
             for (int j = 0; j < 6; ++j) {
@@ -406,9 +417,16 @@ private Q_SLOTS:
 
 // Disabled by default, because they take ~15 minutes to complete
 #if 0
+    void benchmarkInitialSync_data()
+    {
+        makeBenchmarkData();
+    }
+
     void benchmarkInitialSync()
     {
-        const Collection::List collections = prepareBenchmark();
+        QFETCH(int, count);
+
+        const Collection::List collections = prepareBenchmark(count);
 
         CollectionSync *syncer = prepareBenchmarkSyncer(collections);
 
@@ -419,9 +437,18 @@ private Q_SLOTS:
         cleanupBenchmark(collections);
     }
 
+    void benchmarkIncrementalSync_data()
+    {
+        makeBenchmarkData();
+    }
+
+    // Mostly measures matching the remote tree against the local one, as
+    // nothing has changed
     void benchmarkIncrementalSync()
     {
-        const Collection::List collections = prepareBenchmark();
+        QFETCH(int, count);
+
+        const Collection::List collections = prepareBenchmark(count);
 
         // First populate Akonadi with Collections
         CollectionSync *syncer = prepareBenchmarkSyncer(collections);
@@ -0,0 +1,187 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "commandbuffer_p.h"
+
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTest>
+#include <QThread>
+
+#include <algorithm>
+
+using namespace Akonadi;
+
+/// Handles the commands like SessionPrivate::handleCommands(), optionally slowly
+class Consumer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Consumer(const QElapsedTimer &clock, int delay = 0)
+        : buffer(this, "handleCommands")
+        , mClock(clock)
+        , mDelay(delay)
+    {
+    }
+
+    CommandBuffer buffer;
+    int wakeups = 0;
+    int handled = 0;
+    qint64 totalLatency = 0;
+
+public Q_SLOTS:
+    void handleCommands()
+    {
+        ++wakeups;
+        CommandBufferLocker lock(&buffer);
+        CommandBufferNotifyBlocker notify(&buffer);
+        for (int batch = buffer.batchSize(); batch > 0 && !buffer.isEmpty(); --batch) {
+            const auto command = buffer.dequeue();
+            lock.unlock();
+            // The tag carries the time the command was received
+            totalLatency += mClock.nsecsElapsed() - command.tag;
+            if (mDelay > 0) {
+                QThread::usleep(mDelay);
+            }
+            ++handled;
+            lock.relock();
+        }
+        notify.unblock();
+        lock.unlock();
+    }
+
+private:
+    const QElapsedTimer &mClock;
+    int mDelay;
+};
+
+/// Fills the buffer like Connection::handleIncomingData() does
+class Producer : public QObject
+{
+    Q_OBJECT
+public:
+    Producer(CommandBuffer *buffer, const QElapsedTimer &clock, int count)
+        : mBuffer(buffer)
+        , mClock(clock)
+        , mRemaining(count)
+    {
+    }
+
+    Q_INVOKABLE void produce()
+    {
+        while (mRemaining > 0) {
+            CommandBufferLocker locker(mBuffer);
+            if (!mBuffer->canEnqueue()) {
+                return;
+            }
+            mBuffer->enqueue(mClock.nsecsElapsed(), Protocol::FetchItemsResponsePtr::create(mRemaining));
+            peakSize = std::max(peakSize, mBuffer->size());
+            --mRemaining;
+        }
+    }
+
+    int peakSize = 0;
+
+private:
+    CommandBuffer *mBuffer;
+    const QElapsedTimer &mClock;
+    int mRemaining;
+};
+
+class CommandBufferTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    void runThreaded(Consumer *consumer, int count, int highWaterMark, int *peakSize)
+    {
+        QThread thread;
+        Producer producer(&consumer->buffer, mClock, count);
+        producer.moveToThread(&thread);
+        {
+            CommandBufferLocker locker(&consumer->buffer);
+            consumer->buffer.setReader(&producer, "produce");
+            consumer->buffer.setHighWaterMark(highWaterMark);
+        }
+        thread.start();
+        QMetaObject::invokeMethod(&producer, "produce", Qt::QueuedConnection);
+        QTRY_COMPARE_WITH_TIMEOUT(consumer->handled, count, 60000);
+        thread.quit();
+        thread.wait();
+        *peakSize = producer.peakSize;
+    }
+
+    QElapsedTimer mClock;
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        mClock.start();
+    }
+
+    void testBatchedNotification()
+    {
+        Consumer consumer(mClock);
+        const int count = 1000;
+        Producer producer(&consumer.buffer, mClock, count);
+        producer.produce();
+
+        QTRY_COMPARE(consumer.handled, count);
+        // One notification per batch, not one per command
+        QCOMPARE(consumer.wakeups, (count + CommandBuffer::DefaultBatchSize - 1) / CommandBuffer::DefaultBatchSize);
+    }
+
+    void testHighWaterMark()
+    {
+        Consumer consumer(mClock, 20);
+        int peakSize = 0;
+        runThreaded(&consumer, 2000, 100, &peakSize);
+        QVERIFY(peakSize <= 100);
+    }
+
+    void benchSlowConsumer_data()
+    {
+        QTest::addColumn<int>("highWaterMark");
+
+        QTest::newRow("unlimited") << 0;
+        QTest::newRow("high-water mark 1000") << 1000;
+    }
+
+    void benchSlowConsumer()
+    {
+        QFETCH(int, highWaterMark);
+
+        // A large item fetch handled by a GUI thread that needs 50us per item
+        const int count = 20000;
+        Consumer consumer(mClock, 50);
+        int peakSize = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK_ONCE {
+            runThreaded(&consumer, count, highWaterMark, &peakSize);
+        }
+        qDebug() << "total" << timer.elapsed() << "ms, average latency"
+                 << consumer.totalLatency / count / 1000 << "us, peak" << peakSize
+                 << "buffered commands," << consumer.wakeups << "wakeups";
+    }
+};
+
+QTEST_GUILESS_MAIN(CommandBufferTest)
+
+#include "commandbuffertest.moc"
@@ -96,6 +96,8 @@ private Q_SLOTS:
     void testItemChanged_data();
     void testItemChanged();
     void testRemoveCollectionOnChanged();
+    void testChildRowIndex_data();
+    void testChildRowIndex();
 
 private:
     QPair<FakeServerData *, Akonadi::EntityTreeModel *> populateModel(const QString &serverContent, const QString &mimeType = QString())
@@ -657,6 +659,126 @@ void EntityTreeModelTest::testRemoveCollectionOnChanged()
     QVERIFY(m_modelSpy->isEmpty());
 }
 
+static Node *createNode(const QString &token)
+{
+    // "c<id>" for a collection, "i<id>" for an item
+    auto node = new Node;
+    node->type = token.startsWith(QLatin1Char('c')) ? Node::Collection : Node::Item;
+    node->id = token.midRef(1).toLongLong();
+    node->parent = 1;
+    return node;
+}
+
+void EntityTreeModelTest::testChildRowIndex_data()
+{
+    // Each operation is one of
+    //   "+<node>"  append a node
+    //   "^<node>"  prepend a node
+    //   "-<row>"   remove the node at row
+    //   "<<row>"   move the node at row to the front
+    //   "><row>"   move the node at row to the end
+    QTest::addColumn<QStringList>("children");
+    QTest::addColumn<QStringList>("operations");
+
+    const QStringList children = { QStringLiteral("c1"), QStringLiteral("c2"), QStringLiteral("i1"),
+                                   QStringLiteral("i2"), QStringLiteral("i3") };
+
+    QTest::newRow("prepend") << children << QStringList{ QStringLiteral("^c3"), QStringLiteral("^c4") };
+    QTest::newRow("append") << children << QStringList{ QStringLiteral("+i4"), QStringLiteral("+i5") };
+    QTest::newRow("remove first") << children << QStringList{ QStringLiteral("-0"), QStringLiteral("-0") };
+    QTest::newRow("remove middle") << children << QStringList{ QStringLiteral("-2"), QStringLiteral("-1") };
+    QTest::newRow("remove last") << children << QStringList{ QStringLiteral("-4"), QStringLiteral("-3") };
+    QTest::newRow("remove all") << children
+                                << QStringList{ QStringLiteral("-2"), QStringLiteral("-0"), QStringLiteral("-2"),
+                                                QStringLiteral("-1"), QStringLiteral("-0"), QStringLiteral("+i6") };
+    QTest::newRow("move to front") << children << QStringList{ QStringLiteral("<3"), QStringLiteral("<4") };
+    QTest::newRow("move to end") << children << QStringList{ QStringLiteral(">0"), QStringLiteral(">2") };
+    QTest::newRow("mixed") << children
+                           << QStringList{ QStringLiteral("^c3"), QStringLiteral("+i4"), QStringLiteral("-3"),
+                                           QStringLiteral(">1"), QStringLiteral("-0"), QStringLiteral("<4"),
+                                           QStringLiteral("-4") };
+
+    const QStringList duplicates = { QStringLiteral("c1"), QStringLiteral("i1"), QStringLiteral("i2"),
+                                     QStringLiteral("i1"), QStringLiteral("i3") };
+    QTest::newRow("duplicate, remove first") << duplicates << QStringList{ QStringLiteral("-1") };
+    QTest::newRow("duplicate, remove second") << duplicates << QStringList{ QStringLiteral("-3") };
+    QTest::newRow("duplicate, remove both") << duplicates << QStringList{ QStringLiteral("-1"), QStringLiteral("-2") };
+    QTest::newRow("duplicate appended") << children << QStringList{ QStringLiteral("+i1"), QStringLiteral("-2") };
+    QTest::newRow("duplicate prepended") << children << QStringList{ QStringLiteral("^c2"), QStringLiteral("-0") };
+    QTest::newRow("duplicate moved") << duplicates << QStringList{ QStringLiteral(">1"), QStringLiteral("-0"),
+                                                                   QStringLiteral("<3"), QStringLiteral("-0") };
+}
+
+void EntityTreeModelTest::testChildRowIndex()
+{
+    QFETCH(QStringList, children);
+    QFETCH(QStringList, operations);
+
+    QList<Node *> nodes;
+    QList<Node *> allNodes;
+    for (const QString &child : qAsConst(children)) {
+        nodes.append(createNode(child));
+    }
+    allNodes = nodes;
+
+    ChildRowIndex index;
+    index.rebuild(nodes);
+
+    const auto verifyRows = [&](const QString &operation) {
+        // Looked up the same way EntityTreeModelPrivate::rowOf() does
+        if (!index.isValid()) {
+            index.rebuild(nodes);
+        }
+        for (const Node *node : qAsConst(allNodes)) {
+            int expected = -1;
+            for (int row = 0; row < nodes.size(); ++row) {
+                if (nodes.at(row)->type == node->type && nodes.at(row)->id == node->id) {
+                    expected = row;
+                    break;
+                }
+            }
+            const int actual = index.row(node->type, node->id);
+            QVERIFY2(actual == expected, qPrintable(QStringLiteral("after %1: row of %2%3 is %4, expected %5")
+                                                    .arg(operation, node->type == Node::Item ? QStringLiteral("i") : QStringLiteral("c"))
+                                                    .arg(node->id).arg(actual).arg(expected)));
+        }
+    };
+
+    for (const QString &operation : qAsConst(operations)) {
+        const QChar op = operation.at(0);
+        const QString arg = operation.mid(1);
+        if (op == QLatin1Char('+') || op == QLatin1Char('^')) {
+            Node *node = createNode(arg);
+            allNodes.append(node);
+            if (op == QLatin1Char('+')) {
+                nodes.append(node);
+                index.appended(node, nodes.size());
+            } else {
+                nodes.prepend(node);
+                index.prepended(node);
+            }
+        } else {
+            const int row = arg.toInt();
+            QVERIFY(row < nodes.size());
+            Node *node = nodes.takeAt(row);
+            index.removed(node, row, nodes.size());
+            if (op == QLatin1Char('<')) {
+                nodes.prepend(node);
+                index.prepended(node);
+            } else if (op == QLatin1Char('>')) {
+                nodes.append(node);
+                index.appended(node, nodes.size());
+            }
+        }
+        verifyRows(operation);
+        if (QTest::currentTestFailed()) {
+            break;
+        }
+    }
+
+    qDeleteAll(allNodes);
+}
+
 #include "entitytreemodeltest.moc"
 
 QTEST_MAIN(EntityTreeModelTest)
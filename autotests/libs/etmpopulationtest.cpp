@@ -140,6 +140,7 @@ private Q_SLOTS:
     void testRemoveMonitoringCollections();
     void testDisplayFilter();
     void testLoadingOfHiddenCollection();
+    void testChunkedItemInsertion();
 
 private:
     Collection res;
@@ -338,6 +339,35 @@ void EtmPopulationTest::testLoadingOfHiddenCollection()
     AKVERIFYEXEC(deleteJob);
 }
 
+void EtmPopulationTest::testChunkedItemInsertion()
+{
+    Collection col6 = createCollection(QStringLiteral("col6"), monitorCol);
+    QVERIFY(col6.isValid());
+    const int itemCount = 600;
+    for (int i = 0; i < itemCount; ++i) {
+        Item item(QStringLiteral("application/octet-stream"));
+        item.setPayload<QByteArray>(QByteArray::number(i));
+        auto create = new ItemCreateJob(item, col6);
+        AKVERIFYEXEC(create);
+    }
+
+    ChangeRecorder *changeRecorder = new ChangeRecorder(this);
+    changeRecorder->setCollectionMonitored(col6, true);
+    InspectableETM *model = new InspectableETM(changeRecorder, this);
+    model->setItemInsertionBudget(1);
+    QCOMPARE(model->itemInsertionBudget(), 1);
+    model->setItemPopulationStrategy(EntityTreeModel::ImmediatePopulation);
+    model->setCollectionFetchStrategy(EntityTreeModel::FetchCollectionsRecursive);
+
+    QTRY_VERIFY(model->isCollectionTreeFetched());
+    QTRY_VERIFY(getIndex(QStringLiteral("col6"), model).data(Akonadi::EntityTreeModel::IsPopulatedRole).toBool());
+    // The collection must only be reported as populated once all items are in
+    QCOMPARE(model->rowCount(getIndex(QStringLiteral("col6"), model)), itemCount);
+
+    Akonadi::CollectionDeleteJob *deleteJob = new Akonadi::CollectionDeleteJob(col6);
+    AKVERIFYEXEC(deleteJob);
+}
+
 #include "etmpopulationtest.moc"
 
 QTEST_AKONADIMAIN(EtmPopulationTest)
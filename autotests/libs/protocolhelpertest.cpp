@@ -21,6 +21,8 @@
 #include "protocolhelper.cpp"
 #include "attributestorage.cpp"
 
+#include <QTemporaryDir>
+
 using namespace Akonadi;
 
 Q_DECLARE_METATYPE(Scope)
@@ -326,6 +328,82 @@ private Q_SLOTS:
             QCOMPARE(attr->serialized(), expectedAttr->serialized());
         }
     }
+
+    void testLazyPayloadParsing()
+    {
+        Protocol::FetchItemsResponse response(5);
+        response.setMimeType(QStringLiteral("application/octet-stream"));
+        response.setParts({ Protocol::StreamPayloadResponse("PLD:RFC822", Protocol::PartMetaData("PLD:RFC822", 3), "foo") });
+
+        const Item item = ProtocolHelper::parseItemFetchResult(response);
+        QCOMPARE(item.id(), 5);
+        // Shallow copies made before the first access share the deserialized payload
+        const Item copy = item;
+        QVERIFY(item.hasPayload());
+        QVERIFY(item.hasPayload<QByteArray>());
+        QCOMPARE(item.payload<QByteArray>(), QByteArray("foo"));
+        QCOMPARE(copy.payload<QByteArray>(), QByteArray("foo"));
+        QCOMPARE(item.loadedPayloadParts(), QSet<QByteArray>{ "RFC822" });
+
+        // Setting a payload replaces the unparsed one
+        Item modified = ProtocolHelper::parseItemFetchResult(response);
+        modified.setPayload<QByteArray>("bar");
+        QCOMPARE(modified.payload<QByteArray>(), QByteArray("bar"));
+    }
+
+    void testLazyPayloadParsingForeignFile()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.filePath(QStringLiteral("payload"));
+        {
+            QFile file(fileName);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write("foo");
+        }
+
+        Protocol::FetchItemsResponse response(5);
+        response.setMimeType(QStringLiteral("application/octet-stream"));
+        response.setParts({ Protocol::StreamPayloadResponse("PLD:RFC822",
+                                                            Protocol::PartMetaData("PLD:RFC822", 3, 0, Protocol::PartMetaData::Foreign),
+                                                            fileName.toUtf8()) });
+
+        const Item item = ProtocolHelper::parseItemFetchResult(response);
+        QCOMPARE(item.payloadPath(), fileName);
+
+        // The file is read during parsing, changing it afterwards does not matter
+        QVERIFY(QFile::remove(fileName));
+        QVERIFY(item.hasPayload());
+        QCOMPARE(item.payload<QByteArray>(), QByteArray("foo"));
+    }
+
+    void testPayloadFileReferences()
+    {
+        QTemporaryDir dir;
+        const QString fullFileName = dir.filePath(QStringLiteral("full"));
+        const QString headFileName = dir.filePath(QStringLiteral("head"));
+        for (const QString &fileName : { fullFileName, headFileName }) {
+            QFile file(fileName);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write("foo");
+        }
+
+        Protocol::FetchItemsResponse response(5);
+        response.setMimeType(QStringLiteral("application/octet-stream"));
+        response.setParts({ Protocol::StreamPayloadResponse("PLD:RFC822",
+                                                            Protocol::PartMetaData("PLD:RFC822", 3, 0, Protocol::PartMetaData::Foreign),
+                                                            fullFileName.toUtf8()),
+                            Protocol::StreamPayloadResponse("PLD:HEAD",
+                                                            Protocol::PartMetaData("PLD:HEAD", 3, 0, Protocol::PartMetaData::Foreign),
+                                                            headFileName.toUtf8()) });
+
+        ItemFetchScope scope;
+        scope.fetchFullPayload();
+        scope.setPayloadFileReferences(true);
+        const Item item = ProtocolHelper::parseItemFetchResult(response, &scope);
+        // Only the full payload is referenced, whatever the order of the parts
+        QCOMPARE(item.payloadPath(), fullFileName);
+        QVERIFY(!item.hasPayload());
+    }
 };
 
 QTEST_MAIN(ProtocolHelperTest)
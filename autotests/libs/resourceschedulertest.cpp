@@ -25,7 +25,7 @@
 
 using namespace Akonadi;
 
-QTEST_MAIN(ResourceSchedulerTest)
+QTEST_GUILESS_MAIN(ResourceSchedulerTest)
 
 Q_DECLARE_METATYPE(QSet<QByteArray>)
 
@@ -249,18 +249,17 @@ void ResourceSchedulerTest::testCompression()
     QTest::qWait(2);
     QVERIFY(scheduler.isEmpty());
 
-    // sync collection
-    scheduler.scheduleItemFetch(Akonadi::Item(42), QSet<QByteArray>(), QDBusMessage());
-    scheduler.scheduleItemFetch(Akonadi::Item(42), QSet<QByteArray>(), QDBusMessage());
+    // item fetch is not compressed, every task belongs to the request it was created from
+    scheduler.scheduleItemFetch(Akonadi::Item(42), QSet<QByteArray>(), QList<QDBusMessage>(), 1);
+    scheduler.scheduleItemFetch(Akonadi::Item(42), QSet<QByteArray>(), QList<QDBusMessage>(), 2);
     QTest::qWait(1);   // start execution
     QCOMPARE(fetchSpy.count(), 1);
-    scheduler.scheduleItemFetch(Akonadi::Item(43), QSet<QByteArray>(), QDBusMessage());
-    scheduler.scheduleItemFetch(Akonadi::Item(42), QSet<QByteArray>(), QDBusMessage());
-    scheduler.taskDone();
+    scheduler.itemFetchDone(QString());
     QTest::qWait(1);
     QCOMPARE(fetchSpy.count(), 2);
-    scheduler.taskDone();
+    scheduler.itemFetchDone(QString());
     QTest::qWait(2);
+    QCOMPARE(fetchSpy.count(), 2);
     QVERIFY(scheduler.isEmpty());
 }
 
@@ -310,7 +309,7 @@ void ResourceSchedulerTest::testPriorities()
     scheduler.scheduleCollectionTreeSync();
     scheduler.scheduleChangeReplay();
     scheduler.scheduleSync(Akonadi::Collection(42));
-    scheduler.scheduleItemFetch(Akonadi::Item(42), QSet<QByteArray>(), QDBusMessage());
+    scheduler.scheduleItemFetch(Akonadi::Item(42), QSet<QByteArray>(), QList<QDBusMessage>(), 1);
     scheduler.scheduleAttributesSync(Akonadi::Collection(42));
     scheduler.scheduleFullSync();
 
@@ -371,3 +370,79 @@ void ResourceSchedulerTest::testPriorities()
     QVERIFY(scheduler.isEmpty());
 }
 
+void ResourceSchedulerTest::testItemsFetchMerging()
+{
+    ResourceScheduler scheduler;
+    qRegisterMetaType<QVector<Akonadi::Item>>("QVector<Akonadi::Item>");
+    QSignalSpy fetchSpy(&scheduler, SIGNAL(executeItemsFetch(QVector<Akonadi::Item>,QSet<QByteArray>)));
+    QVERIFY(fetchSpy.isValid());
+
+    const Item::List items = { Item(1), Item(2) };
+    const QSet<QByteArray> parts = { "RFC822" };
+    scheduler.scheduleItemsFetch(items, parts, QDBusMessage());
+    scheduler.scheduleItemsFetch({ Item(3) }, parts, QDBusMessage());
+    scheduler.scheduleItemsFetch(items, parts, QDBusMessage());
+    scheduler.scheduleItemsFetch(items, { "HEAD" }, QDBusMessage());
+
+    scheduler.setOnline(true);
+    QTest::qWait(1);
+    QCOMPARE(fetchSpy.count(), 1);
+    QCOMPARE(scheduler.currentTask().items, items);
+    QCOMPARE(scheduler.currentTask().dbusMsgs.size(), 2);
+
+    // while running, an equal request is merged into the current task
+    scheduler.scheduleItemsFetch(items, parts, QDBusMessage());
+    QCOMPARE(scheduler.currentTask().dbusMsgs.size(), 3);
+
+    scheduler.taskDone();
+    QTest::qWait(1);
+    QCOMPARE(fetchSpy.count(), 2);
+    QCOMPARE(scheduler.currentTask().items, Item::List{ Item(3) });
+
+    // a deferred task goes back to the front and can still be merged with
+    scheduler.deferTask();
+    scheduler.scheduleItemsFetch({ Item(3) }, parts, QDBusMessage());
+    QTest::qWait(1);
+    QCOMPARE(fetchSpy.count(), 3);
+    QCOMPARE(scheduler.currentTask().items, Item::List{ Item(3) });
+    QCOMPARE(scheduler.currentTask().dbusMsgs.size(), 2);
+    scheduler.taskDone();
+
+    QTest::qWait(1);
+    QCOMPARE(fetchSpy.count(), 4);
+    QCOMPARE(scheduler.currentTask().itemParts, QSet<QByteArray>{ "HEAD" });
+    scheduler.taskDone();
+    QVERIFY(scheduler.isEmpty());
+}
+
+void ResourceSchedulerTest::benchmarkItemsFetchScheduling_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<int>("distinct");
+
+    QTest::newRow("10k distinct") << 10000 << 10000;
+    QTest::newRow("10k, 100 distinct") << 10000 << 100;
+    QTest::newRow("100k distinct") << 100000 << 100000;
+    QTest::newRow("100k, 100 distinct") << 100000 << 100;
+}
+
+void ResourceSchedulerTest::benchmarkItemsFetchScheduling()
+{
+    QFETCH(int, count);
+    QFETCH(int, distinct);
+
+    // The 10k rows are small enough for every test run
+    if (count > 10000 && !qEnvironmentVariableIsSet("AKONADI_TEST_FULL_BENCHMARKS")) {
+        QSKIP("Set AKONADI_TEST_FULL_BENCHMARKS to run the 100k tasks benchmark");
+    }
+
+    const QSet<QByteArray> parts = { "RFC822" };
+    QBENCHMARK_ONCE {
+        // offline, so nothing is executed and every task stays queued
+        ResourceScheduler scheduler;
+        for (int i = 0; i < count; ++i) {
+            scheduler.scheduleItemsFetch({ Item(i % distinct + 1) }, parts, QDBusMessage());
+        }
+        QVERIFY(!scheduler.isEmpty());
+    }
+}
@@ -40,6 +40,9 @@ private Q_SLOTS:
     void testCompression();
     void testSyncCompletion();
     void testPriorities();
+    void testItemsFetchMerging();
+    void benchmarkItemsFetchScheduling_data();
+    void benchmarkItemsFetchScheduling();
 
 private:
     int mCustomCallCount;
@@ -0,0 +1,101 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include <private/commandtrace_p.h>
+#include <shared/aktest.h>
+
+#include <QBuffer>
+#include <QObject>
+#include <QTest>
+
+using namespace Akonadi;
+
+class CommandTraceTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    QByteArray writeTrace()
+    {
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        Protocol::CommandTrace::writeHeader(&buffer, "kmail");
+        Protocol::CommandTrace::writeEntry(&buffer, 0, 1, Protocol::LoginCommandPtr::create("kmail"));
+        auto select = Protocol::SelectResourceCommandPtr::create(QStringLiteral("akonadi_imap_resource_0"));
+        Protocol::CommandTrace::writeEntry(&buffer, 15, 2, select);
+        auto payload = Protocol::StreamPayloadResponsePtr::create();
+        payload->setData("Hello World");
+        Protocol::CommandTrace::writeEntry(&buffer, 20, 2, payload);
+        return data;
+    }
+
+private Q_SLOTS:
+    void testRoundtrip()
+    {
+        QByteArray data = writeTrace();
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+
+        Protocol::CommandTrace trace;
+        QString error;
+        QVERIFY(trace.read(&buffer, &error));
+        QVERIFY(error.isEmpty());
+        QCOMPARE(trace.sessionId, QByteArray("kmail"));
+        QVERIFY(trace.recorded.isValid());
+        QCOMPARE(trace.entries.size(), 3);
+
+        QCOMPARE(trace.entries[0].tag, qint64(1));
+        QCOMPARE(trace.entries[0].command->type(), Protocol::Command::Login);
+        QCOMPARE(Protocol::cmdCast<Protocol::LoginCommand>(trace.entries[0].command).sessionId(), QByteArray("kmail"));
+        QCOMPARE(trace.entries[1].offset, qint64(15));
+        QCOMPARE(Protocol::cmdCast<Protocol::SelectResourceCommand>(trace.entries[1].command).resourceId(),
+                 QStringLiteral("akonadi_imap_resource_0"));
+        QVERIFY(trace.entries[2].command->isResponse());
+        QCOMPARE(Protocol::cmdCast<Protocol::StreamPayloadResponse>(trace.entries[2].command).data(), QByteArray("Hello World"));
+    }
+
+    void testTruncated()
+    {
+        QByteArray data = writeTrace();
+        data.chop(4);
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+
+        Protocol::CommandTrace trace;
+        QString error;
+        QVERIFY(trace.read(&buffer, &error));
+        QVERIFY(!error.isEmpty());
+        QCOMPARE(trace.entries.size(), 2);
+    }
+
+    void testInvalid()
+    {
+        QByteArray data("This is not a trace");
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+
+        Protocol::CommandTrace trace;
+        QVERIFY(!trace.read(&buffer));
+    }
+};
+
+AKTEST_MAIN(CommandTraceTest)
+
+#include "commandtracetest.moc"
@@ -0,0 +1,206 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include <QObject>
+#include <QTest>
+#include <QFile>
+#include <QDateTime>
+
+#include "cachecleaner.h"
+#include "storage/datastore.h"
+#include "storage/parthelper.h"
+#include "storage/querybuilder.h"
+#include "storage/selectquerybuilder.h"
+#include "storage/transaction.h"
+#include "fakeakonadiserver.h"
+#include "dbinitializer.h"
+#include "entities.h"
+#include "aktest.h"
+
+#include <private/externalpartstorage_p.h>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+class CacheCleanerTest : public QObject
+{
+    Q_OBJECT
+
+    DbInitializer *dbInitializer = nullptr;
+
+public:
+    CacheCleanerTest()
+    {
+        FakeAkonadiServer::instance()->setPopulateDb(false);
+        FakeAkonadiServer::instance()->init();
+
+        dbInitializer = new DbInitializer;
+    }
+
+    ~CacheCleanerTest()
+    {
+        delete dbInitializer;
+        FakeAkonadiServer::instance()->quit();
+    }
+
+private:
+    Collection createCollection(const char *name)
+    {
+        Collection col = dbInitializer->createCollection(name);
+        col.setCachePolicyInherit(false);
+        col.setCachePolicyCacheTimeout(5);
+        col.setCachePolicyLocalParts(QStringLiteral("PLD:HEAD"));
+        col.update();
+        return col;
+    }
+
+    static void makeExpired(const Collection &col)
+    {
+        QueryBuilder qb(PimItem::tableName(), QueryBuilder::Update);
+        qb.setColumnValue(PimItem::atimeColumn(), QDateTime::currentDateTimeUtc().addDays(-1));
+        qb.addValueCondition(PimItem::collectionIdColumn(), Query::Equals, col.id());
+        QVERIFY(qb.exec());
+    }
+
+    static Part makeExternal(Part part)
+    {
+        QByteArray fileName;
+        ExternalPartStorage::self()->createPartFile(part.data(), part.id(), fileName);
+        part.setData(fileName);
+        part.setStorage(Part::External);
+        part.update();
+        return part;
+    }
+
+    // The pre-bulk expiry path: one UPDATE (and possibly one unlink) per part
+    static void expirePartsIndividually(const Collection &col)
+    {
+        SelectQueryBuilder<Part> qb;
+        qb.addJoin(QueryBuilder::InnerJoin, PimItem::tableName(), Part::pimItemIdFullColumnName(), PimItem::idFullColumnName());
+        qb.addValueCondition(PimItem::collectionIdFullColumnName(), Query::Equals, col.id());
+        qb.addValueCondition(Part::dataFullColumnName(), Query::IsNot, QVariant());
+        QVERIFY(qb.exec());
+        const Part::List parts = qb.result();
+        for (Part part : parts) {
+            PartHelper::truncate(part);
+        }
+    }
+
+private Q_SLOTS:
+    void testExpireParts()
+    {
+        dbInitializer->createResource("testresource");
+        const Collection col = createCollection("col1");
+
+        const PimItem item1 = dbInitializer->createItem("item1", col);
+        const Part body1 = dbInitializer->createPart(item1.id(), "PLD:RFC822", "body");
+        const Part head1 = dbInitializer->createPart(item1.id(), "PLD:HEAD", "head");
+        const Part attr1 = dbInitializer->createPart(item1.id(), "ATR:foo", "attribute");
+
+        PimItem item2 = dbInitializer->createItem("item2", col);
+        item2.setDirty(true);
+        item2.update();
+        const Part body2 = dbInitializer->createPart(item2.id(), "PLD:RFC822", "dirty");
+
+        const PimItem item3 = dbInitializer->createItem("item3", col);
+        const Part body3 = makeExternal(dbInitializer->createPart(item3.id(), "PLD:RFC822", "external"));
+        const QString body3File = ExternalPartStorage::resolveAbsolutePath(body3.data());
+        QVERIFY(QFile::exists(body3File));
+
+        makeExpired(col);
+
+        // Accessed just now, must not expire yet
+        const PimItem item4 = dbInitializer->createItem("item4", col);
+        const Part body4 = dbInitializer->createPart(item4.id(), "PLD:RFC822", "recent");
+
+        QStringList files;
+        QCOMPARE(CacheCleaner::expireParts(col, files), 2);
+        QCOMPARE(files, QStringList{ body3File });
+        // Files are left for the caller to remove
+        QVERIFY(QFile::exists(body3File));
+
+        for (const Part &part : { body1, body3 }) {
+            const Part expired = Part::retrieveById(part.id());
+            QVERIFY(expired.data().isNull());
+            QCOMPARE(expired.datasize(), qint64(0));
+            QCOMPARE(expired.storage(), Part::Internal);
+        }
+        for (const Part &part : { head1, attr1, body2, body4 }) {
+            QCOMPARE(Part::retrieveById(part.id()).data(), part.data());
+        }
+
+        // Nothing left to expire
+        files.clear();
+        QCOMPARE(CacheCleaner::expireParts(col, files), 0);
+        QVERIFY(files.isEmpty());
+
+        ExternalPartStorage::self()->removePartFile(body3File);
+        dbInitializer->cleanup();
+    }
+
+    void benchmarkExpireParts_data()
+    {
+        QTest::addColumn<bool>("bulk");
+        QTest::addColumn<int>("count");
+
+        QTest::newRow("per-part") << false << 5000;
+        QTest::newRow("bulk") << true << 5000;
+        QTest::newRow("per-part 100k") << false << 100000;
+        QTest::newRow("bulk 100k") << true << 100000;
+    }
+
+    void benchmarkExpireParts()
+    {
+        QFETCH(bool, bulk);
+        QFETCH(int, count);
+
+        // The 5000 parts rows are small enough for every test run
+        if (count > 5000 && !qEnvironmentVariableIsSet("AKONADI_TEST_FULL_BENCHMARKS")) {
+            QSKIP("Set AKONADI_TEST_FULL_BENCHMARKS to run the 100k parts benchmark");
+        }
+
+        dbInitializer->createResource("testresource");
+        const Collection col = createCollection("col1");
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("BENCHMARK"));
+            for (int i = 0; i < count; ++i) {
+                const QByteArray name = "item" + QByteArray::number(i);
+                const PimItem item = dbInitializer->createItem(name.constData(), col);
+                dbInitializer->createPart(item.id(), "PLD:RFC822", "payload of " + name);
+            }
+            QVERIFY(transaction.commit());
+        }
+        makeExpired(col);
+
+        QStringList files;
+        QBENCHMARK_ONCE {
+            if (bulk) {
+                QCOMPARE(CacheCleaner::expireParts(col, files), count);
+            } else {
+                expirePartsIndividually(col);
+            }
+        }
+
+        dbInitializer->cleanup();
+    }
+};
+
+AKTEST_FAKESERVER_MAIN(CacheCleanerTest)
+
+#include "cachecleanertest.moc"
@@ -26,6 +26,8 @@
 #include "entities.h"
 #include "dbinitializer.h"
 #include <storage/storagedebugger.h>
+#include <storage/transaction.h>
+#include <storage/datastore.h>
 
 #include <QTest>
 
@@ -79,6 +81,19 @@ public:
         return cmd;
     }
 
+    // Runs the scenarios against both the SQL and the CollectionTreeCache
+    // listing, which must produce identical responses.
+    void runScenarios(const TestScenario::List &scenarios)
+    {
+        FakeAkonadiServer::instance()->setScenarios(scenarios);
+        FakeAkonadiServer::instance()->runTest();
+
+        FakeAkonadiServer::instance()->setCollectionTreeCacheEnabled(true);
+        FakeAkonadiServer::instance()->setScenarios(scenarios);
+        FakeAkonadiServer::instance()->runTest();
+        FakeAkonadiServer::instance()->setCollectionTreeCacheEnabled(false);
+    }
+
     QScopedPointer<DbInitializer> initializer;
 private Q_SLOTS:
 
@@ -174,8 +189,7 @@ private Q_SLOTS:
     {
         QFETCH(TestScenario::List, scenarios);
 
-        FakeAkonadiServer::instance()->setScenarios(scenarios);
-        FakeAkonadiServer::instance()->runTest();
+        runScenarios(scenarios);
     }
 
     void testListFiltered_data()
@@ -211,8 +225,7 @@ private Q_SLOTS:
     {
         QFETCH(TestScenario::List, scenarios);
 
-        FakeAkonadiServer::instance()->setScenarios(scenarios);
-        FakeAkonadiServer::instance()->runTest();
+        runScenarios(scenarios);
     }
 
     void testListFilterByResource()
@@ -240,8 +253,7 @@ private Q_SLOTS:
                   << TestScenario::create(5, TestScenario::ServerCmd, initializer->listResponse(col1))
                   << TestScenario::create(5, TestScenario::ServerCmd, Protocol::FetchCollectionsResponsePtr::create());
 
-        FakeAkonadiServer::instance()->setScenarios(scenarios);
-        FakeAkonadiServer::instance()->runTest();
+        runScenarios(scenarios);
 
         col2.remove();
         res2.remove();
@@ -338,8 +350,7 @@ private Q_SLOTS:
     {
         QFETCH(TestScenario::List, scenarios);
 
-        FakeAkonadiServer::instance()->setScenarios(scenarios);
-        FakeAkonadiServer::instance()->runTest();
+        runScenarios(scenarios);
     }
 
     void testListAttribute_data()
@@ -386,8 +397,7 @@ private Q_SLOTS:
     {
         QFETCH(TestScenario::List, scenarios);
 
-        FakeAkonadiServer::instance()->setScenarios(scenarios);
-        FakeAkonadiServer::instance()->runTest();
+        runScenarios(scenarios);
     }
 
     void testListAncestorAttributes_data()
@@ -423,8 +433,7 @@ private Q_SLOTS:
     {
         QFETCH(TestScenario::List, scenarios);
 
-        FakeAkonadiServer::instance()->setScenarios(scenarios);
-        FakeAkonadiServer::instance()->runTest();
+        runScenarios(scenarios);
     }
 
     void testIncludeAncestors_data()
@@ -477,8 +486,52 @@ private Q_SLOTS:
     {
         QFETCH(TestScenario::List, scenarios);
 
-        FakeAkonadiServer::instance()->setScenarios(scenarios);
-        FakeAkonadiServer::instance()->runTest();
+        runScenarios(scenarios);
+    }
+
+    void benchmarkRecursiveList_data()
+    {
+        // 10k folders: 100 folders with 99 subfolders each
+        initializer.reset(new DbInitializer);
+        Resource res = initializer->createResource("testresource");
+        Collection toplevel = initializer->createCollection("toplevel");
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("BENCHMARK"));
+            for (int i = 0; i < 100; ++i) {
+                const QByteArray name = "folder" + QByteArray::number(i);
+                const Collection folder = initializer->createCollection(name.constData(), toplevel);
+                for (int j = 0; j < 99; ++j) {
+                    const QByteArray subName = name + '-' + QByteArray::number(j);
+                    initializer->createCollection(subName.constData(), folder);
+                }
+            }
+            QVERIFY(transaction.commit());
+        }
+
+        QTest::addColumn<TestScenario::List>("scenarios");
+        QTest::addColumn<bool>("useCache");
+
+        TestScenario::List scenarios;
+        scenarios << FakeAkonadiServer::loginScenario()
+                  << TestScenario::create(5, TestScenario::ClientCmd, createCommand(toplevel.id(), Protocol::FetchCollectionsCommand::AllCollections,
+                                                                                    Protocol::Ancestor::AllAncestors))
+                  << TestScenario::ignore(10000)
+                  << TestScenario::create(5, TestScenario::ServerCmd, Protocol::FetchCollectionsResponsePtr::create());
+        QTest::newRow("sql") << scenarios << false;
+        QTest::newRow("cache") << scenarios << true;
+    }
+
+    void benchmarkRecursiveList()
+    {
+        QFETCH(TestScenario::List, scenarios);
+        QFETCH(bool, useCache);
+
+        FakeAkonadiServer::instance()->setCollectionTreeCacheEnabled(useCache);
+        QBENCHMARK {
+            FakeAkonadiServer::instance()->setScenarios(scenarios);
+            FakeAkonadiServer::instance()->runTest();
+        }
+        FakeAkonadiServer::instance()->setCollectionTreeCacheEnabled(false);
     }
 
 //No point in running the benchmark every time
@@ -59,6 +59,7 @@ protected:
 
     void quit() Q_DECL_OVERRIDE
     {
+        CollectionTreeCache::quit();
     }
 
 private:
@@ -139,6 +140,77 @@ private Q_SLOTS:
         QCOMPARE(allCols, expCols);
     }
 
+    void updateTest()
+    {
+        DbInitializer db;
+        populateDb(db);
+
+        InspectableCollectionTreeCache treeCache;
+        QVERIFY(treeCache.waitForCachePopulated());
+
+        auto resA = db.collection("Res A");
+        auto colA1 = db.collection("Col A1");
+        auto colA2 = db.collection("Col A2");
+
+        const auto subtreeNames = [&treeCache](const Collection &col, int depth) {
+            QVector<CollectionTreeCache::CachedCollection> subtree, ancestors;
+            QStringList names;
+            if (treeCache.retrieveSubtree(col.id(), depth, 0, subtree, ancestors)) {
+                for (const auto &cached : qAsConst(subtree)) {
+                    names << cached.collection.name();
+                }
+            }
+            return names;
+        };
+
+        QCOMPARE(subtreeNames(colA1, 1), QStringList{ QStringLiteral("Col A1") });
+
+        // Added collections are loaded on demand, including their mimetypes and attributes
+        auto colA11 = db.createCollection("Col A11", colA1);
+        auto mt = MimeType::retrieveByNameOrCreate(QStringLiteral("text/plain"));
+        QVERIFY(colA11.addMimeType(mt));
+        CollectionAttribute attr;
+        attr.setCollectionId(colA11.id());
+        attr.setType("type");
+        attr.setValue("value");
+        QVERIFY(attr.insert());
+        treeCache.collectionAdded(colA11);
+        QCOMPARE(subtreeNames(colA1, 1), (QStringList{ QStringLiteral("Col A1"), QStringLiteral("Col A11") }));
+        {
+            QVector<CollectionTreeCache::CachedCollection> subtree, ancestors;
+            QVERIFY(treeCache.retrieveSubtree(colA11.id(), 0, 1, subtree, ancestors));
+            QCOMPARE(subtree.size(), 1);
+            QCOMPARE(subtree[0].mimeTypes, QVector<MimeType::Id>{ mt.id() });
+            QCOMPARE(subtree[0].attributes.size(), 1);
+            QCOMPARE(subtree[0].attributes[0].value(), QByteArray("value"));
+            QCOMPARE(ancestors.size(), 1);
+            QCOMPARE(ancestors[0].collection.id(), colA1.id());
+        }
+
+        // Changes are reloaded on demand
+        colA11.setName(QStringLiteral("Col A11 renamed"));
+        QVERIFY(colA11.update());
+        treeCache.collectionChanged(colA11);
+        QCOMPARE(subtreeNames(colA1, 1), (QStringList{ QStringLiteral("Col A1"), QStringLiteral("Col A11 renamed") }));
+
+        // Moving takes the whole subtree along
+        colA2.setParentId(colA1.id());
+        QVERIFY(colA2.update());
+        treeCache.collectionMoved(colA2);
+        QCOMPARE(subtreeNames(colA1, 1).size(), 3);
+        QCOMPARE(subtreeNames(colA1, std::numeric_limits<int>::max()).size(), 7);
+        QVERIFY(!subtreeNames(resA, 1).contains(QStringLiteral("Col A2")));
+
+        // Removing drops the whole subtree
+        treeCache.collectionRemoved(colA2);
+        QCOMPARE(subtreeNames(colA1, std::numeric_limits<int>::max()),
+                 (QStringList{ QStringLiteral("Col A1"), QStringLiteral("Col A11 renamed") }));
+        QVERIFY(subtreeNames(db.collection("Col A8"), 0).isEmpty());
+
+        colA2.setParentId(resA.id());
+        QVERIFY(colA2.update());
+    }
+
 };
 
 AKTEST_FAKESERVER_MAIN(CollectionTreeCacheTest)
@@ -0,0 +1,179 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include <QObject>
+#include <QTest>
+
+#include "storage/datastorepool.h"
+
+#include <aktest.h>
+
+using namespace Akonadi::Server;
+
+class DataStorePoolTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testLeases()
+    {
+        DataStorePool pool(2);
+        QObject a, b;
+
+        QVERIFY(pool.acquire(&a, {}, {}));
+        QVERIFY(pool.acquire(&b, {}, {}));
+        // Acquiring again is a no-op
+        QVERIFY(pool.acquire(&a, {}, {}));
+        QVERIFY(pool.hasLease(&a));
+
+        auto stats = pool.statistics();
+        QCOMPARE(stats.active, 2);
+        QCOMPARE(stats.leases, 2);
+        QCOMPARE(stats.waits, 0);
+
+        pool.setIdle(&b);
+        stats = pool.statistics();
+        QCOMPARE(stats.active, 1);
+        QCOMPARE(stats.idle, 1);
+
+        pool.release(&a);
+        pool.release(&b);
+        QVERIFY(!pool.hasLease(&a));
+        stats = pool.statistics();
+        QCOMPARE(stats.active, 0);
+        QCOMPARE(stats.idle, 0);
+        QCOMPARE(stats.peak, 2);
+    }
+
+    void testEviction()
+    {
+        DataStorePool pool(1);
+        QObject idle;
+        bool evicted = false;
+        QVERIFY(pool.acquire(&idle, [&]() {
+            evicted = true;
+            pool.release(&idle);
+        }, {}));
+        pool.setIdle(&idle);
+
+        QObject waiter;
+        int grants = 0;
+        bool granted = false;
+        QVERIFY(!pool.acquire(&waiter, {}, [&](bool ok) {
+            ++grants;
+            granted = ok;
+        }));
+        QVERIFY(!pool.hasLease(&waiter));
+        QCOMPARE(pool.statistics().waiting, 1);
+
+        // Both the eviction and the grant are delivered through our event loop
+        QTRY_COMPARE(grants, 1);
+        QVERIFY(evicted);
+        QVERIFY(granted);
+        QVERIFY(!pool.hasLease(&idle));
+        QVERIFY(pool.hasLease(&waiter));
+
+        const auto stats = pool.statistics();
+        QCOMPARE(stats.waiting, 0);
+        QCOMPARE(stats.waits, 1);
+        QCOMPARE(stats.evictions, 1);
+        QCOMPARE(stats.overcommits, 0);
+    }
+
+    void testOvercommit()
+    {
+        DataStorePool pool(1, 100);
+        QObject busy, waiter;
+        QVERIFY(pool.acquire(&busy, {}, {}));
+
+        // Busy leases are never evicted, we get a lease over the capacity
+        // once the wait times out
+        int grants = 0;
+        bool granted = true;
+        QVERIFY(!pool.acquire(&waiter, {}, [&](bool ok) {
+            ++grants;
+            granted = ok;
+        }));
+        QTRY_COMPARE(grants, 1);
+        QVERIFY(!granted);
+        QVERIFY(pool.hasLease(&waiter));
+
+        const auto stats = pool.statistics();
+        QCOMPARE(stats.active, 2);
+        QCOMPARE(stats.waiting, 0);
+        QCOMPARE(stats.overcommits, 1);
+        QCOMPARE(stats.evictions, 0);
+        QVERIFY(stats.maxWaitTime >= 100);
+    }
+
+    void testStaleEviction()
+    {
+        DataStorePool pool(1);
+        QObject holder;
+        int evictions = 0;
+        QVERIFY(pool.acquire(&holder, [&]() {
+            ++evictions;
+            pool.release(&holder);
+        }, {}));
+        pool.setIdle(&holder);
+
+        QObject waiter;
+        bool granted = false;
+        QVERIFY(!pool.acquire(&waiter, {}, [&](bool ok) { granted = ok; }));
+
+        // The holder is busy again before the eviction is delivered, it must
+        // not lose its lease
+        QVERIFY(pool.acquire(&holder, {}, {}));
+        QTest::qWait(50);
+        QCOMPARE(evictions, 0);
+        QVERIFY(pool.hasLease(&holder));
+        QVERIFY(!pool.hasLease(&waiter));
+
+        // Once idle again, it is evicted for the waiting holder
+        pool.setIdle(&holder);
+        QTRY_VERIFY(granted);
+        QCOMPARE(evictions, 1);
+        QVERIFY(!pool.hasLease(&holder));
+        QVERIFY(pool.hasLease(&waiter));
+    }
+
+    void testCancelRequest()
+    {
+        DataStorePool pool(1, 100);
+        QObject busy, waiter;
+        QVERIFY(pool.acquire(&busy, {}, {}));
+
+        int grants = 0;
+        QVERIFY(!pool.acquire(&waiter, {}, [&](bool) { ++grants; }));
+        pool.release(&waiter);
+        QCOMPARE(pool.statistics().waiting, 0);
+
+        // Neither a returned lease nor the timeout grant the cancelled request
+        pool.release(&busy);
+        QTest::qWait(200);
+        QCOMPARE(grants, 0);
+        QVERIFY(!pool.hasLease(&waiter));
+        QCOMPARE(pool.statistics().overcommits, 0);
+    }
+};
+
+AKTEST_MAIN(DataStorePoolTest)
+
+#include "datastorepooltest.moc"
@@ -63,6 +63,28 @@ private Q_SLOTS:
                     DbDeadlockException);
         QCOMPARE(m_myFuncCalled, 6);
     }
+
+    void testRetryVetoed()
+    {
+        m_myFuncCalled = 0;
+        QVERIFY_EXCEPTION_THROWN(
+                    DbDeadlockCatcher catcher([this](){ myFunc(1); }, [](){ return false; }),
+                    DbDeadlockException);
+        QCOMPARE(m_myFuncCalled, 1);
+    }
+
+    void testStatistics()
+    {
+        const auto before = DbDeadlockCatcher::statistics();
+        m_myFuncCalled = 0;
+        DbDeadlockCatcher catcher([this](){ myFunc(2); });
+        const auto after = DbDeadlockCatcher::statistics();
+        QCOMPARE(after.deadlocks - before.deadlocks, qint64(2));
+        QCOMPARE(after.retries - before.retries, qint64(2));
+        QCOMPARE(after.failures, before.failures);
+        // Half of the backoff before the first and the second retry at least
+        QVERIFY(after.totalBackoffTime - before.totalBackoffTime >= 15);
+    }
 };
 
 AKTEST_MAIN(DbDeadlockCatcherTest)
@@ -18,6 +18,7 @@
 */
 
 #include <QObject>
+#include <QSqlError>
 #include <QTest>
 
 #include <aktest.h>
@@ -56,6 +57,35 @@ private Q_SLOTS:
             QCOMPARE(DbType::type(db), dbType);
         }
     }
+
+    void testTransactionConflict_data()
+    {
+        QTest::addColumn<QString>("driverName");
+        QTest::addColumn<QString>("errorCode");
+        QTest::addColumn<bool>("conflict");
+
+        QTest::newRow("mysql deadlock") << "QMYSQL" << "1213" << true;
+        QTest::newRow("mysql lock timeout") << "QMYSQL" << "1205" << true;
+        QTest::newRow("mysql duplicate key") << "QMYSQL" << "1062" << false;
+        QTest::newRow("mysql no error") << "QMYSQL" << "" << false;
+        QTest::newRow("psql deadlock") << "QPSQL" << "40P01" << true;
+        QTest::newRow("psql serialization failure") << "QPSQL" << "40001" << true;
+        QTest::newRow("psql unique violation") << "QPSQL" << "23505" << false;
+        QTest::newRow("sqlite3 busy") << "QSQLITE3" << "5" << true;
+        QTest::newRow("sqlite3 locked") << "QSQLITE3" << "6" << true;
+        QTest::newRow("sqlite3 constraint") << "QSQLITE3" << "19" << false;
+        QTest::newRow("system sqlite busy") << "QSQLITE" << "5" << false;
+    }
+
+    void testTransactionConflict()
+    {
+        QFETCH(QString, driverName);
+        QFETCH(QString, errorCode);
+        QFETCH(bool, conflict);
+
+        const QSqlError error(QString(), QString(), QSqlError::StatementError, errorCode);
+        QCOMPARE(DbType::isTransactionConflictForDriverName(driverName, error), conflict);
+    }
 };
 
 AKTEST_MAIN(DbTypeTest)
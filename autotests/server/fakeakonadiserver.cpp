@@ -32,6 +32,7 @@
 #include <QTest>
 #include <QBuffer>
 #include <QStandardPaths>
+#include <QThreadPool>
 
 #include <private/protocol_p.h>
 #include <private/scope_p.h>
@@ -41,6 +42,8 @@
 #include "aklocalserver.h"
 #include "storage/dbconfig.h"
 #include "storage/datastore.h"
+#include "storage/collectiontreecache.h"
+#include "notificationmanager.h"
 #include "preprocessormanager.h"
 #include "search/searchmanager.h"
 #include "utils.h"
@@ -183,6 +186,44 @@ void FakeAkonadiServer::disableItemRetrievalManager()
     mDisableItemRetrievalManager = true;
 }
 
+void FakeAkonadiServer::setCollectionTreeCacheEnabled(bool enabled)
+{
+    delete mCollectionTreeCache;
+    mCollectionTreeCache = nullptr;
+
+    if (enabled) {
+        mCollectionTreeCache = new CollectionTreeCache();
+        if (!QTest::qWaitFor([this]() { return mCollectionTreeCache->isPopulated(); }, 10000)) {
+            throw FakeAkonadiServerException("Collection tree cache failed to populate");
+        }
+    }
+}
+
+void FakeAkonadiServer::setItemFetchThreadCount(int count)
+{
+    if (mItemFetchThreadPool) {
+        mItemFetchThreadPool->waitForDone();
+        delete mItemFetchThreadPool;
+        mItemFetchThreadPool = nullptr;
+    }
+
+    if (count > 0) {
+        mItemFetchThreadPool = new QThreadPool(this);
+        mItemFetchThreadPool->setMaxThreadCount(count);
+    }
+}
+
+void FakeAkonadiServer::setNotificationManagerEnabled(bool enabled)
+{
+    delete mNotificationManager;
+    mNotificationManager = nullptr;
+
+    if (enabled) {
+        mNotificationManager = new NotificationManager(AkThread::NoThread);
+        QMetaObject::invokeMethod(mNotificationManager, "init", Qt::DirectConnection);
+    }
+}
+
 bool FakeAkonadiServer::init()
 {
     try {
@@ -279,7 +320,11 @@ bool FakeAkonadiServer::quit()
         mDataStore->close();
     }
 
+    setItemFetchThreadCount(0);
+    setNotificationManagerEnabled(false);
     delete mIntervalCheck;
+    delete mCollectionTreeCache;
+    mCollectionTreeCache = nullptr;
 
     qDebug() << "==== Fake Akonadi Server shut down ====";
     return true;
@@ -108,6 +108,12 @@ public:
 
     void setPopulateDb(bool populate);
     void disableItemRetrievalManager();
+    /** Serves collection listings from a CollectionTreeCache populated from the current database content. */
+    void setCollectionTreeCacheEnabled(bool enabled);
+    /** Splits large item fetches among @p count worker threads, 0 disables parallel fetching. */
+    void setItemFetchThreadCount(int count);
+    /** Runs a NotificationManager in the calling thread, so that notifications get their payloads filled in. */
+    void setNotificationManagerEnabled(bool enabled);
 
 protected:
     void newCmdConnection(quintptr socketDescriptor) override;
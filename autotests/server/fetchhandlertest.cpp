@@ -175,6 +175,72 @@ private Q_SLOTS:
         FakeAkonadiServer::instance()->runTest();
     }
 
+    void testFetchTagsAndRelations_data()
+    {
+        initializer.reset(new DbInitializer);
+        Resource res = initializer->createResource("testresource");
+        Collection col = initializer->createCollection("root");
+        PimItem item1 = initializer->createItem("item1", col);
+        PimItem item2 = initializer->createItem("item2", col);
+
+        TagType type;
+        type.setName(QStringLiteral("PLAIN"));
+        type.insert();
+        Tag tag;
+        tag.setTagType(type);
+        tag.setGid(QStringLiteral("gid"));
+        tag.insert();
+        TagAttribute attr;
+        attr.setTagId(tag.id());
+        attr.setType("TAGATTR");
+        attr.setValue("value");
+        attr.insert();
+
+        item1.addTag(tag);
+        item1.update();
+
+        RelationType relType;
+        relType.setName(QStringLiteral("GENERIC"));
+        relType.insert();
+        Relation rel;
+        rel.setLeftId(item1.id());
+        rel.setRightId(item2.id());
+        rel.setRelationType(relType);
+        rel.insert();
+
+        auto cmd = createCommand(ImapSet::all(), Protocol::ScopeContext(Protocol::ScopeContext::Collection, col.id()));
+        auto fetchScope = cmd->itemFetchScope();
+        fetchScope.setFetch(Protocol::ItemFetchScope::Tags | Protocol::ItemFetchScope::Relations);
+        cmd->setItemFetchScope(fetchScope);
+
+        const Protocol::FetchRelationsResponse relResp(item1.id(), item1.mimeType().name().toUtf8(),
+                                                       item2.id(), item2.mimeType().name().toUtf8(),
+                                                       "GENERIC");
+        auto resp2 = createResponse(item2);
+        resp2->setRelations({ relResp });
+        auto resp1 = createResponse(item1);
+        resp1->setRelations({ relResp });
+        resp1->setTags({ Protocol::FetchTagsResponse(tag.id(), "gid", "PLAIN", QByteArray(), 0, { { "TAGATTR", "value" } }) });
+
+        QTest::addColumn<TestScenario::List>("scenarios");
+
+        TestScenario::List scenarios;
+        scenarios << FakeAkonadiServer::loginScenario()
+                  << TestScenario::create(5, TestScenario::ClientCmd, cmd)
+                  << TestScenario::create(5, TestScenario::ServerCmd, resp2)
+                  << TestScenario::create(5, TestScenario::ServerCmd, resp1)
+                  << TestScenario::create(5, TestScenario::ServerCmd, Protocol::FetchItemsResponsePtr::create());
+        QTest::newRow("tags and relations") << scenarios;
+    }
+
+    void testFetchTagsAndRelations()
+    {
+        QFETCH(TestScenario::List, scenarios);
+
+        FakeAkonadiServer::instance()->setScenarios(scenarios);
+        FakeAkonadiServer::instance()->runTest();
+    }
+
     void testFetchCommandContext_data()
     {
         initializer.reset(new DbInitializer);
@@ -219,6 +285,102 @@ private Q_SLOTS:
         FakeAkonadiServer::instance()->runTest();
     }
 
+    void testFetchPaged_data()
+    {
+        initializer.reset(new DbInitializer);
+        Resource res = initializer->createResource("testresource");
+        Collection col = initializer->createCollection("root");
+        // Whole seconds, the database does not necessarily store more
+        const QDateTime now = QDateTime::fromSecsSinceEpoch(QDateTime::currentSecsSinceEpoch(), Qt::UTC);
+        QVector<PimItem> items;
+        for (int i = 0; i < 5; ++i) {
+            PimItem item = initializer->createItem(QByteArray::number(i).constData(), col);
+            // Modification times in a different order than IDs
+            item.setDatetime(now.addSecs(-((i * 3) % 5) * 60));
+            item.update();
+            items.push_back(item);
+        }
+        QVector<PimItem> byId = items;
+        std::sort(byId.begin(), byId.end(), [](const PimItem &a, const PimItem &b) {
+            return a.id() > b.id();
+        });
+        QVector<PimItem> byMTime = items;
+        std::sort(byMTime.begin(), byMTime.end(), [](const PimItem &a, const PimItem &b) {
+            return a.datetime() > b.datetime();
+        });
+
+        const auto createPagedCommand = [&](Protocol::ItemFetchLimit::SortKey sortKey, const PimItem &after) {
+            auto cmd = createCommand(ImapSet::all(), Protocol::ScopeContext(Protocol::ScopeContext::Collection, col.id()));
+            Protocol::ItemFetchLimit limit;
+            limit.setLimit(2);
+            limit.setSortKey(sortKey);
+            if (after.isValid()) {
+                limit.setContinuationId(after.id());
+                limit.setContinuationMTime(after.datetime());
+            }
+            cmd->setItemFetchLimit(limit);
+            return cmd;
+        };
+        const auto createLastResponse = [](Protocol::ItemFetchLimit::SortKey sortKey, const PimItem &last) {
+            auto resp = Protocol::FetchItemsResponsePtr::create();
+            if (last.isValid()) {
+                Protocol::ItemFetchLimit nextPage;
+                nextPage.setLimit(2);
+                nextPage.setSortKey(sortKey);
+                nextPage.setContinuationId(last.id());
+                nextPage.setContinuationMTime(last.datetime());
+                resp->setNextPage(nextPage);
+            }
+            return resp;
+        };
+
+        QTest::addColumn<TestScenario::List>("scenarios");
+
+        {
+            TestScenario::List scenarios;
+            scenarios << FakeAkonadiServer::loginScenario()
+                      << TestScenario::create(5, TestScenario::ClientCmd, createPagedCommand(Protocol::ItemFetchLimit::Id, PimItem()))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createResponse(byId[0]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createResponse(byId[1]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createLastResponse(Protocol::ItemFetchLimit::Id, byId[1]));
+            QTest::newRow("first page by id") << scenarios;
+        }
+        {
+            TestScenario::List scenarios;
+            scenarios << FakeAkonadiServer::loginScenario()
+                      << TestScenario::create(5, TestScenario::ClientCmd, createPagedCommand(Protocol::ItemFetchLimit::Id, byId[3]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createResponse(byId[4]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createLastResponse(Protocol::ItemFetchLimit::Id, PimItem()));
+            QTest::newRow("last page by id") << scenarios;
+        }
+        {
+            TestScenario::List scenarios;
+            scenarios << FakeAkonadiServer::loginScenario()
+                      << TestScenario::create(5, TestScenario::ClientCmd, createPagedCommand(Protocol::ItemFetchLimit::ModificationTime, PimItem()))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createResponse(byMTime[0]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createResponse(byMTime[1]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createLastResponse(Protocol::ItemFetchLimit::ModificationTime, byMTime[1]));
+            QTest::newRow("first page by mtime") << scenarios;
+        }
+        {
+            TestScenario::List scenarios;
+            scenarios << FakeAkonadiServer::loginScenario()
+                      << TestScenario::create(5, TestScenario::ClientCmd, createPagedCommand(Protocol::ItemFetchLimit::ModificationTime, byMTime[1]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createResponse(byMTime[2]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createResponse(byMTime[3]))
+                      << TestScenario::create(5, TestScenario::ServerCmd, createLastResponse(Protocol::ItemFetchLimit::ModificationTime, byMTime[3]));
+            QTest::newRow("next page by mtime") << scenarios;
+        }
+    }
+
+    void testFetchPaged()
+    {
+        QFETCH(TestScenario::List, scenarios);
+
+        FakeAkonadiServer::instance()->setScenarios(scenarios);
+        FakeAkonadiServer::instance()->runTest();
+    }
+
     void testList_data()
     {
         QElapsedTimer timer;
@@ -228,14 +390,48 @@ private Q_SLOTS:
 
         timer.start();
         QList<PimItem> items;
-        for (int i = 0; i < 1000; i++) {
+        // More than two fetch windows worth of items
+        for (int i = 0; i < 2500; i++) {
             items.append(initializer->createItem(QString::number(i).toLatin1().constData(),col1));
         }
         qDebug() << timer.nsecsElapsed()/1.0e6 << "ms";
         timer.start();
 
         QTest::addColumn<TestScenario::List>("scenarios");
+        QTest::addColumn<int>("fetchThreads");
 
+        {
+            // Too many single ids for an IN condition, matched through a temporary table
+            QVector<qint64> ids;
+            TestScenario::List responses;
+            for (int i = items.size() - 1; i >= 0; i -= 2) {
+                ids << items.at(i).id();
+                responses << TestScenario::create(5, TestScenario::ServerCmd, createResponse(items.at(i)));
+            }
+            TestScenario::List scenarios;
+            scenarios << FakeAkonadiServer::loginScenario()
+                      << TestScenario::create(5, TestScenario::ClientCmd, createCommand(ImapSet(ids)))
+                      << responses
+                      << TestScenario::create(5, TestScenario::ServerCmd, Protocol::FetchItemsResponsePtr::create());
+            QTest::newRow("scattered list") << scenarios << 0;
+        }
+        {
+            // Only the single ids go into the temporary table, the range stays a range condition
+            QVector<qint64> ids;
+            TestScenario::List responses;
+            for (int i = items.size() - 1; i >= 0; --i) {
+                if (i >= 1500 || i % 2 == 1) {
+                    ids << items.at(i).id();
+                    responses << TestScenario::create(5, TestScenario::ServerCmd, createResponse(items.at(i)));
+                }
+            }
+            TestScenario::List scenarios;
+            scenarios << FakeAkonadiServer::loginScenario()
+                      << TestScenario::create(5, TestScenario::ClientCmd, createCommand(ImapSet(ids)))
+                      << responses
+                      << TestScenario::create(5, TestScenario::ServerCmd, Protocol::FetchItemsResponsePtr::create());
+            QTest::newRow("scattered list and range") << scenarios << 0;
+        }
         {
             TestScenario::List scenarios;
             scenarios << FakeAkonadiServer::loginScenario()
@@ -245,7 +441,8 @@ private Q_SLOTS:
                 scenarios << TestScenario::create(5, TestScenario::ServerCmd, createResponse(item));
             }
             scenarios << TestScenario::create(5, TestScenario::ServerCmd, Protocol::FetchItemsResponsePtr::create());
-            QTest::newRow("complete list") << scenarios;
+            QTest::newRow("complete list") << scenarios << 0;
+            QTest::newRow("complete list, parallel") << scenarios << 2;
         }
         qDebug() << timer.nsecsElapsed()/1.0e6 << "ms";
     }
@@ -253,11 +450,14 @@ private Q_SLOTS:
     void testList()
     {
         QFETCH(TestScenario::List, scenarios);
+        QFETCH(int, fetchThreads);
 
+        FakeAkonadiServer::instance()->setItemFetchThreadCount(fetchThreads);
         FakeAkonadiServer::instance()->setScenarios(scenarios);
         //StorageDebugger::instance()->enableSQLDebugging(true);
         //StorageDebugger::instance()->writeToFile(QStringLiteral("sqllog.txt"));
         FakeAkonadiServer::instance()->runTest();
+        FakeAkonadiServer::instance()->setItemFetchThreadCount(0);
     }
 
 };
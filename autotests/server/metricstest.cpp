@@ -0,0 +1,160 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include <QObject>
+#include <QTest>
+#include <QSemaphore>
+#include <QThread>
+
+#include "metrics.h"
+
+#include <aktest.h>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+class MetricsTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init()
+    {
+        Metrics::self()->reset();
+    }
+
+    void testHistogram()
+    {
+        Metrics::Histogram h;
+        for (int i = 0; i < 90; ++i) {
+            h.record(80);
+        }
+        for (int i = 0; i < 9; ++i) {
+            h.record(700);
+        }
+        h.record(3000000);
+
+        QCOMPARE(h.count, qint64(100));
+        QCOMPARE(h.max, qint64(3000000));
+        QCOMPARE(h.buckets[0], qint64(90));
+        QCOMPARE(h.buckets[3], qint64(9));
+        QCOMPARE(h.buckets[14], qint64(1));
+        QCOMPARE(h.percentile(50), qint64(100));
+        QCOMPARE(h.percentile(90), qint64(100));
+        QCOMPARE(h.percentile(99), qint64(1000));
+        // The last bucket is capped by the largest value seen
+        QCOMPARE(h.percentile(100), qint64(3000000));
+    }
+
+    void testSnapshot()
+    {
+        auto metrics = Metrics::self();
+        metrics->recordCommand(Protocol::Command::FetchItems, 1200);
+        metrics->recordCommand(Protocol::Command::FetchItems, 800);
+        metrics->recordQuery(1, QStringLiteral("SELECT id FROM PimItemTable WHERE id = ?"), 150);
+        metrics->recordQuery(1, QStringLiteral("SELECT id FROM PimItemTable WHERE id = ?"), 250);
+        metrics->recordNotifications(3, 2);
+        metrics->recordNotificationDelivery();
+        metrics->recordNotificationPayloads(4, 10, 6, 3);
+        metrics->recordRetrievalRequest(4);
+
+        const QString snapshot = metrics->snapshot();
+        QVERIFY(snapshot.contains(QLatin1String("FetchItems: count 2, avg 1000")));
+        QVERIFY(snapshot.contains(QLatin1String("2, 0, 200, 250: SELECT id FROM PimItemTable WHERE id = ?")));
+        QVERIFY(snapshot.contains(QLatin1String("Notifications: 3 in 1 batches, 6 offered to subscribers, 1 accepted")));
+        QVERIFY(snapshot.contains(QLatin1String("Payloads: 4 notifications with 10 items, 6 distinct items fetched, 3 SQL queries (0.75 per notification)")));
+        QVERIFY(snapshot.contains(QLatin1String("peak queue depth 4")));
+
+        metrics->reset();
+        QVERIFY(!metrics->snapshot().contains(QLatin1String("FetchItems")));
+    }
+
+    void testThreadQueryCount()
+    {
+        auto metrics = Metrics::self();
+        const qint64 before = Metrics::threadQueryCount();
+        metrics->recordQuery(1, QStringLiteral("SELECT 1"), 10);
+        metrics->recordQuery(2, QStringLiteral("SELECT 2"), 10);
+        QCOMPARE(Metrics::threadQueryCount() - before, qint64(2));
+
+        // Queries of other threads are not counted
+        QThread *thread = QThread::create([metrics]() {
+            metrics->recordQuery(3, QStringLiteral("SELECT 3"), 10);
+        });
+        thread->start();
+        QVERIFY(thread->wait());
+        delete thread;
+        QCOMPARE(Metrics::threadQueryCount() - before, qint64(2));
+    }
+
+    void testQueryShapeLimit()
+    {
+        auto metrics = Metrics::self();
+        for (int i = 0; i < 1100; ++i) {
+            metrics->recordQuery(i, QStringLiteral("SELECT %1").arg(i), 10);
+        }
+        const QString snapshot = metrics->snapshot();
+        QVERIFY(snapshot.contains(QLatin1String("SQL queries: 1100 in 11 ms, 1000 statements")));
+        QVERIFY(snapshot.contains(QLatin1String("(100 queries of further statements not tracked)")));
+    }
+
+    void testQueriesOfThreads()
+    {
+        auto metrics = Metrics::self();
+        metrics->recordQuery(1, QStringLiteral("SELECT 1"), 100);
+
+        // A thread that has finished already...
+        QThread *finished = QThread::create([metrics]() {
+            metrics->recordQuery(1, QStringLiteral("SELECT 1"), 200);
+            metrics->recordQuery(2, QStringLiteral("SELECT 2"), 50);
+        });
+        finished->start();
+        QVERIFY(finished->wait());
+        delete finished;
+
+        // ...and one that is still running
+        QSemaphore recorded;
+        QSemaphore done;
+        QThread *running = QThread::create([metrics, &recorded, &done]() {
+            metrics->recordQuery(1, QStringLiteral("SELECT 1"), 300);
+            recorded.release();
+            done.acquire();
+        });
+        running->start();
+        recorded.acquire();
+
+        QString snapshot = metrics->snapshot();
+        QVERIFY(snapshot.contains(QLatin1String("SQL queries: 4 in 0 ms, 2 statements")));
+        QVERIFY(snapshot.contains(QLatin1String("3, 0, 200, 300: SELECT 1")));
+        QVERIFY(snapshot.contains(QLatin1String("1, 0, 50, 50: SELECT 2")));
+
+        // Statistics of running threads are reset as well
+        metrics->reset();
+        snapshot = metrics->snapshot();
+        QVERIFY(snapshot.contains(QLatin1String("SQL queries: 0 in 0 ms, 0 statements")));
+
+        done.release();
+        QVERIFY(running->wait());
+        delete running;
+    }
+};
+
+AKTEST_MAIN(MetricsTest)
+
+#include "metricstest.moc"
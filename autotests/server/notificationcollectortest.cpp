@@ -0,0 +1,211 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include <QObject>
+#include <QTest>
+#include <QSignalSpy>
+
+#include "fakeakonadiserver.h"
+#include "fakeconnection.h"
+#include "inspectablenotificationcollector.h"
+#include "dbinitializer.h"
+#include "aktest.h"
+
+#include "aggregatedfetchscope.h"
+#include "metrics.h"
+#include "notificationmanager.h"
+#include "storage/datastore.h"
+#include "storage/transaction.h"
+
+#include <private/protocol_p.h>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+class NotificationCollectorTest : public QObject
+{
+    Q_OBJECT
+
+    DbInitializer *dbInitializer = nullptr;
+    Collection mCollection;
+
+public:
+    NotificationCollectorTest()
+    {
+        qRegisterMetaType<Akonadi::Protocol::ChangeNotificationList>();
+
+        FakeAkonadiServer::instance()->setPopulateDb(false);
+        FakeAkonadiServer::instance()->init();
+        FakeAkonadiServer::instance()->setNotificationManagerEnabled(true);
+
+        dbInitializer = new DbInitializer;
+        dbInitializer->createResource("testresource");
+        mCollection = dbInitializer->createCollection("ntfcol");
+
+        // Make the notifications carry the PLD:DATA part
+        Protocol::ItemFetchScope scope;
+        scope.setRequestedParts({ "PLD:DATA" });
+        auto fetchScope = AkonadiServer::instance()->notificationManager()->itemFetchScope();
+        fetchScope->addSubscriber();
+        fetchScope->apply(Protocol::ItemFetchScope(), scope);
+    }
+
+    ~NotificationCollectorTest()
+    {
+        delete dbInitializer;
+        FakeAkonadiServer::instance()->quit();
+    }
+
+private:
+    PimItem createItem(const char *name)
+    {
+        const PimItem item = dbInitializer->createItem(name, mCollection);
+        dbInitializer->createPart(item.id(), "PLD:DATA", QByteArray("data of ") + name);
+        return item;
+    }
+
+    static InspectableNotificationCollector *collector()
+    {
+        return static_cast<InspectableNotificationCollector *>(DataStore::self()->notificationCollector());
+    }
+
+    static QByteArray payload(const Protocol::FetchItemsResponse &item)
+    {
+        const auto parts = item.parts();
+        for (const auto &part : parts) {
+            if (part.payloadName() == "PLD:DATA") {
+                return part.data();
+            }
+        }
+        return QByteArray();
+    }
+
+    static QString payloadsLine(int notifications, int items, int fetchedItems)
+    {
+        return QStringLiteral("Payloads: %1 notifications with %2 items, %3 distinct items fetched")
+               .arg(notifications).arg(items).arg(fetchedItems);
+    }
+
+private Q_SLOTS:
+    void testItemsFetchedOncePerTransaction()
+    {
+        const PimItem itemA = createItem("A");
+        const PimItem itemB = createItem("B");
+        const PimItem itemC = createItem("C");
+
+        FakeConnection connection;
+        collector()->setConnection(&connection);
+        QSignalSpy spy(collector(), &InspectableNotificationCollector::notifySignal);
+        Metrics::self()->reset();
+
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+            collector()->itemChanged(itemA, { "PLD:DATA" }, mCollection);
+            collector()->itemChanged(itemB, { "PLD:DATA" }, mCollection);
+            collector()->itemsFlagsChanged({ itemA, itemB, itemC }, { "\\SEEN" }, {}, mCollection);
+            QVERIFY(spy.isEmpty());
+            QVERIFY(transaction.commit());
+        }
+        collector()->setConnection(nullptr);
+
+        QCOMPARE(spy.count(), 1);
+        const auto ntfs = spy.at(0).at(0).value<Protocol::ChangeNotificationList>();
+        QCOMPARE(ntfs.count(), 3);
+
+        const QVector<QVector<PimItem>> expected = { { itemA }, { itemB }, { itemA, itemB, itemC } };
+        for (int i = 0; i < ntfs.count(); ++i) {
+            QCOMPARE(ntfs[i]->type(), Protocol::Command::ItemChangeNotification);
+            const auto &ntf = Protocol::cmdCast<Protocol::ItemChangeNotification>(ntfs[i]);
+            QVERIFY(!ntf.mustRetrieve());
+            const auto items = ntf.items();
+            QCOMPARE(items.count(), expected[i].count());
+            for (int j = 0; j < items.count(); ++j) {
+                const auto &item = expected[i][j];
+                QCOMPARE(items[j].id(), item.id());
+                QCOMPARE(payload(items[j]), QByteArray("data of ") + item.remoteId().toLatin1());
+            }
+        }
+
+        // Three notifications with five items in total, but only three distinct items
+        QVERIFY(Metrics::self()->snapshot().contains(payloadsLine(3, 5, 3)));
+    }
+
+    void testItemAddedAndRemovedInTransaction()
+    {
+        const PimItem kept = createItem("kept");
+
+        FakeConnection connection;
+        collector()->setConnection(&connection);
+        QSignalSpy spy(collector(), &InspectableNotificationCollector::notifySignal);
+        Metrics::self()->reset();
+
+        PimItem removed;
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+            // No parts, so that the item can be removed right away
+            removed = dbInitializer->createItem("removed", mCollection);
+            collector()->itemAdded(removed, false, mCollection);
+            collector()->itemChanged(kept, { "PLD:DATA" }, mCollection);
+            collector()->itemsFlagsChanged({ kept, removed }, { "\\SEEN" }, {}, mCollection);
+            collector()->itemsRemoved({ removed }, mCollection);
+            QVERIFY(removed.remove());
+            QVERIFY(transaction.commit());
+        }
+        collector()->setConnection(nullptr);
+
+        QCOMPARE(spy.count(), 1);
+        const auto ntfs = spy.at(0).at(0).value<Protocol::ChangeNotificationList>();
+        QCOMPARE(ntfs.count(), 4);
+
+        // The removed item is not found anymore, the notifications keep its
+        // original entry and the Monitor has to retrieve it
+        const auto &added = Protocol::cmdCast<Protocol::ItemChangeNotification>(ntfs[0]);
+        QCOMPARE(added.operation(), Protocol::ItemChangeNotification::Add);
+        QCOMPARE(added.items().count(), 1);
+        QCOMPARE(added.items().at(0).id(), removed.id());
+        QVERIFY(added.mustRetrieve());
+
+        const auto &changed = Protocol::cmdCast<Protocol::ItemChangeNotification>(ntfs[1]);
+        QCOMPARE(changed.operation(), Protocol::ItemChangeNotification::Modify);
+        QCOMPARE(changed.items().count(), 1);
+        QCOMPARE(payload(changed.items().at(0)), QByteArray("data of kept"));
+        QVERIFY(!changed.mustRetrieve());
+
+        const auto &flags = Protocol::cmdCast<Protocol::ItemChangeNotification>(ntfs[2]);
+        QCOMPARE(flags.operation(), Protocol::ItemChangeNotification::ModifyFlags);
+        QCOMPARE(flags.items().count(), 2);
+        QCOMPARE(flags.items().at(0).id(), kept.id());
+        QCOMPARE(payload(flags.items().at(0)), QByteArray("data of kept"));
+        QCOMPARE(flags.items().at(1).id(), removed.id());
+        QVERIFY(payload(flags.items().at(1)).isEmpty());
+        QVERIFY(flags.mustRetrieve());
+
+        // Removals are not completed, they keep what they were created with
+        const auto &remove = Protocol::cmdCast<Protocol::ItemChangeNotification>(ntfs[3]);
+        QCOMPARE(remove.operation(), Protocol::ItemChangeNotification::Remove);
+        QCOMPARE(remove.items().count(), 1);
+        QCOMPARE(remove.items().at(0).id(), removed.id());
+
+        QVERIFY(Metrics::self()->snapshot().contains(payloadsLine(3, 4, 1)));
+    }
+};
+
+AKTEST_FAKESERVER_MAIN(NotificationCollectorTest)
+
+#include "notificationcollectortest.moc"
@@ -0,0 +1,312 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include <QObject>
+#include <QTest>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "preprocessormanager.h"
+#include "preprocessorinstance.h"
+#include "storage/datastore.h"
+#include "storage/transaction.h"
+#include "fakeakonadiserver.h"
+#include "dbinitializer.h"
+#include "entities.h"
+#include "aktest.h"
+
+#include <private/protocol_p.h>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+class DummyPreprocessor : public PreprocessorInstance
+{
+public:
+    DummyPreprocessor(const QString &id, int latency)
+        : PreprocessorInstance(id)
+        , mLatency(latency)
+    {
+    }
+
+    bool init() override
+    {
+        return true;
+    }
+
+    void beginProcessItems(const QVector<qint64> &ids) override
+    {
+        ++batches;
+        // Stands in for the D-Bus round trip and the processing of the batch
+        QTimer::singleShot(mLatency, this, [this, ids]() {
+            processed += ids.count();
+            itemsProcessed(ids.toList());
+        });
+    }
+
+    int batches = 0;
+    int processed = 0;
+
+private:
+    int mLatency;
+};
+
+class PreprocessorManagerTest : public QObject
+{
+    Q_OBJECT
+
+    DbInitializer *dbInitializer = nullptr;
+
+public:
+    PreprocessorManagerTest()
+    {
+        FakeAkonadiServer::instance()->setPopulateDb(false);
+        FakeAkonadiServer::instance()->init();
+
+        dbInitializer = new DbInitializer;
+    }
+
+    ~PreprocessorManagerTest()
+    {
+        delete dbInitializer;
+        FakeAkonadiServer::instance()->quit();
+    }
+
+private:
+    PimItem::List createHiddenItems(int count)
+    {
+        dbInitializer->createResource("testresource");
+        const Collection col = dbInitializer->createCollection("col1");
+
+        PimItem::List items;
+        items.reserve(count);
+        Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+        for (int i = 0; i < count; ++i) {
+            const QByteArray name = "item" + QByteArray::number(i);
+            items.push_back(dbInitializer->createItem(name.constData(), col));
+            dbInitializer->createPart(items.back().id(), AKONADI_ATTRIBUTE_HIDDEN, QByteArray());
+        }
+        transaction.commit();
+        return items;
+    }
+
+    static int hiddenItemCount()
+    {
+        const PartType hidden = PartType::retrieveByFQNameOrCreate(QStringLiteral("ATR"), QStringLiteral("HIDDEN"));
+        return Part::retrieveFiltered(Part::partTypeIdColumn(), hidden.id()).count();
+    }
+
+    static void waitForItems(const DummyPreprocessor *last, int count)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (last->processed < count && timer.elapsed() < 60000) {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+        }
+    }
+
+    QVector<DummyPreprocessor *> setupChain(int batchSize, int latency)
+    {
+        auto manager = PreprocessorManager::instance();
+        manager->setEnabled(true);
+        manager->setBatchSize(batchSize);
+
+        QVector<DummyPreprocessor *> chain = {
+            new DummyPreprocessor(QStringLiteral("preprocessor1"), latency),
+            new DummyPreprocessor(QStringLiteral("preprocessor2"), latency)
+        };
+        for (DummyPreprocessor *preprocessor : chain) {
+            manager->registerInstance(preprocessor);
+        }
+        return chain;
+    }
+
+    void teardownChain()
+    {
+        auto manager = PreprocessorManager::instance();
+        manager->unregisterInstance(QStringLiteral("preprocessor1"));
+        manager->unregisterInstance(QStringLiteral("preprocessor2"));
+        manager->setEnabled(false);
+        dbInitializer->cleanup();
+    }
+
+private Q_SLOTS:
+    void testItemsOutsideTransaction()
+    {
+        const auto chain = setupChain(10, 0);
+        QVERIFY(PreprocessorManager::instance()->isActive());
+
+        const PimItem::List items = createHiddenItems(100);
+        QCOMPARE(hiddenItemCount(), 100);
+        for (const PimItem &item : items) {
+            PreprocessorManager::instance()->beginHandleItem(item, DataStore::self());
+        }
+
+        waitForItems(chain.last(), items.count());
+        QCOMPARE(chain.first()->processed, 100);
+        QCOMPARE(chain.last()->processed, 100);
+        // Items handed over one by one are still sent in batches
+        QVERIFY(chain.first()->batches < 100);
+        QCOMPARE(hiddenItemCount(), 0);
+
+        teardownChain();
+    }
+
+    void testItemsInTransaction()
+    {
+        const auto chain = setupChain(10, 0);
+
+        const PimItem::List items = createHiddenItems(95);
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+            for (const PimItem &item : items) {
+                PreprocessorManager::instance()->beginHandleItem(item, DataStore::self());
+            }
+            // Nothing is passed to the chain before the transaction is committed
+            QCOMPARE(chain.first()->batches, 0);
+            QVERIFY(transaction.commit());
+        }
+
+        waitForItems(chain.last(), items.count());
+        QCOMPARE(chain.first()->batches, 10);
+        QCOMPARE(chain.last()->batches, 10);
+        QCOMPARE(hiddenItemCount(), 0);
+
+        teardownChain();
+    }
+
+    void testUnregisterPassesItemsOn()
+    {
+        const auto chain = setupChain(10, 1000);
+
+        const PimItem::List items = createHiddenItems(30);
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+            for (const PimItem &item : items) {
+                PreprocessorManager::instance()->beginHandleItem(item, DataStore::self());
+            }
+            QVERIFY(transaction.commit());
+        }
+        QCOMPARE(chain.first()->batches, 1);
+
+        // The batch in processing and the waiting items move on to the next preprocessor
+        DummyPreprocessor *last = chain.last();
+        PreprocessorManager::instance()->unregisterInstance(QStringLiteral("preprocessor1"));
+        waitForItems(last, items.count());
+        QCOMPARE(last->processed, 30);
+        QCOMPARE(hiddenItemCount(), 0);
+
+        teardownChain();
+    }
+
+    void testPartialAcknowledgement()
+    {
+        const auto chain = setupChain(10, 3600 * 1000);
+
+        const PimItem::List items = createHiddenItems(15);
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+            for (const PimItem &item : items) {
+                PreprocessorManager::instance()->beginHandleItem(item, DataStore::self());
+            }
+            QVERIFY(transaction.commit());
+        }
+        DummyPreprocessor *first = chain.first();
+        DummyPreprocessor *last = chain.last();
+        QCOMPARE(first->currentBatchSize(), 10);
+
+        // Only the acknowledged items of the batch move on, unknown ones are ignored
+        first->itemsProcessed({ items[0].id(), items[1].id(), items[14].id(), -1 });
+        QCOMPARE(first->currentBatchSize(), 8);
+        QCOMPARE(first->batches, 1);
+        QCOMPARE(last->currentBatchSize(), 2);
+
+        // The next batch is only sent once the whole current one is done
+        QList<qlonglong> rest;
+        for (int i = 2; i < 10; ++i) {
+            rest.push_back(items[i].id());
+        }
+        first->itemsProcessed(rest);
+        QCOMPARE(first->currentBatchSize(), 5);
+        QCOMPARE(first->batches, 2);
+
+        teardownChain();
+    }
+
+    void testHeartbeatScalesWithBatchSize()
+    {
+        const auto chain = setupChain(10, 3600 * 1000);
+
+        const PimItem::List items = createHiddenItems(10);
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+            for (const PimItem &item : items) {
+                PreprocessorManager::instance()->beginHandleItem(item, DataStore::self());
+            }
+            QVERIFY(transaction.commit());
+        }
+        DummyPreprocessor *first = chain.first();
+        QCOMPARE(first->currentBatchSize(), 10);
+
+        // Way over the limit for a single item, but not for 10 of them
+        first->mItemProcessingStartDateTime = QDateTime::currentDateTime().addSecs(-600);
+        PreprocessorManager::instance()->heartbeat();
+        QCOMPARE(PreprocessorManager::instance()->findInstance(QStringLiteral("preprocessor1")), first);
+
+        // The dummy can be neither aborted nor restarted, past the deadline it is dropped
+        first->mItemProcessingStartDateTime = QDateTime::currentDateTime().addSecs(-2401);
+        PreprocessorManager::instance()->heartbeat();
+        QVERIFY(!PreprocessorManager::instance()->findInstance(QStringLiteral("preprocessor1")));
+
+        teardownChain();
+    }
+
+    void benchmarkImport_data()
+    {
+        QTest::addColumn<int>("batchSize");
+
+        QTest::newRow("one item per call") << 1;
+        QTest::newRow("batches of 50") << 50;
+    }
+
+    void benchmarkImport()
+    {
+        QFETCH(int, batchSize);
+
+        // Every call to a preprocessor takes at least 1ms
+        const auto chain = setupChain(batchSize, 1);
+        const PimItem::List items = createHiddenItems(2000);
+
+        QBENCHMARK_ONCE {
+            Transaction transaction(DataStore::self(), QStringLiteral("IMPORT"));
+            for (const PimItem &item : items) {
+                PreprocessorManager::instance()->beginHandleItem(item, DataStore::self());
+            }
+            QVERIFY(transaction.commit());
+            waitForItems(chain.last(), items.count());
+        }
+        QCOMPARE(hiddenItemCount(), 0);
+
+        teardownChain();
+    }
+};
+
+AKTEST_FAKESERVER_MAIN(PreprocessorManagerTest)
+
+#include "preprocessormanagertest.moc"
@@ -304,6 +304,14 @@ void QueryBuilderTest::testQueryBuilder()
 
     --qbId;
 
+    // The fingerprint must bind the values in the same order as the statement,
+    // except for SQLite, which builds update joins differently and doesn't use it
+    if (mBuilders[qbId].mDatabaseType != DbType::Sqlite) {
+        QueryBuilder qb = mBuilders[qbId];
+        qb.fingerprint();
+        QCOMPARE(qb.mBindValues, bindValues);
+    }
+
     QVERIFY(mBuilders[qbId].exec());
     QCOMPARE(mBuilders[qbId].mStatement, sql);
     QCOMPARE(mBuilders[qbId].mBindValues, bindValues);
@@ -345,3 +353,79 @@ void QueryBuilderTest::benchQueryBuilder()
 
     QVERIFY(executed);
 }
+
+void QueryBuilderTest::testQueryFingerprint()
+{
+    const auto fingerprint = [](const QVariant &value, const QString &column = QStringLiteral("col2")) {
+        QueryBuilder qb(QStringLiteral("table"), QueryBuilder::Select);
+        qb.addColumn(QStringLiteral("col1"));
+        qb.addValueCondition(column, Query::In, value);
+        qb.addSortColumn(QStringLiteral("col1"));
+        return qb.fingerprint();
+    };
+
+    // Same shape, different values
+    QCOMPARE(fingerprint(QVariantList{1, 2}), fingerprint(QVariantList{3, 4}));
+    // Different number of placeholders
+    QVERIFY(fingerprint(QVariantList{1, 2}) != fingerprint(QVariantList{1, 2, 3}));
+    QVERIFY(fingerprint(5) != fingerprint(QVariantList{5}));
+    QVERIFY(fingerprint(5) != fingerprint(QVariant()));
+    // Different column
+    QVERIFY(fingerprint(5) != fingerprint(5, QStringLiteral("col3")));
+
+    QueryBuilder qb1(QStringLiteral("table"), QueryBuilder::Select);
+    qb1.addColumn(QStringLiteral("col1"));
+    QueryBuilder qb2 = qb1;
+    qb1.setLimit(10);
+    QVERIFY(qb1.fingerprint() != qb2.fingerprint());
+    qb2.setLimit(10);
+    QCOMPARE(qb1.fingerprint(), qb2.fingerprint());
+    qb2.setDistinct(true);
+    QVERIFY(qb1.fingerprint() != qb2.fingerprint());
+
+    // Adjacent strings must not run into each other
+    QueryBuilder qb3(QStringLiteral("table"), QueryBuilder::Select);
+    qb3.addColumns({ QStringLiteral("ab"), QStringLiteral("c") });
+    QueryBuilder qb4(QStringLiteral("table"), QueryBuilder::Select);
+    qb4.addColumns({ QStringLiteral("a"), QStringLiteral("bc") });
+    QVERIFY(qb3.fingerprint() != qb4.fingerprint());
+}
+
+void QueryBuilderTest::benchQueryFingerprint()
+{
+    // Same query as in benchQueryBuilder(), exec() only needs the fingerprint
+    // to find the cached prepared query
+    const QString table1 = QStringLiteral("Table1");
+    const QString table2 = QStringLiteral("Table2");
+    const QString table3 = QStringLiteral("Table3");
+    const QString table1_id = QStringLiteral("Table1.id");
+    const QString table2_id = QStringLiteral("Table2.id");
+    const QString table3_id = QStringLiteral("Table3.id");
+    const QString aggregate = QStringLiteral("COUNT");
+    const QVariant value = QVariant::fromValue(QStringLiteral("asdf"));
+
+    const QStringList columns = QStringList()
+        << QStringLiteral("Table1.id")
+        << QStringLiteral("Table1.fooAsdf")
+        << QStringLiteral("Table2.barLala")
+        << QStringLiteral("Table3.xyzFsd");
+
+    quint64 fingerprint = 0;
+
+    QBENCHMARK {
+        QueryBuilder builder(table1, QueryBuilder::Select);
+        builder.setDatabaseType(DbType::MySQL);
+        builder.addColumns(columns);
+        builder.addJoin(QueryBuilder::InnerJoin, table2, table2_id, table1_id);
+        builder.addJoin(QueryBuilder::LeftJoin, table3, table1_id, table3_id);
+        builder.addAggregation(columns.first(), aggregate);
+        builder.addColumnCondition(columns.at(1), Query::LessOrEqual, columns.last());
+        builder.addValueCondition(columns.at(3), Query::Equals, value);
+        builder.addSortColumn(columns.at(2));
+        builder.setLimit(10);
+        builder.addGroupColumn(columns.at(3));
+        fingerprint ^= builder.fingerprint();
+    }
+
+    Q_UNUSED(fingerprint);
+}
@@ -37,6 +37,8 @@ private Q_SLOTS:
     void testQueryBuilder_data();
     void testQueryBuilder();
     void benchQueryBuilder();
+    void testQueryFingerprint();
+    void benchQueryFingerprint();
 
   private:
     QList<Akonadi::Server::QueryBuilder> mBuilders;
@@ -0,0 +1,264 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include <QObject>
+#include <QTest>
+#include <QSettings>
+#include <QSignalSpy>
+#include <QSqlError>
+#include <QTemporaryDir>
+#include <QThreadPool>
+
+#include "storagejanitor.h"
+#include "storage/datastore.h"
+#include "storage/dbexception.h"
+#include "fakeakonadiserver.h"
+#include "dbinitializer.h"
+#include "aktest.h"
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+class StorageJanitorTest : public QObject
+{
+    Q_OBJECT
+
+    DbInitializer *dbInitializer = nullptr;
+    qint64 mFirstCollectionId = -1;
+    qint64 mLastCollectionId = -1;
+    QTemporaryDir mCheckpointsDir;
+
+public:
+    StorageJanitorTest()
+    {
+        FakeAkonadiServer::instance()->setPopulateDb(false);
+        FakeAkonadiServer::instance()->init();
+
+        dbInitializer = new DbInitializer;
+        dbInitializer->createResource("testresource");
+        const auto parent = dbInitializer->createCollection("janitor1");
+        dbInitializer->createCollection("janitor2", parent);
+        const auto last = dbInitializer->createCollection("janitor3", parent);
+        mFirstCollectionId = parent.id();
+        mLastCollectionId = last.id();
+    }
+
+    ~StorageJanitorTest()
+    {
+        delete dbInitializer;
+        FakeAkonadiServer::instance()->quit();
+    }
+
+private:
+    // The janitor is not initialized, that would register it on D-Bus
+    void setupJanitor(StorageJanitor &janitor)
+    {
+        janitor.m_chunkSize = 1;
+        janitor.m_checkpoints = std::make_unique<QSettings>(mCheckpointsDir.filePath(QStringLiteral("checkpoints")),
+                                                            QSettings::IniFormat);
+        janitor.m_checkpoints->clear();
+    }
+
+    // findRIDDuplicates() reports every collection it checks
+    static QStringList checkedCollections(const QSignalSpy &spy)
+    {
+        QStringList names;
+        for (const auto &args : spy) {
+            const QString msg = args.at(0).toString();
+            if (msg.startsWith(QLatin1String("Checking janitor"))) {
+                names << msg.mid(9);
+            }
+        }
+        return names;
+    }
+
+private Q_SLOTS:
+    void testFullCheckIgnoresBackgroundCheckpoint()
+    {
+        StorageJanitor janitor(AkThread::NoThread);
+        setupJanitor(janitor);
+        QSignalSpy spy(&janitor, &StorageJanitor::information);
+
+        // A background round has already walked past all our collections
+        janitor.m_checkpoints->setValue(QStringLiteral("Background/RIDDuplicates"), mLastCollectionId + 1);
+
+        QVERIFY(janitor.runChunkedCheck(StorageJanitor::RIDDuplicatesCheck));
+        QCOMPARE(checkedCollections(spy), QStringList({ QStringLiteral("janitor1"), QStringLiteral("janitor2"), QStringLiteral("janitor3") }));
+        // ...and its checkpoint is left alone
+        QVERIFY(janitor.m_checkpoints->contains(QStringLiteral("Background/RIDDuplicates")));
+    }
+
+    void testInterruptedCheckResumes()
+    {
+        StorageJanitor janitor(AkThread::NoThread);
+        setupJanitor(janitor);
+        QSignalSpy spy(&janitor, &StorageJanitor::information);
+        const QString key = QStringLiteral("Fsck/RIDDuplicates");
+
+        // Abort while checking the first collection
+        auto abort = connect(&janitor, &StorageJanitor::information, this, [&janitor](const QString &msg) {
+            if (msg == QLatin1String("Checking janitor1")) {
+                janitor.m_aborted = true;
+            }
+        });
+        QVERIFY(!janitor.runChunkedCheck(StorageJanitor::RIDDuplicatesCheck));
+        QCOMPARE(checkedCollections(spy), QStringList({ QStringLiteral("janitor1") }));
+        QCOMPARE(janitor.m_checkpoints->value(key).toLongLong(), mFirstCollectionId + 1);
+        disconnect(abort);
+        janitor.m_aborted = false;
+
+        // The next run continues after the first collection and finishes the table
+        spy.clear();
+        QVERIFY(janitor.runChunkedCheck(StorageJanitor::RIDDuplicatesCheck));
+        QCOMPARE(checkedCollections(spy), QStringList({ QStringLiteral("janitor2"), QStringLiteral("janitor3") }));
+        QVERIFY(!janitor.m_checkpoints->contains(key));
+
+        // ...and the one after that starts from the beginning again
+        spy.clear();
+        QVERIFY(janitor.runChunkedCheck(StorageJanitor::RIDDuplicatesCheck));
+        QCOMPARE(checkedCollections(spy).size(), 3);
+    }
+
+    void testRestartDiscardsCheckpoints()
+    {
+        StorageJanitor janitor(AkThread::NoThread);
+        setupJanitor(janitor);
+        // Don't run the actual checks
+        janitor.m_aborted = true;
+
+        janitor.m_checkpoints->setValue(QStringLiteral("Fsck/RIDDuplicates"), mLastCollectionId);
+        janitor.m_checkpoints->setValue(QStringLiteral("Background/RIDDuplicates"), mLastCollectionId);
+        janitor.restartCheck();
+        QVERIFY(!janitor.m_checkpoints->contains(QStringLiteral("Fsck/RIDDuplicates")));
+        QVERIFY(janitor.m_checkpoints->contains(QStringLiteral("Background/RIDDuplicates")));
+    }
+
+    void testBackgroundChunks()
+    {
+        StorageJanitor janitor(AkThread::NoThread);
+        setupJanitor(janitor);
+        QSignalSpy spy(&janitor, &StorageJanitor::information);
+        const QString key = QStringLiteral("Background/RIDDuplicates");
+        const qint64 firstId = mFirstCollectionId;
+
+        // Starts where the previous round stopped
+        janitor.m_checkpoints->setValue(key, firstId);
+        QVERIFY(!janitor.runBackgroundChunks(StorageJanitor::RIDDuplicatesCheck, 2, {}));
+        QCOMPARE(checkedCollections(spy), QStringList({ QStringLiteral("janitor1"), QStringLiteral("janitor2") }));
+        QCOMPARE(janitor.m_checkpoints->value(key).toLongLong(), firstId + 2);
+
+        // Stops as soon as the server gets busy
+        spy.clear();
+        QVERIFY(!janitor.runBackgroundChunks(StorageJanitor::RIDDuplicatesCheck, 10, []() { return false; }));
+        QVERIFY(checkedCollections(spy).isEmpty());
+        QCOMPARE(janitor.m_checkpoints->value(key).toLongLong(), firstId + 2);
+
+        // Reaching the end of the table resets the checkpoint
+        QVERIFY(janitor.runBackgroundChunks(StorageJanitor::RIDDuplicatesCheck, 10, {}));
+        QCOMPARE(checkedCollections(spy), QStringList({ QStringLiteral("janitor3") }));
+        QVERIFY(!janitor.m_checkpoints->contains(key));
+    }
+
+    void testBackgroundReportsOnly()
+    {
+        StorageJanitor janitor(AkThread::NoThread);
+        setupJanitor(janitor);
+        janitor.m_chunkSize = 1000;
+        QSignalSpy spy(&janitor, &StorageJanitor::information);
+
+        // The collections have no content mime types, so both items are
+        // duplicates which don't belong there
+        Collection col = Collection::retrieveById(mLastCollectionId);
+        const PimItem dup1 = dbInitializer->createItem("dup", col);
+        const PimItem dup2 = dbInitializer->createItem("dup", col);
+        const auto found = [&spy]() {
+            for (const auto &args : spy) {
+                if (args.at(0).toString() == QLatin1String("Found duplicates dup")) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        QVERIFY(janitor.runBackgroundChunks(StorageJanitor::RIDDuplicatesCheck, 10, {}));
+        QVERIFY(found());
+        QVERIFY(PimItem::retrieveById(dup1.id()).isValid());
+        QVERIFY(PimItem::retrieveById(dup2.id()).isValid());
+
+        spy.clear();
+        janitor.m_backgroundRepair = true;
+        QVERIFY(janitor.runBackgroundChunks(StorageJanitor::RIDDuplicatesCheck, 10, {}));
+        QVERIFY(found());
+        QVERIFY(!PimItem::retrieveById(dup1.id()).isValid());
+        QVERIFY(!PimItem::retrieveById(dup2.id()).isValid());
+    }
+
+    void testBackgroundCheckNeedsPool()
+    {
+        StorageJanitor janitor(AkThread::NoThread);
+        setupJanitor(janitor);
+        janitor.m_backgroundRepair = true;
+        QSignalSpy spy(&janitor, &StorageJanitor::information);
+
+        // The fake server has no DataStorePool, so we can't tell whether it is idle
+        janitor.backgroundCheck();
+        QVERIFY(spy.isEmpty());
+        QVERIFY(janitor.m_checkpoints->allKeys().isEmpty());
+    }
+
+    void testDatabaseErrorInLane_data()
+    {
+        QTest::addColumn<bool>("workers");
+
+        QTest::newRow("sequential") << false;
+        QTest::newRow("worker threads") << true;
+    }
+
+    void testDatabaseErrorInLane()
+    {
+        QFETCH(bool, workers);
+
+        StorageJanitor janitor(AkThread::NoThread);
+        setupJanitor(janitor);
+        if (workers) {
+            janitor.m_workers = new QThreadPool();
+            janitor.m_workers->setMaxThreadCount(2);
+        }
+        QSignalSpy spy(&janitor, &StorageJanitor::information);
+
+        bool otherLaneDone = false;
+        bool localDone = false;
+        janitor.runInParallel({
+            []() { throw DbException(QSqlError(), QStringLiteral("SELECT broken"), "lane failed"); },
+            [&otherLaneDone]() { otherLaneDone = true; }
+        }, [&localDone]() { localDone = true; });
+
+        QVERIFY(otherLaneDone);
+        QVERIFY(localDone);
+        QCOMPARE(spy.count(), 1);
+        QVERIFY(spy.at(0).at(0).toString().contains(QLatin1String("lane failed")));
+
+        delete janitor.m_workers;
+        janitor.m_workers = nullptr;
+    }
+};
+
+AKTEST_FAKESERVER_MAIN(StorageJanitorTest)
+
+#include "storagejanitortest.moc"
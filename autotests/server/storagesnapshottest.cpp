@@ -0,0 +1,199 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include <QObject>
+#include <QTest>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFileInfo>
+
+#include "storage/storagesnapshot.h"
+#include "storage/datastore.h"
+#include "fakeakonadiserver.h"
+#include "dbinitializer.h"
+#include "entities.h"
+#include "aktest.h"
+
+#include <private/externalpartstorage_p.h>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+class StorageSnapshotTest : public QObject
+{
+    Q_OBJECT
+
+    DbInitializer *dbInitializer = nullptr;
+
+public:
+    StorageSnapshotTest()
+    {
+        FakeAkonadiServer::instance()->setPopulateDb(false);
+        FakeAkonadiServer::instance()->init();
+
+        dbInitializer = new DbInitializer;
+    }
+
+    ~StorageSnapshotTest()
+    {
+        delete dbInitializer;
+        FakeAkonadiServer::instance()->quit();
+    }
+
+private:
+    static QStringList collectionNames()
+    {
+        QStringList names;
+        const auto cols = Collection::retrieveAll();
+        for (const Collection &col : cols) {
+            names << col.name();
+        }
+        names.sort();
+        return names;
+    }
+
+private Q_SLOTS:
+    void testRoundTrip()
+    {
+        dbInitializer->createResource("testresource");
+        const auto col1 = dbInitializer->createCollection("col1");
+        dbInitializer->createCollection("col2", col1);
+        const auto item = dbInitializer->createItem("item1", col1);
+        const auto internalPart = dbInitializer->createPart(item.id(), "PLD:DATA", "internal payload");
+
+        const QByteArray externalData("external payload");
+        const QByteArray externalName = ExternalPartStorage::nameForPartId(internalPart.id() + 1000);
+        const QString externalPath = ExternalPartStorage::resolveAbsolutePath(externalName);
+        QVERIFY(QDir().mkpath(QFileInfo(externalPath).absolutePath()));
+        {
+            QFile file(externalPath);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write(externalData);
+        }
+        Part externalPart;
+        externalPart.setPimItemId(item.id());
+        externalPart.setPartTypeId(PartType::retrieveByFQNameOrCreate(QStringLiteral("PLD"), QStringLiteral("HEAD")).id());
+        externalPart.setData(externalName);
+        externalPart.setDatasize(externalData.size());
+        externalPart.setStorage(Part::External);
+        QVERIFY(externalPart.insert());
+
+        const QStringList names = collectionNames();
+        const int partCount = Part::retrieveAll().size();
+
+        QTemporaryDir dir;
+        StorageSnapshot snapshot(DataStore::self());
+        QVERIFY(snapshot.create(dir.path()));
+        QVERIFY(QFile::exists(dir.filePath(StorageSnapshot::databaseFileName())));
+        // Refuses to overwrite an existing snapshot
+        QVERIFY(!snapshot.create(dir.path()));
+
+        // Change the store after taking the snapshot
+        dbInitializer->createCollection("col3", col1);
+        Part::retrieveById(internalPart.id()).remove();
+        QVERIFY(QFile::remove(externalPath));
+        QVERIFY(collectionNames() != names);
+
+        QVERIFY(snapshot.restore(dir.path()));
+        QCOMPARE(collectionNames(), names);
+        QCOMPARE(Part::retrieveAll().size(), partCount);
+        QCOMPARE(Part::retrieveById(internalPart.id()).data(), QByteArray("internal payload"));
+
+        QFile file(externalPath);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), externalData);
+    }
+
+    void testFailedRestoreKeepsExternalParts()
+    {
+        dbInitializer->createResource("failresource");
+        const auto col = dbInitializer->createCollection("failcol");
+        const auto item = dbInitializer->createItem("failitem", col);
+        dbInitializer->createPart(item.id(), "PLD:DATA", "payload");
+
+        QTemporaryDir dir;
+        StorageSnapshot snapshot(DataStore::self());
+        QVERIFY(snapshot.create(dir.path()));
+
+        // A payload file written after the snapshot was taken
+        const QString livePath = ExternalPartStorage::resolveAbsolutePath(ExternalPartStorage::nameForPartId(987654));
+        QVERIFY(QDir().mkpath(QFileInfo(livePath).absolutePath()));
+        {
+            QFile file(livePath);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write("live payload");
+        }
+
+        // Cut the dump in half, so that the restore fails midway
+        QFile dump(dir.filePath(StorageSnapshot::databaseFileName()));
+        QVERIFY(dump.open(QIODevice::ReadWrite));
+        QVERIFY(dump.resize(dump.size() / 2));
+        dump.close();
+
+        QVERIFY(!snapshot.restore(dir.path()));
+        QVERIFY(QFile::exists(livePath));
+        QVERIFY(!QDir(ExternalPartStorage::akonadiStoragePath() + QStringLiteral(".restore")).exists());
+        QVERIFY(QFile::remove(livePath));
+    }
+
+    void testMissingExternalPartFile()
+    {
+        dbInitializer->createResource("missingresource");
+        const auto col = dbInitializer->createCollection("missingcol");
+        const auto item = dbInitializer->createItem("missingitem", col);
+
+        const QByteArray externalName = ExternalPartStorage::nameForPartId(876543);
+        const QString externalPath = ExternalPartStorage::resolveAbsolutePath(externalName);
+        QVERIFY(!QFile::exists(externalPath));
+        Part part;
+        part.setPimItemId(item.id());
+        part.setPartTypeId(PartType::retrieveByFQNameOrCreate(QStringLiteral("PLD"), QStringLiteral("DATA")).id());
+        part.setData(externalName);
+        part.setDatasize(42);
+        part.setStorage(Part::External);
+        QVERIFY(part.insert());
+
+        QTemporaryDir dir;
+        StorageSnapshot snapshot(DataStore::self());
+        QVERIFY(!snapshot.create(dir.path()));
+        QVERIFY(snapshot.errorString().contains(externalPath));
+        // No partial snapshot is left behind
+        QVERIFY(!QFile::exists(dir.filePath(StorageSnapshot::databaseFileName())));
+
+        QVERIFY(part.remove());
+    }
+
+    void testInvalidSnapshot()
+    {
+        QTemporaryDir dir;
+        StorageSnapshot snapshot(DataStore::self());
+        QVERIFY(!snapshot.restore(dir.path()));
+
+        QFile file(dir.filePath(StorageSnapshot::databaseFileName()));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("garbage");
+        file.close();
+        QVERIFY(!snapshot.restore(dir.path()));
+        QVERIFY(!snapshot.errorString().isEmpty());
+    }
+};
+
+AKTEST_FAKESERVER_MAIN(StorageSnapshotTest)
+
+#include "storagesnapshottest.moc"
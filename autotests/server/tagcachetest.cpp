@@ -0,0 +1,145 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include <QObject>
+#include <QTest>
+
+#include "storage/tagcache.h"
+#include "storage/datastore.h"
+#include "storage/transaction.h"
+#include "commandcontext.h"
+#include "handlerhelper.h"
+#include "fakeakonadiserver.h"
+#include "dbinitializer.h"
+#include "aktest.h"
+
+using namespace Akonadi::Server;
+
+class TagCacheTest : public QObject
+{
+    Q_OBJECT
+
+    DbInitializer *dbInitializer = nullptr;
+    Tag mTag;
+    TagAttribute mAttribute;
+    Resource mResource;
+
+public:
+    TagCacheTest()
+    {
+        FakeAkonadiServer::instance()->setPopulateDb(false);
+        FakeAkonadiServer::instance()->init();
+
+        dbInitializer = new DbInitializer;
+    }
+
+    ~TagCacheTest()
+    {
+        delete dbInitializer;
+        FakeAkonadiServer::instance()->quit();
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        mResource = dbInitializer->createResource("testresource");
+
+        TagType type;
+        type.setName(QStringLiteral("PLAIN"));
+        QVERIFY(type.insert());
+
+        mTag.setTagType(type);
+        mTag.setGid(QStringLiteral("gid"));
+        QVERIFY(mTag.insert());
+
+        mAttribute.setTagId(mTag.id());
+        mAttribute.setType("ATTR");
+        mAttribute.setValue("value");
+        QVERIFY(mAttribute.insert());
+
+        TagRemoteIdResourceRelation rid;
+        rid.setTagId(mTag.id());
+        rid.setResourceId(mResource.id());
+        rid.setRemoteId(QStringLiteral("rid"));
+        QVERIFY(rid.insert());
+    }
+
+    void testLoad()
+    {
+        const auto cached = TagCache::self()->tag(mTag.id());
+        QVERIFY(cached.isValid());
+        QCOMPARE(cached.tag.gid(), QStringLiteral("gid"));
+        QCOMPARE(cached.type, QByteArray("PLAIN"));
+        QCOMPARE(cached.attributes, (Akonadi::Protocol::Attributes{ { "ATTR", "value" } }));
+        QCOMPARE(cached.remoteIds.value(mResource.id()), QByteArray("rid"));
+
+        QVERIFY(!TagCache::self()->tag(mTag.id() + 1).isValid());
+    }
+
+    void testInvalidation()
+    {
+        QCOMPARE(TagCache::self()->tag(mTag.id()).attributes.value("ATTR"), QByteArray("value"));
+
+        mAttribute.setValue("changed");
+        QVERIFY(mAttribute.update());
+        // Still cached
+        QCOMPARE(TagCache::self()->tag(mTag.id()).attributes.value("ATTR"), QByteArray("value"));
+
+        TagCache::self()->invalidateTag(mTag.id());
+        QCOMPARE(TagCache::self()->tag(mTag.id()).attributes.value("ATTR"), QByteArray("changed"));
+    }
+
+    void testRolledBackTransaction()
+    {
+        QCOMPARE(TagCache::self()->tag(mTag.id()).attributes.value("ATTR"), QByteArray("changed"));
+
+        {
+            Transaction transaction(DataStore::self(), QStringLiteral("TEST"));
+            mAttribute.setValue("uncommitted");
+            QVERIFY(mAttribute.update());
+            TagCache::self()->invalidateTag(mTag.id());
+
+            // The transaction sees its own changes, but they must not end
+            // up in the cache
+            QCOMPARE(TagCache::self()->tag(mTag.id()).attributes.value("ATTR"), QByteArray("uncommitted"));
+        }
+
+        QCOMPARE(TagCache::self()->tag(mTag.id()).attributes.value("ATTR"), QByteArray("changed"));
+    }
+
+    void testResolveByRIDInvalidates()
+    {
+        const Resource otherResource = dbInitializer->createResource("otherresource");
+        QVERIFY(!TagCache::self()->tag(mTag.id()).remoteIds.contains(otherResource.id()));
+
+        // Resolving an unknown RID assigns it to the tag with matching GID
+        CommandContext context;
+        context.setResource(otherResource);
+        const Tag::List tags = HandlerHelper::resolveTagsByRID({ QStringLiteral("gid") }, &context);
+        QCOMPARE(tags.size(), 1);
+        QCOMPARE(tags.at(0).id(), mTag.id());
+
+        QCOMPARE(TagCache::self()->tag(mTag.id()).remoteIds.value(otherResource.id()), QByteArray("gid"));
+    }
+};
+
+AKTEST_MAIN(TagCacheTest)
+
+#include "tagcachetest.moc"
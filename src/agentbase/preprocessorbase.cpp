@@ -45,7 +45,11 @@ void PreprocessorBase::finishProcessing(ProcessingResult result)
     Q_UNUSED(result);
 
     d->mInDelayedProcessing = false;
-    Q_EMIT d->itemProcessed(d->mDelayedProcessingItemId);
+    if (d->mInBatch) {
+        d->processBatchItems();
+    } else {
+        Q_EMIT d->itemProcessed(d->mDelayedProcessingItemId);
+    }
 }
 
 void PreprocessorBase::setFetchScope(const ItemFetchScope &fetchScope)
@@ -100,3 +100,71 @@ void PreprocessorBasePrivate::itemFetched(KJob *job)
         break;
     }
 }
+
+void PreprocessorBasePrivate::beginProcessItems(const QList<qlonglong> &ids)
+{
+    qCDebug(AKONADIAGENTBASE_LOG) << "PreprocessorBase: about to process" << ids.count() << "items";
+
+    mPendingBatches.enqueue(ids);
+    if (!mInBatch) {
+        startNextBatch();
+    }
+}
+
+void PreprocessorBasePrivate::startNextBatch()
+{
+    if (mPendingBatches.isEmpty()) {
+        return;
+    }
+
+    mInBatch = true;
+    mBatchIds = mPendingBatches.dequeue();
+
+    Item::List items;
+    items.reserve(mBatchIds.count());
+    for (qlonglong id : qAsConst(mBatchIds)) {
+        items.push_back(Item(id));
+    }
+    ItemFetchJob *fetchJob = new ItemFetchJob(items, this);
+    fetchJob->setFetchScope(mFetchScope);
+    connect(fetchJob, &ItemFetchJob::result, this, &PreprocessorBasePrivate::batchFetched);
+}
+
+void PreprocessorBasePrivate::batchFetched(KJob *job)
+{
+    // Items which could not be fetched (most likely because they have been
+    // removed meanwhile) are acknowledged along with the rest of the batch
+    if (job->error()) {
+        qCWarning(AKONADIAGENTBASE_LOG) << "PreprocessorBase: failed to fetch batch:" << job->errorString();
+        mBatchItems.clear();
+    } else {
+        mBatchItems = qobject_cast<ItemFetchJob *>(job)->items();
+    }
+
+    processBatchItems();
+}
+
+void PreprocessorBasePrivate::processBatchItems()
+{
+    Q_Q(PreprocessorBase);
+
+    while (!mBatchItems.isEmpty()) {
+        const Item item = mBatchItems.takeFirst();
+        if (q->processItem(item) == PreprocessorBase::ProcessingDelayed) {
+            qCDebug(AKONADIAGENTBASE_LOG) << "PreprocessorBase: item processing delayed (" << item.id() << ")";
+
+            mInDelayedProcessing = true;
+            mDelayedProcessingItemId = item.id();
+            return;
+        }
+    }
+
+    const QList<qlonglong> ids = mBatchIds;
+    mBatchIds.clear();
+    mInBatch = false;
+
+    qCDebug(AKONADIAGENTBASE_LOG) << "PreprocessorBase: batch of" << ids.count() << "items processed, emitting signal";
+    Q_EMIT itemsProcessed(ids);
+
+    startNextBatch();
+}
@@ -24,6 +24,9 @@
 
 #include "preprocessorbase.h"
 #include "itemfetchscope.h"
+#include "item.h"
+
+#include <QQueue>
 
 class KJob;
 
@@ -40,18 +43,36 @@ public:
     void delayedInit() override;
 
     void beginProcessItem(qlonglong itemId, qlonglong collectionId, const QString &mimeType);
+    void beginProcessItems(const QList<qlonglong> &ids);
+
+    /**
+     * Processes the remaining items of the current batch, until one of
+     * them is delayed or the whole batch has been acknowledged.
+     */
+    void processBatchItems();
 
 Q_SIGNALS:
     void itemProcessed(qlonglong id);
+    void itemsProcessed(const QList<qlonglong> &ids);
 
 private Q_SLOTS:
     void itemFetched(KJob *job);
+    void batchFetched(KJob *job);
+
+private:
+    void startNextBatch();
 
 public:
     bool mInDelayedProcessing;
     qlonglong mDelayedProcessingItemId;
     ItemFetchScope mFetchScope;
 
+    // Batches are processed one at a time and acknowledged as a whole
+    QQueue<QList<qlonglong>> mPendingBatches;
+    QList<qlonglong> mBatchIds;
+    Item::List mBatchItems;
+    bool mInBatch = false;
+
     Q_DECLARE_PUBLIC(PreprocessorBase)
 };
 
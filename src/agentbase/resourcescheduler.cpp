@@ -28,6 +28,7 @@
 
 #include <QTimer>
 #include <QDBusInterface>
+#include <QDBusConnectionInterface>
 
 using namespace Akonadi;
 
@@ -36,6 +37,128 @@ static QDBusAbstractInterface *s_resourcetracker = nullptr;
 
 //@cond PRIVATE
 
+uint Akonadi::qHash(const ResourceScheduler::Task &task)
+{
+    // Has to agree with Task::operator==: all invalid collections and items are
+    // equal no matter their id, and the argument is left out since equal
+    // QVariants can have different types.
+    uint h = ::qHash(static_cast<int>(task.type));
+    h = 31 * h + ::qHash(task.collection.isValid() ? task.collection.id() : -1);
+    for (const Item &item : task.items) {
+        h = 31 * h + ::qHash(item.isValid() ? item.id() : -1);
+    }
+    for (const QByteArray &part : task.itemParts) {
+        h ^= ::qHash(part); // order independent, like QSet::operator==
+    }
+    h = 31 * h + ::qHash(reinterpret_cast<quintptr>(task.receiver));
+    h = 31 * h + ::qHash(task.methodName);
+    return h;
+}
+
+bool ResourceScheduler::TaskQueue::isEmpty() const
+{
+    return mTasks.empty();
+}
+
+int ResourceScheduler::TaskQueue::size() const
+{
+    return static_cast<int>(mTasks.size());
+}
+
+bool ResourceScheduler::TaskQueue::contains(const Task &task) const
+{
+    const uint h = qHash(task);
+    for (auto it = mIndex.constFind(h), end = mIndex.constEnd(); it != end && it.key() == h; ++it) {
+        if (*it.value() == task) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ResourceScheduler::Task *ResourceScheduler::TaskQueue::find(const Task &task)
+{
+    const uint h = qHash(task);
+    for (auto it = mIndex.constFind(h), end = mIndex.constEnd(); it != end && it.key() == h; ++it) {
+        if (*it.value() == task) {
+            return &*it.value();
+        }
+    }
+    return nullptr;
+}
+
+ResourceScheduler::Task &ResourceScheduler::TaskQueue::first()
+{
+    return mTasks.front();
+}
+
+void ResourceScheduler::TaskQueue::append(const Task &task)
+{
+    index(mTasks.insert(mTasks.end(), task));
+}
+
+ResourceScheduler::TaskQueue &ResourceScheduler::TaskQueue::operator<<(const Task &task)
+{
+    append(task);
+    return *this;
+}
+
+void ResourceScheduler::TaskQueue::prepend(const Task &task)
+{
+    index(mTasks.insert(mTasks.begin(), task));
+}
+
+ResourceScheduler::Task ResourceScheduler::TaskQueue::takeFirst()
+{
+    // copy rather than move, erase() needs the task to find its index entry
+    Task task = mTasks.front();
+    erase(mTasks.begin());
+    return task;
+}
+
+ResourceScheduler::TaskQueue::iterator ResourceScheduler::TaskQueue::erase(iterator it)
+{
+    const uint h = qHash(*it);
+    for (auto idxIt = mIndex.find(h), end = mIndex.end(); idxIt != end && idxIt.key() == h; ++idxIt) {
+        if (idxIt.value() == it) {
+            mIndex.erase(idxIt);
+            break;
+        }
+    }
+    return mTasks.erase(it);
+}
+
+void ResourceScheduler::TaskQueue::clear()
+{
+    mIndex.clear();
+    mTasks.clear();
+}
+
+ResourceScheduler::TaskQueue::iterator ResourceScheduler::TaskQueue::begin()
+{
+    return mTasks.begin();
+}
+
+ResourceScheduler::TaskQueue::iterator ResourceScheduler::TaskQueue::end()
+{
+    return mTasks.end();
+}
+
+ResourceScheduler::TaskQueue::const_iterator ResourceScheduler::TaskQueue::begin() const
+{
+    return mTasks.cbegin();
+}
+
+ResourceScheduler::TaskQueue::const_iterator ResourceScheduler::TaskQueue::end() const
+{
+    return mTasks.cend();
+}
+
+void ResourceScheduler::TaskQueue::index(iterator it)
+{
+    mIndex.insert(qHash(*it), it);
+}
+
 ResourceScheduler::ResourceScheduler(QObject *parent)
     : QObject(parent)
     , mCurrentTasksQueue(-1)
@@ -158,9 +281,8 @@ void ResourceScheduler::scheduleItemsFetch(const Item::List &items, const QSet<Q
 
     // If this task is already in the queue, merge with it.
     TaskList &queue = queueForTaskType(t.type);
-    const int idx = queue.indexOf(t);
-    if (idx != -1) {
-        queue[ idx ].dbusMsgs << msg;
+    if (Task *queued = queue.find(t)) {
+        queued->dbusMsgs << msg;
         return;
     }
 
@@ -313,7 +435,7 @@ void ResourceScheduler::itemFetchDone(const QString &msg)
     const qint64 parentId = mCurrentTask.argument.toLongLong();
     // msg is empty, there was no error
     if (msg.isEmpty() && !queue.isEmpty()) {
-        Task &nextTask = queue[0];
+        Task &nextTask = queue.first();
         // If the next task is FetchItem too...
         if (nextTask.type != mCurrentTask.type || nextTask.argument.toLongLong() != parentId) {
             // If the next task is not FetchItem or the next FetchItem task has
@@ -498,7 +620,7 @@ void ResourceScheduler::setOnline(bool state)
         TaskList &itemFetchQueue = queueForTaskType(FetchItem);
         qint64 parentId = -1;
         Task lastTask;
-        for (QList< Task >::iterator it = itemFetchQueue.begin(); it != itemFetchQueue.end();) {
+        for (TaskList::iterator it = itemFetchQueue.begin(); it != itemFetchQueue.end();) {
             if ((*it).type == FetchItem) {
                 qint64 idx = it->argument.toLongLong();
                 if (parentId == -1) {
@@ -528,7 +650,9 @@ void ResourceScheduler::signalTaskToTracker(const Task &task, const QByteArray &
     // if there's a job tracer running, tell it about the new job
     if (!s_resourcetracker) {
         const QString suffix = Akonadi::Instance::identifier().isEmpty() ? QString() : QLatin1Char('-') + Akonadi::Instance::identifier();
-        if (KDBusConnectionPool::threadConnection().interface()->isServiceRegistered(QStringLiteral("org.kde.akonadiconsole") + suffix)) {
+        // There is no bus interface without a session bus, e.g. in unit tests
+        const QDBusConnectionInterface *busInterface = KDBusConnectionPool::threadConnection().interface();
+        if (busInterface && busInterface->isServiceRegistered(QStringLiteral("org.kde.akonadiconsole") + suffix)) {
             s_resourcetracker = new QDBusInterface(QStringLiteral("org.kde.akonadiconsole") + suffix,
                                                    QStringLiteral("/resourcesJobtracker"),
                                                    QStringLiteral("org.freedesktop.Akonadi.JobTracker"),
@@ -538,7 +662,7 @@ void ResourceScheduler::signalTaskToTracker(const Task &task, const QByteArray &
 
     if (s_resourcetracker) {
         const QList<QVariant> argumentList = QList<QVariant>()
-                << static_cast<AgentBase *>(parent())->identifier()   // "session" (in our case resource)
+                << (parent() ? static_cast<AgentBase *>(parent())->identifier() : QString()) // "session" (in our case resource)
                 << QString::number(task.serial)                       // "job"
                 << QString()                                          // "parent job"
                 << QString::fromLatin1(taskType)                      // "job type"
@@ -554,7 +678,7 @@ void ResourceScheduler::collectionRemoved(const Akonadi::Collection &collection)
         return;
     }
     TaskList &queue = queueForTaskType(SyncCollection);
-    for (QList<Task>::iterator it = queue.begin(); it != queue.end();) {
+    for (TaskList::iterator it = queue.begin(); it != queue.end();) {
         if ((*it).type == SyncCollection && (*it).collection == collection) {
             it = queue.erase(it);
             qCDebug(AKONADIAGENTBASE_LOG) << " erasing";
@@ -618,8 +742,8 @@ QString ResourceScheduler::dumpToString() const
             str << " queue " << i << " is empty" << endl;
         } else {
             str << " queue " << i << " " << queue.size() << " tasks:" << endl;
-            const QList<Task>::const_iterator queueEnd(queue.constEnd());
-            for (QList<Task>::const_iterator it = queue.constBegin(); it != queueEnd; ++it) {
+            const TaskList::const_iterator queueEnd(queue.end());
+            for (TaskList::const_iterator it = queue.begin(); it != queueEnd; ++it) {
                 str << "  " << (*it) << endl;
             }
         }
@@ -643,7 +767,7 @@ void Akonadi::ResourceScheduler::cancelQueues()
     for (int i = 0; i < NQueueCount; ++i) {
         TaskList &queue = mTaskList[i];
         if (s_resourcetracker) {
-            foreach (const Task &t, queue) {
+            for (const Task &t : qAsConst(queue)) {
                 QList<QVariant> argumentList;
                 argumentList << QString::number(t.serial) << QString();
                 s_resourcetracker->asyncCallWithArgumentList(QStringLiteral("jobEnded"), argumentList);
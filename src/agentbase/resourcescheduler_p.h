@@ -24,9 +24,13 @@
 #include "collection.h"
 #include "item.h"
 #include "resourcebase.h"
+#include "akonadiagentbasetests_export.h"
 
 #include <QObject>
 #include <QDBusMessage>
+#include <QMultiHash>
+
+#include <list>
 
 namespace Akonadi
 {
@@ -42,7 +46,7 @@ class RecursiveMover;
 
   @todo Attach to the ResourceBase Monitor,
 */
-class ResourceScheduler : public QObject
+class AKONADIAGENTBASE_TESTS_EXPORT ResourceScheduler : public QObject
 {
     Q_OBJECT
 
@@ -101,6 +105,44 @@ public:
         }
     };
 
+    /**
+      A FIFO of tasks with a hash index on top, so that finding an equal
+      task for compression or merging does not need to scan the queue.
+
+      Tasks returned by find() must not be modified in a way that affects
+      Task::operator==, only the D-Bus messages may be amended.
+    */
+    class TaskQueue
+    {
+    public:
+        typedef std::list<Task>::iterator iterator;
+        typedef std::list<Task>::const_iterator const_iterator;
+
+        bool isEmpty() const;
+        int size() const;
+        bool contains(const Task &task) const;
+        Task *find(const Task &task);
+        Task &first();
+
+        void append(const Task &task);
+        TaskQueue &operator<<(const Task &task);
+        void prepend(const Task &task);
+        Task takeFirst();
+        iterator erase(iterator it);
+        void clear();
+
+        iterator begin();
+        iterator end();
+        const_iterator begin() const;
+        const_iterator end() const;
+
+    private:
+        void index(iterator it);
+
+        std::list<Task> mTasks;
+        QMultiHash<uint, iterator> mIndex;
+    };
+
     explicit ResourceScheduler(QObject *parent = nullptr);
 
     /**
@@ -295,7 +337,7 @@ private:
         GenericTaskQueue,
         NQueueCount
     };
-    typedef QList<Task> TaskList;
+    typedef TaskQueue TaskList;
 
     static QueueType queueTypeForTaskType(TaskType type);
     TaskList &queueForTaskType(TaskType type);
@@ -307,6 +349,7 @@ private:
     bool mOnline;
 };
 
+uint qHash(const ResourceScheduler::Task &task);
 QDebug operator<<(QDebug, const ResourceScheduler::Task &task);
 QTextStream &operator<<(QTextStream &, const ResourceScheduler::Task &task);
 
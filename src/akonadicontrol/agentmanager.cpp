@@ -24,6 +24,7 @@
 #include "agentmanagerinternaladaptor.h"
 #include "agentprocessinstance.h"
 #include "agentserverinterface.h"
+#include "agentstartupscheduler.h"
 #include "agentthreadinstance.h"
 #include "preprocessor_manager.h"
 #include "processcontrol.h"
@@ -67,6 +68,18 @@ AgentManager::AgentManager(bool verbose, QObject *parent)
     const QSettings settings(Akonadi::StandardDirs::agentsConfigFile(Akonadi::StandardDirs::ReadOnly), QSettings::IniFormat);
     mAgentServerEnabled = settings.value(QStringLiteral("AgentServer/Enabled"), enableAgentServerDefault).toBool();
 
+    mStartupScheduler = new AgentStartupScheduler(this);
+    mStartupScheduler->setParallelism(settings.value(QStringLiteral("Startup/Parallelism"), 4).toInt());
+    mStartupScheduler->setDeferredAgentTypes(settings.value(QStringLiteral("Startup/DeferredAgentTypes"),
+                                                            QStringList{ QStringLiteral("akonadi_indexing_agent"),
+                                                                         QStringLiteral("akonadi_migration_agent") }).toStringList());
+    connect(mStartupScheduler, &AgentStartupScheduler::startFailed, this, [this](const QString &identifier) {
+        // Already listed to clients, so tell them it's gone again
+        if (mAgentInstances.remove(identifier)) {
+            Q_EMIT agentInstanceRemoved(identifier);
+        }
+    });
+
     QStringList serviceArgs;
     if (Akonadi::Instance::hasIdentifier()) {
         serviceArgs << QStringLiteral("--instance") << Akonadi::Instance::identifier();
@@ -124,6 +137,8 @@ AgentManager::~AgentManager()
 
 void AgentManager::cleanup()
 {
+    mStartupScheduler->clear();
+
     for (const AgentInstance::Ptr &instance : qAsConst(mAgentInstances)) {
         instance->quit();
     }
@@ -283,6 +298,7 @@ void AgentManager::removeAgentInstance(const QString &identifier)
     }
 
     mAgentInstances.remove(identifier);
+    mStartupScheduler->cancel(identifier);
 
     save();
 
@@ -580,11 +596,11 @@ void AgentManager::load()
             registerAgentAtServer(instanceIdentifier, type);
         }
 
+        // Known to clients right away, started in the background
         const AgentInstance::Ptr instance = createAgentInstance(type);
         instance->setIdentifier(instanceIdentifier);
-        if (instance->start(type)) {
-            mAgentInstances.insert(instanceIdentifier, instance);
-        }
+        mAgentInstances.insert(instanceIdentifier, instance);
+        mStartupScheduler->schedule(instance, type);
 
         file.endGroup();
     }
@@ -649,6 +665,7 @@ void AgentManager::serviceOwnerChanged(const QString &name, const QString &oldOw
         }
 
         if (!restarting) {
+            mStartupScheduler->instanceReady(service->serviceName);
             Q_EMIT agentInstanceAdded(service->serviceName);
         }
 
@@ -751,6 +768,8 @@ bool AgentManager::checkResourceInterface(const QString &identifier, const QStri
     }
 
     if (!mAgentInstances[identifier]->hasResourceInterface()) {
+        // Someone needs it, so start it next if it has not been started yet
+        mStartupScheduler->prioritize(identifier);
         qCWarning(AKONADICONTROL_LOG) << QLatin1String("AgentManager::") + method << " Agent instance "
                                       << identifier << " has no resource interface!";
         return false;
@@ -776,6 +795,7 @@ bool AgentManager::checkAgentInterfaces(const QString &identifier, const QString
     }
 
     if (!mAgentInstances.value(identifier)->hasAgentInterface()) {
+        mStartupScheduler->prioritize(identifier);
         qCWarning(AKONADICONTROL_LOG) << "Agent instance (" << method << ") " << identifier << " has no agent interface.";
         return false;
     }
@@ -799,11 +819,11 @@ void AgentManager::ensureAutoStart(const AgentType &info)
 
     const AgentInstance::Ptr instance = createAgentInstance(info);
     instance->setIdentifier(info.identifier);
-    if (instance->start(info)) {
-        mAgentInstances.insert(instance->identifier(), instance);
-        registerAgentAtServer(instance->identifier(), info);
+    mAgentInstances.insert(instance->identifier(), instance);
+    mStartupScheduler->schedule(instance, info, [this, info]() {
+        registerAgentAtServer(info.identifier, info);
         save();
-    }
+    });
 }
 
 void AgentManager::agentExeChanged(const QString &fileName)
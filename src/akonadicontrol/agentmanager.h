@@ -28,6 +28,7 @@
 #include "agentinstance.h"
 
 class QDir;
+class AgentStartupScheduler;
 
 namespace Akonadi
 {
@@ -384,6 +385,7 @@ private:
 
     Akonadi::ProcessControl *mAgentServer = nullptr;
     Akonadi::ProcessControl *mStorageController = nullptr;
+    AgentStartupScheduler *mStartupScheduler = nullptr;
     bool mAgentServerEnabled;
     bool mVerbose;
 
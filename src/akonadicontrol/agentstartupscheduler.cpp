@@ -0,0 +1,225 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "agentstartupscheduler.h"
+#include "akonadicontrol_debug.h"
+
+#include <algorithm>
+
+/// Instances that did not register their service by then no longer block the queue
+static const int StartTimeout = 30 * 1000;
+/// How often to check whether the running agents are idle
+static const int IdleCheckInterval = 5 * 1000;
+/// Deferred agents are started after this time even if the others are still busy
+static const qint64 MaxDeferral = 2 * 60 * 1000;
+
+AgentStartupScheduler::AgentStartupScheduler(QObject *parent)
+    : QObject(parent)
+{
+    mIdleTimer.setInterval(IdleCheckInterval);
+    connect(&mIdleTimer, &QTimer::timeout, this, &AgentStartupScheduler::checkIdle);
+}
+
+void AgentStartupScheduler::setParallelism(int parallelism)
+{
+    mParallelism = parallelism;
+}
+
+int AgentStartupScheduler::parallelism() const
+{
+    return mParallelism;
+}
+
+void AgentStartupScheduler::setDeferredAgentTypes(const QStringList &agentTypes)
+{
+    mDeferredTypes = agentTypes;
+}
+
+void AgentStartupScheduler::schedule(const AgentInstance::Ptr &instance, const AgentType &type,
+                                     const std::function<void()> &started)
+{
+    if (!mStartupTime.isValid()) {
+        mStartupTime.start();
+    }
+
+    Entry entry{ instance, type, started };
+    if (mDeferredTypes.contains(type.identifier)) {
+        mDeferred.push_back(entry);
+    } else if (type.capabilities.contains(AgentType::CapabilityResource)) {
+        // Resources go before the other agents, but keep their order
+        const auto it = std::find_if(mQueue.begin(), mQueue.end(), [](const Entry &queued) {
+            return !queued.type.capabilities.contains(AgentType::CapabilityResource);
+        });
+        mQueue.insert(it, entry);
+    } else {
+        mQueue.push_back(entry);
+    }
+
+    scheduleStartNext();
+}
+
+void AgentStartupScheduler::prioritize(const QString &identifier)
+{
+    const auto matches = [&identifier](const Entry &entry) {
+        return entry.instance->identifier() == identifier;
+    };
+    for (QVector<Entry> *queue : { &mQueue, &mDeferred }) {
+        const auto it = std::find_if(queue->begin(), queue->end(), matches);
+        if (it != queue->end()) {
+            const Entry entry = *it;
+            queue->erase(it);
+            mQueue.prepend(entry);
+            qCDebug(AKONADICONTROL_LOG) << "Agent instance" << identifier << "was requested, starting it next";
+            scheduleStartNext();
+            return;
+        }
+    }
+}
+
+void AgentStartupScheduler::cancel(const QString &identifier)
+{
+    const auto matches = [&identifier](const Entry &entry) {
+        return entry.instance->identifier() == identifier;
+    };
+    mQueue.erase(std::remove_if(mQueue.begin(), mQueue.end(), matches), mQueue.end());
+    mDeferred.erase(std::remove_if(mDeferred.begin(), mDeferred.end(), matches), mDeferred.end());
+    if (mStarting.remove(identifier) > 0) {
+        scheduleStartNext();
+    }
+}
+
+void AgentStartupScheduler::clear()
+{
+    mQueue.clear();
+    mDeferred.clear();
+    mStarting.clear();
+    mStarted.clear();
+    mIdleTimer.stop();
+}
+
+bool AgentStartupScheduler::isQueued(const QString &identifier) const
+{
+    const auto matches = [&identifier](const Entry &entry) {
+        return entry.instance->identifier() == identifier;
+    };
+    return std::any_of(mQueue.cbegin(), mQueue.cend(), matches)
+           || std::any_of(mDeferred.cbegin(), mDeferred.cend(), matches);
+}
+
+void AgentStartupScheduler::instanceReady(const QString &identifier)
+{
+    const auto it = mStarting.constFind(identifier);
+    if (it == mStarting.cend()) {
+        return;
+    }
+
+    const qint64 elapsed = it->elapsed();
+    qCInfo(AKONADICONTROL_LOG) << "Agent instance" << identifier << "started in" << elapsed << "ms";
+    if (elapsed > mSlowestTime) {
+        mSlowestTime = elapsed;
+        mSlowestInstance = identifier;
+    }
+    finishStart(identifier);
+}
+
+void AgentStartupScheduler::scheduleStartNext()
+{
+    if (!mStartNextScheduled) {
+        mStartNextScheduled = true;
+        // Let the caller queue everything it has first, so that the order is
+        // decided on the complete set of instances
+        QMetaObject::invokeMethod(this, &AgentStartupScheduler::startNext, Qt::QueuedConnection);
+    }
+}
+
+void AgentStartupScheduler::startNext()
+{
+    mStartNextScheduled = false;
+
+    while (!mQueue.isEmpty() && (mParallelism <= 0 || mStarting.size() < mParallelism)) {
+        start(mQueue.takeFirst());
+    }
+
+    if (!mQueue.isEmpty() || !mStarting.isEmpty()) {
+        return;
+    }
+
+    if (!mDeferred.isEmpty()) {
+        if (!mIdleTimer.isActive()) {
+            mIdleTimer.start();
+        }
+    } else if (mStartupTime.isValid()) {
+        qCInfo(AKONADICONTROL_LOG) << "Started" << mStartedCount << "agent instances in" << mStartupTime.elapsed()
+                                   << "ms, slowest was" << mSlowestInstance << "with" << mSlowestTime << "ms";
+        mStartupTime.invalidate();
+        mStartedCount = 0;
+        mSlowestInstance.clear();
+        mSlowestTime = 0;
+        mStarted.clear();
+    }
+}
+
+void AgentStartupScheduler::start(const Entry &entry)
+{
+    const QString identifier = entry.instance->identifier();
+    QElapsedTimer timer;
+    timer.start();
+    if (!entry.instance->start(entry.type)) {
+        qCWarning(AKONADICONTROL_LOG) << "Failed to start agent instance" << identifier;
+        Q_EMIT startFailed(identifier);
+        return;
+    }
+    if (entry.started) {
+        entry.started();
+    }
+
+    ++mStartedCount;
+    mStarting.insert(identifier, timer);
+    mStarted.push_back(entry.instance.toWeakRef());
+    QTimer::singleShot(StartTimeout, this, [this, identifier]() {
+        if (mStarting.contains(identifier)) {
+            qCWarning(AKONADICONTROL_LOG) << "Agent instance" << identifier << "did not come up within"
+                                          << StartTimeout << "ms, not waiting for it any longer";
+            finishStart(identifier);
+        }
+    });
+}
+
+void AgentStartupScheduler::finishStart(const QString &identifier)
+{
+    mStarting.remove(identifier);
+    startNext();
+}
+
+void AgentStartupScheduler::checkIdle()
+{
+    const bool busy = std::any_of(mStarted.cbegin(), mStarted.cend(), [](const QWeakPointer<AgentInstance> &weak) {
+        const auto instance = weak.toStrongRef();
+        return instance && instance->status() == 1 /* Running */;
+    });
+    if (busy && mStartupTime.elapsed() < MaxDeferral) {
+        return;
+    }
+
+    mIdleTimer.stop();
+    qCDebug(AKONADICONTROL_LOG) << "Agents are idle, starting" << mDeferred.size() << "deferred agent instances";
+    mQueue += mDeferred;
+    mDeferred.clear();
+    startNext();
+}
@@ -0,0 +1,116 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef AKONADICONTROL_AGENTSTARTUPSCHEDULER_H
+#define AKONADICONTROL_AGENTSTARTUPSCHEDULER_H
+
+#include "agentinstance.h"
+#include "agenttype.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <QWeakPointer>
+
+#include <functional>
+
+/**
+ * Starts the configured agent instances when the server comes up.
+ *
+ * Up to parallelism() instances are starting concurrently, an instance is
+ * considered started once it registered its agent D-Bus service. Resources
+ * are started before other agents and instances a client asks for while
+ * still queued are moved to the front. Agent types that are not needed
+ * right away (the indexing and migration agents by default) are deferred
+ * until the other agents went idle.
+ *
+ * The startup time of each instance is logged.
+ */
+class AgentStartupScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AgentStartupScheduler(QObject *parent = nullptr);
+
+    /// Sets the number of concurrently starting instances, 0 for no limit
+    void setParallelism(int parallelism);
+    Q_REQUIRED_RESULT int parallelism() const;
+
+    void setDeferredAgentTypes(const QStringList &agentTypes);
+
+    /**
+     * Queues @p instance of agent @p type. @p started is called once the
+     * instance was launched successfully.
+     */
+    void schedule(const AgentInstance::Ptr &instance, const AgentType &type,
+                  const std::function<void()> &started = {});
+
+    /// Moves the queued instance @p identifier to the front of the queue
+    void prioritize(const QString &identifier);
+
+    /// Drops @p identifier from the queue
+    void cancel(const QString &identifier);
+
+    /// Drops all queued instances
+    void clear();
+
+    Q_REQUIRED_RESULT bool isQueued(const QString &identifier) const;
+
+    /// Called when instance @p identifier registered its agent D-Bus service
+    void instanceReady(const QString &identifier);
+
+Q_SIGNALS:
+    /// Emitted when launching the queued instance @p identifier failed
+    void startFailed(const QString &identifier);
+
+private Q_SLOTS:
+    void startNext();
+    void checkIdle();
+
+private:
+    struct Entry {
+        AgentInstance::Ptr instance;
+        AgentType type;
+        std::function<void()> started;
+    };
+
+    void scheduleStartNext();
+    void start(const Entry &entry);
+    void finishStart(const QString &identifier);
+
+    QVector<Entry> mQueue;
+    QVector<Entry> mDeferred;
+    QHash<QString, QElapsedTimer> mStarting;
+    /// Instances started before the deferred ones, to find out when they are idle
+    QVector<QWeakPointer<AgentInstance>> mStarted;
+    QStringList mDeferredTypes;
+    QTimer mIdleTimer;
+    QElapsedTimer mStartupTime;
+    int mParallelism = 4;
+    int mStartedCount = 0;
+    QString mSlowestInstance;
+    qint64 mSlowestTime = 0;
+    bool mStartNextScheduled = false;
+};
+
+#endif
@@ -71,6 +71,10 @@ void AgentThreadInstance::quit()
 
 void AgentThreadInstance::restartWhenIdle()
 {
+    // Not started yet if still waiting in the startup queue
+    if (mAgentType.exec.isEmpty()) {
+        return;
+    }
     if (status() != 1 && !identifier().isEmpty()) {
         org::freedesktop::Akonadi::AgentServer agentServer(Akonadi::DBus::serviceName(Akonadi::DBus::AgentServer),
                 QStringLiteral("/AgentServer"), QDBusConnection::sessionBus());
@@ -81,6 +85,9 @@ void AgentThreadInstance::restartWhenIdle()
 
 void AgentThreadInstance::agentServerRegistered()
 {
+    if (mAgentType.exec.isEmpty()) {
+        return;
+    }
     start(mAgentType);
 }
 
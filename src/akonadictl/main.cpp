@@ -19,10 +19,12 @@
 
 #include <QCoreApplication>
 #include <QDir>
+#include <QFileInfo>
 #include <QString>
 #include <QStringList>
 #include <QSettings>
 #include <QDBusConnection>
+#include <QDBusReply>
 #include <QPluginLoader>
 
 #include <KAboutData>
@@ -31,6 +33,7 @@
 
 #include "controlmanagerinterface.h"
 #include "janitorinterface.h"
+#include "serverinterface.h"
 #include "akonadistarter.h"
 #include "akonadi_version.h"
 
@@ -194,7 +197,7 @@ static bool statusServer()
     return true;
 }
 
-static void runJanitor(const QString &operation)
+static void runJanitor(const QString &operation, const QVariantList &args = QVariantList())
 {
     if (!isAkonadiServerRunning()) {
         std::cerr << "Akonadi Server is not running, " << operation.toStdString() << " will not run" << std::endl;
@@ -212,10 +215,28 @@ static void runJanitor(const QString &operation)
     []() {
         qApp->exit();
     });
-    janitor.asyncCall(operation);
+    janitor.asyncCallWithArgumentList(operation, args);
     qApp->exec();
 }
 
+static bool printMetrics()
+{
+    if (!isAkonadiServerRunning()) {
+        std::cerr << "Akonadi Server is not running" << std::endl;
+        return false;
+    }
+
+    org::freedesktop::Akonadi::Server iface(Akonadi::DBus::serviceName(Akonadi::DBus::Server),
+                                            QStringLiteral("/Server"), QDBusConnection::sessionBus());
+    const QDBusReply<QString> reply = iface.metrics();
+    if (!reply.isValid()) {
+        std::cerr << "Failed to retrieve server metrics: " << reply.error().message().toStdString() << std::endl;
+        return false;
+    }
+    std::cout << reply.value().toStdString();
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     AkCoreApplication app(argc, argv);
@@ -230,7 +251,11 @@ int main(int argc, char **argv)
                                       "  vacuum         Vacuum internal storage (WARNING: needs a lot of time and disk\n"
                                       "                 space!)\n"
                                       "  fsck           Check (and attempt to fix) consistency of the internal storage\n"
-                                      "                 (can take some time)"));
+                                      "                 (can take some time, an interrupted check is resumed unless\n"
+                                      "                 --restart is given)\n"
+                                      "  snapshot <dir> Write a binary snapshot of the internal storage into <dir>\n"
+                                      "  restore <dir>  Replace the internal storage by the snapshot in <dir>\n"
+                                      "  metrics        Shows performance counters of the running Akonadi server"));
 
     KAboutData aboutData(QStringLiteral("akonadictl"),
                          QStringLiteral("akonadictl"),
@@ -240,19 +265,28 @@ int main(int argc, char **argv)
     KAboutData::setApplicationData(aboutData);
 
     app.addPositionalCommandLineOption(QStringLiteral("command"), QStringLiteral("Command to execute"),
-                                       QStringLiteral("start|stop|restart|status|vacuum|fsck|instances"));
+                                       QStringLiteral("start|stop|restart|status|vacuum|fsck|snapshot|restore|instances|metrics"));
+    app.addPositionalCommandLineOption(QStringLiteral("directory"), QStringLiteral("Snapshot directory (snapshot and restore only)"),
+                                       QStringLiteral("[dir]"));
+    app.addCommandLineOptions(QCommandLineOption(QStringLiteral("restart"),
+                                                 QStringLiteral("Check everything again instead of resuming an interrupted check (fsck only)")));
 
     app.parseCommandLine();
 
     const auto &cmdArgs = app.commandLineArguments();
     const QStringList commands = cmdArgs.positionalArguments();
-    if (commands.size() != 1) {
+    if (commands.isEmpty() || commands.size() > 2) {
         app.printUsage();
         return -1;
     }
     const bool verbose = cmdArgs.isSet(QStringLiteral("verbose"));
 
     const QString command = commands[0];
+    const bool isSnapshotCommand = command == QLatin1String("snapshot") || command == QLatin1String("restore");
+    if ((commands.size() == 2) != isSnapshotCommand) {
+        app.printUsage();
+        return -1;
+    }
     if (command == QLatin1String("start")) {
         if (!startServer(verbose)) {
             return 3;
@@ -279,9 +313,16 @@ int main(int argc, char **argv)
     } else if (command == QLatin1String("vacuum")) {
         runJanitor(QStringLiteral("vacuum"));
     } else if (command == QLatin1String("fsck")) {
-        runJanitor(QStringLiteral("check"));
+        runJanitor(cmdArgs.isSet(QStringLiteral("restart")) ? QStringLiteral("restartCheck") : QStringLiteral("check"));
+    } else if (isSnapshotCommand) {
+        // The janitor runs inside the server, so hand it an absolute path
+        runJanitor(command, { QFileInfo(commands[1]).absoluteFilePath() });
     } else if (command == QLatin1String("instances")) {
         listInstances();
+    } else if (command == QLatin1String("metrics")) {
+        if (!printMetrics()) {
+            return 6;
+        }
     } else {
         app.printUsage();
         return -1;
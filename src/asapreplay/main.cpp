@@ -0,0 +1,167 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "replaysession.h"
+
+#include <shared/akapplication.h>
+
+#include <QCommandLineOption>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace Akonadi;
+
+static qint64 percentile(const QVector<qint64> &sorted, int percentile)
+{
+    const int rank = std::ceil(sorted.size() * percentile / 100.0);
+    return sorted[std::max(rank, 1) - 1];
+}
+
+static QString msecs(qint64 usecs)
+{
+    return QString::number(usecs / 1000.0, 'f', 2);
+}
+
+int main(int argc, char **argv)
+{
+    AkCoreApplication app(argc, argv);
+    app.setDescription(QStringLiteral("Akonadi protocol trace replay\n"
+                                      "Replays command traces recorded by the Akonadi server (see the [Recording] section\n"
+                                      "of akonadiserverrc) and reports throughput and latencies per command. Replay against\n"
+                                      "a disposable server, e.g. one started by akonaditest on a SQLite database restored\n"
+                                      "from a snapshot taken when the recording started.\n"
+                                      "This is a development tool, only use this if you know what you are doing."));
+
+    app.addCommandLineOptions(QCommandLineOption(QStringLiteral("realtime"),
+                              QStringLiteral("Send commands with their recorded timing instead of as fast as possible")));
+    app.addCommandLineOptions(QCommandLineOption(QStringLiteral("repeat"),
+                              QStringLiteral("Replay each trace <count> times in parallel"),
+                              QStringLiteral("count"), QStringLiteral("1")));
+    app.addPositionalCommandLineOption(QStringLiteral("traces"), QStringLiteral("Trace files to replay"),
+                                       QStringLiteral("traces..."));
+    app.parseCommandLine();
+
+    const auto &cmdArgs = app.commandLineArguments();
+    const QStringList files = cmdArgs.positionalArguments();
+    const int repeat = cmdArgs.value(QStringLiteral("repeat")).toInt();
+    if (files.isEmpty() || repeat < 1) {
+        app.printUsage();
+        return -1;
+    }
+
+    QVector<Protocol::CommandTrace> traces;
+    for (const QString &fileName : files) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::cerr << qPrintable(fileName) << ": " << qPrintable(file.errorString()) << std::endl;
+            return 1;
+        }
+        Protocol::CommandTrace trace;
+        QString error;
+        if (!trace.read(&file, &error)) {
+            std::cerr << qPrintable(fileName) << ": " << qPrintable(error) << std::endl;
+            return 1;
+        } else if (!error.isEmpty()) {
+            std::cerr << qPrintable(fileName) << ": " << qPrintable(error) << std::endl;
+        }
+        traces.push_back(trace);
+    }
+
+    // Every session gets its own thread, so that reading a large response
+    // does not delay the timing of the others
+    QVector<ReplaySession *> sessions;
+    QVector<QThread *> threads;
+    for (int i = 0; i < repeat; ++i) {
+        for (const auto &trace : qAsConst(traces)) {
+            const QByteArray sessionId = trace.sessionId + "-replay-" + QByteArray::number(sessions.size());
+            auto session = new ReplaySession(trace, sessionId, cmdArgs.isSet(QStringLiteral("realtime")));
+            auto thread = new QThread;
+            session->moveToThread(thread);
+            QObject::connect(thread, &QThread::started, session, &ReplaySession::start);
+            QObject::connect(session, &ReplaySession::finished, thread, &QThread::quit);
+            sessions.push_back(session);
+            threads.push_back(thread);
+        }
+    }
+
+    int running = threads.size();
+    for (QThread *thread : qAsConst(threads)) {
+        QObject::connect(thread, &QThread::finished, QCoreApplication::instance(), [&running]() {
+            if (--running == 0) {
+                QCoreApplication::quit();
+            }
+        });
+    }
+
+    QElapsedTimer wallTime;
+    wallTime.start();
+    for (QThread *thread : qAsConst(threads)) {
+        thread->start();
+    }
+    app.exec();
+    const qint64 elapsed = std::max<qint64>(wallTime.elapsed(), 1);
+
+    QMap<QString, QVector<qint64>> latencies;
+    qint64 commands = 0;
+    qint64 failures = 0;
+    int aborted = 0;
+    for (int i = 0; i < sessions.size(); ++i) {
+        threads[i]->wait();
+        const ReplaySession *session = sessions[i];
+        if (!session->errorString().isEmpty()) {
+            std::cerr << "Session " << i << " aborted: " << qPrintable(session->errorString()) << std::endl;
+            ++aborted;
+        }
+        for (const auto &timing : session->timings()) {
+            QString name;
+            QDebug(&name).nospace() << timing.type;
+            latencies[name.trimmed()].push_back(timing.usecs);
+            ++commands;
+            failures += timing.failed ? 1 : 0;
+        }
+        delete session;
+        delete threads[i];
+    }
+
+    std::cout << "Replayed " << sessions.size() << " sessions, " << commands << " commands in "
+              << elapsed << " ms: " << qPrintable(QString::number(commands * 1000.0 / elapsed, 'f', 1))
+              << " commands/s, " << failures << " failed" << std::endl;
+    std::cout << qPrintable(QStringLiteral("%1 %2 %3 %4 %5 %6  (ms)")
+                            .arg(QStringLiteral("Command"), -24).arg(QStringLiteral("count"), 8)
+                            .arg(QStringLiteral("p50"), 9).arg(QStringLiteral("p90"), 9)
+                            .arg(QStringLiteral("p99"), 9).arg(QStringLiteral("max"), 9)) << std::endl;
+    for (auto it = latencies.begin(), end = latencies.end(); it != end; ++it) {
+        QVector<qint64> &values = it.value();
+        std::sort(values.begin(), values.end());
+        std::cout << qPrintable(QStringLiteral("%1 %2 %3 %4 %5 %6")
+                                .arg(it.key(), -24).arg(values.size(), 8)
+                                .arg(msecs(percentile(values, 50)), 9).arg(msecs(percentile(values, 90)), 9)
+                                .arg(msecs(percentile(values, 99)), 9).arg(msecs(values.last()), 9)) << std::endl;
+    }
+
+    return aborted > 0 ? 1 : 0;
+}
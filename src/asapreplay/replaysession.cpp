@@ -0,0 +1,232 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "replaysession.h"
+
+#include <private/datastream_p_p.h>
+#include <private/standarddirs_p.h>
+
+#include <QSettings>
+#include <QTimer>
+
+using namespace Akonadi;
+
+template<typename T>
+static bool isEmptyResponse(const Protocol::CommandPtr &response)
+{
+    return Protocol::cmdCast<T>(response) == T();
+}
+
+ReplaySession::ReplaySession(const Protocol::CommandTrace &trace, const QByteArray &sessionId,
+                             bool realTime, QObject *parent)
+    : QObject(parent)
+    , mTrace(trace)
+    , mSessionId(sessionId)
+    , mRealTime(realTime)
+{
+}
+
+const QVector<ReplaySession::Timing> &ReplaySession::timings() const
+{
+    return mTimings;
+}
+
+QString ReplaySession::errorString() const
+{
+    return mErrorString;
+}
+
+void ReplaySession::start()
+{
+    const QSettings connectionSettings(StandardDirs::connectionConfigFile(), QSettings::IniFormat);
+    const QString serverAddress = connectionSettings.value(QStringLiteral("Data/UnixPath"), QString()).toString();
+    if (serverAddress.isEmpty()) {
+        finish(QStringLiteral("Unable to determine server address"));
+        return;
+    }
+
+    mSocket = new QLocalSocket(this);
+    connect(mSocket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error), this, &ReplaySession::serverError);
+    connect(mSocket, &QIODevice::readyRead, this, &ReplaySession::serverRead);
+    mSocket->connectToServer(serverAddress);
+}
+
+void ReplaySession::serverRead()
+{
+    while (!mFinished && mSocket->bytesAvailable() >= int(sizeof(qint64))) {
+        qint64 tag = -1;
+        Protocol::CommandPtr response;
+        try {
+            Protocol::DataStream stream(mSocket);
+            stream >> tag;
+            response = Protocol::deserialize(mSocket);
+        } catch (const ProtocolException &e) {
+            finish(QStringLiteral("Failed to read from server: %1").arg(QString::fromUtf8(e.what())));
+            return;
+        }
+
+        if (!mHelloReceived) {
+            if (response->type() != Protocol::Command::Hello) {
+                finish(QStringLiteral("Server did not greet"));
+                return;
+            }
+            mHelloReceived = true;
+            mClock.start();
+            sendNext();
+            continue;
+        }
+
+        if (mCurrent < 0 || mCurrent >= mTrace.entries.size() || tag != mTrace.entries[mCurrent].tag) {
+            continue;
+        }
+
+        if (!response->isResponse() && response->type() == Protocol::Command::StreamPayload) {
+            sendPayload(tag);
+        } else if (isFinalResponse(response)) {
+            mTimings.push_back({ mTrace.entries[mCurrent].command->type(), mCommandTimer.nsecsElapsed() / 1000,
+                                 Protocol::cmdCast<Protocol::Response>(response).isError() });
+            sendNext();
+        }
+    }
+}
+
+void ReplaySession::serverError(QLocalSocket::LocalSocketError socketError)
+{
+    Q_UNUSED(socketError);
+    if (!mFinished) {
+        finish(mSocket->errorString());
+    }
+}
+
+void ReplaySession::sendNext()
+{
+    int next = mCurrent + 1;
+    while (next < mTrace.entries.size() && mTrace.entries[next].command->isResponse()) {
+        ++next;
+    }
+    mCurrent = next;
+    if (mCurrent >= mTrace.entries.size()) {
+        finish();
+        return;
+    }
+
+    if (mRealTime) {
+        const qint64 due = mTrace.entries[mCurrent].offset - mTrace.entries.first().offset;
+        const qint64 delay = due - mClock.elapsed();
+        if (delay > 0) {
+            QTimer::singleShot(delay, this, &ReplaySession::sendCommand);
+            return;
+        }
+    }
+    sendCommand();
+}
+
+void ReplaySession::sendCommand()
+{
+    if (mFinished) {
+        return;
+    }
+
+    const auto &entry = mTrace.entries[mCurrent];
+    Protocol::CommandPtr cmd = entry.command;
+    if (cmd->type() == Protocol::Command::Login) {
+        // Parallel replays of the same trace must not share a session id
+        cmd = Protocol::LoginCommandPtr::create(mSessionId);
+    }
+    mNextPayload = mCurrent + 1;
+
+    try {
+        Protocol::DataStream stream(mSocket);
+        stream << entry.tag;
+        Protocol::serialize(mSocket, cmd);
+    } catch (const ProtocolException &e) {
+        finish(QStringLiteral("Failed to send command: %1").arg(QString::fromUtf8(e.what())));
+        return;
+    }
+    mCommandTimer.start();
+}
+
+void ReplaySession::sendPayload(qint64 tag)
+{
+    Protocol::CommandPtr payload;
+    while (mNextPayload < mTrace.entries.size() && mTrace.entries[mNextPayload].command->isResponse()) {
+        const auto &entry = mTrace.entries[mNextPayload++];
+        if (entry.command->type() == Protocol::Command::StreamPayload) {
+            payload = entry.command;
+            break;
+        }
+    }
+    if (!payload) {
+        // The server asked for more than it did when recording, most likely
+        // because its storage differs from the recorded one
+        auto response = Protocol::StreamPayloadResponsePtr::create();
+        response->setError(1, QStringLiteral("Payload not recorded"));
+        payload = response;
+    }
+
+    try {
+        Protocol::DataStream stream(mSocket);
+        stream << tag;
+        Protocol::serialize(mSocket, payload);
+    } catch (const ProtocolException &e) {
+        finish(QStringLiteral("Failed to send payload: %1").arg(QString::fromUtf8(e.what())));
+    }
+}
+
+bool ReplaySession::isFinalResponse(const Protocol::CommandPtr &response) const
+{
+    const auto type = mTrace.entries[mCurrent].command->type();
+    if (!response->isResponse() || response->type() != type) {
+        return false;
+    }
+    if (Protocol::cmdCast<Protocol::Response>(response).isError()) {
+        return true;
+    }
+
+    switch (type) {
+    // Streamed results are terminated by an empty response
+    case Protocol::Command::FetchItems:
+        return isEmptyResponse<Protocol::FetchItemsResponse>(response);
+    case Protocol::Command::FetchCollections:
+        return isEmptyResponse<Protocol::FetchCollectionsResponse>(response);
+    case Protocol::Command::FetchTags:
+        return isEmptyResponse<Protocol::FetchTagsResponse>(response);
+    case Protocol::Command::FetchRelations:
+        return isEmptyResponse<Protocol::FetchRelationsResponse>(response);
+    // Responses for the individual items precede the final one
+    case Protocol::Command::ModifyItems:
+        return Protocol::cmdCast<Protocol::ModifyItemsResponse>(response).id() < 0;
+    default:
+        return true;
+    }
+}
+
+void ReplaySession::finish(const QString &error)
+{
+    if (mFinished) {
+        return;
+    }
+    mFinished = true;
+    mErrorString = error;
+    if (mSocket) {
+        mSocket->disconnect(this);
+        mSocket->disconnectFromServer();
+    }
+    Q_EMIT finished();
+}
@@ -0,0 +1,95 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef REPLAYSESSION_H
+#define REPLAYSESSION_H
+
+#include <private/commandtrace_p.h>
+
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QVector>
+
+/**
+ * Replays the commands of one recorded client session against the server
+ * and measures how long the server takes to answer each of them.
+ *
+ * Like a real client session, a command is only sent once the server
+ * finished the previous one. Payload parts the server asks for are answered
+ * with the data recorded for the command.
+ */
+class ReplaySession : public QObject
+{
+    Q_OBJECT
+public:
+    struct Timing {
+        Akonadi::Protocol::Command::Type type;
+        qint64 usecs;
+        bool failed;
+    };
+
+    /**
+     * Replays @p trace in a session called @p sessionId. With @p realTime
+     * the commands are not sent before their recorded offset, otherwise as
+     * fast as the server answers them.
+     */
+    ReplaySession(const Akonadi::Protocol::CommandTrace &trace, const QByteArray &sessionId,
+                  bool realTime, QObject *parent = nullptr);
+
+    const QVector<Timing> &timings() const;
+
+    /// Returns the reason the replay was aborted, empty if it completed
+    QString errorString() const;
+
+public Q_SLOTS:
+    void start();
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void serverRead();
+    void serverError(QLocalSocket::LocalSocketError socketError);
+    void sendNext();
+
+private:
+    void sendCommand();
+    void sendPayload(qint64 tag);
+    bool isFinalResponse(const Akonadi::Protocol::CommandPtr &response) const;
+    void finish(const QString &error = QString());
+
+    const Akonadi::Protocol::CommandTrace mTrace;
+    const QByteArray mSessionId;
+    const bool mRealTime;
+
+    QLocalSocket *mSocket = nullptr;
+    QElapsedTimer mClock;
+    QElapsedTimer mCommandTimer;
+    /// Index of the command in flight, or of the next one to send
+    int mCurrent = -1;
+    /// Index of the next recorded payload reply of the command in flight
+    int mNextPayload = -1;
+    bool mHelloReceived = false;
+    bool mFinished = false;
+    QVector<Timing> mTimings;
+    QString mErrorString;
+};
+
+#endif // REPLAYSESSION_H
@@ -33,7 +33,7 @@
 #include <QHash>
 #include <QList>
 
-#include <functional>
+#include <vector>
 
 using namespace Akonadi;
 
@@ -84,12 +84,14 @@ Q_DECLARE_METATYPE(RemoteId)
 
 uint qHash(const RemoteId &rid)
 {
+    // Order-sensitive, so that sibling chains like (a, b, root) and (b, a, root)
+    // do not end up in the same bucket
     uint hash = 0;
     for (QStringList::ConstIterator iter = rid.ridChain.constBegin(),
             end = rid.ridChain.constEnd();
             iter != end;
             ++iter) {
-        hash += qHash(*iter);
+        hash = 31 * hash + qHash(*iter);
     }
     return hash;
 }
@@ -120,6 +122,91 @@ QDebug operator<<(QDebug s, const RemoteId &rid)
     return s;
 }
 
+/**
+ * @internal
+ *
+ * Hash index over the remote children of a single parent, so that a whole
+ * level can be matched against the local children in linear time.
+ * Collections are matched by remoteId, falling back to name comparison in case
+ * the local collection does not have a remoteId (which can happen in some cases).
+ * Each child can be taken once, equal keys are handed out in list order.
+ */
+class ChildIndex
+{
+public:
+    explicit ChildIndex(const Collection::List &children)
+        : mChildren(children)
+        , mTaken(children.size(), false)
+    {
+        mByRid.reserve(children.size());
+        // QMultiHash returns the most recently inserted value first
+        for (int i = children.size() - 1; i >= 0; --i) {
+            mByRid.insert(children.at(i).remoteId(), i);
+        }
+    }
+
+    const Collection &at(int idx) const
+    {
+        return mChildren.at(idx);
+    }
+
+    /**
+     * Returns the index of the first not yet taken child matching @p local
+     * and marks it as taken, or -1 when there is none.
+     */
+    int take(const Collection &local)
+    {
+        if (!local.remoteId().isEmpty()) {
+            return take(mByRid, local.remoteId());
+        }
+        if (!mNameIndexBuilt) {
+            // local collections without remote id are rare, only pay for this when needed
+            mNameIndexBuilt = true;
+            mByName.reserve(mChildren.size());
+            for (int i = mChildren.size() - 1; i >= 0; --i) {
+                mByName.insert(mChildren.at(i).name(), i);
+            }
+        }
+        return take(mByName, local.name());
+    }
+
+    /**
+     * Returns the children that were not taken, in their original order.
+     */
+    Collection::List remaining() const
+    {
+        Collection::List result;
+        for (int i = 0, count = mChildren.size(); i < count; ++i) {
+            if (!mTaken[i]) {
+                result.append(mChildren.at(i));
+            }
+        }
+        return result;
+    }
+
+private:
+    int take(QMultiHash<QString, int> &index, const QString &key)
+    {
+        auto it = index.find(key);
+        while (it != index.end() && it.key() == key) {
+            const int idx = it.value();
+            it = index.erase(it);
+            // skip children already taken through the other index
+            if (!mTaken[idx]) {
+                mTaken[idx] = true;
+                return idx;
+            }
+        }
+        return -1;
+    }
+
+    const Collection::List mChildren;
+    std::vector<bool> mTaken;
+    QMultiHash<QString, int> mByRid;
+    QMultiHash<QString, int> mByName;
+    bool mNameIndexBuilt = false;
+};
+
 /**
  * @internal
  */
@@ -189,18 +276,6 @@ public:
         }
     }
 
-    /* Compares collections by remoteId and falls back to name comparison in case
-     * local collection does not have remoteId (which can happen in some cases)
-     */
-    bool matchLocalAndRemoteCollection(const Collection &local, const Collection &remote)
-    {
-        if (!local.remoteId().isEmpty()) {
-            return local.remoteId() == remote.remoteId();
-        } else {
-            return local.name() == remote.name();
-        }
-    }
-
     void localCollectionsReceived(const Akonadi::Collection::List &localCols)
     {
         for (const Akonadi::Collection &collection : localCols) {
@@ -211,129 +286,100 @@ public:
 
     void processCollections(const RemoteId &parentRid)
     {
-        Collection::List remoteChildren = remoteCollections.value(parentRid);
-        Collection::List removedChildren = removedRemoteCollections.value(parentRid);
-        Collection::List localChildren = localCollections.value(parentRid);
+        const Collection::List localChildren = localCollections.value(parentRid);
+        // Index the removed and remote children of this level once instead of
+        // scanning them for every local child
+        ChildIndex removedChildren(removedRemoteCollections.value(parentRid));
+        ChildIndex remoteChildren(remoteCollections.value(parentRid));
+        std::vector<bool> localMatched(localChildren.size(), false);
 
-        // Iterate over the list of local children of localParent
-        Collection::List::Iterator localIter, localEnd,
-                   removedIter, removedEnd,
-                   remoteIter, remoteEnd;
+        for (const Collection &localCollection : localChildren) {
+            uidRidMap.insert(localCollection.id(), localCollection.remoteId());
+        }
 
-        for (localIter = localChildren.begin(), localEnd = localChildren.end(); localIter != localEnd;) {
-            const Collection localCollection = *localIter;
-            bool matched = false;
-            uidRidMap.insert(localIter->id(), localIter->remoteId());
+        for (int i = 0, count = localChildren.size(); i < count; ++i) {
+            if (localMatched[i]) {
+                continue;
+            }
+            const Collection localCollection = localChildren.at(i);
 
             // Try to map removed remote collections (from incremental sync) to local collections
-            for (removedIter = removedChildren.begin(), removedEnd = removedChildren.end(); removedIter != removedEnd;) {
-                Collection removedCollection = *removedIter;
-
-                if (matchLocalAndRemoteCollection(localCollection, removedCollection)) {
-                    matched = true;
-                    if (!localCollection.remoteId().isEmpty()) {
-                        localCollectionsToRemove.append(localCollection);
-                    }
-                    // Remove the matched removed collection from the list so that
-                    // we don't have to iterate over it again next time.
-                    removedIter = removedChildren.erase(removedIter);
-                    removedEnd = removedChildren.end();
-                    break;
-                } else {
-                    // Keep looking
-                    ++removedIter;
+            if (removedChildren.take(localCollection) != -1) {
+                if (!localCollection.remoteId().isEmpty()) {
+                    localCollectionsToRemove.append(localCollection);
                 }
-            }
-
-            if (matched) {
-                // Remove the matched local collection from the list, because we
-                // have already put it into localCollectionsToRemove
-                localIter = localChildren.erase(localIter);
-                localEnd = localChildren.end();
+                // Matched local collections are not left over as removed
+                // collections in the end
+                localMatched[i] = true;
                 continue;
             }
 
             // Try to find a matching collection in the list of remote children
-            for (remoteIter = remoteChildren.begin(), remoteEnd = remoteChildren.end(); !matched && remoteIter != remoteEnd;) {
-                Collection remoteCollection = *remoteIter;
-
-                // Yay, we found a match!
-                if (matchLocalAndRemoteCollection(localCollection, remoteCollection)) {
-                    matched = true;
-
-                    // "Virtual" flag cannot be updated: we need to recreate
-                    // the collection from scratch.
-                    if (localCollection.isVirtual() != remoteCollection.isVirtual()) {
-                        // Mark the local collection and all its children for deletion and re-creation
-                        QList<QPair<Collection/*local*/, Collection/*remote*/>> parents = {{localCollection,remoteCollection}};
-                        while (!parents.empty()) {
-                            auto parent = parents.takeFirst();
-                            qCDebug(AKONADICORE_LOG) << "Local collection " << parent.first.name() << " will be recreated";
-                            localCollectionsToRemove.push_back(parent.first);
-                            remoteCollectionsToCreate.push_back(parent.second);
-                            for (auto it = localChildren.begin(), end = localChildren.end(); it != end;) {
-                                if (it->parentCollection() == parent.first) {
-                                    Collection remoteParent;
-                                    auto remoteIt = std::find_if(remoteChildren.begin(), remoteChildren.end(),
-                                                                 std::bind(&CollectionSync::Private::matchLocalAndRemoteCollection,
-                                                                           this, parent.first, std::placeholders::_1));
-                                    if (remoteIt != remoteChildren.end()) {
-                                        remoteParent = *remoteIt;
-                                        remoteEnd = remoteChildren.erase(remoteIt);
-                                    }
-                                    parents.push_back({*it, remoteParent});
-                                    it = localChildren.erase(it);
-                                    localEnd = end = localChildren.end();
-                                } else {
-                                    ++it;
-                                }
+            const int remoteIdx = remoteChildren.take(localCollection);
+            if (remoteIdx == -1) {
+                continue;
+            }
+            // Yay, we found a match! Taken remote collections are not left
+            // over in the end, so what remains are the new collections.
+            localMatched[i] = true;
+            const Collection remoteCollection = remoteChildren.at(remoteIdx);
+
+            // "Virtual" flag cannot be updated: we need to recreate
+            // the collection from scratch.
+            if (localCollection.isVirtual() != remoteCollection.isVirtual()) {
+                // Mark the local collection and all its children for deletion and re-creation
+                QList<QPair<Collection/*local*/, Collection/*remote*/>> parents = {{localCollection, remoteCollection}};
+                while (!parents.empty()) {
+                    auto parent = parents.takeFirst();
+                    qCDebug(AKONADICORE_LOG) << "Local collection " << parent.first.name() << " will be recreated";
+                    localCollectionsToRemove.push_back(parent.first);
+                    remoteCollectionsToCreate.push_back(parent.second);
+                    for (int j = 0; j < count; ++j) {
+                        if (!localMatched[j] && localChildren.at(j).parentCollection() == parent.first) {
+                            Collection remoteParent;
+                            const int remoteParentIdx = remoteChildren.take(parent.first);
+                            if (remoteParentIdx != -1) {
+                                remoteParent = remoteChildren.at(remoteParentIdx);
                             }
+                            parents.push_back({localChildren.at(j), remoteParent});
+                            localMatched[j] = true;
                         }
-                    } else if (collectionNeedsUpdate(localCollection, remoteCollection)) {
-                        // We need to store both local and remote collections, so that
-                        // we can copy over attributes to be preserved
-                        remoteCollectionsToUpdate.append(qMakePair(localCollection, remoteCollection));
-                    } else {
-                        // Collections are the same, no need to update anything
                     }
-
-                    // Remove the matched remote collection from the list so that
-                    // in the end we are left with list of collections that don't
-                    // exist locally (i.e. new collections)
-                    remoteIter = remoteChildren.erase(remoteIter);
-                    remoteEnd = remoteChildren.end();
-                    break;
-                } else {
-                    // Keep looking
-                    ++remoteIter;
                 }
-            }
-
-            if (matched) {
-                // Remove the matched local collection from the list so that
-                // in the end we are left with list of collections that don't
-                // exist remotely (i.e. removed collections)
-                localIter = localChildren.erase(localIter);
-                localEnd = localChildren.end();
+            } else if (collectionNeedsUpdate(localCollection, remoteCollection)) {
+                // We need to store both local and remote collections, so that
+                // we can copy over attributes to be preserved
+                remoteCollectionsToUpdate.append(qMakePair(localCollection, remoteCollection));
             } else {
-                ++localIter;
+                // Collections are the same, no need to update anything
             }
         }
 
-        if (!removedChildren.isEmpty()) {
-            removedRemoteCollections[parentRid] = removedChildren;
+        // What is left unmatched: remote collections that don't exist locally
+        // (i.e. new collections), and local collections that don't exist
+        // remotely (i.e. removed collections)
+        const Collection::List removedLeft = removedChildren.remaining();
+        if (!removedLeft.isEmpty()) {
+            removedRemoteCollections[parentRid] = removedLeft;
         } else {
             removedRemoteCollections.remove(parentRid);
         }
 
-        if (!remoteChildren.isEmpty()) {
-            remoteCollections[parentRid] = remoteChildren;
+        const Collection::List remoteLeft = remoteChildren.remaining();
+        if (!remoteLeft.isEmpty()) {
+            remoteCollections[parentRid] = remoteLeft;
         } else {
             remoteCollections.remove(parentRid);
         }
 
-        if (!localChildren.isEmpty()) {
-            localCollections[parentRid] = localChildren;
+        Collection::List localLeft;
+        for (int i = 0, count = localChildren.size(); i < count; ++i) {
+            if (!localMatched[i]) {
+                localLeft.append(localChildren.at(i));
+            }
+        }
+        if (!localLeft.isEmpty()) {
+            localCollections[parentRid] = localLeft;
         } else {
             localCollections.remove(parentRid);
         }
@@ -445,9 +491,10 @@ public:
             return;
         }
 
-        Collection::List::Iterator iter, end;
-        for (iter = remoteCollectionsToCreate.begin(), end = remoteCollectionsToCreate.end(); iter != end;) {
-            const Collection col = *iter;
+        // Send out everything we already have a parent for in one go, erasing
+        // them one by one from the middle of the list is quadratic
+        Collection::List waitingForParent;
+        for (const Collection &col : qAsConst(remoteCollectionsToCreate)) {
             const Collection parentCollection = col.parentCollection();
             // The parent already exists locally
             if (parentCollection == akonadiRootCollection || parentCollection.id() > 0) {
@@ -462,15 +509,13 @@ public:
                     currentTransaction->commit();
                     createTransaction();
                 }
-
-                iter = remoteCollectionsToCreate.erase(iter);
-                end = remoteCollectionsToCreate.end();
             } else {
                 // Skip the collection, we'll try again once we create all the other
                 // collection we already have a parent for
-                ++iter;
+                waitingForParent.append(col);
             }
         }
+        remoteCollectionsToCreate = waitingForParent;
     }
 
     void createLocalCollectionResult(KJob *job)
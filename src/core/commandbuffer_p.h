@@ -34,6 +34,21 @@ namespace Akonadi {
 class CommandBufferLocker;
 class CommandBufferNotifyBlocker;
 
+/**
+ * Queue of commands received by the Connection in the SessionThread, waiting
+ * to be handled in the thread of the Session or Monitor.
+ *
+ * The consumer is notified through @p notifySlot once per batch of commands
+ * rather than once per command, and is expected to handle up to batchSize()
+ * commands per call (see CommandBufferNotifyBlocker).
+ *
+ * When a high-water mark is set, the Connection stops reading from the socket
+ * while the buffer is full and is resumed through @p resumeSlot once the
+ * consumer has drained half of it, so a slow consumer can't make the buffer
+ * grow without limit.
+ *
+ * All methods must be called with the buffer locked by CommandBufferLocker.
+ */
 class CommandBuffer
 {
     friend class CommandBufferLocker;
@@ -44,6 +59,9 @@ public:
         Protocol::CommandPtr command;
     };
 
+    /// Default maximum number of commands handled per notification
+    static const int DefaultBatchSize = 250;
+
     CommandBuffer(QObject *parent, const char *notifySlot)
         : mParent(parent)
         , mNotifySlot(notifySlot)
@@ -53,15 +71,20 @@ public:
     void enqueue(qint64 tag, const Protocol::CommandPtr &command)
     {
         mCommands.enqueue({ tag, command });
-        if (mNotify) {
-            const bool ok = QMetaObject::invokeMethod(mParent, mNotifySlot.constData(), Qt::QueuedConnection);
-            Q_ASSERT(ok); Q_UNUSED(ok);
+        if (mNotify && !mNotifyPending) {
+            notify();
         }
     }
 
     inline Command dequeue()
     {
-        return mCommands.dequeue();
+        Command command = mCommands.dequeue();
+        if (mReaderWaiting && mCommands.size() <= mHighWaterMark / 2) {
+            mReaderWaiting = false;
+            const bool ok = QMetaObject::invokeMethod(mReader, mResumeSlot.constData(), Qt::QueuedConnection);
+            Q_ASSERT(ok); Q_UNUSED(ok);
+        }
+        return command;
     }
 
     inline bool isEmpty() const
@@ -74,14 +97,74 @@ public:
         return mCommands.size();
     }
 
+    /**
+     * Sets the @p reader that fills the buffer, @p resumeSlot is invoked when
+     * the reader should continue after canEnqueue() returned false.
+     */
+    void setReader(QObject *reader, const char *resumeSlot)
+    {
+        mReader = reader;
+        mResumeSlot = resumeSlot;
+    }
+
+    /**
+     * Sets the number of commands at which the reader is throttled. 0, the
+     * default, means no limit.
+     */
+    void setHighWaterMark(int highWaterMark)
+    {
+        mHighWaterMark = highWaterMark;
+    }
+
+    inline int highWaterMark() const
+    {
+        return mHighWaterMark;
+    }
+
+    /**
+     * Returns false when the buffer is full. The reader should stop reading
+     * then, it is resumed once the buffer has been drained.
+     */
+    bool canEnqueue()
+    {
+        if (mHighWaterMark <= 0 || !mReader || mCommands.size() < mHighWaterMark) {
+            return true;
+        }
+        mReaderWaiting = true;
+        return false;
+    }
+
+    void setBatchSize(int batchSize)
+    {
+        mBatchSize = batchSize;
+    }
+
+    inline int batchSize() const
+    {
+        return mBatchSize;
+    }
+
 private:
+    void notify()
+    {
+        mNotifyPending = true;
+        const bool ok = QMetaObject::invokeMethod(mParent, mNotifySlot.constData(), Qt::QueuedConnection);
+        Q_ASSERT(ok); Q_UNUSED(ok);
+    }
+
     QObject *mParent = nullptr;
     QByteArray mNotifySlot;
+    QObject *mReader = nullptr;
+    QByteArray mResumeSlot;
 
     QQueue<Command> mCommands;
     QMutex mLock;
 
+    int mBatchSize = DefaultBatchSize;
+    int mHighWaterMark = 0;
     bool mNotify = true;
+    bool mNotifyPending = false;
+    bool mReaderWaiting = false;
 };
 
 class CommandBufferLocker
@@ -119,6 +202,11 @@ private:
     bool mLocked = false;
 };
 
+/**
+ * Blocks notifications while the consumer handles commands. Commands left in
+ * the buffer when unblocking, for example because the batch size has been
+ * reached, are announced by a new notification.
+ */
 class CommandBufferNotifyBlocker
 {
 public:
@@ -126,6 +214,7 @@ public:
         : mBuffer(buffer)
     {
         mBuffer->mNotify = false;
+        mBuffer->mNotifyPending = false;
     }
 
     ~CommandBufferNotifyBlocker()
@@ -135,7 +224,13 @@ public:
 
     void unblock()
     {
+        if (mBuffer->mNotify) {
+            return;
+        }
         mBuffer->mNotify = true;
+        if (!mBuffer->mCommands.isEmpty() && !mBuffer->mNotifyPending) {
+            mBuffer->notify();
+        }
     }
 private:
     CommandBuffer *mBuffer;
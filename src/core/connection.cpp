@@ -48,6 +48,11 @@ Connection::Connection(ConnectionType connType, const QByteArray &sessionId,
     qRegisterMetaType<Protocol::CommandPtr>();
     qRegisterMetaType<QAbstractSocket::SocketState>();
 
+    if (mCommandBuffer) {
+        CommandBufferLocker locker(mCommandBuffer);
+        mCommandBuffer->setReader(this, "handleIncomingData");
+    }
+
     const QByteArray sessionLogFile = qgetenv("AKONADI_SESSION_LOGFILE");
     if (!sessionLogFile.isEmpty()) {
         mLogFile = new QFile(QStringLiteral("%1.%2.%3.%4-%5").arg(QString::fromLatin1(sessionLogFile))
@@ -245,6 +250,15 @@ void Connection::handleIncomingData()
     }
 
     while (mSocket->bytesAvailable() >= int(sizeof(qint64))) {
+        {
+            // Leave the data in the socket while the consumer is behind, the
+            // buffer calls us again once it has been drained
+            CommandBufferLocker locker(mCommandBuffer);
+            if (!mCommandBuffer->canEnqueue()) {
+                return;
+            }
+        }
+
         Protocol::DataStream stream(mSocket.data());
         qint64 tag;
         stream >> tag;
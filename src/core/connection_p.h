@@ -61,7 +61,7 @@ public:
     void closeConnection();
     void sendCommand(qint64 tag, const Protocol::CommandPtr &command);
 
-    void handleIncomingData();
+    Q_INVOKABLE void handleIncomingData();
 
 Q_SIGNALS:
     void connected();
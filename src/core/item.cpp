@@ -484,6 +484,7 @@ Collection::List Item::virtualReferences() const
 
 bool Item::hasPayload() const
 {
+    d_ptr->ensurePayloadDeserialized();
     return d_ptr->hasMetaTypeId(-1);
 }
 
@@ -538,6 +539,7 @@ Internal::PayloadBase *Item::payloadBase() const
 
 void ItemPrivate::tryEnsureLegacyPayload() const
 {
+    ensurePayloadDeserialized();
     if (!mLegacyPayload) {
         for (PayloadContainer::const_iterator it = mPayloads.begin(), end = mPayloads.end(); it != end; ++it) {
             if (lookupLegacyMapping(mMimeType, it->payload.get())) {
@@ -549,9 +551,30 @@ void ItemPrivate::tryEnsureLegacyPayload() const
 
 Internal::PayloadBase *Item::payloadBaseV2(int spid, int mtid) const
 {
+    d_ptr->ensurePayloadDeserialized();
     return d_ptr->payloadBaseImpl(spid, mtid);
 }
 
+void ItemPrivate::deserializePendingPayloadParts() const
+{
+    const auto parts = std::move(mPendingPayloadParts);
+    mPendingPayloadParts.clear();
+
+    // Deserialize into a temporary item and move the payloads over, like
+    // Item::ensureMetaTypeId() does, so that all shallow copies of this item
+    // benefit from it and none of them needs to detach. The temporary item
+    // is a full copy (without payload) of this one, serializer plugins may
+    // look at its collection, flags, remote ID or attributes.
+    Item item;
+    item.d_ptr = new ItemPrivate(*this);
+    item.d_ptr->mPayloads.clear();
+    item.d_ptr->mLegacyPayload.reset();
+    for (const PendingPayloadPart &part : parts) {
+        ItemSerializer::deserialize(item, part.label, part.data, part.version, ItemSerializer::Internal);
+    }
+    movePayloadFrom(item.d_ptr, -1);
+}
+
 namespace
 {
 class ConversionGuard
@@ -576,6 +599,8 @@ private:
 
 bool Item::ensureMetaTypeId(int mtid) const
 {
+    d_ptr->ensurePayloadDeserialized();
+
     // 0. Nothing there - nothing to convert from, either
     if (d_ptr->mPayloads.empty()) {
         return false;
@@ -635,6 +660,7 @@ QString Item::payloadExceptionText(int spid, int mtid) const
 #else
 void Item::throwPayloadException(int spid, int mtid) const
 {
+    d_ptr->ensurePayloadDeserialized();
     if (d_ptr->mPayloads.empty()) {
         qCDebug(AKONADICORE_LOG) << "Throwing PayloadException: No payload set";
         throw PayloadException("No payload set");
@@ -663,6 +689,7 @@ void ItemPrivate::setLegacyPayloadBaseImpl(std::unique_ptr<Internal::PayloadBase
         mLegacyPayload.reset(clone.release());
     } else {
         mPayloads.clear();
+        mPendingPayloadParts.clear();
         mLegacyPayload.reset(p.release());
     }
 }
@@ -694,6 +721,7 @@ QSet<QByteArray> Item::availablePayloadParts() const
 
 QVector<int> Item::availablePayloadMetaTypeIds() const
 {
+    d_ptr->ensurePayloadDeserialized();
     QVector<int> result;
     result.reserve(d_ptr->mPayloads.size());
     // Stable Insertion Sort - N is typically _very_ low (1 or 2).
@@ -560,7 +560,10 @@ public:
      * Returns path to the payload file set by setPayloadPath()
      *
      * If payload was set via setPayload() or setPayloadFromData() then this
-     * method will return a null string.
+     * method will return a null string. For fetched items this is the file
+     * the server stores the payload in, if any.
+     *
+     * @see ItemFetchScope::setPayloadFileReferences()
      */
     QString payloadPath() const;
 
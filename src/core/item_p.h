@@ -22,6 +22,7 @@
 
 #include <QDateTime>
 #include <QVarLengthArray>
+#include <QVector>
 
 #include "itempayloadinternals_p.h"
 #include "itemchangelog_p.h"
@@ -320,6 +321,7 @@ public:
         mMimeType = other.mMimeType;
         mLegacyPayload = other.mLegacyPayload;
         mPayloads = other.mPayloads;
+        mPendingPayloadParts = other.mPendingPayloadParts;
         mFlagsOverwritten = other.mFlagsOverwritten;
         mSizeChanged = other.mSizeChanged;
         mCollectionId = other.mCollectionId;
@@ -353,6 +355,18 @@ public:
         ItemChangeLog::instance()->clearItemChangelog(this);
     }
 
+    /**
+     * Deserializes payload parts that were received from the server but
+     * have not been accessed yet.
+     */
+    void ensurePayloadDeserialized() const
+    {
+        if (!mPendingPayloadParts.isEmpty()) {
+            deserializePendingPayloadParts();
+        }
+    }
+    void deserializePendingPayloadParts() const;
+
     bool hasMetaTypeId(int mtid) const
     {
         return std::find_if(mPayloads.cbegin(), mPayloads.cend(),
@@ -408,6 +422,8 @@ public:
 
         if (!add) {
             mLegacyPayload.reset();
+            // The payload is replaced, so don't merge the received parts into it later
+            mPendingPayloadParts.clear();
         }
 
         if (!p.get()) {
@@ -439,6 +455,15 @@ public:
     mutable Collection *mParent;
     mutable _detail::clone_ptr<Internal::PayloadBase> mLegacyPayload;
     mutable PayloadContainer mPayloads;
+    struct PendingPayloadPart {
+        QByteArray label;
+        QByteArray data;
+        int version;
+    };
+    // Raw payload parts (including the contents of external and foreign
+    // files, read when the item was fetched), deserialized into mPayloads
+    // on first access
+    mutable QVector<PendingPayloadPart> mPendingPayloadParts;
     Item::Flags mFlags;
     Tag::List mTags;
     Relation::List mRelations;
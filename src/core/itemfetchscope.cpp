@@ -240,3 +240,39 @@ bool ItemFetchScope::fetchRelations() const
 {
     return d->mFetchRelations;
 }
+
+void ItemFetchScope::setPayloadFileReferences(bool references)
+{
+    d->mPayloadFileReferences = references;
+}
+
+bool ItemFetchScope::payloadFileReferences() const
+{
+    return d->mPayloadFileReferences;
+}
+
+void ItemFetchScope::setLimit(int limit, SortOrder sortOrder)
+{
+    d->mLimit = limit;
+    d->mSortOrder = sortOrder;
+}
+
+int ItemFetchScope::limit() const
+{
+    return d->mLimit;
+}
+
+ItemFetchScope::SortOrder ItemFetchScope::sortOrder() const
+{
+    return d->mSortOrder;
+}
+
+void ItemFetchScope::setContinuation(const QByteArray &continuation)
+{
+    d->mContinuation = continuation;
+}
+
+QByteArray ItemFetchScope::continuation() const
+{
+    return d->mContinuation;
+}
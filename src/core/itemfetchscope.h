@@ -81,6 +81,15 @@ public:
         All ///< Retrieve all ancestors, up to Collection::root()
     };
 
+    /**
+     * Describes the order in which a limited fetch returns items.
+     * @since 5.13
+     */
+    enum SortOrder {
+        SortById, ///< Items with the highest ID first (the default)
+        SortByModificationTime ///< Most recently modified items first
+    };
+
     /**
      * Creates an empty item fetch scope.
      *
@@ -425,6 +434,87 @@ public:
      */
     Q_REQUIRED_RESULT bool fetchRelations() const;
 
+    /**
+     * Sets whether payload parts stored in files should only be referenced.
+     *
+     * By default the content of payload parts the server stores in files is
+     * read when the item is received. With this option enabled the file of the
+     * full payload part (Item::FullPayload) is not read, only its location is
+     * available through Item::payloadPath() and the payload of the item stays
+     * empty. Other payload parts are read as usual. This is meant for
+     * consumers which copy the payload as-is, like exports.
+     *
+     * The file belongs to the revision of the item that was fetched and may
+     * be removed as soon as the item is changed, so it should be consumed
+     * right away. Items fetched this way must not be stored back.
+     *
+     * The default is @c false.
+     *
+     * @param references whether to only reference payload files.
+     * @since 5.13
+     */
+    void setPayloadFileReferences(bool references);
+
+    /**
+     * Returns whether payload parts stored in files are only referenced.
+     *
+     * @see setPayloadFileReferences()
+     * @since 5.13
+     */
+    Q_REQUIRED_RESULT bool payloadFileReferences() const;
+
+    /**
+     * Limits the fetch to at most @p limit items, sent in the given @p sortOrder.
+     *
+     * Together with setContinuation() this allows to page through large
+     * collections: the first page is available immediately and following
+     * pages are only fetched when needed. Pages are positioned by the sort
+     * key of the last item of the previous page rather than by an offset, so
+     * items added or removed in the meantime do not shift the pages.
+     *
+     * The default limit of @c 0 fetches all items.
+     *
+     * @param limit maximum number of items to fetch, 0 for no limit
+     * @param sortOrder order in which the items are sent
+     * @see ItemFetchJob::continuation()
+     * @since 5.13
+     */
+    void setLimit(int limit, SortOrder sortOrder = SortById);
+
+    /**
+     * Returns the maximum number of items to fetch, or 0 when not limited.
+     *
+     * @see setLimit()
+     * @since 5.13
+     */
+    Q_REQUIRED_RESULT int limit() const;
+
+    /**
+     * Returns the order in which a limited fetch sends items.
+     *
+     * @see setLimit()
+     * @since 5.13
+     */
+    Q_REQUIRED_RESULT SortOrder sortOrder() const;
+
+    /**
+     * Continue a limited fetch after the last item of a previous page.
+     *
+     * @param continuation continuation token as returned by ItemFetchJob::continuation()
+     *        of the job that fetched the previous page, or an empty token to fetch
+     *        the first page
+     * @since 5.13
+     */
+    void setContinuation(const QByteArray &continuation);
+
+    /**
+     * Returns the continuation token of a limited fetch.
+     *
+     * @see setContinuation()
+     * @since 5.13
+     */
+    Q_REQUIRED_RESULT QByteArray continuation() const;
+
 private:
     //@cond PRIVATE
     QSharedDataPointer<ItemFetchScopePrivate> d;
@@ -47,6 +47,9 @@ public:
         , mFetchTags(false)
         , mFetchVRefs(false)
         , mFetchRelations(false)
+        , mPayloadFileReferences(false)
+        , mLimit(0)
+        , mSortOrder(ItemFetchScope::SortById)
     {
         mTagFetchScope.setFetchIdOnly(true);
     }
@@ -70,6 +73,10 @@ public:
         mTagFetchScope = other.mTagFetchScope;
         mFetchVRefs = other.mFetchVRefs;
         mFetchRelations = other.mFetchRelations;
+        mPayloadFileReferences = other.mPayloadFileReferences;
+        mLimit = other.mLimit;
+        mSortOrder = other.mSortOrder;
+        mContinuation = other.mContinuation;
     }
 
 public:
@@ -89,6 +96,10 @@ public:
     TagFetchScope mTagFetchScope;
     bool mFetchVRefs;
     bool mFetchRelations;
+    bool mPayloadFileReferences;
+    int mLimit;
+    ItemFetchScope::SortOrder mSortOrder;
+    QByteArray mContinuation;
 };
 
 }
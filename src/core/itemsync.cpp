@@ -81,7 +81,7 @@ public:
     void slotTransactionResult(KJob *job);
     void requestTransaction();
     Job *subjobParent() const;
-    void fetchLocalItemsToDelete();
+    void fetchLocalItemsToDelete(const QByteArray &continuation = QByteArray());
     QString jobDebuggingString() const override;
     bool allProcessed() const;
 
@@ -291,7 +291,10 @@ void ItemSync::doStart()
 {
 }
 
-void ItemSyncPrivate::fetchLocalItemsToDelete()
+/// Number of local items listed at once, see fetchLocalItemsToDelete()
+static const int LocalListPageSize = 5000;
+
+void ItemSyncPrivate::fetchLocalItemsToDelete(const QByteArray &continuation)
 {
     Q_Q(ItemSync);
     if (mIncremental) {
@@ -304,6 +307,10 @@ void ItemSyncPrivate::fetchLocalItemsToDelete()
     job->setDeliveryOption(ItemFetchJob::EmitItemsIndividually);
     // we only can fetch parts already in the cache, otherwise this will deadlock
     job->fetchScope().setCacheOnly(true);
+    // list the collection in pages, so that a huge collection does not occupy the
+    // server for a single long-running command
+    job->fetchScope().setLimit(LocalListPageSize);
+    job->fetchScope().setContinuation(continuation);
 
     QObject::connect(job, &ItemFetchJob::itemsReceived, q, [this](const Akonadi::Item::List &lst)  { slotItemsReceived(lst); });
     QObject::connect(job, &ItemFetchJob::result, q, [this](KJob *job) { slotLocalListDone(job); });
@@ -328,6 +335,12 @@ void ItemSyncPrivate::slotLocalListDone(KJob *job)
     mPendingJobs--;
     if (job->error()) {
         qCWarning(AKONADICORE_LOG) << job->errorString();
+    } else {
+        const QByteArray continuation = static_cast<ItemFetchJob *>(job)->continuation();
+        if (!continuation.isEmpty()) {
+            fetchLocalItemsToDelete(continuation);
+            return;
+        }
     }
     deleteItems(mItemsToDelete);
     checkDone();
@@ -119,6 +119,7 @@ public:
     ProtocolHelperValuePool *mValuePool = nullptr;
     ItemFetchJob::DeliveryOptions mDeliveryOptions = ItemFetchJob::Default;
     int mCount = 0;
+    Protocol::ItemFetchLimit mNextPage; // sent by the server at the end of a limited fetch
 };
 
 ItemFetchJob::ItemFetchJob(const Collection &collection, QObject *parent)
@@ -192,11 +193,13 @@ void ItemFetchJob::doStart()
     Q_D(ItemFetchJob);
 
     try {
-        d->sendCommand(Protocol::FetchItemsCommandPtr::create(
-                           d->mRequestedItems.isEmpty() ? Scope() : ProtocolHelper::entitySetToScope(d->mRequestedItems),
-                           ProtocolHelper::commandContextToProtocol(d->mCollection, d->mCurrentTag, d->mRequestedItems),
-                           ProtocolHelper::itemFetchScopeToProtocol(d->mFetchScope),
-                           ProtocolHelper::tagFetchScopeToProtocol(d->mFetchScope.tagFetchScope())));
+        auto cmd = Protocol::FetchItemsCommandPtr::create(
+                       d->mRequestedItems.isEmpty() ? Scope() : ProtocolHelper::entitySetToScope(d->mRequestedItems),
+                       ProtocolHelper::commandContextToProtocol(d->mCollection, d->mCurrentTag, d->mRequestedItems),
+                       ProtocolHelper::itemFetchScopeToProtocol(d->mFetchScope),
+                       ProtocolHelper::tagFetchScopeToProtocol(d->mFetchScope.tagFetchScope()));
+        cmd->setItemFetchLimit(ProtocolHelper::itemFetchLimitToProtocol(d->mFetchScope));
+        d->sendCommand(cmd);
     } catch (const Akonadi::Exception &e) {
         setError(Job::Unknown);
         setErrorText(QString::fromUtf8(e.what()));
@@ -216,10 +219,12 @@ bool ItemFetchJob::doHandleResponse(qint64 tag, const Protocol::CommandPtr &resp
     const auto resp = Protocol::cmdCast<Protocol::FetchItemsResponse>(response);
     // Invalid ID marks the last part of the response
     if (resp.id() < 0) {
+        d->mNextPage = resp.nextPage();
         return true;
     }
 
-    const Item item = ProtocolHelper::parseItemFetchResult(resp, nullptr, d->mValuePool);
+    const Item item = ProtocolHelper::parseItemFetchResult(resp, nullptr, d->mValuePool,
+                                                         d->mFetchScope.payloadFileReferences());
     if (!item.isValid()) {
         return false;
     }
@@ -297,4 +302,18 @@ int ItemFetchJob::count() const
 
     return d->mCount;
 }
+
+QByteArray ItemFetchJob::continuation() const
+{
+    Q_D(const ItemFetchJob);
+
+    // Items the server skipped (see ItemFetchScope::setIgnoreRetrievalErrors())
+    // still count towards the limit, so only the server knows whether there
+    // is another page
+    if (d->mNextPage.limit() <= 0) {
+        return QByteArray();
+    }
+    return ProtocolHelper::itemFetchContinuation(d->mNextPage);
+}
+
 #include "moc_itemfetchjob.cpp"
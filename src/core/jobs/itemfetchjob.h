@@ -240,6 +240,22 @@ public:
      */
     int count() const;
 
+    /**
+     * Returns the continuation token of a limited fetch.
+     *
+     * When the fetch scope limits the number of items (see ItemFetchScope::setLimit())
+     * and the server reports that there may be more items, the returned token
+     * can be passed to ItemFetchScope::setContinuation() of another job to fetch
+     * the next page. Note that with ItemFetchScope::setIgnoreRetrievalErrors()
+     * a page can contain less items than the limit and still be followed by
+     * another one.
+     * An empty token is returned when there are no more items to fetch.
+     *
+     * @note The token is only valid after the result(KJob*) signal has been emitted.
+     * @since 5.13
+     */
+    Q_REQUIRED_RESULT QByteArray continuation() const;
+
 Q_SIGNALS:
     /**
      * This signal is emitted whenever new items have been fetched completely.
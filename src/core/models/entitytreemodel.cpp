@@ -660,7 +660,7 @@ QModelIndex EntityTreeModel::parent(const QModelIndex &index) const
     }
 
     Q_ASSERT(collection.parentCollection().isValid());
-    const int row = d->indexOf<Node::Collection>(d->m_childEntities.value(collection.parentCollection().id()), collection.id());
+    const int row = d->indexOf<Node::Collection>(collection.parentCollection().id(), collection.id());
 
     Q_ASSERT(row >= 0);
     Node *parentNode = d->m_childEntities.value(collection.parentCollection().id()).at(row);
@@ -1082,6 +1082,21 @@ EntityTreeModel::ItemPopulationStrategy EntityTreeModel::itemPopulationStrategy(
     return d->m_itemPopulation;
 }
 
+void EntityTreeModel::setItemInsertionBudget(int msecs)
+{
+    Q_D(EntityTreeModel);
+    d->m_itemInsertionBudget = msecs;
+    if (msecs <= 0) {
+        d->flushPendingItems();
+    }
+}
+
+int EntityTreeModel::itemInsertionBudget() const
+{
+    Q_D(const EntityTreeModel);
+    return d->m_itemInsertionBudget;
+}
+
 void EntityTreeModel::setIncludeRootCollection(bool include)
 {
     Q_D(EntityTreeModel);
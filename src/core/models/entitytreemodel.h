@@ -461,6 +461,29 @@ public:
      */
     Q_REQUIRED_RESULT ItemPopulationStrategy itemPopulationStrategy() const;
 
+    /**
+     * Sets the maximum time in milliseconds the model may spend inserting fetched
+     * items in a single iteration of the event loop.
+     *
+     * When set to a positive value, items received from item fetch jobs are queued
+     * and inserted in chunks, so that populating large collections does not block
+     * the event loop. The collectionPopulated() signal is only emitted once all items
+     * of a collection have been inserted. The default of 0 inserts received items
+     * immediately.
+     *
+     * @param msecs the time budget in milliseconds, or 0 to disable chunked insertion
+     * @since 5.13
+     */
+    void setItemInsertionBudget(int msecs);
+
+    /**
+     * Returns the time budget for item insertion.
+     *
+     * @see setItemInsertionBudget()
+     * @since 5.13
+     */
+    Q_REQUIRED_RESULT int itemInsertionBudget() const;
+
     /**
      * Sets whether the root collection shall be provided by the model.
      * @param include enables root collection if set as @c true
@@ -50,6 +50,8 @@
 
 #include <QMessageBox>
 #include <QIcon>
+#include <QElapsedTimer>
+#include <QTimer>
 
 QHash<KJob *, QTime> jobTimeTracker;
 
@@ -90,6 +92,11 @@ EntityTreeModelPrivate::EntityTreeModelPrivate(EntityTreeModel *parent)
     QObject::connect(agentManager, SIGNAL(instanceRemoved(Akonadi::AgentInstance)),
                      q_ptr, SLOT(agentInstanceRemoved(Akonadi::AgentInstance)));
 
+    m_pendingItemsTimer = new QTimer(q_ptr);
+    m_pendingItemsTimer->setSingleShot(true);
+    m_pendingItemsTimer->setInterval(0);
+    QObject::connect(m_pendingItemsTimer, &QTimer::timeout,
+                     q_ptr, [this]() { processPendingItems(m_itemInsertionBudget); });
 }
 
 EntityTreeModelPrivate::~EntityTreeModelPrivate()
@@ -207,19 +214,14 @@ void EntityTreeModelPrivate::agentInstanceRemoved(const Akonadi::AgentInstance &
     }
 }
 
+/// Number of items fetched from a collection at once, see fetchItemsPage()
+static const int ItemFetchPageSize = 5000;
+
 void EntityTreeModelPrivate::fetchItems(const Collection &parent)
 {
     Q_Q(const EntityTreeModel);
     Q_ASSERT(parent.isValid());
     Q_ASSERT(m_collections.contains(parent.id()));
-    // TODO: Use a more specific fetch scope to get only the envelope for mails etc.
-    ItemFetchJob *itemFetchJob = new Akonadi::ItemFetchJob(parent, m_session);
-    itemFetchJob->setFetchScope(m_monitor->itemFetchScope());
-    itemFetchJob->fetchScope().setAncestorRetrieval(ItemFetchScope::All);
-    itemFetchJob->fetchScope().setIgnoreRetrievalErrors(true);
-    itemFetchJob->setDeliveryOption(ItemFetchJob::EmitItemsInBatches);
-
-    itemFetchJob->setProperty(FetchCollectionId().constData(), QVariant(parent.id()));
 
     if (m_showRootCollection || parent != m_rootCollection) {
         m_pendingCollectionRetrieveJobs.insert(parent.id());
@@ -236,6 +238,26 @@ void EntityTreeModelPrivate::fetchItems(const Collection &parent)
         }
     }
 
+    fetchItemsPage(parent, QByteArray(), 0);
+}
+
+void EntityTreeModelPrivate::fetchItemsPage(const Collection &parent, const QByteArray &continuation, int fetchedCount)
+{
+    Q_Q(const EntityTreeModel);
+    // TODO: Use a more specific fetch scope to get only the envelope for mails etc.
+    ItemFetchJob *itemFetchJob = new Akonadi::ItemFetchJob(parent, m_session);
+    itemFetchJob->setFetchScope(m_monitor->itemFetchScope());
+    itemFetchJob->fetchScope().setAncestorRetrieval(ItemFetchScope::All);
+    itemFetchJob->fetchScope().setIgnoreRetrievalErrors(true);
+    // Fetch large collections in pages, newest items first, so that the first
+    // items show up without waiting for the whole collection
+    itemFetchJob->fetchScope().setLimit(ItemFetchPageSize, ItemFetchScope::SortById);
+    itemFetchJob->fetchScope().setContinuation(continuation);
+    itemFetchJob->setDeliveryOption(ItemFetchJob::EmitItemsInBatches);
+
+    itemFetchJob->setProperty(FetchCollectionId().constData(), QVariant(parent.id()));
+    itemFetchJob->setProperty(FetchedItemCount().constData(), fetchedCount);
+
     q->connect(itemFetchJob, SIGNAL(itemsReceived(Akonadi::Item::List)),
                q, SLOT(itemsFetched(Akonadi::Item::List)));
     q->connect(itemFetchJob, SIGNAL(result(KJob*)),
@@ -336,7 +358,7 @@ void EntityTreeModelPrivate::collectionListFetched(const Akonadi::Collection::Li
         node->id = collection.id();
         node->parent = -1;
         node->type = Node::Collection;
-        m_childEntities[-1].prepend(node);
+        prependNode(-1, node);
 
         fetchItems(collection);
     }
@@ -468,7 +490,7 @@ void EntityTreeModelPrivate::collectionsFetched(const Akonadi::Collection::List
             Q_ASSERT(collection.parentCollection().isValid());
             node->parent = collection.parentCollection().id();
             node->type = Node::Collection;
-            m_childEntities[node->parent].prepend(node);
+            prependNode(node->parent, node);
         }
         q->endInsertRows();
 
@@ -500,6 +522,77 @@ void EntityTreeModelPrivate::itemsFetched(const Akonadi::Item::List &items)
 }
 
 void EntityTreeModelPrivate::itemsFetched(const Collection::Id collectionId, const Akonadi::Item::List &items)
+{
+    if (m_itemInsertionBudget <= 0) {
+        insertFetchedItems(collectionId, items);
+        return;
+    }
+
+    if (items.isEmpty()) {
+        return;
+    }
+
+    // Queue the items and insert them in chunks from the event loop, so that
+    // populating a large collection does not block the UI
+    m_pendingItems.enqueue({ collectionId, items, 0 });
+    ++m_pendingItemBatches[collectionId];
+    if (!m_pendingItemsTimer->isActive()) {
+        m_pendingItemsTimer->start();
+    }
+}
+
+void EntityTreeModelPrivate::processPendingItems(int budget)
+{
+    // Number of items to insert before checking the time budget again
+    static const int ChunkSize = 250;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_pendingItems.isEmpty()) {
+        PendingItems &batch = m_pendingItems.head();
+        const Collection::Id collectionId = batch.collectionId;
+        const Item::List chunk = (batch.offset == 0 && batch.items.size() <= ChunkSize)
+                                 ? batch.items : batch.items.mid(batch.offset, ChunkSize);
+        batch.offset += chunk.size();
+        const bool batchDone = batch.offset >= batch.items.size();
+        if (batchDone) {
+            m_pendingItems.dequeue();
+        }
+
+        insertFetchedItems(collectionId, chunk);
+
+        if (batchDone) {
+            auto it = m_pendingItemBatches.find(collectionId);
+            if (--(*it) == 0) {
+                m_pendingItemBatches.erase(it);
+                const auto populationIt = m_deferredPopulations.find(collectionId);
+                if (populationIt != m_deferredPopulations.end()) {
+                    const int count = *populationIt;
+                    m_deferredPopulations.erase(populationIt);
+                    itemsPopulated(collectionId, count);
+                }
+            }
+        }
+
+        if (budget >= 0 && timer.elapsed() >= budget) {
+            break;
+        }
+    }
+
+    if (!m_pendingItems.isEmpty()) {
+        m_pendingItemsTimer->start();
+    }
+}
+
+void EntityTreeModelPrivate::flushPendingItems()
+{
+    if (!m_pendingItems.isEmpty()) {
+        m_pendingItemsTimer->stop();
+        processPendingItems(-1);
+    }
+}
+
+void EntityTreeModelPrivate::insertFetchedItems(const Collection::Id collectionId, const Akonadi::Item::List &items)
 {
     Q_Q(EntityTreeModel);
 
@@ -535,17 +628,11 @@ void EntityTreeModelPrivate::itemsFetched(const Collection::Id collectionId, con
             // considering their (possibly virtual) parent.
             bool isNewItem = true;
             auto itemIt = m_items.find(item.id());
-            if (itemIt != m_items.end()) {
-                const Akonadi::Collection::List parents = getParentCollections(item);
-                for (const Akonadi::Collection &parent : parents) {
-                    if (parent.id() == collectionId) {
-                        qCWarning(AKONADICORE_LOG) << "Fetched an item which is already in the model";
-                        // Update it in case the revision changed;
-                        itemIt->value.apply(item);
-                        isNewItem = false;
-                        break;
-                    }
-                }
+            if (itemIt != m_items.end() && m_itemParents.value(item.id()).contains(collectionId)) {
+                qCWarning(AKONADICORE_LOG) << "Fetched an item which is already in the model";
+                // Update it in case the revision changed;
+                itemIt->value.apply(item);
+                isNewItem = false;
             }
 
             if (isNewItem) {
@@ -574,7 +661,7 @@ void EntityTreeModelPrivate::itemsFetched(const Collection::Id collectionId, con
             node->parent = collectionId;
             node->type = Node::Item;
 
-            m_childEntities[colId].append(node);
+            appendNode(colId, node);
         }
         q->endInsertRows();
     }
@@ -684,7 +771,7 @@ void EntityTreeModelPrivate::retrieveAncestors(const Akonadi::Collection &collec
         node->id = ancestor.id();
         node->parent = ancestor.parentCollection().id();
         node->type = Node::Collection;
-        m_childEntities[node->parent].prepend(node);
+        prependNode(node->parent, node);
     }
 
     if (insertBaseCollection) {
@@ -694,7 +781,7 @@ void EntityTreeModelPrivate::retrieveAncestors(const Akonadi::Collection &collec
         // Can't just use parentCollection because that doesn't necessarily refer to collection.
         node->parent = collection.parentCollection().id();
         node->type = Node::Collection;
-        m_childEntities[node->parent].prepend(node);
+        prependNode(node->parent, node);
     }
 
     q->endInsertRows();
@@ -727,7 +814,7 @@ void EntityTreeModelPrivate::insertCollection(const Akonadi::Collection &collect
     node->id = collection.id();
     node->parent = parent.id();
     node->type = Node::Collection;
-    m_childEntities[parent.id()].prepend(node);
+    prependNode(parent.id(), node);
     q->endInsertRows();
 }
 
@@ -854,6 +941,8 @@ void EntityTreeModelPrivate::monitoredCollectionAdded(const Akonadi::Collection
 
 void EntityTreeModelPrivate::monitoredCollectionRemoved(const Akonadi::Collection &collection)
 {
+    flushPendingItems();
+
     //if an explicitly monitored collection is removed, we would also have to remove collections which were included to show it (as in the move case)
     if ((collection == m_rootCollection) ||
             m_monitor->collectionsMonitored().contains(collection)) {
@@ -882,7 +971,7 @@ void EntityTreeModelPrivate::monitoredCollectionRemoved(const Akonadi::Collectio
 
     Q_ASSERT(m_childEntities.contains(parentId));
 
-    const int row = indexOf<Node::Collection>(m_childEntities.value(parentId), collection.id());
+    const int row = indexOf<Node::Collection>(parentId, collection.id());
 
     Q_ASSERT(row >= 0);
 
@@ -900,7 +989,7 @@ void EntityTreeModelPrivate::monitoredCollectionRemoved(const Akonadi::Collectio
     removeChildEntities(collection.id());
 
     // Remove deleted collection from its parent.
-    delete m_childEntities[parentId].takeAt(row);
+    delete takeNode(parentId, row);
 
     // Remove deleted collection itself.
     m_collections.remove(collection.id());
@@ -915,7 +1004,7 @@ void EntityTreeModelPrivate::monitoredCollectionRemoved(const Akonadi::Collectio
 
 void EntityTreeModelPrivate::removeChildEntities(Collection::Id collectionId)
 {
-    QList<Node *> childList = m_childEntities.value(collectionId);
+    const QList<Node *> childList = takeChildren(collectionId);
     QList<Node *>::const_iterator it = childList.constBegin();
     const QList<Node *>::const_iterator end = childList.constEnd();
     for (; it != end; ++it) {
@@ -928,7 +1017,7 @@ void EntityTreeModelPrivate::removeChildEntities(Collection::Id collectionId)
         }
     }
 
-    qDeleteAll(m_childEntities.take(collectionId));
+    qDeleteAll(childList);
 }
 
 QStringList EntityTreeModelPrivate::childCollectionNames(const Collection &collection) const
@@ -984,7 +1073,7 @@ void EntityTreeModelPrivate::monitoredCollectionMoved(const Akonadi::Collection
     Q_ASSERT(destCollection.isValid());
     Q_ASSERT(collection.parentCollection() == destCollection);
 
-    const int srcRow = indexOf<Node::Collection>(m_childEntities.value(sourceCollection.id()), collection.id());
+    const int srcRow = indexOf<Node::Collection>(sourceCollection.id(), collection.id());
     const int destRow = 0; // Prepend collections
 
     if (!q->beginMoveRows(srcParentIndex, srcRow, srcRow, destParentIndex, destRow)) {
@@ -992,12 +1081,12 @@ void EntityTreeModelPrivate::monitoredCollectionMoved(const Akonadi::Collection
         return;
     }
 
-    Node *node = m_childEntities[sourceCollection.id()].takeAt(srcRow);
+    Node *node = takeNode(sourceCollection.id(), srcRow);
     // collection has the correct parentCollection etc. We need to set it on the
     // internal data structure to not corrupt things.
     m_collections.insert(collection.id(), collection);
     node->parent = destCollection.id();
-    m_childEntities[destCollection.id()].prepend(node);
+    prependNode(destCollection.id(), node);
     q->endMoveRows();
 }
 
@@ -1063,6 +1152,9 @@ void EntityTreeModelPrivate::monitoredCollectionStatisticsChanged(Akonadi::Colle
 
 void EntityTreeModelPrivate::monitoredItemAdded(const Akonadi::Item &item, const Akonadi::Collection &collection)
 {
+    // Apply notifications on top of the complete result of pending fetches
+    flushPendingItems();
+
     Q_Q(EntityTreeModel);
 
     if (isHidden(item)) {
@@ -1106,15 +1198,17 @@ void EntityTreeModelPrivate::monitoredItemAdded(const Akonadi::Item &item, const
     node->parent = collection.id();
     node->type = Node::Item;
     if (m_collectionFetchStrategy != EntityTreeModel::InvisibleCollectionFetch) {
-        m_childEntities[collection.id()].append(node);
+        appendNode(collection.id(), node);
     } else {
-        m_childEntities[m_rootCollection.id()].append(node);
+        appendNode(m_rootCollection.id(), node);
     }
     q->endInsertRows();
 }
 
 void EntityTreeModelPrivate::monitoredItemRemoved(const Akonadi::Item &item, const Akonadi::Collection &parentCollection)
 {
+    flushPendingItems();
+
     Q_Q(EntityTreeModel);
 
     if (isHidden(item)) {
@@ -1140,20 +1234,22 @@ void EntityTreeModelPrivate::monitoredItemRemoved(const Akonadi::Item &item, con
         Q_ASSERT(m_collections.contains(collection.id()));
         Q_ASSERT(m_childEntities.contains(collection.id()));
 
-        const int row = indexOf<Node::Item>(m_childEntities.value(collection.id()), item.id());
+        const int row = indexOf<Node::Item>(collection.id(), item.id());
         Q_ASSERT(row >= 0);
 
         const QModelIndex parentIndex = indexForCollection(m_collections.value(collection.id()));
 
         q->beginRemoveRows(parentIndex, row, row);
         m_items.unref(item.id());
-        delete m_childEntities[collection.id()].takeAt(row);
+        delete takeNode(collection.id(), row);
         q->endRemoveRows();
     }
 }
 
 void EntityTreeModelPrivate::monitoredItemChanged(const Akonadi::Item &item, const QSet<QByteArray> &)
 {
+    flushPendingItems();
+
     if (isHidden(item)) {
         return;
     }
@@ -1234,7 +1330,7 @@ void EntityTreeModelPrivate::monitoredItemMoved(const Akonadi::Item &item,
 
     const Item::Id itemId = item.id();
 
-    const int srcRow = indexOf<Node::Item>(m_childEntities.value(sourceCollection.id()), itemId);
+    const int srcRow = indexOf<Node::Item>(sourceCollection.id(), itemId);
     const int destRow = q->rowCount(destIndex);
 
     Q_ASSERT(srcRow >= 0);
@@ -1247,16 +1343,18 @@ void EntityTreeModelPrivate::monitoredItemMoved(const Akonadi::Item &item,
     Q_ASSERT(m_childEntities.contains(sourceCollection.id()));
     Q_ASSERT(m_childEntities[sourceCollection.id()].size() > srcRow);
 
-    Node *node = m_childEntities[sourceCollection.id()].takeAt(srcRow);
+    Node *node = takeNode(sourceCollection.id(), srcRow);
     m_items.insert(item.id(), item);
     node->parent = destCollection.id();
-    m_childEntities[destCollection.id()].append(node);
+    appendNode(destCollection.id(), node);
     q->endMoveRows();
 #endif
 }
 
 void EntityTreeModelPrivate::monitoredItemLinked(const Akonadi::Item &item, const Akonadi::Collection &collection)
 {
+    flushPendingItems();
+
     Q_Q(EntityTreeModel);
 
     if (isHidden(item)) {
@@ -1284,16 +1382,14 @@ void EntityTreeModelPrivate::monitoredItemLinked(const Akonadi::Item &item, cons
         return;
     }
 
-    QList<Node *> &collectionEntities =  m_childEntities[collectionId];
-
-    const int existingPosition = indexOf<Node::Item>(collectionEntities, itemId);
+    const int existingPosition = indexOf<Node::Item>(collectionId, itemId);
 
     if (existingPosition > 0) {
         qCWarning(AKONADICORE_LOG) << "Item with id " << itemId << " already in virtual collection with id " << collectionId;
         return;
     }
 
-    const int row = collectionEntities.size();
+    const int row = m_childEntities.value(collectionId).size();
 
     const QModelIndex parentIndex = indexForCollection(m_collections.value(collectionId));
 
@@ -1303,12 +1399,14 @@ void EntityTreeModelPrivate::monitoredItemLinked(const Akonadi::Item &item, cons
     node->id = itemId;
     node->parent = collectionId;
     node->type = Node::Item;
-    collectionEntities.append(node);
+    appendNode(collectionId, node);
     q->endInsertRows();
 }
 
 void EntityTreeModelPrivate::monitoredItemUnlinked(const Akonadi::Item &item, const Akonadi::Collection &collection)
 {
+    flushPendingItems();
+
     Q_Q(EntityTreeModel);
 
     if (isHidden(item)) {
@@ -1325,8 +1423,8 @@ void EntityTreeModelPrivate::monitoredItemUnlinked(const Akonadi::Item &item, co
     }
 
     Q_ASSERT(m_collectionFetchStrategy != EntityTreeModel::InvisibleCollectionFetch ? m_collections.contains(collection.id()) : true);
-    const int row = indexOf<Node::Item>(m_childEntities.value(collection.id()), item.id());
-    if (row < 0 || row >= m_childEntities[ collection.id() ].size()) {
+    const int row = indexOf<Node::Item>(collection.id(), item.id());
+    if (row < 0 || row >= m_childEntities.value(collection.id()).size()) {
         qCWarning(AKONADICORE_LOG) << "couldn't find index of unlinked item " << item.id() << collection.id() << row;
         Q_ASSERT(false);
         return;
@@ -1335,7 +1433,7 @@ void EntityTreeModelPrivate::monitoredItemUnlinked(const Akonadi::Item &item, co
     const QModelIndex parentIndex = indexForCollection(m_collections.value(collection.id()));
 
     q->beginRemoveRows(parentIndex, row, row);
-    delete m_childEntities[collection.id()].takeAt(row);
+    delete takeNode(collection.id(), row);
     m_items.unref(item.id());
     q->endRemoveRows();
 }
@@ -1364,13 +1462,14 @@ void EntityTreeModelPrivate::collectionFetchJobDone(KJob *job)
 void EntityTreeModelPrivate::itemFetchJobDone(KJob *job)
 {
     const Collection::Id collectionId = job->property(FetchCollectionId().constData()).value<Collection::Id>();
-    m_pendingCollectionRetrieveJobs.remove(collectionId);
 
     if (job->error()) {
+        m_pendingCollectionRetrieveJobs.remove(collectionId);
         qCWarning(AKONADICORE_LOG) << "Job error: " << job->errorString() << "for collection:" << collectionId << endl;
         return;
     }
     if (!m_collections.contains(collectionId)) {
+        m_pendingCollectionRetrieveJobs.remove(collectionId);
         qCWarning(AKONADICORE_LOG) << "Collection has been removed while fetching items";
         return;
     }
@@ -1378,7 +1477,33 @@ void EntityTreeModelPrivate::itemFetchJobDone(KJob *job)
     qCDebug(DebugETM) << "Fetch job took " << jobTimeTracker.take(job).elapsed() << "msec";
     qCDebug(DebugETM) << "was item fetch job: items:" << iJob->count();
 
-    if (!iJob->count()) {
+    const int count = job->property(FetchedItemCount().constData()).toInt() + iJob->count();
+    const QByteArray continuation = iJob->continuation();
+    if (!continuation.isEmpty()) {
+        // The collection is not populated until its last page has been fetched
+        fetchItemsPage(m_collections.value(collectionId), continuation, count);
+        return;
+    }
+
+    if (m_pendingItemBatches.contains(collectionId)) {
+        // Some of the fetched items are still queued for insertion, the collection
+        // is populated once the last of them has been inserted
+        m_deferredPopulations.insert(collectionId, count);
+        return;
+    }
+
+    itemsPopulated(collectionId, count);
+}
+
+void EntityTreeModelPrivate::itemsPopulated(Collection::Id collectionId, int count)
+{
+    m_pendingCollectionRetrieveJobs.remove(collectionId);
+    if (!m_collections.contains(collectionId)) {
+        qCWarning(AKONADICORE_LOG) << "Collection has been removed while fetching items";
+        return;
+    }
+
+    if (!count) {
         m_collectionsWithoutItems.insert(collectionId);
     } else {
         m_collectionsWithoutItems.remove(collectionId);
@@ -1461,7 +1586,7 @@ void EntityTreeModelPrivate::startFirstListJob()
         m_rootNode->id = m_rootCollection.id();
         m_rootNode->parent = -1;
         m_rootNode->type = Node::Collection;
-        m_childEntities[-1].append(m_rootNode);
+        appendNode(-1, m_rootNode);
         q->endInsertRows();
     } else {
         // Otherwise store it silently because it's not part of the usable model.
@@ -1548,7 +1673,7 @@ void EntityTreeModelPrivate::topLevelCollectionsFetched(const Akonadi::Collectio
             Q_ASSERT(collection.parentCollection() == Collection::root());
             node->parent = collection.parentCollection().id();
             node->type = Node::Collection;
-            m_childEntities[collection.parentCollection().id()].prepend(node);
+            prependNode(collection.parentCollection().id(), node);
 
             q->endInsertRows();
 
@@ -1565,14 +1690,10 @@ void EntityTreeModelPrivate::topLevelCollectionsFetched(const Akonadi::Collectio
 Akonadi::Collection::List EntityTreeModelPrivate::getParentCollections(const Item &item) const
 {
     Collection::List list;
-    QHashIterator<Collection::Id, QList<Node *> > iter(m_childEntities);
-    while (iter.hasNext()) {
-        iter.next();
-        int nodeIndex = indexOf<Node::Item>(iter.value(), item.id());
-        if (nodeIndex != -1 &&
-                iter.value().at(nodeIndex)->type == Node::Item) {
-            list << m_collections.value(iter.key());
-        }
+    const auto parents = m_itemParents.value(item.id());
+    list.reserve(parents.size());
+    for (const Collection::Id parentId : parents) {
+        list << m_collections.value(parentId);
     }
 
     return list;
@@ -1660,16 +1781,14 @@ QList<Node *>::iterator EntityTreeModelPrivate::removeItems(QList<Node *>::itera
     const int toDelete = (*pos) - start;
     Q_ASSERT(toDelete > 0);
 
-    QList<Node *> &es = m_childEntities[collection.id()];
     //NOTE: .erase will invalidate all iterators besides "it"!
     for (int i = 0; i < toDelete; ++i) {
-        Q_ASSERT(es.count(*it) == 1);
+        Q_ASSERT(m_childEntities[collection.id()].count(*it) == 1);
         // don't keep implicitly shared data alive
         Q_ASSERT(m_items.contains((*it)->id));
         m_items.unref((*it)->id);
         // delete actual node
-        delete *it;
-        it = es.erase(it);
+        it = eraseNode(collection.id(), it);
     }
     q->endRemoveRows();
 
@@ -1678,6 +1797,8 @@ QList<Node *>::iterator EntityTreeModelPrivate::removeItems(QList<Node *>::itera
 
 void EntityTreeModelPrivate::purgeItems(Collection::Id id)
 {
+    flushPendingItems();
+
     QList<Node *> &childEntities = m_childEntities[id];
 
     const Collection collection = m_collections.value(id);
@@ -1719,6 +1840,115 @@ void EntityTreeModelPrivate::dataChanged(const QModelIndex &top, const QModelInd
     Q_EMIT q->dataChanged(top, rightIndex);
 }
 
+int EntityTreeModelPrivate::rowOf(Collection::Id parentId, int type, Node::Id id) const
+{
+    auto it = m_childRowIndex.find(parentId);
+    if (it == m_childRowIndex.end()) {
+        const auto childIt = m_childEntities.constFind(parentId);
+        if (childIt == m_childEntities.cend()) {
+            return -1;
+        }
+        it = m_childRowIndex.insert(parentId, ChildRowIndex());
+    }
+    if (!it->isValid()) {
+        it->rebuild(m_childEntities.value(parentId));
+    }
+    return it->row(type, id);
+}
+
+void EntityTreeModelPrivate::appendNode(Collection::Id parentId, Node *node)
+{
+    QList<Node *> &children = m_childEntities[parentId];
+    children.append(node);
+
+    const auto it = m_childRowIndex.find(parentId);
+    if (it != m_childRowIndex.end()) {
+        it->appended(node, children.size());
+    }
+
+    if (node->type == Node::Item) {
+        m_itemParents[node->id].append(parentId);
+    } else {
+        m_collectionParents.insert(node->id, parentId);
+    }
+}
+
+void EntityTreeModelPrivate::prependNode(Collection::Id parentId, Node *node)
+{
+    m_childEntities[parentId].prepend(node);
+
+    const auto it = m_childRowIndex.find(parentId);
+    if (it != m_childRowIndex.end()) {
+        it->prepended(node);
+    }
+
+    if (node->type == Node::Item) {
+        m_itemParents[node->id].append(parentId);
+    } else {
+        m_collectionParents.insert(node->id, parentId);
+    }
+}
+
+Node *EntityTreeModelPrivate::takeNode(Collection::Id parentId, int row)
+{
+    Node *node = m_childEntities[parentId].takeAt(row);
+    nodeRemoved(parentId, node, row);
+    return node;
+}
+
+QList<Node *>::iterator EntityTreeModelPrivate::eraseNode(Collection::Id parentId, QList<Node *>::iterator it)
+{
+    QList<Node *> &children = m_childEntities[parentId];
+    Node *node = *it;
+    it = children.erase(it);
+    nodeRemoved(parentId, node, it - children.begin());
+    delete node;
+    return it;
+}
+
+QList<Node *> EntityTreeModelPrivate::takeChildren(Collection::Id parentId)
+{
+    const QList<Node *> children = m_childEntities.take(parentId);
+    m_childRowIndex.remove(parentId);
+    for (const Node *node : children) {
+        nodeRemoved(parentId, node, -1);
+    }
+    return children;
+}
+
+void EntityTreeModelPrivate::nodeRemoved(Collection::Id parentId, const Node *node, int row)
+{
+    if (row >= 0) {
+        const auto indexIt = m_childRowIndex.find(parentId);
+        if (indexIt != m_childRowIndex.end()) {
+            indexIt->removed(node, row, m_childEntities.value(parentId).size());
+        }
+    }
+
+    if (node->type == Node::Item) {
+        auto it = m_itemParents.find(node->id);
+        if (it != m_itemParents.end()) {
+            it->removeOne(parentId);
+            if (it->isEmpty()) {
+                m_itemParents.erase(it);
+            }
+        }
+    } else if (m_collectionParents.value(node->id, -2) == parentId) {
+        m_collectionParents.remove(node->id);
+    }
+}
+
+void EntityTreeModelPrivate::clearNodes()
+{
+    for (const QList<Node *> &list : qAsConst(m_childEntities)) {
+        qDeleteAll(list);
+    }
+    m_childEntities.clear();
+    m_childRowIndex.clear();
+    m_collectionParents.clear();
+    m_itemParents.clear();
+}
+
 QModelIndex EntityTreeModelPrivate::indexForCollection(const Collection &collection) const
 {
     Q_Q(const EntityTreeModel);
@@ -1747,21 +1977,14 @@ QModelIndex EntityTreeModelPrivate::indexForCollection(const Collection &collect
     } else if (collection.parentCollection().isValid()) {
         parentId = collection.parentCollection().id();
     } else {
-        QHash<Node::Id, QList<Node *> >::const_iterator it = m_childEntities.constBegin();
-        const QHash<Node::Id, QList<Node *> >::const_iterator end = m_childEntities.constEnd();
-        for (; it != end; ++it) {
-            const int row = indexOf<Node::Collection>(it.value(), collection.id());
-            if (row < 0) {
-                continue;
-            }
-
-            Node *node = it.value().at(row);
-            return q->createIndex(row, 0, static_cast<void *>(node));
+        const auto parentIt = m_collectionParents.constFind(collection.id());
+        if (parentIt == m_collectionParents.cend()) {
+            return QModelIndex();
         }
-        return QModelIndex();
+        parentId = *parentIt;
     }
 
-    const int row = indexOf<Node::Collection>(m_childEntities.value(parentId), collection.id());
+    const int row = indexOf<Node::Collection>(parentId, collection.id());
 
     if (row < 0) {
         return QModelIndex();
@@ -1779,8 +2002,8 @@ QModelIndexList EntityTreeModelPrivate::indexesForItem(const Item &item) const
 
     if (m_collectionFetchStrategy == EntityTreeModel::FetchNoCollections) {
         Q_ASSERT(m_childEntities.contains(m_rootCollection.id()));
-        QList<Node *> nodeList = m_childEntities.value(m_rootCollection.id());
-        const int row = indexOf<Node::Item>(nodeList, item.id());
+        const QList<Node *> nodeList = m_childEntities.value(m_rootCollection.id());
+        const int row = indexOf<Node::Item>(m_rootCollection.id(), item.id());
         Q_ASSERT(row >= 0);
         Q_ASSERT(row < nodeList.size());
         Node *node = nodeList.at(row);
@@ -1793,10 +2016,10 @@ QModelIndexList EntityTreeModelPrivate::indexesForItem(const Item &item) const
 
     indexes.reserve(collections.size());
     for (const Collection &collection : collections) {
-        const int row = indexOf<Node::Item>(m_childEntities.value(collection.id()), item.id());
+        const int row = indexOf<Node::Item>(collection.id(), item.id());
         Q_ASSERT(row >= 0);
         Q_ASSERT(m_childEntities.contains(collection.id()));
-        QList<Node *> nodeList = m_childEntities.value(collection.id());
+        const QList<Node *> nodeList = m_childEntities.value(collection.id());
         Q_ASSERT(row < nodeList.size());
         Node *node = nodeList.at(row);
 
@@ -1818,6 +2041,10 @@ void EntityTreeModelPrivate::endResetModel()
     foreach (Akonadi::Job *job, m_session->findChildren<Akonadi::Job *>()) {
         job->disconnect(q);
     }
+    m_pendingItemsTimer->stop();
+    m_pendingItems.clear();
+    m_pendingItemBatches.clear();
+    m_deferredPopulations.clear();
     m_collections.clear();
     m_collectionsWithoutItems.clear();
     m_populatedCols.clear();
@@ -1826,10 +2053,7 @@ void EntityTreeModelPrivate::endResetModel()
     m_pendingCollectionRetrieveJobs.clear();
     m_collectionTreeFetched = false;
 
-    foreach (const QList<Node *> &list, m_childEntities) {
-        qDeleteAll(list);
-    }
-    m_childEntities.clear();
+    clearNodes();
     if (m_needDeleteRootNode) {
         m_needDeleteRootNode = false;
         delete m_rootNode;
@@ -1860,7 +2084,7 @@ void EntityTreeModelPrivate::monitoredItemsRetrieved(KJob *job)
         node->parent = m_rootCollection.id();
         node->type = Node::Item;
 
-        m_childEntities[-1].append(node);
+        appendNode(-1, node);
         m_items.ref(item.id(), item);
     }
 
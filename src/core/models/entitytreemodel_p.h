@@ -32,6 +32,9 @@
 #include "akonaditests_export.h"
 
 #include <QLoggingCategory>
+#include <QQueue>
+
+class QTimer;
 
 Q_DECLARE_LOGGING_CATEGORY(DebugETM)
 
@@ -125,6 +128,125 @@ private:
     QHash<Key, RefCountedValue<Value>> mHash;
 };
 
+/**
+ * Position index over the child nodes of a single parent in the node tree.
+ *
+ * Rows are stored as sequence numbers relative to a moving base, so both
+ * prepending collections and appending items, as well as removing the first
+ * or last child, keep the index valid without touching existing entries.
+ * Removing any other child shifts the following entries in place. If the
+ * index does not match the child list, or the same node appears more than
+ * once in it, removals invalidate it and it is lazily rebuilt on the next
+ * lookup.
+ */
+class ChildRowIndex
+{
+public:
+    inline bool isValid() const { return mValid; }
+
+    inline void invalidate()
+    {
+        mValid = false;
+        mHasDuplicates = false;
+        mItems.clear();
+        mCollections.clear();
+    }
+
+    inline void rebuild(const QList<Node *> &nodes)
+    {
+        invalidate();
+        mBase = 0;
+        mItems.reserve(nodes.size());
+        int row = 0;
+        for (const Node *node : nodes) {
+            auto &hash = (node->type == Node::Item) ? mItems : mCollections;
+            // Keep the first occurrence, same as a linear scan would find
+            if (!hash.contains(node->id)) {
+                hash.insert(node->id, row);
+            } else {
+                mHasDuplicates = true;
+            }
+            ++row;
+        }
+        mValid = true;
+    }
+
+    inline int row(int type, Node::Id id) const
+    {
+        const auto &hash = (type == Node::Item) ? mItems : mCollections;
+        const auto it = hash.constFind(id);
+        return it == hash.cend() ? -1 : (*it - mBase);
+    }
+
+    inline void prepended(const Node *node)
+    {
+        if (mValid) {
+            --mBase;
+            auto &hash = (node->type == Node::Item) ? mItems : mCollections;
+            mHasDuplicates |= hash.contains(node->id);
+            hash.insert(node->id, mBase);
+        }
+    }
+
+    /**
+     * @p size is the size of the child list after @p node was appended.
+     */
+    inline void appended(const Node *node, int size)
+    {
+        if (mValid) {
+            auto &hash = (node->type == Node::Item) ? mItems : mCollections;
+            if (!hash.contains(node->id)) {
+                hash.insert(node->id, mBase + size - 1);
+            } else {
+                mHasDuplicates = true;
+            }
+        }
+    }
+
+    /**
+     * @p row is the row @p node was removed from, @p size is the size of the
+     * child list after it was removed.
+     */
+    inline void removed(const Node *node, int row, int size)
+    {
+        if (!mValid) {
+            return;
+        }
+        auto &hash = (node->type == Node::Item) ? mItems : mCollections;
+        const auto it = hash.find(node->id);
+        if (it == hash.end() || *it - mBase != row || mHasDuplicates) {
+            // Not the entry we know, or a later duplicate of it would have
+            // to take its place
+            invalidate();
+            return;
+        }
+        hash.erase(it);
+
+        if (row == 0) {
+            ++mBase;
+        } else if (row < size) {
+            const int seq = mBase + row;
+            for (auto &entry : mItems) {
+                if (entry > seq) {
+                    --entry;
+                }
+            }
+            for (auto &entry : mCollections) {
+                if (entry > seq) {
+                    --entry;
+                }
+            }
+        }
+    }
+
+private:
+    QHash<Node::Id, int> mItems;
+    QHash<Node::Id, int> mCollections;
+    int mBase = 0;
+    bool mValid = false;
+    bool mHasDuplicates = false;
+};
+
 namespace Akonadi
 {
 /**
@@ -149,10 +271,20 @@ public:
     void fetchCollections(const Collection::List &collections, CollectionFetchJob::Type type = CollectionFetchJob::FirstLevel);
     void fetchCollections(Akonadi::CollectionFetchJob *job);
     void fetchItems(const Collection &collection);
+    void fetchItemsPage(const Collection &collection, const QByteArray &continuation, int fetchedCount);
     void collectionsFetched(const Akonadi::Collection::List &collections);
     void collectionListFetched(const Akonadi::Collection::List &collections);
     void itemsFetched(const Akonadi::Item::List &items);
     void itemsFetched(const Collection::Id collectionId, const Akonadi::Item::List &items);
+    void insertFetchedItems(const Collection::Id collectionId, const Akonadi::Item::List &items);
+
+    /**
+     * Inserts queued fetched items until @p budget milliseconds have elapsed.
+     * A negative @p budget inserts all queued items.
+     */
+    void processPendingItems(int budget);
+    void flushPendingItems();
+    void itemsPopulated(Collection::Id collectionId, int count);
 
     void monitoredCollectionAdded(const Akonadi::Collection &collection, const Akonadi::Collection &parent);
     void monitoredCollectionRemoved(const Akonadi::Collection &collection);
@@ -206,6 +338,24 @@ public:
     QHash<Collection::Id, Collection> m_collections;
     RefCountedHash<Item::Id, Item> m_items;
     QHash<Collection::Id, QList<Node *> > m_childEntities;
+    // Lookup structures for m_childEntities, only modify through
+    // appendNode(), prependNode(), takeNode() and eraseNode()
+    mutable QHash<Collection::Id, ChildRowIndex> m_childRowIndex;
+    QHash<Collection::Id, Collection::Id> m_collectionParents;
+    QHash<Item::Id, QVector<Collection::Id>> m_itemParents;
+
+    // Fetched items waiting to be inserted when an item insertion budget is set
+    struct PendingItems {
+        Collection::Id collectionId;
+        Item::List items;
+        int offset;
+    };
+    QQueue<PendingItems> m_pendingItems;
+    QHash<Collection::Id, int> m_pendingItemBatches;
+    // Item fetch jobs that finished while their items were still queued, with their item count
+    QHash<Collection::Id, int> m_deferredPopulations;
+    QTimer *m_pendingItemsTimer = nullptr;
+    int m_itemInsertionBudget = 0;
     QSet<Collection::Id> m_populatedCols;
     QSet<Collection::Id> m_collectionsWithoutItems;
 
@@ -254,21 +404,44 @@ public:
     void pasteJobDone(KJob *job);
 
     /**
-     * Returns the index of the node in @p list with the id @p id. Returns -1 if not found.
+     * Returns the row of the node with the id @p id among the children of @p parentId.
+     * Returns -1 if not found.
      */
     template<Node::Type Type>
-    int indexOf(const QList<Node *> &nodes, Node::Id id) const
+    int indexOf(Collection::Id parentId, Node::Id id) const
     {
-        int i = 0;
-        for (const Node *node : nodes) {
-            if (node->id == id && node->type == Type) {
-                return i;
-            }
-            i++;
-        }
-
-        return -1;
+        return rowOf(parentId, Type, id);
     }
+    int rowOf(Collection::Id parentId, int type, Node::Id id) const;
+
+    /**
+     * Appends or prepends @p node to the children of @p parentId and updates the lookup indexes.
+     */
+    void appendNode(Collection::Id parentId, Node *node);
+    void prependNode(Collection::Id parentId, Node *node);
+
+    /**
+     * Removes the node at @p row from the children of @p parentId and returns it.
+     */
+    Node *takeNode(Collection::Id parentId, int row);
+
+    /**
+     * Erases the node at @p it from the children of @p parentId, deleting the node. Returns
+     * an iterator pointing to the next node.
+     */
+    QList<Node *>::iterator eraseNode(Collection::Id parentId, QList<Node *>::iterator it);
+
+    /**
+     * Removes the child list of @p parentId and returns it, dropping all lookup entries for it.
+     */
+    QList<Node *> takeChildren(Collection::Id parentId);
+
+    void clearNodes();
+    /**
+     * Updates the lookup indexes after @p node was removed from @p row. The
+     * row is -1 when the whole child list has been removed.
+     */
+    void nodeRemoved(Collection::Id parentId, const Node *node, int row);
 
     /**
      * The id of the collection which starts an item fetch job. This is part of a hack with QObject::sender
@@ -279,6 +452,14 @@ public:
         return "FetchCollectionId";
     }
 
+    /**
+     * The number of items fetched by the previous pages of an item fetch job.
+     */
+    static QByteArray FetchedItemCount()
+    {
+        return "FetchedItemCount";
+    }
+
     Session *m_session = nullptr;
 
     Q_DECLARE_PUBLIC(EntityTreeModel)
@@ -787,7 +787,8 @@ void MonitorPrivate::handleCommands()
 
     CommandBufferLocker lock(&mCommandBuffer);
     CommandBufferNotifyBlocker notify(&mCommandBuffer);
-    while (!mCommandBuffer.isEmpty()) {
+    // Yield to the event loop after a batch, the rest is announced again when unblocking
+    for (int batch = mCommandBuffer.batchSize(); batch > 0 && !mCommandBuffer.isEmpty(); --batch) {
         const auto cmd = mCommandBuffer.dequeue();
         lock.unlock();
         const auto command = cmd.command;
@@ -393,12 +393,57 @@ Protocol::ItemFetchScope ProtocolHelper::itemFetchScopeToProtocol(const ItemFetc
     fs.setFetch(Protocol::ItemFetchScope::GID, fetchScope.fetchGid());
     fs.setFetch(Protocol::ItemFetchScope::Tags, fetchScope.fetchTags());
     fs.setFetch(Protocol::ItemFetchScope::VirtReferences, fetchScope.fetchVirtualReferences());
-    fs.setFetch(Protocol::ItemFetchScope::MTime, fetchScope.fetchModificationTime());
+    // The continuation of a page sorted by modification time needs the mtime of its last item
+    fs.setFetch(Protocol::ItemFetchScope::MTime, fetchScope.fetchModificationTime()
+                || (fetchScope.limit() > 0 && fetchScope.sortOrder() == ItemFetchScope::SortByModificationTime));
     fs.setFetch(Protocol::ItemFetchScope::Relations, fetchScope.fetchRelations());
 
     return fs;
 }
 
+Protocol::ItemFetchLimit ProtocolHelper::itemFetchLimitToProtocol(const ItemFetchScope &fetchScope)
+{
+    Protocol::ItemFetchLimit limit;
+    if (fetchScope.limit() <= 0) {
+        return limit;
+    }
+
+    limit.setLimit(fetchScope.limit());
+    limit.setSortKey(fetchScope.sortOrder() == ItemFetchScope::SortByModificationTime
+                     ? Protocol::ItemFetchLimit::ModificationTime
+                     : Protocol::ItemFetchLimit::Id);
+
+    // The continuation token is "<id>" or "<id>:<mtime in msecs since epoch>"
+    const QByteArray continuation = fetchScope.continuation();
+    if (!continuation.isEmpty()) {
+        const int pos = continuation.indexOf(':');
+        bool ok = false;
+        const qint64 id = continuation.left(pos).toLongLong(&ok);
+        if (!ok || id < 0) {
+            throw Exception("Invalid item fetch continuation");
+        }
+        limit.setContinuationId(id);
+        if (limit.sortKey() == Protocol::ItemFetchLimit::ModificationTime) {
+            const qint64 mtime = pos < 0 ? -1 : continuation.mid(pos + 1).toLongLong(&ok);
+            if (!ok || mtime < 0) {
+                throw Exception("Invalid item fetch continuation");
+            }
+            limit.setContinuationMTime(QDateTime::fromMSecsSinceEpoch(mtime, Qt::UTC));
+        }
+    }
+
+    return limit;
+}
+
+QByteArray ProtocolHelper::itemFetchContinuation(const Protocol::ItemFetchLimit &nextPage)
+{
+    QByteArray continuation = QByteArray::number(nextPage.continuationId());
+    if (nextPage.sortKey() == Protocol::ItemFetchLimit::ModificationTime) {
+        continuation += ':' + QByteArray::number(nextPage.continuationMTime().toMSecsSinceEpoch());
+    }
+    return continuation;
+}
+
 ItemFetchScope ProtocolHelper::parseItemFetchScope(const Protocol::ItemFetchScope &fetchScope)
 {
     ItemFetchScope ifs;
@@ -605,8 +650,13 @@ static Item::Flags convertFlags(const QVector<QByteArray> &flags, ProtocolHelper
 }
 
 Item ProtocolHelper::parseItemFetchResult(const Protocol::FetchItemsResponse &data,
-                                          const Akonadi::ItemFetchScope *fetchScope, ProtocolHelperValuePool *valuePool)
+                                          const Akonadi::ItemFetchScope *fetchScope, ProtocolHelperValuePool *valuePool,
+                                          bool payloadFileReferences)
 {
+    if (fetchScope && fetchScope->payloadFileReferences()) {
+        payloadFileReferences = true;
+    }
+
     Item item;
     item.setId(data.id());
     item.setRevision(data.revision());
@@ -677,10 +727,31 @@ Item ProtocolHelper::parseItemFetchResult(const Protocol::FetchItemsResponse &da
             if (fetchScope && !fetchScope->fullPayload() && !fetchScope->payloadParts().contains(plainKey)) {
                 continue;
             }
-            ItemSerializer::deserialize(item, plainKey, part.data(), metaData.version(),
-                                        static_cast<ItemSerializer::PayloadStorage>(metaData.storageType()));
-            if (metaData.storageType() == Protocol::PartMetaData::Foreign) {
-                item.d_ptr->mPayloadPath = QString::fromUtf8(part.data());
+            if (metaData.storageType() == Protocol::PartMetaData::Internal) {
+                // Payloads are only deserialized once they are accessed, many users
+                // (e.g. list views) only need the attributes
+                item.d_ptr->mPendingPayloadParts.push_back({ plainKey, part.data(), metaData.version() });
+            } else {
+                const QString filename = (metaData.storageType() == Protocol::PartMetaData::External)
+                                         ? ExternalPartStorage::resolveAbsolutePath(part.data())
+                                         : QString::fromUtf8(part.data());
+                // payloadPath() can only refer to one part, the full payload
+                if (payloadFileReferences && plainKey == Item::FullPayload) {
+                    // The caller consumes the file itself, see ItemFetchScope::setPayloadFileReferences()
+                    item.d_ptr->mPayloadPath = filename;
+                    continue;
+                }
+                // The file of an older revision is removed once the item changes,
+                // so it has to be read right away
+                QFile file(filename);
+                if (file.open(QFile::ReadOnly)) {
+                    item.d_ptr->mPendingPayloadParts.push_back({ plainKey, file.readAll(), metaData.version() });
+                } else {
+                    qCWarning(AKONADICORE_LOG) << "Failed to open payload file" << filename << "of item" << item.id() << ":" << file.errorString();
+                }
+                if (metaData.storageType() == Protocol::PartMetaData::Foreign && !payloadFileReferences) {
+                    item.d_ptr->mPayloadPath = filename;
+                }
             }
             break;
         case ProtocolHelper::PartAttribute: {
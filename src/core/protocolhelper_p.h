@@ -230,6 +230,18 @@ public:
     static Protocol::ItemFetchScope itemFetchScopeToProtocol(const ItemFetchScope &fetchScope);
     static ItemFetchScope parseItemFetchScope(const Protocol::ItemFetchScope &fetchScope);
 
+    /**
+      Converts the limit, sort order and continuation of the given ItemFetchScope
+      into a protocol representation.
+    */
+    static Protocol::ItemFetchLimit itemFetchLimitToProtocol(const ItemFetchScope &fetchScope);
+
+    /**
+      Returns the continuation token for the next page of a limited fetch,
+      as announced by the server in @p nextPage.
+    */
+    static QByteArray itemFetchContinuation(const Protocol::ItemFetchLimit &nextPage);
+
     static Protocol::CollectionFetchScope collectionFetchScopeToProtocol(const CollectionFetchScope &fetchScope);
     static CollectionFetchScope parseCollectionFetchScope(const Protocol::CollectionFetchScope &fetchScope);
 
@@ -238,9 +250,12 @@ public:
 
     /**
      * Parses a single line from an item fetch job result into an Item object.
+     * The full payload file is not read if @p payloadFileReferences is set or requested
+     * by @p fetchScope, see ItemFetchScope::setPayloadFileReferences().
      * FIXME: std::optional
      */
-    static Item parseItemFetchResult(const Protocol::FetchItemsResponse &data, const ItemFetchScope *fetchScope = nullptr, ProtocolHelperValuePool *valuePool = nullptr);
+    static Item parseItemFetchResult(const Protocol::FetchItemsResponse &data, const ItemFetchScope *fetchScope = nullptr, ProtocolHelperValuePool *valuePool = nullptr,
+                                     bool payloadFileReferences = false);
     static Tag parseTagFetchResult(const Protocol::FetchTagsResponse &data);
     static Relation parseRelationFetchResult(const Protocol::FetchRelationsResponse &data);
 
@@ -49,6 +49,9 @@
 #define PIPELINE_LENGTH 0
 //#define PIPELINE_LENGTH 2
 
+/// Number of received commands at which the SessionThread stops reading from the server
+static const int DefaultCommandBufferSize = 10000;
+
 using namespace Akonadi;
 
 //@cond PRIVATE
@@ -92,7 +95,8 @@ bool SessionPrivate::handleCommands()
 {
     CommandBufferLocker lock(&mCommandBuffer);
     CommandBufferNotifyBlocker notify(&mCommandBuffer);
-    while (!mCommandBuffer.isEmpty()) {
+    // Yield to the event loop after a batch, the rest is announced again when unblocking
+    for (int batch = mCommandBuffer.batchSize(); batch > 0 && !mCommandBuffer.isEmpty(); --batch) {
         const auto command = mCommandBuffer.dequeue();
         lock.unlock();
         const auto cmd = command.command;
@@ -105,6 +109,8 @@ bool SessionPrivate::handleCommands()
                 qCWarning(AKONADICORE_LOG) << "Error when establishing connection with Akonadi server:" << hello.errorMessage();
                 connection->closeConnection();
                 QTimer::singleShot(1000, connection, &Connection::reconnect);
+                // The buffer must be locked when the notifications are unblocked
+                lock.relock();
                 return false;
             }
 
@@ -124,6 +130,7 @@ bool SessionPrivate::handleCommands()
                 qCWarning(AKONADICORE_LOG) << "Unable to login to Akonadi server:" << login.errorMessage();
                 connection->closeConnection();
                 QTimer::singleShot(1000, mParent, SLOT(reconnect()));
+                lock.relock();
                 return false;
             }
 
@@ -309,6 +316,11 @@ SessionPrivate::SessionPrivate(Session *parent)
     , mCommandBuffer(parent, "handleCommands")
     , currentJob(nullptr)
 {
+    // Throttle reading from the server when the jobs can't keep up with the responses
+    bool ok = false;
+    const int highWaterMark = qEnvironmentVariableIntValue("AKONADI_SESSION_BUFFER_SIZE", &ok);
+    mCommandBuffer.setHighWaterMark(ok ? highWaterMark : DefaultCommandBufferSize);
+
     // Shutdown the thread before QApplication event loop quits - the
     // thread()->wait() mechanism in Connection dtor crashes sometimes
     // when called from QApplication destructor
@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "commandtrace_p.h"
+#include "datastream_p_p.h"
+
+#include <QIODevice>
+
+using namespace Akonadi;
+using namespace Akonadi::Protocol;
+
+namespace
+{
+static const char Magic[] = "AKTRACE1";
+static const int MagicSize = sizeof(Magic) - 1;
+}
+
+void CommandTrace::writeHeader(QIODevice *device, const QByteArray &sessionId)
+{
+    DataStream stream(device);
+    stream.writeRawData(Magic, MagicSize);
+    stream << Protocol::version()
+           << sessionId
+           << QDateTime::currentDateTimeUtc();
+}
+
+void CommandTrace::writeEntry(QIODevice *device, qint64 offset, qint64 tag, const CommandPtr &command)
+{
+    DataStream stream(device);
+    stream << offset << tag;
+    Protocol::serialize(device, command);
+}
+
+bool CommandTrace::read(QIODevice *device, QString *errorString)
+{
+    entries.clear();
+
+    if (device->read(MagicSize) != QByteArray(Magic, MagicSize)) {
+        if (errorString) {
+            *errorString = QStringLiteral("Not an Akonadi command trace");
+        }
+        return false;
+    }
+
+    DataStream stream(device);
+    try {
+        int version = 0;
+        stream >> version;
+        if (version != Protocol::version()) {
+            if (errorString) {
+                *errorString = QStringLiteral("Trace was recorded with protocol version %1, expected %2")
+                               .arg(version).arg(Protocol::version());
+            }
+            return false;
+        }
+        stream >> sessionId
+               >> recorded;
+    } catch (const ProtocolException &e) {
+        if (errorString) {
+            *errorString = QStringLiteral("Invalid trace header: %1").arg(QString::fromUtf8(e.what()));
+        }
+        return false;
+    }
+
+    while (!device->atEnd()) {
+        Entry entry;
+        try {
+            stream >> entry.offset
+                   >> entry.tag;
+            entry.command = Protocol::deserialize(device);
+        } catch (const ProtocolException &e) {
+            if (errorString) {
+                *errorString = QStringLiteral("Trace truncated after %1 commands: %2")
+                               .arg(entries.size()).arg(QString::fromUtf8(e.what()));
+            }
+            break;
+        }
+        entries.push_back(std::move(entry));
+    }
+
+    return true;
+}
@@ -0,0 +1,79 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef AKONADI_COMMANDTRACE_P_H
+#define AKONADI_COMMANDTRACE_P_H
+
+#include "akonadiprivate_export.h"
+#include "protocol_p.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QVector>
+
+class QIODevice;
+
+namespace Akonadi
+{
+namespace Protocol
+{
+
+/**
+ * Binary recording of the commands a client sent over one connection.
+ *
+ * The server writes traces for the sessions selected in its configuration,
+ * asapreplay reads them to drive the recorded workload against another
+ * server. Commands are stored in the wire format, so a trace can only be
+ * replayed by a build speaking the same protocol version.
+ *
+ * @since 5.13
+ */
+class AKONADIPRIVATE_EXPORT CommandTrace
+{
+public:
+    struct Entry {
+        /// Milliseconds since the start of the recording
+        qint64 offset = 0;
+        qint64 tag = -1;
+        CommandPtr command;
+    };
+
+    /// Writes the trace header, must be called before any writeEntry()
+    static void writeHeader(QIODevice *device, const QByteArray &sessionId);
+    static void writeEntry(QIODevice *device, qint64 offset, qint64 tag, const CommandPtr &command);
+
+    /**
+     * Reads a trace written by writeHeader() and writeEntry().
+     *
+     * Returns @c false if the header is invalid or the trace was recorded
+     * with a different protocol version. A truncated trace, e.g. of a server
+     * that crashed, is read up to the last complete entry; @p errorString
+     * describes the problem in both cases.
+     */
+    bool read(QIODevice *device, QString *errorString = nullptr);
+
+    QByteArray sessionId;
+    QDateTime recorded;
+    QVector<Entry> entries;
+};
+
+} // namespace Protocol
+} // namespace Akonadi
+
+#endif
@@ -71,6 +71,13 @@ public:
 
     bool inTransaction() const;
 
+    /**
+     * Rolls back the transaction of the current thread. Normally done by
+     * ExternalPartStorageTransaction, use this only to clean up after a
+     * transaction that has been left open.
+     */
+    bool rollbackTransaction();
+
 private:
     friend class ExternalPartStorageTransaction;
 
@@ -90,7 +97,6 @@ private:
 
     bool beginTransaction();
     bool commitTransaction();
-    bool rollbackTransaction();
 
     bool replayTransaction(const QVector<Operation> &trx, bool commit);
     void addToTransaction(const QVector<Operation> &ops);
@@ -25,9 +25,12 @@
 
 #include "cachecleaner.h"
 #include "intervalcheck.h"
+#include "metrics.h"
 #include "storagejanitor.h"
 #include "storage/dbconfig.h"
 #include "storage/datastore.h"
+#include "storage/datastorepool.h"
+#include "storage/dbdeadlockcatcher.h"
 #include "notificationmanager.h"
 #include "resourcemanager.h"
 #include "tracer.h"
@@ -35,6 +38,8 @@
 #include "debuginterface.h"
 #include "storage/itemretrievalmanager.h"
 #include "storage/collectionstatistics.h"
+#include "storage/collectiontreecache.h"
+#include "storage/tagcache.h"
 #include "preprocessormanager.h"
 #include "search/searchmanager.h"
 #include "search/searchtaskmanager.h"
@@ -50,7 +55,9 @@
 
 #include <QCoreApplication>
 #include <QDir>
+#include <QSaveFile>
 #include <QSettings>
+#include <QThreadPool>
 #include <QTimer>
 #include <QDBusServiceWatcher>
 
@@ -184,6 +191,7 @@ bool AkonadiServer::init()
     ResourceManager::self();
 
     CollectionStatistics::self();
+    TagCache::self();
 
     // Initialize the preprocessor manager
     PreprocessorManager::init();
@@ -192,11 +200,39 @@ bool AkonadiServer::init()
     if (settings.value(QStringLiteral("General/DisablePreprocessing"), false).toBool()) {
         PreprocessorManager::instance()->setEnabled(false);
     }
+    PreprocessorManager::instance()->setBatchSize(settings.value(QStringLiteral("General/PreprocessingBatchSize"),
+                                                                 PreprocessorManager::instance()->batchSize()).toInt());
 
     if (settings.value(QStringLiteral("Cache/EnableCleaner"), true).toBool()) {
         mCacheCleaner = new CacheCleaner();
     }
 
+    if (settings.value(QStringLiteral("Cache/EnableCollectionTreeCache"), true).toBool()) {
+        mCollectionTreeCache = new CollectionTreeCache();
+    }
+
+    const int maxDbConnections = settings.value(QStringLiteral("Connection/MaxDatabaseConnections"), 200).toInt();
+    if (maxDbConnections > 0) {
+        mDataStorePool = new DataStorePool(maxDbConnections);
+    }
+
+    // Opt-in: large item fetches are split among the worker threads, each
+    // of them with its own database connection
+    const int fetchThreads = settings.value(QStringLiteral("ItemFetch/WorkerThreads"), 0).toInt();
+    if (fetchThreads > 0) {
+        mItemFetchThreadPool = new QThreadPool(this);
+        mItemFetchThreadPool->setMaxThreadCount(fetchThreads);
+    }
+
+    // Optionally write the metrics snapshot to a file every few seconds,
+    // for when akonadictl cannot be used
+    const int metricsDumpInterval = settings.value(QStringLiteral("Metrics/DumpInterval"), 0).toInt();
+    if (metricsDumpInterval > 0) {
+        auto *metricsTimer = new QTimer(this);
+        connect(metricsTimer, &QTimer::timeout, this, &AkonadiServer::dumpMetrics);
+        metricsTimer->start(metricsDumpInterval * 1000);
+    }
+
     mIntervalCheck = new IntervalCheck();
     mStorageJanitor = new StorageJanitor();
     mItemRetrieval = new ItemRetrievalManager();
@@ -264,8 +300,34 @@ bool AkonadiServer::quit()
     qDeleteAll(mConnections);
     mConnections.clear();
 
+    if (mItemFetchThreadPool) {
+        // Joins the worker threads, which closes their database connections
+        mItemFetchThreadPool->waitForDone();
+        delete mItemFetchThreadPool;
+        mItemFetchThreadPool = nullptr;
+    }
+
+    if (mDataStorePool) {
+        const auto stats = mDataStorePool->statistics();
+        qCDebug(AKONADISERVER_LOG) << "database connection pool:" << stats.leases << "leases,"
+                                   << stats.waits << "waits (" << stats.totalWaitTime << "ms total,"
+                                   << stats.maxWaitTime << "ms max)," << stats.evictions << "evictions,"
+                                   << stats.overcommits << "overcommits, peak" << stats.peak
+                                   << "of" << stats.capacity;
+        delete mDataStorePool;
+        mDataStorePool = nullptr;
+    }
+
+    const auto deadlockStats = DbDeadlockCatcher::statistics();
+    if (deadlockStats.deadlocks > 0) {
+        qCDebug(AKONADISERVER_LOG) << "database deadlocks:" << deadlockStats.deadlocks << "deadlocks,"
+                                   << deadlockStats.retries << "retries (" << deadlockStats.totalBackoffTime
+                                   << "ms backoff total)," << deadlockStats.failures << "failures";
+    }
+
     qCDebug(AKONADISERVER_LOG) << "terminating service threads";
     delete mCacheCleaner;
+    delete mCollectionTreeCache;
     delete mIntervalCheck;
     delete mStorageJanitor;
     delete mItemRetrieval;
@@ -276,6 +338,7 @@ bool AkonadiServer::quit()
     // Terminate the preprocessor manager before the database but after all connections are gone
     PreprocessorManager::done();
     CollectionStatistics::destroy();
+    TagCache::destroy();
 
     if (DbConfig::isConfigured()) {
         if (DataStore::hasDataStore()) {
@@ -409,6 +472,21 @@ CacheCleaner *AkonadiServer::cacheCleaner()
     return mCacheCleaner;
 }
 
+CollectionTreeCache *AkonadiServer::collectionTreeCache()
+{
+    return mCollectionTreeCache;
+}
+
+DataStorePool *AkonadiServer::dataStorePool()
+{
+    return mDataStorePool;
+}
+
+QThreadPool *AkonadiServer::itemFetchThreadPool()
+{
+    return mItemFetchThreadPool;
+}
+
 IntervalCheck *AkonadiServer::intervalChecker()
 {
     return mIntervalCheck;
@@ -419,6 +497,33 @@ NotificationManager *AkonadiServer::notificationManager()
     return mNotificationManager;
 }
 
+QString AkonadiServer::metrics() const
+{
+    QString out = Metrics::self()->snapshot();
+    if (mDataStorePool) {
+        const auto stats = mDataStorePool->statistics();
+        out += QStringLiteral("\nDatabase connections: %1 active, %2 idle, peak %3 of %4, %5 leases, "
+                              "%6 waits (%7 ms total, %8 ms max), %9 evictions, %10 overcommits\n")
+               .arg(stats.active).arg(stats.idle).arg(stats.peak).arg(stats.capacity).arg(stats.leases)
+               .arg(stats.waits).arg(stats.totalWaitTime).arg(stats.maxWaitTime).arg(stats.evictions)
+               .arg(stats.overcommits);
+    }
+    return out;
+}
+
+void AkonadiServer::dumpMetrics()
+{
+    QSaveFile file(StandardDirs::saveDir("data") + QStringLiteral("/server_metrics.txt"));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qCWarning(AKONADISERVER_LOG) << "Failed to open metrics file" << file.fileName() << ":" << file.errorString();
+        return;
+    }
+    file.write(metrics().toUtf8());
+    if (!file.commit()) {
+        qCWarning(AKONADISERVER_LOG) << "Failed to write metrics file" << file.fileName() << ":" << file.errorString();
+    }
+}
+
 QString AkonadiServer::serverPath() const
 {
     return StandardDirs::saveDir("config");
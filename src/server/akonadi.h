@@ -24,6 +24,7 @@
 #include <QVector>
 
 class QProcess;
+class QThreadPool;
 
 namespace Akonadi
 {
@@ -36,6 +37,8 @@ class SearchTaskManager;
 class SearchManager;
 class StorageJanitor;
 class CacheCleaner;
+class CollectionTreeCache;
+class DataStorePool;
 class IntervalCheck;
 class AkLocalServer;
 class NotificationManager;
@@ -58,6 +61,21 @@ public:
      */
     IntervalCheck *intervalChecker();
 
+    /**
+     * Can return a nullptr
+     */
+    CollectionTreeCache *collectionTreeCache();
+
+    /**
+     * Can return a nullptr
+     */
+    DataStorePool *dataStorePool();
+
+    /**
+     * Worker threads for parallel item fetches, can return a nullptr
+     */
+    QThreadPool *itemFetchThreadPool();
+
     /**
      * Instance-aware server .config directory
      */
@@ -68,6 +86,11 @@ public:
      */
     NotificationManager *notificationManager();
 
+    /**
+     * Returns a text snapshot of the server performance metrics
+     */
+    QString metrics() const;
+
 public Q_SLOTS:
     /**
      * Triggers a clean server shutdown.
@@ -81,6 +104,7 @@ protected Q_SLOTS:
 
 private Q_SLOTS:
     void doQuit();
+    void dumpMetrics();
     void serviceOwnerChanged(const QString &name, const QString &oldOwner, const QString &newOwner);
     void connectionDisconnected();
 
@@ -98,6 +122,9 @@ protected:
 
     NotificationManager *mNotificationManager = nullptr;
     CacheCleaner *mCacheCleaner = nullptr;
+    CollectionTreeCache *mCollectionTreeCache = nullptr;
+    DataStorePool *mDataStorePool = nullptr;
+    QThreadPool *mItemFetchThreadPool = nullptr;
     IntervalCheck *mIntervalCheck = nullptr;
     StorageJanitor *mStorageJanitor = nullptr;
     ItemRetrievalManager *mItemRetrieval = nullptr;
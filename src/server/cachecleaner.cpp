@@ -19,19 +19,27 @@
 */
 
 #include "cachecleaner.h"
-#include "storage/parthelper.h"
 #include "storage/datastore.h"
 #include "storage/selectquerybuilder.h"
+#include "storage/queryhelper.h"
+#include "storage/transaction.h"
 #include "storage/entity.h"
 #include "akonadi.h"
 #include "akonadiserver_debug.h"
 
 #include <private/protocol_p.h>
+#include <private/externalpartstorage_p.h>
 
 #include <QDateTime>
+#include <QSqlQuery>
+#include <QTimer>
 
+using namespace Akonadi;
 using namespace Akonadi::Server;
 
+// Number of expired part files removed per event loop iteration
+static const int FileRemovalBatchSize = 500;
+
 QMutex CacheCleanerInhibitor::sLock;
 int CacheCleanerInhibitor::sInhibitCount = 0;
 
@@ -116,10 +124,33 @@ bool CacheCleaner::shouldScheduleCollection(const Collection &collection)
            && collection.resourceId() > 0;
 }
 
-void CacheCleaner::collectionExpired(const Collection &collection)
+void CacheCleaner::init()
+{
+    CollectionScheduler::init();
+
+    mFileRemovalTimer = new QTimer();
+    mFileRemovalTimer->setInterval(0);
+    connect(mFileRemovalTimer, &QTimer::timeout,
+            this, &CacheCleaner::removeExpiredFiles);
+}
+
+void CacheCleaner::quit()
 {
-    SelectQueryBuilder<Part> qb;
-    qb.addJoin(QueryBuilder::InnerJoin, PimItem::tableName(), Part::pimItemIdColumn(), PimItem::idFullColumnName());
+    // The parts have already been truncated, don't leave the files behind
+    for (const QString &file : qAsConst(mExpiredFiles)) {
+        ExternalPartStorage::self()->removePartFile(file);
+    }
+    mExpiredFiles.clear();
+
+    delete mFileRemovalTimer;
+    mFileRemovalTimer = nullptr;
+
+    CollectionScheduler::quit();
+}
+
+static void prepareExpiredPartsQuery(const Collection &collection, QueryBuilder &qb)
+{
+    qb.addJoin(QueryBuilder::InnerJoin, PimItem::tableName(), Part::pimItemIdFullColumnName(), PimItem::idFullColumnName());
     qb.addJoin(QueryBuilder::InnerJoin, PartType::tableName(), Part::partTypeIdFullColumnName(), PartType::idFullColumnName());
     qb.addValueCondition(PimItem::collectionIdFullColumnName(), Query::Equals, collection.id());
     qb.addValueCondition(PimItem::atimeFullColumnName(), Query::Less, QDateTime::currentDateTimeUtc().addSecs(-60 * collection.cachePolicyCacheTimeout()));
@@ -134,20 +165,90 @@ void CacheCleaner::collectionExpired(const Collection &collection)
         }
         qb.addValueCondition(PartType::nameFullColumnName(), Query::NotEquals, partName);
     }
-    if (qb.exec()) {
-        const Part::List parts = qb.result();
-        if (!parts.isEmpty()) {
-            qCInfo(AKONADISERVER_LOG) << "CacheCleaner found" << parts.count() << "item parts to expire in collection" << collection.name();
-            // clear data field
-            for (Part part : parts) {
-                try {
-                    if (!PartHelper::truncate(part)) {
-                        qCWarning(AKONADISERVER_LOG) << "CacheCleaner failed to expire item part" << part.id();
-                    }
-                } catch (const PartHelperException &e) {
-                    qCCritical(AKONADISERVER_LOG) << e.type() << e.what();
-                }
-            }
+}
+
+int CacheCleaner::expireParts(const Collection &collection, QStringList &externalFiles)
+{
+    Transaction transaction(DataStore::self(), QStringLiteral("CACHE CLEANER"));
+
+    // Only fetch ids and storage type, the payload itself is of no interest
+    QueryBuilder qb(Part::tableName());
+    qb.addColumn(Part::idFullColumnName());
+    qb.addColumn(Part::storageFullColumnName());
+    prepareExpiredPartsQuery(collection, qb);
+    if (!qb.exec()) {
+        return -1;
+    }
+
+    QVector<ImapSet::Id> partIds;
+    QVector<ImapSet::Id> externalIds;
+    QSqlQuery query = qb.query();
+    while (query.next()) {
+        const qint64 id = query.value(0).toLongLong();
+        partIds.push_back(id);
+        if (query.value(1).toInt() == Part::External) {
+            externalIds.push_back(id);
+        }
+    }
+    query.finish();
+    if (partIds.isEmpty()) {
+        return 0;
+    }
+
+    QStringList files;
+    if (!externalIds.isEmpty()) {
+        QueryBuilder fileQb(Part::tableName());
+        fileQb.addColumn(Part::dataFullColumnName());
+        QueryHelper::setToQuery(ImapSet(externalIds), Part::idFullColumnName(), fileQb);
+        if (!fileQb.exec()) {
+            return -1;
+        }
+        files.reserve(externalIds.size());
+        QSqlQuery fileQuery = fileQb.query();
+        while (fileQuery.next()) {
+            files.push_back(ExternalPartStorage::resolveAbsolutePath(fileQuery.value(0).toByteArray()));
         }
+        fileQuery.finish();
+    }
+
+    QueryBuilder updateQb(Part::tableName(), QueryBuilder::Update);
+    updateQb.setColumnValue(Part::dataColumn(), QByteArray());
+    updateQb.setColumnValue(Part::datasizeColumn(), 0);
+    updateQb.setColumnValue(Part::storageColumn(), static_cast<int>(Part::Internal));
+    QueryHelper::setToQuery(ImapSet(partIds), Part::idFullColumnName(), updateQb);
+    if (!updateQb.exec() || !transaction.commit()) {
+        return -1;
+    }
+
+    externalFiles += files;
+    return partIds.size();
+}
+
+void CacheCleaner::collectionExpired(const Collection &collection)
+{
+    const int expired = expireParts(collection, mExpiredFiles);
+    if (expired < 0) {
+        qCWarning(AKONADISERVER_LOG) << "CacheCleaner failed to expire item parts in collection" << collection.name();
+    } else if (expired > 0) {
+        qCInfo(AKONADISERVER_LOG) << "CacheCleaner expired" << expired << "item parts in collection" << collection.name();
+    }
+
+    if (!mExpiredFiles.isEmpty() && !mFileRemovalTimer->isActive()) {
+        mFileRemovalTimer->start();
+    }
+}
+
+// Removes the files of expired external parts in small batches, so that
+// unlinking thousands of files does not block the scheduler for too long.
+void CacheCleaner::removeExpiredFiles()
+{
+    const int count = qMin(FileRemovalBatchSize, mExpiredFiles.size());
+    for (int i = 0; i < count; ++i) {
+        ExternalPartStorage::self()->removePartFile(mExpiredFiles.at(i));
+    }
+    mExpiredFiles.erase(mExpiredFiles.begin(), mExpiredFiles.begin() + count);
+
+    if (mExpiredFiles.isEmpty()) {
+        mFileRemovalTimer->stop();
     }
 }
@@ -23,6 +23,9 @@
 #include "collectionscheduler.h"
 
 #include <QMutex>
+#include <QStringList>
+
+class QTimer;
 
 namespace Akonadi
 {
@@ -72,15 +75,35 @@ public:
     explicit CacheCleaner(QObject *parent = nullptr);
     ~CacheCleaner() override;
 
+    /**
+     * Truncates all expired payload parts of @p collection within a single
+     * transaction, using a few set-based statements instead of updating each
+     * part on its own.
+     *
+     * Absolute paths of the external part files which are no longer referenced
+     * are appended to @p externalFiles, removing them is up to the caller.
+     *
+     * @return number of expired parts, or -1 on error
+     */
+    static int expireParts(const Collection &collection, QStringList &externalFiles);
+
 protected:
+    void init() override;
+    void quit() override;
+
     void collectionExpired(const Collection &collection) override;
     int collectionScheduleInterval(const Collection &collection) override;
     bool hasChanged(const Collection &collection, const Collection &changed) override;
     bool shouldScheduleCollection(const Collection &collection) override;
 
+private Q_SLOTS:
+    void removeExpiredFiles();
+
 private:
     friend class CacheCleanerInhibitor;
 
+    QStringList mExpiredFiles;
+    QTimer *mFileRemovalTimer = nullptr;
 };
 
 } // namespace Server
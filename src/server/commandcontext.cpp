@@ -19,6 +19,7 @@
 
 #include "commandcontext.h"
 #include "storage/selectquerybuilder.h"
+#include "storage/tagcache.h"
 
 #include <private/protocol_p.h>
 
@@ -99,7 +100,7 @@ Tag CommandContext::tag() const
         return Tag();
     }
 
-    return Tag::retrieveById(mTagId);
+    return TagCache::self()->tag(mTagId).tag;
 }
 
 bool CommandContext::isEmpty() const
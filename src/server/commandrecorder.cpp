@@ -0,0 +1,134 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "commandrecorder.h"
+#include "akonadiserver_debug.h"
+
+#include <private/commandtrace_p.h>
+#include <private/standarddirs_p.h>
+
+#include <QDateTime>
+#include <QDir>
+#include <QRegularExpression>
+#include <QSettings>
+
+#include <algorithm>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+namespace
+{
+
+struct RecordingConfig {
+    QVector<QRegularExpression> sessions;
+    QString directory;
+};
+
+const RecordingConfig &recordingConfig()
+{
+    static const RecordingConfig sConfig = []() {
+        RecordingConfig config;
+        QSettings settings(StandardDirs::serverConfigFile(), QSettings::IniFormat);
+        settings.beginGroup(QStringLiteral("Recording"));
+        const QStringList patterns = settings.value(QStringLiteral("Sessions")).toStringList();
+        for (const QString &pattern : patterns) {
+            QRegularExpression re(QRegularExpression::anchoredPattern(pattern));
+            if (re.isValid()) {
+                config.sessions.push_back(re);
+            } else {
+                qCWarning(AKONADISERVER_LOG) << "Ignoring invalid session pattern for recording:" << pattern;
+            }
+        }
+        if (!config.sessions.isEmpty()) {
+            config.directory = settings.value(QStringLiteral("Directory"),
+                                              StandardDirs::saveDir("data", QStringLiteral("traces"))).toString();
+        }
+        return config;
+    }();
+    return sConfig;
+}
+
+}
+
+std::unique_ptr<CommandRecorder> CommandRecorder::create(const QByteArray &sessionId)
+{
+    const RecordingConfig &config = recordingConfig();
+    if (config.sessions.isEmpty()) {
+        return {};
+    }
+
+    const QString session = QString::fromUtf8(sessionId);
+    const bool selected = std::any_of(config.sessions.cbegin(), config.sessions.cend(),
+                                      [&session](const QRegularExpression &re) {
+                                          return re.match(session).hasMatch();
+                                      });
+    if (!selected) {
+        return {};
+    }
+
+    QString name = session;
+    name.replace(QRegularExpression(QStringLiteral("[^A-Za-z0-9_.-]")), QStringLiteral("_"));
+    const QString fileName = QStringLiteral("%1/%2-%3.trace")
+                             .arg(config.directory, name,
+                                  QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmsszzz")));
+
+    std::unique_ptr<CommandRecorder> recorder(new CommandRecorder(fileName));
+    if (!QDir().mkpath(config.directory) || !recorder->mFile.open(QIODevice::WriteOnly)) {
+        qCWarning(AKONADISERVER_LOG) << "Failed to create trace file" << fileName << ":" << recorder->mFile.errorString();
+        return {};
+    }
+    try {
+        Protocol::CommandTrace::writeHeader(&recorder->mFile, sessionId);
+    } catch (const ProtocolException &e) {
+        qCWarning(AKONADISERVER_LOG) << "Failed to write trace file" << fileName << ":" << e.what();
+        return {};
+    }
+
+    qCInfo(AKONADISERVER_LOG) << "Recording commands of session" << session << "to" << fileName;
+    return recorder;
+}
+
+CommandRecorder::CommandRecorder(const QString &fileName)
+    : mFile(fileName)
+{
+    mTimer.start();
+}
+
+CommandRecorder::~CommandRecorder()
+{
+    mFile.close();
+}
+
+void CommandRecorder::record(qint64 tag, const Protocol::CommandPtr &command, qint64 age)
+{
+    if (!mFile.isOpen()) {
+        return;
+    }
+
+    try {
+        Protocol::CommandTrace::writeEntry(&mFile, std::max<qint64>(0, mTimer.elapsed() - age), tag, command);
+        // Keep the trace usable when the server does not terminate cleanly
+        mFile.flush();
+    } catch (const ProtocolException &e) {
+        qCWarning(AKONADISERVER_LOG) << "Failed to write trace file" << mFile.fileName() << ":" << e.what()
+                                     << ", recording stopped";
+        mFile.close();
+    }
+}
@@ -0,0 +1,68 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef AKONADI_SERVER_COMMANDRECORDER_H
+#define AKONADI_SERVER_COMMANDRECORDER_H
+
+#include <private/protocol_p.h>
+
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <memory>
+
+namespace Akonadi
+{
+namespace Server
+{
+
+/**
+ * Records the commands of one client session into a trace file, which
+ * asapreplay can replay against another server as a benchmark.
+ *
+ * Sessions are selected in the [Recording] section of akonadiserverrc:
+ * Sessions holds a list of regular expressions matched against the
+ * session id, Directory the target directory (defaults to the "traces"
+ * subdirectory of the server data directory).
+ */
+class CommandRecorder
+{
+public:
+    /**
+     * Returns a recorder if recording of @p sessionId is enabled in the
+     * server configuration, a nullptr otherwise.
+     */
+    static std::unique_ptr<CommandRecorder> create(const QByteArray &sessionId);
+
+    ~CommandRecorder();
+
+    /// Appends @p command, received @p age milliseconds ago, to the trace
+    void record(qint64 tag, const Protocol::CommandPtr &command, qint64 age = 0);
+
+private:
+    explicit CommandRecorder(const QString &fileName);
+
+    QFile mFile;
+    QElapsedTimer mTimer;
+};
+
+} // namespace Server
+} // namespace Akonadi
+
+#endif
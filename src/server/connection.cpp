@@ -22,12 +22,17 @@
 
 
 #include <QSettings>
+#include <QElapsedTimer>
 #include <QEventLoop>
 #include <QThreadStorage>
 
+#include "akonadi.h"
+#include "commandrecorder.h"
 #include "storage/datastore.h"
+#include "storage/datastorepool.h"
 #include "storage/dbdeadlockcatcher.h"
 #include "handler.h"
+#include "metrics.h"
 #include "notificationmanager.h"
 
 #include "tracer.h"
@@ -54,8 +59,13 @@ static QString connectionIdentifier(Connection *c) {
     return id;
 }
 
+static DataStorePool *dataStorePool()
+{
+    return AkonadiServer::instance()->dataStorePool();
+}
+
 Connection::Connection(QObject *parent)
-    : AkThread(connectionIdentifier(this), QThread::InheritPriority, parent)
+    : AkThread(connectionIdentifier(this), AkThread::NoThread, QThread::InheritPriority, parent)
 {
 }
 
@@ -91,6 +101,9 @@ void Connection::init()
     connect(m_idleTimer, &QTimer::timeout,
             this, &Connection::slotConnectionIdle);
 
+    if (!acquireStorage()) {
+        return;
+    }
     storageBackend()->notificationCollector()->setConnection(this);
 
     if (socket->state() == QLocalSocket::ConnectedState) {
@@ -106,6 +119,8 @@ void Connection::init()
         qCWarning(AKONADISERVER_LOG) << "Protocol Exception sending \"hello\" on connection" << m_identifier << ":" << e.what();
         m_socket->disconnectFromServer();
     }
+
+    setStorageIdle();
 }
 
 void Connection::quit()
@@ -117,6 +132,7 @@ void Connection::quit()
     }
 
     Tracer::self()->endConnection(m_identifier, QString());
+    m_recorder.reset();
 
     delete m_socket;
     m_socket = nullptr;
@@ -126,6 +142,10 @@ void Connection::quit()
     }
     delete m_idleTimer;
 
+    if (DataStorePool *pool = dataStorePool()) {
+        pool->release(this);
+    }
+
     AkThread::quit();
 }
 
@@ -172,6 +192,77 @@ void Connection::slotConnectionIdle()
         }
         m_backend->close();
     }
+
+    if (DataStorePool *pool = dataStorePool()) {
+        pool->release(this);
+    }
+}
+
+bool Connection::acquireStorage()
+{
+    DataStorePool *pool = dataStorePool();
+    if (!pool) {
+        return true;
+    }
+
+    const auto evict = [this]() {
+        // The pool wants our database connection back. This is invoked from
+        // the event loop, so make sure we are not in the middle of a command.
+        if (!m_currentHandler) {
+            slotConnectionIdle();
+        }
+    };
+    const quint64 request = ++m_storageRequest;
+    const auto granted = [this, request](bool granted) {
+        if (request != m_storageRequest || !m_storageWaiting) {
+            return;
+        }
+        m_storageWaiting = false;
+        m_storageOvercommitted = !granted;
+        if (m_storageWaitLoop) {
+            m_storageWaitLoop->quit();
+        }
+    };
+    if (pool->acquire(this, evict, granted)) {
+        return true;
+    }
+    m_storageWaiting = true;
+
+    // Keep our event loop running while waiting, the pool may need to deliver
+    // evictions or the wait timeout to this thread
+    QEventLoop loop;
+    m_storageWaitLoop = &loop;
+    connect(this, &Connection::connectionClosing, &loop, &QEventLoop::quit);
+    if (m_socket) {
+        connect(m_socket, &QLocalSocket::disconnected, &loop, &QEventLoop::quit);
+    }
+    loop.exec();
+    m_storageWaitLoop = nullptr;
+
+    if (m_storageWaiting) {
+        // Closing, cancel the request (or return a lease granted in the meantime)
+        m_storageWaiting = false;
+        pool->release(this);
+        return false;
+    }
+    return true;
+}
+
+void Connection::setStorageIdle()
+{
+    DataStorePool *pool = dataStorePool();
+    if (!pool || (m_backend && m_backend->inTransaction())) {
+        return;
+    }
+
+    if (m_storageOvercommitted) {
+        // Granted over the capacity, so give the database connection back
+        // right away instead of waiting to be evicted
+        m_storageOvercommitted = false;
+        slotConnectionIdle();
+    } else {
+        pool->setIdle(this);
+    }
 }
 
 void Connection::slotSocketDisconnected()
@@ -221,6 +312,9 @@ void Connection::handleIncomingData()
         }
 
         m_idleTimer->stop();
+        if (!acquireStorage()) {
+            break;
+        }
 
         // will only open() a previously idle backend.
         // Otherwise, a new backend could lazily be constructed by later calls.
@@ -256,6 +350,10 @@ void Connection::handleIncomingData()
                 return;
             }
 
+            if (m_recorder) {
+                m_recorder->record(tag, cmd);
+            }
+
             // Tag context and collection context is not persistent.
             context()->setTag(-1);
             context()->setCollection(Collection());
@@ -273,12 +371,17 @@ void Connection::handleIncomingData()
             if (m_reportTime) {
                 startTime();
             }
+            QElapsedTimer commandTimer;
+            commandTimer.start();
 
             m_currentHandler->setConnection(this);
             m_currentHandler->setTag(tag);
             m_currentHandler->setCommand(cmd);
             try {
-                DbDeadlockCatcher catcher([this, &cmd]() { parseStream(cmd); });
+                // Repeating the command would send the client some responses twice
+                const quint64 responsesSent = m_responsesSent;
+                DbDeadlockCatcher catcher([this, &cmd]() { parseStream(cmd); },
+                                          [this, responsesSent]() { return m_responsesSent == responsesSent; });
             } catch (const Akonadi::Server::HandlerException &e) {
                 if (m_currentHandler) {
                     try {
@@ -327,6 +430,7 @@ void Connection::handleIncomingData()
                     }
                 }
             }
+            Metrics::self()->recordCommand(cmd->type(), commandTimer.nsecsElapsed() / 1000);
             if (m_reportTime) {
                 stopTime(currentCommand);
             }
@@ -345,6 +449,10 @@ void Connection::handleIncomingData()
         // reset, arm the timer
         m_idleTimer->start(IDLE_TIMER_TIMEOUT);
 
+        // Let the pool evict our database connection if needed, unless a
+        // transaction spans multiple commands
+        setStorageIdle();
+
         if (m_connectionClosing) {
             break;
         }
@@ -421,6 +529,12 @@ void Connection::setSessionId(const QByteArray &id)
     // this races with the use of objectName() in QThreadPrivate::start
     //thread()->setObjectName(objectName() + QStringLiteral("-Thread"));
     storageBackend()->setSessionId(id);
+
+    // Called while handling the login command, which was not recorded yet
+    m_recorder = CommandRecorder::create(id);
+    if (m_recorder) {
+        m_recorder->record(currentTag(), Protocol::LoginCommandPtr::create(id));
+    }
 }
 
 QByteArray Connection::sessionId() const
@@ -485,6 +599,9 @@ void Connection::sendResponse(qint64 tag, const Protocol::CommandPtr &response)
     if (Tracer::self()->currentTracer() != QLatin1String("null")) {
         Tracer::self()->connectionOutput(m_identifier, tag, response);
     }
+    if (response->isResponse()) {
+        ++m_responsesSent;
+    }
     Protocol::DataStream stream(m_socket);
     stream << tag;
     Protocol::serialize(m_socket, response);
@@ -510,5 +627,9 @@ Protocol::CommandPtr Connection::readCommand()
     stream >> tag;
 
     // TODO: compare tag with m_currentHandler->tag() ?
-    return Protocol::deserialize(m_socket);
+    auto cmd = Protocol::deserialize(m_socket);
+    if (m_recorder) {
+        m_recorder->record(tag, cmd);
+    }
+    return cmd;
 }
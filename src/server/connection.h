@@ -36,11 +36,14 @@
 
 #include <memory>
 
+class QEventLoop;
+
 namespace Akonadi
 {
 namespace Server
 {
 
+class CommandRecorder;
 class Handler;
 class Response;
 class DataStore;
@@ -94,7 +97,7 @@ protected Q_SLOTS:
     void slotSendHello();
 
 protected:
-    Connection(QObject *parent = nullptr); // used for testing
+    Connection(QObject *parent = nullptr); // used for testing, lives in the calling thread
 
     void init() override;
     void quit() override;
@@ -122,9 +125,21 @@ protected:
     QHash<QString, qint64> m_executionsByHandler;
 
     bool m_connectionClosing = false;
+    /// Number of responses (not commands) sent to the client, see DbDeadlockCatcher
+    quint64 m_responsesSent = 0;
+    std::unique_ptr<CommandRecorder> m_recorder;
+    /// Quit while waiting for a database connection from the DataStorePool
+    QEventLoop *m_storageWaitLoop = nullptr;
+    /// Identifies the current request for a database connection, late grants of earlier ones are ignored
+    quint64 m_storageRequest = 0;
+    bool m_storageWaiting = false;
+    /// The database connection was granted over the capacity of the DataStorePool
+    bool m_storageOvercommitted = false;
 
 private:
     void parseStream(const Protocol::CommandPtr &cmd);
+    bool acquireStorage();
+    void setStorageIdle();
     template<typename T>
     inline typename std::enable_if<std::is_base_of<Protocol::Command, T>::value>::type
     sendResponse(qint64 tag, T &&response);
@@ -151,6 +166,9 @@ Connection::sendResponse(qint64 tag, T &&response)
     if (Tracer::self()->currentTracer() != QLatin1String("null")) {
         Tracer::self()->connectionOutput(m_identifier, tag, response);
     }
+    if (response.isResponse()) {
+        ++m_responsesSent;
+    }
     Protocol::DataStream stream(m_socket);
     stream << tag;
     stream << std::move(response);
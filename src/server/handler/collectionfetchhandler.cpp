@@ -21,14 +21,18 @@
 #include "akonadiserver_debug.h"
 
 
+#include "akonadi.h"
 #include "connection.h"
 #include "handlerhelper.h"
 #include "storage/datastore.h"
 #include "storage/selectquerybuilder.h"
 #include "storage/collectionqueryhelper.h"
+#include "storage/queryhelper.h"
 
 #include <private/scope_p.h>
 
+#include <algorithm>
+
 using namespace Akonadi;
 using namespace Akonadi::Server;
 
@@ -181,9 +185,9 @@ static QSqlQuery getAttributeQuery(const QVariantList &ids, const QSet<QByteArra
 
 void CollectionFetchHandler::retrieveAttributes(const QVariantList &collectionIds)
 {
-    //We are querying for the attributes in batches because something can't handle WHERE IN queries with sets larger than 999
+    //We are querying for the attributes in batches because the backends can't handle arbitrarily large WHERE IN queries
     int start = 0;
-    const int size = 999;
+    const int size = QueryHelper::maxInConditionSize();
     while (start < collectionIds.size()) {
         const QVariantList ids = collectionIds.mid(start, size);
         QSqlQuery attributeQuery = getAttributeQuery(ids, mAncestorAttributes);
@@ -217,8 +221,119 @@ static QSqlQuery getMimeTypeQuery(const QVariantList &ids)
     return qb.query();
 }
 
+static bool filterMatches(Collection::Tristate pref, bool enabled)
+{
+    // In-memory counterpart of filterCondition()
+    return pref == Collection::True || (pref == Collection::Undefined && enabled);
+}
+
+bool CollectionFetchHandler::checkListFilter(const CollectionTreeCache::CachedCollection &cached) const
+{
+    // Mirrors the conditions of the SQL query in retrieveCollections()
+    const Collection &col = cached.collection;
+    if (mCollectionsToSynchronize) {
+        if (!filterMatches(col.syncPref(), col.enabled())) {
+            return false;
+        }
+    } else if (mCollectionsToDisplay) {
+        if (!filterMatches(col.displayPref(), col.enabled())) {
+            return false;
+        }
+    } else if (mCollectionsToIndex) {
+        if (!filterMatches(col.indexPref(), col.enabled())) {
+            return false;
+        }
+    } else if (mEnabledCollections && !col.enabled()) {
+        return false;
+    }
+    if (mResource.isValid() && col.resourceId() != mResource.id()) {
+        return false;
+    }
+    if (!mMimeTypes.isEmpty()) {
+        return std::any_of(cached.mimeTypes.cbegin(), cached.mimeTypes.cend(),
+                           [this](MimeType::Id id) { return mMimeTypes.contains(id); });
+    }
+    return true;
+}
+
+bool CollectionFetchHandler::retrieveCollectionsFromCache(const Collection &topParent, int depth)
+{
+    auto cache = AkonadiServer::instance()->collectionTreeCache();
+    // The cache only reflects committed changes, don't use it when we are
+    // inside a transaction that might have modified the collection tree.
+    if (!cache || !cache->isPopulated() || storageBackend()->inTransaction()) {
+        return false;
+    }
+
+    const qint64 parentId = topParent.isValid() ? topParent.id() : 0;
+    QVector<CollectionTreeCache::CachedCollection> subtree;
+    QVector<CollectionTreeCache::CachedCollection> ancestors;
+    if (!cache->retrieveSubtree(parentId, depth, mAncestorDepth, subtree, ancestors)) {
+        return false;
+    }
+
+    QHash<qint64, const CollectionTreeCache::CachedCollection *> cachedCollections;
+    cachedCollections.reserve(subtree.size() + ancestors.size());
+    for (const auto &cached : qAsConst(subtree)) {
+        cachedCollections.insert(cached.collection.id(), &cached);
+        //Base listings should succeed always
+        if (depth == 0 || (cached.collection.id() != parentId && checkListFilter(cached))) {
+            mCollections.insert(cached.collection.id(), cached.collection);
+        }
+    }
+
+    //Complete the tree with the parents that did not match the filter
+    if (depth > 0) {
+        const auto listed = mCollections.keys();
+        for (qint64 id : listed) {
+            qint64 parent = mCollections.value(id).parentId();
+            while (parent != parentId && !mCollections.contains(parent)) {
+                const auto cached = cachedCollections.value(parent);
+                if (!cached) {
+                    break;
+                }
+                mCollections.insert(parent, cached->collection);
+                parent = cached->collection.parentId();
+            }
+        }
+    }
+
+    if (mAncestorDepth > 0 && topParent.isValid()) {
+        //unless depth is 0 the base collection is not part of the listing
+        mAncestors.insert(topParent.id(), topParent);
+        for (const auto &cached : qAsConst(ancestors)) {
+            mAncestors.insert(cached.collection.id(), cached.collection);
+            cachedCollections.insert(cached.collection.id(), &cached);
+        }
+    }
+
+    if (!mAncestorAttributes.isEmpty()) {
+        for (auto it = cachedCollections.cbegin(), end = cachedCollections.cend(); it != end; ++it) {
+            for (const auto &attr : (*it)->attributes) {
+                mCollectionAttributes.insert(it.key(), attr);
+            }
+        }
+    }
+
+    for (auto it = mCollections.cbegin(), end = mCollections.cend(); it != end; ++it) {
+        const auto cached = cachedCollections.value(it.key());
+        QStringList mimeTypes;
+        mimeTypes.reserve(cached->mimeTypes.size());
+        for (MimeType::Id mtId : cached->mimeTypes) {
+            mimeTypes << MimeType::retrieveById(mtId).name();
+        }
+        listCollection(*it, ancestorsForCollection(*it), mimeTypes, cached->attributes);
+    }
+
+    return true;
+}
+
 void CollectionFetchHandler::retrieveCollections(const Collection &topParent, int depth)
 {
+    if (retrieveCollectionsFromCache(topParent, depth)) {
+        return;
+    }
+
     /*
      * Retrieval of collections:
      * The aim is to reduce the amount of queries as much as possible, as this has the largest performance impact for large queries.
@@ -398,8 +513,8 @@ void CollectionFetchHandler::retrieveCollections(const Collection &topParent, in
         retrieveAttributes(ancestorIds);
     }
 
-    //We are querying in batches because something can't handle WHERE IN queries with sets larger than 999
-    const int querySizeLimit = 999;
+    //We are querying in batches because the backends can't handle arbitrarily large WHERE IN queries
+    const int querySizeLimit = QueryHelper::maxInConditionSize();
     int mimetypeQueryStart = 0;
     int attributeQueryStart = 0;
     QSqlQuery mimeTypeQuery(storageBackend()->database());
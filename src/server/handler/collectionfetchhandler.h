@@ -22,6 +22,7 @@
 
 #include "entities.h"
 #include "handler.h"
+#include "storage/collectiontreecache.h"
 
 template <typename T> class QStack;
 
@@ -75,6 +76,8 @@ private:
                         const CollectionAttribute::List &attributes);
     QStack<Collection> ancestorsForCollection(const Collection &col);
     void retrieveCollections(const Collection &topParent, int depth);
+    bool retrieveCollectionsFromCache(const Collection &topParent, int depth);
+    bool checkListFilter(const CollectionTreeCache::CachedCollection &cached) const;
     bool checkFilterCondition(const Collection &col) const;
     bool checkChildrenForMimeTypes(const QHash<qint64, Collection> &collectionsMap,
                                    const QHash<qint64, qint64> &parentMap,
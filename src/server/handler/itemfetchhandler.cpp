@@ -42,9 +42,12 @@ bool ItemFetchHandler::parseStream()
     CacheCleanerInhibitor inhibitor;
 
     ItemFetchHelper fetchHelper(connection(), cmd.scope(), cmd.itemFetchScope(), cmd.tagFetchScope());
+    fetchHelper.setItemFetchLimit(cmd.itemFetchLimit());
     if (!fetchHelper.fetchItems()) {
         return failureResponse(QStringLiteral("Failed to fetch items"));
     }
 
-    return successResponse<Protocol::FetchItemsResponse>();
+    Protocol::FetchItemsResponse response;
+    response.setNextPage(fetchHelper.nextPage());
+    return successResponse(std::move(response));
 }
@@ -30,6 +30,7 @@
 #include "storage/itemretrievalrequest.h"
 #include "storage/parthelper.h"
 #include "storage/parttypehelper.h"
+#include "storage/queryhelper.h"
 #include "storage/transaction.h"
 #include "shared/akranges.h"
 
@@ -48,8 +49,18 @@
 #include <QVariant>
 #include <QDateTime>
 #include <QSqlQuery>
+#include <QSet>
 
 #include <QElapsedTimer>
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
 
 using namespace Akonadi;
 using namespace Akonadi::Server;
@@ -70,6 +81,9 @@ using namespace Akonadi::Server;
 #define PROF_INC(name)
 #endif
 
+/// Number of items fetched and sent at once, see fetchWindow()
+static const int FetchWindowSize = 1000;
+
 ItemFetchHelper::ItemFetchHelper(Connection *connection, const Scope &scope,
                                  const Protocol::ItemFetchScope &itemFetchScope,
                                  const Protocol::TagFetchScope &tagFetchScope)
@@ -96,6 +110,28 @@ void ItemFetchHelper::disableATimeUpdates()
     mUpdateATimeEnabled = false;
 }
 
+void ItemFetchHelper::setItemFetchLimit(const Protocol::ItemFetchLimit &itemFetchLimit)
+{
+    mItemFetchLimit = itemFetchLimit;
+    // The page continues right after the last item of the previous one
+    mWindowLastId = itemFetchLimit.continuationId();
+    mWindowLastMTime = itemFetchLimit.continuationMTime();
+}
+
+Protocol::ItemFetchLimit ItemFetchHelper::nextPage() const
+{
+    Protocol::ItemFetchLimit next;
+    // Only a page that was filled up to the limit can be followed by another one
+    if (mItemFetchLimit.limit() <= 0 || mFetchedCount < mItemFetchLimit.limit()) {
+        return next;
+    }
+    next.setLimit(mItemFetchLimit.limit());
+    next.setSortKey(mItemFetchLimit.sortKey());
+    next.setContinuationId(mWindowLastId);
+    next.setContinuationMTime(mWindowLastMTime);
+    return next;
+}
+
 enum PartQueryColumns {
     PartQueryPimIdColumn,
     PartQueryTypeIdColumn,
@@ -141,7 +177,7 @@ QSqlQuery ItemFetchHelper::buildPartQuery(const QVector<QByteArray> &partList, b
             partQuery.addCondition(cond);
         }
 
-        ItemQueryHelper::scopeToQuery(mScope, mContext, partQuery);
+        windowScopeToQuery(partQuery);
 
         if (!partQuery.exec()) {
             throw HandlerException("Unable to list item parts");
@@ -181,7 +217,7 @@ QSqlQuery ItemFetchHelper::buildItemQuery()
 
     itemQuery.addSortColumn(PimItem::idFullColumnName(), Query::Descending);
 
-    ItemQueryHelper::scopeToQuery(mScope, mContext, itemQuery);
+    windowScopeToQuery(itemQuery);
 
     if (mItemFetchScope.changedSince().isValid()) {
         itemQuery.addValueCondition(PimItem::datetimeFullColumnName(), Query::GreaterOrEqual, mItemFetchScope.changedSince().toUTC());
@@ -196,6 +232,88 @@ QSqlQuery ItemFetchHelper::buildItemQuery()
     return itemQuery.query();
 }
 
+bool ItemFetchHelper::nextWindow()
+{
+    if (mLastWindow) {
+        return false;
+    }
+
+    const bool sortByMTime = (mItemFetchLimit.sortKey() == Protocol::ItemFetchLimit::ModificationTime);
+    // Windows sorted by mtime are not contiguous ID ranges and have to be
+    // passed to the queries as a list of IDs
+    int windowSize = sortByMTime ? std::min(QueryHelper::maxInConditionSize(), FetchWindowSize) : FetchWindowSize;
+    if (mItemFetchLimit.limit() > 0) {
+        windowSize = qMin(windowSize, mItemFetchLimit.limit() - mFetchedCount);
+        if (windowSize <= 0) {
+            mLastWindow = true;
+            return false;
+        }
+    }
+
+    // Find the IDs of the next window of items (continuing after the last item
+    // of the previous window). All the queries for the window are then limited
+    // to these items.
+    QueryBuilder windowQuery(PimItem::tableName());
+    windowQuery.addColumn(PimItem::idFullColumnName());
+    windowQuery.addColumn(PimItem::datetimeFullColumnName());
+    ItemQueryHelper::scopeToQuery(mScope, mContext, windowQuery);
+    if (mItemFetchScope.changedSince().isValid()) {
+        windowQuery.addValueCondition(PimItem::datetimeFullColumnName(), Query::GreaterOrEqual, mItemFetchScope.changedSince().toUTC());
+    }
+    if (sortByMTime) {
+        if (mWindowLastMTime.isValid()) {
+            Query::Condition sameMTime;
+            sameMTime.addValueCondition(PimItem::datetimeFullColumnName(), Query::Equals, mWindowLastMTime.toUTC());
+            sameMTime.addValueCondition(PimItem::idFullColumnName(), Query::Less, mWindowLastId);
+            Query::Condition after(Query::Or);
+            after.addValueCondition(PimItem::datetimeFullColumnName(), Query::Less, mWindowLastMTime.toUTC());
+            after.addCondition(sameMTime);
+            windowQuery.addCondition(after);
+        }
+        windowQuery.addSortColumn(PimItem::datetimeFullColumnName(), Query::Descending);
+    } else if (mWindowLastId >= 0) {
+        windowQuery.addValueCondition(PimItem::idFullColumnName(), Query::Less, mWindowLastId);
+    }
+    windowQuery.addSortColumn(PimItem::idFullColumnName(), Query::Descending);
+    windowQuery.setLimit(windowSize);
+
+    if (!windowQuery.exec()) {
+        throw HandlerException("Unable to list items");
+    }
+
+    QSqlQuery query = windowQuery.query();
+    mWindowIds.clear();
+    while (query.next()) {
+        mWindowIds.push_back(query.value(0).toLongLong());
+        mWindowLastMTime = Utils::variantToDateTime(query.value(1));
+    }
+    query.finish();
+
+    if (!mWindowIds.isEmpty()) {
+        mWindowLastId = mWindowIds.constLast();
+    }
+    mFetchedCount += mWindowIds.size();
+    mLastWindow = (mWindowIds.size() < windowSize);
+    return !mWindowIds.isEmpty();
+}
+
+void ItemFetchHelper::windowScopeToQuery(QueryBuilder &qb)
+{
+    ItemQueryHelper::scopeToQuery(mScope, mContext, qb);
+
+    if (mItemFetchLimit.sortKey() == Protocol::ItemFetchLimit::ModificationTime) {
+        QVariantList ids;
+        ids.reserve(mWindowIds.size());
+        for (const qint64 id : qAsConst(mWindowIds)) {
+            ids.push_back(id);
+        }
+        qb.addValueCondition(PimItem::idFullColumnName(), Query::In, ids);
+    } else {
+        qb.addValueCondition(PimItem::idFullColumnName(), Query::LessOrEqual, mWindowIds.constFirst());
+        qb.addValueCondition(PimItem::idFullColumnName(), Query::GreaterOrEqual, mWindowIds.constLast());
+    }
+}
+
 enum FlagQueryColumns {
     FlagQueryPimItemIdColumn,
     FlagQueryFlagIdColumn
@@ -209,7 +327,7 @@ QSqlQuery ItemFetchHelper::buildFlagQuery()
     flagQuery.addColumn(PimItem::idFullColumnName());
     flagQuery.addColumn(PimItemFlagRelation::rightFullColumnName());
 
-    ItemQueryHelper::scopeToQuery(mScope, mContext, flagQuery);
+    windowScopeToQuery(flagQuery);
     flagQuery.addSortColumn(PimItem::idFullColumnName(), Query::Descending);
 
     if (!flagQuery.exec()) {
@@ -236,7 +354,7 @@ QSqlQuery ItemFetchHelper::buildTagQuery()
     tagQuery.addColumn(PimItem::idFullColumnName());
     tagQuery.addColumn(Tag::idFullColumnName());
 
-    ItemQueryHelper::scopeToQuery(mScope, mContext, tagQuery);
+    windowScopeToQuery(tagQuery);
     tagQuery.addSortColumn(PimItem::idFullColumnName(), Query::Descending);
 
     if (!tagQuery.exec()) {
@@ -248,6 +366,217 @@ QSqlQuery ItemFetchHelper::buildTagQuery()
     return tagQuery.query();
 }
 
+enum TagResponseQueryColumns {
+    TagResponseQueryIdColumn,
+    TagResponseQueryGidColumn,
+    TagResponseQueryParentIdColumn,
+    TagResponseQueryTypeColumn,
+    TagResponseQueryRemoteIdColumn
+};
+
+enum TagAttributeQueryColumns {
+    TagAttributeQueryTagIdColumn,
+    TagAttributeQueryTypeColumn,
+    TagAttributeQueryValueColumn
+};
+
+void ItemFetchHelper::fetchTagResponses(QHash<qint64, Protocol::FetchTagsResponse> &cache)
+{
+    QueryBuilder tagQuery(PimItem::tableName());
+    tagQuery.setDistinct(true);
+    tagQuery.addJoin(QueryBuilder::InnerJoin, PimItemTagRelation::tableName(),
+                     PimItem::idFullColumnName(), PimItemTagRelation::leftFullColumnName());
+    tagQuery.addJoin(QueryBuilder::InnerJoin, Tag::tableName(),
+                     Tag::idFullColumnName(), PimItemTagRelation::rightFullColumnName());
+    tagQuery.addJoin(QueryBuilder::InnerJoin, TagType::tableName(),
+                     Tag::typeIdFullColumnName(), TagType::idFullColumnName());
+    tagQuery.addColumn(Tag::idFullColumnName());
+    tagQuery.addColumn(Tag::gidFullColumnName());
+    tagQuery.addColumn(Tag::parentIdFullColumnName());
+    tagQuery.addColumn(TagType::nameFullColumnName());
+
+    // Expose tag's remote ID only to resources
+    const bool fetchRemoteId = mTagFetchScope.fetchRemoteID() && mConnection
+                                && mConnection->context()->resource().isValid();
+    if (fetchRemoteId) {
+        tagQuery.addColumn(TagRemoteIdResourceRelation::remoteIdFullColumnName());
+        Query::Condition joinCondition;
+        joinCondition.addValueCondition(TagRemoteIdResourceRelation::resourceIdFullColumnName(),
+                                        Query::Equals, mConnection->context()->resource().id());
+        joinCondition.addColumnCondition(TagRemoteIdResourceRelation::tagIdFullColumnName(),
+                                         Query::Equals, Tag::idFullColumnName());
+        tagQuery.addJoin(QueryBuilder::LeftJoin, TagRemoteIdResourceRelation::tableName(), joinCondition);
+    }
+
+    windowScopeToQuery(tagQuery);
+
+    if (!tagQuery.exec()) {
+        throw HandlerException("Unable to retrieve item tags");
+    }
+
+    // Tags seen in previous windows are already cached
+    QHash<qint64, Protocol::FetchTagsResponse> tags;
+    QSqlQuery query = tagQuery.query();
+    while (query.next()) {
+        if (cache.contains(query.value(TagResponseQueryIdColumn).toLongLong())) {
+            continue;
+        }
+        Protocol::FetchTagsResponse response;
+        response.setId(query.value(TagResponseQueryIdColumn).toLongLong());
+        response.setGid(query.value(TagResponseQueryGidColumn).toString().toUtf8());
+        response.setParentId(query.value(TagResponseQueryParentIdColumn).toLongLong());
+        response.setType(query.value(TagResponseQueryTypeColumn).toString().toUtf8());
+        if (fetchRemoteId) {
+            response.setRemoteId(Utils::variantToByteArray(query.value(TagResponseQueryRemoteIdColumn)));
+        }
+        tags.insert(response.id(), response);
+    }
+    query.finish();
+
+    if (tags.isEmpty() || (!mTagFetchScope.fetchAllAttributes() && mTagFetchScope.attributes().isEmpty())) {
+        cache.unite(tags);
+        return;
+    }
+
+    QVariantList types;
+    if (!mTagFetchScope.fetchAllAttributes()) {
+        const auto attrs = mTagFetchScope.attributes();
+        std::transform(attrs.cbegin(), attrs.cend(), std::back_inserter(types),
+                       [](const QByteArray &ba) { return QVariant(ba); });
+    }
+
+    QVariantList tagIds;
+    tagIds.reserve(tags.size());
+    for (auto it = tags.cbegin(), end = tags.cend(); it != end; ++it) {
+        tagIds.push_back(it.key());
+    }
+
+    QHash<qint64, Protocol::Attributes> attributes;
+    const int chunkSize = QueryHelper::maxInConditionSize();
+    for (int i = 0; i < tagIds.size(); i += chunkSize) {
+        QueryBuilder attributeQuery(TagAttribute::tableName());
+        attributeQuery.addColumn(TagAttribute::tagIdFullColumnName());
+        attributeQuery.addColumn(TagAttribute::typeFullColumnName());
+        attributeQuery.addColumn(TagAttribute::valueFullColumnName());
+        attributeQuery.addValueCondition(TagAttribute::tagIdFullColumnName(), Query::In,
+                                         tagIds.mid(i, chunkSize));
+        if (!types.isEmpty()) {
+            attributeQuery.addValueCondition(TagAttribute::typeFullColumnName(), Query::In, types);
+        }
+
+        if (!attributeQuery.exec()) {
+            throw HandlerException("Unable to query Tag Attributes");
+        }
+
+        QSqlQuery query = attributeQuery.query();
+        while (query.next()) {
+            attributes[query.value(TagAttributeQueryTagIdColumn).toLongLong()].insert(
+                Utils::variantToByteArray(query.value(TagAttributeQueryTypeColumn)),
+                Utils::variantToByteArray(query.value(TagAttributeQueryValueColumn)));
+        }
+        query.finish();
+    }
+
+    // Tags without any matching attribute still get an empty attribute map,
+    // the same as HandlerHelper::fetchTagsResponse() does
+    for (auto it = tags.begin(), end = tags.end(); it != end; ++it) {
+        it->setAttributes(attributes.value(it.key()));
+    }
+
+    cache.unite(tags);
+}
+
+enum RelationQueryColumns {
+    RelationQueryItemIdColumn,
+    RelationQueryLeftIdColumn,
+    RelationQueryRightIdColumn,
+    RelationQueryTypeColumn
+};
+
+QHash<qint64, QVector<Protocol::FetchRelationsResponse>> ItemFetchHelper::fetchRelationResponses()
+{
+    QueryBuilder relationQuery(PimItem::tableName());
+    Query::Condition joinCondition(Query::Or);
+    joinCondition.addColumnCondition(Relation::leftIdFullColumnName(), Query::Equals, PimItem::idFullColumnName());
+    joinCondition.addColumnCondition(Relation::rightIdFullColumnName(), Query::Equals, PimItem::idFullColumnName());
+    relationQuery.addJoin(QueryBuilder::InnerJoin, Relation::tableName(), joinCondition);
+    relationQuery.addJoin(QueryBuilder::InnerJoin, RelationType::tableName(),
+                          Relation::typeIdFullColumnName(), RelationType::idFullColumnName());
+    relationQuery.addColumn(PimItem::idFullColumnName());
+    relationQuery.addColumn(Relation::leftIdFullColumnName());
+    relationQuery.addColumn(Relation::rightIdFullColumnName());
+    relationQuery.addColumn(RelationType::nameFullColumnName());
+
+    windowScopeToQuery(relationQuery);
+
+    if (!relationQuery.exec()) {
+        throw HandlerException("Unable to list item relations");
+    }
+
+    struct RelationRow {
+        qint64 itemId;
+        qint64 leftId;
+        qint64 rightId;
+        QByteArray type;
+    };
+    QVector<RelationRow> rows;
+    QSet<qint64> endpoints;
+    QSqlQuery query = relationQuery.query();
+    while (query.next()) {
+        RelationRow row{ query.value(RelationQueryItemIdColumn).toLongLong(),
+                         query.value(RelationQueryLeftIdColumn).toLongLong(),
+                         query.value(RelationQueryRightIdColumn).toLongLong(),
+                         query.value(RelationQueryTypeColumn).toString().toUtf8() };
+        endpoints.insert(row.leftId);
+        endpoints.insert(row.rightId);
+        rows.push_back(std::move(row));
+    }
+    query.finish();
+
+    // Resolve the mime types of both sides of all relations at once
+    QVariantList endpointIds;
+    endpointIds.reserve(endpoints.size());
+    for (const qint64 id : qAsConst(endpoints)) {
+        endpointIds.push_back(id);
+    }
+    QHash<qint64, QByteArray> endpointMimeTypes;
+    const int chunkSize = QueryHelper::maxInConditionSize();
+    for (int i = 0; i < endpointIds.size(); i += chunkSize) {
+        QueryBuilder mimeTypeQuery(PimItem::tableName());
+        mimeTypeQuery.addColumn(PimItem::idFullColumnName());
+        mimeTypeQuery.addColumn(PimItem::mimeTypeIdFullColumnName());
+        mimeTypeQuery.addValueCondition(PimItem::idFullColumnName(), Query::In,
+                                        endpointIds.mid(i, chunkSize));
+        if (!mimeTypeQuery.exec()) {
+            throw HandlerException("Unable to list item relations");
+        }
+
+        QSqlQuery query = mimeTypeQuery.query();
+        while (query.next()) {
+            const qint64 mimeTypeId = query.value(1).toLongLong();
+            auto mtIter = mMimeTypeIdNameCache.find(mimeTypeId);
+            if (mtIter == mMimeTypeIdNameCache.end()) {
+                mtIter = mMimeTypeIdNameCache.insert(mimeTypeId, MimeType::retrieveById(mimeTypeId).name());
+            }
+            endpointMimeTypes.insert(query.value(0).toLongLong(), mtIter.value().toUtf8());
+        }
+        query.finish();
+    }
+
+    QHash<qint64, QVector<Protocol::FetchRelationsResponse>> relations;
+    for (const RelationRow &row : qAsConst(rows)) {
+        Protocol::FetchRelationsResponse resp;
+        resp.setLeft(row.leftId);
+        resp.setLeftMimeType(endpointMimeTypes.value(row.leftId));
+        resp.setRight(row.rightId);
+        resp.setRightMimeType(endpointMimeTypes.value(row.rightId));
+        resp.setType(row.type);
+        relations[row.itemId].push_back(std::move(resp));
+    }
+
+    return relations;
+}
+
 enum VRefQueryColumns {
     VRefQueryCollectionIdColumn,
     VRefQueryItemIdColumn
@@ -261,7 +590,7 @@ QSqlQuery ItemFetchHelper::buildVRefQuery()
                       PimItem::idFullColumnName());
     vRefQuery.addColumn(CollectionPimItemRelation::leftFullColumnName());
     vRefQuery.addColumn(CollectionPimItemRelation::rightFullColumnName());
-    ItemQueryHelper::scopeToQuery(mScope, mContext, vRefQuery);
+    windowScopeToQuery(vRefQuery);
     vRefQuery.addSortColumn(PimItem::idFullColumnName(), Query::Descending);
 
     if (!vRefQuery.exec()) {
@@ -322,7 +651,8 @@ bool ItemFetchHelper::isScopeLocal(const Scope &scope)
 
 DataStore *ItemFetchHelper::storageBackend() const
 {
-    if (mConnection) {
+    // Worker threads of a parallel fetch use their own DataStore
+    if (mConnection && mConnection->thread() == QThread::currentThread()) {
         if (auto store = mConnection->storageBackend()) {
             return store;
         }
@@ -378,13 +708,11 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
     }
     END_TIMER(itemRetriever)
 
-    BEGIN_TIMER(items)
-    QSqlQuery itemQuery = buildItemQuery();
-    END_TIMER(items)
+    bool hasItems = nextWindow();
 
     // error if query did not find any item and scope is not listing items but
     // a request for a specific item
-    if (!itemQuery.isValid()) {
+    if (!hasItems) {
         if (mItemFetchScope.ignoreErrors()) {
             return true;
         }
@@ -399,6 +727,50 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
             break;
         }
     }
+
+    // Process the items in windows of FetchWindowSize items, so that the first
+    // responses are sent right away and we never hold the auxiliary queries
+    // (especially the payload parts) for the whole scope at once
+    QThreadPool *pool = AkonadiServer::instance()->itemFetchThreadPool();
+    if (hasItems && !mLastWindow && pool && !itemCallback && !storageBackend()->inTransaction()) {
+        // The workers use their own database connections, they would not see
+        // the changes of an open transaction
+        fetchWindowsInParallel(pool);
+    } else {
+        while (hasItems) {
+            fetchWindow(itemCallback);
+            hasItems = nextWindow();
+        }
+    }
+
+    // update atime (only if the payload was actually requested, otherwise a simple resource sync prevents cache clearing)
+    BEGIN_TIMER(aTime)
+    if (mUpdateATimeEnabled &&
+            (needsAccessTimeUpdate(mItemFetchScope.requestedParts()) || mItemFetchScope.fullPayload())) {
+        updateItemAccessTime();
+    }
+    END_TIMER(aTime)
+
+    END_TIMER(fetch)
+#if ENABLE_FETCH_PROFILING
+    qCDebug(AKONADISERVER_LOG) << "ItemFetchHelper execution stats:";
+    qCDebug(AKONADISERVER_LOG) << "\tItem retriever:" << itemRetrieverElapsed << "ms (scope local:" << scopeLocalElapsed << "ms)";
+    qCDebug(AKONADISERVER_LOG) << "\tATime update:" << aTimeElapsed << "ms";
+    qCDebug(AKONADISERVER_LOG) << "\t============";
+    qCDebug(AKONADISERVER_LOG) << "\tTotal FETCH:" << fetchElapsed << "ms";
+    qCDebug(AKONADISERVER_LOG);
+    qCDebug(AKONADISERVER_LOG);
+#endif
+
+    return true;
+}
+
+void ItemFetchHelper::fetchWindow(const std::function<void(Protocol::FetchItemsResponse &&)> &itemCallback)
+{
+    BEGIN_TIMER(items)
+    QSqlQuery itemQuery = buildItemQuery();
+    END_TIMER(items)
+
     // build part query if needed
     BEGIN_TIMER(parts)
     QSqlQuery partQuery(storageBackend()->database());
@@ -420,6 +792,9 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
     QSqlQuery tagQuery(storageBackend()->database());
     if (mItemFetchScope.fetchTags()) {
         tagQuery = buildTagQuery();
+        if (!mTagFetchScope.fetchIdOnly()) {
+            fetchTagResponses(mTagResponseCache);
+        }
     }
     END_TIMER(tags)
 
@@ -430,6 +805,13 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
     }
     END_TIMER(vRefs)
 
+    BEGIN_TIMER(relations)
+    QHash<qint64, QVector<Protocol::FetchRelationsResponse>> relationResponses;
+    if (mItemFetchScope.fetchRelations()) {
+        relationResponses = fetchRelationResponses();
+    }
+    END_TIMER(relations)
+
 #if ENABLE_FETCH_PROFILING
     int itemsCount = 0;
     int flagsCount = 0;
@@ -438,10 +820,17 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
     int vRefsCount = 0;
 #endif
 
+    const auto sendResponse = [this, &itemCallback](Protocol::FetchItemsResponse &&response) {
+        if (itemCallback) {
+            itemCallback(std::move(response));
+        } else {
+            mConnection->sendResponse(std::move(response));
+        }
+    };
+    const bool sortByMTime = (mItemFetchLimit.sortKey() == Protocol::ItemFetchLimit::ModificationTime);
+    QHash<qint64, Protocol::FetchItemsResponse> windowResponses;
+
     BEGIN_TIMER(processing)
-    QHash<qint64, QByteArray> flagIdNameCache;
-    QHash<qint64, QString> mimeTypeIdNameCache;
-    QHash<qint64, QByteArray> partTypeIdNameCache;
     while (itemQuery.isValid()) {
         PROF_INC(itemsCount)
 
@@ -452,9 +841,9 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
         response.setId(pimItemId);
         response.setRevision(pimItemRev);
         const qint64 mimeTypeId = extractQueryResult(itemQuery, ItemQueryMimeTypeIdColumn).toLongLong();
-        auto mtIter = mimeTypeIdNameCache.find(mimeTypeId);
-        if (mtIter == mimeTypeIdNameCache.end()) {
-            mtIter = mimeTypeIdNameCache.insert(mimeTypeId, MimeType::retrieveById(mimeTypeId).name());
+        auto mtIter = mMimeTypeIdNameCache.find(mimeTypeId);
+        if (mtIter == mMimeTypeIdNameCache.end()) {
+            mtIter = mMimeTypeIdNameCache.insert(mimeTypeId, MimeType::retrieveById(mimeTypeId).name());
         }
         response.setMimeType(mtIter.value());
         if (mItemFetchScope.fetchRemoteId()) {
@@ -486,9 +875,9 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
                     break;
                 }
                 const qint64 flagId = flagQuery.value(FlagQueryFlagIdColumn).toLongLong();
-                auto flagNameIter = flagIdNameCache.find(flagId);
-                if (flagNameIter == flagIdNameCache.end()) {
-                    flagNameIter = flagIdNameCache.insert(flagId, Flag::retrieveById(flagId).name().toUtf8());
+                auto flagNameIter = mFlagIdNameCache.find(flagId);
+                if (flagNameIter == mFlagIdNameCache.end()) {
+                    flagNameIter = mFlagIdNameCache.insert(flagId, Flag::retrieveById(flagId).name().toUtf8());
                 }
                 flags << flagNameIter.value();
                 flagQuery.next();
@@ -521,7 +910,7 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
                               | toQVector;
             } else {
                 tags = tagIds | transform([this](const auto tagId) {
-                                    return HandlerHelper::fetchTagsResponse(Tag::retrieveById(tagId), mTagFetchScope, mConnection);
+                                    return mTagResponseCache.value(tagId);
                                 })
                               | toQVector;
             }
@@ -546,23 +935,7 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
         }
 
         if (mItemFetchScope.fetchRelations()) {
-            SelectQueryBuilder<Relation> qb;
-            Query::Condition condition;
-            condition.setSubQueryMode(Query::Or);
-            condition.addValueCondition(Relation::leftIdFullColumnName(), Query::Equals, pimItemId);
-            condition.addValueCondition(Relation::rightIdFullColumnName(), Query::Equals, pimItemId);
-            qb.addCondition(condition);
-            qb.addGroupColumns(QStringList() << Relation::leftIdColumn() << Relation::rightIdColumn() << Relation::typeIdColumn() << Relation::remoteIdColumn());
-            if (!qb.exec()) {
-                throw HandlerException("Unable to list item relations");
-            }
-            QVector<Protocol::FetchRelationsResponse> relations;
-            const auto result = qb.result();
-            relations.reserve(result.size());
-            for (const Relation &rel : result) {
-                relations.push_back(HandlerHelper::fetchRelationsResponse(rel));;
-            }
-            response.setRelations(relations);
+            response.setRelations(relationResponses.value(pimItemId));
         }
 
         if (mItemFetchScope.ancestorDepth() != Protocol::ItemFetchScope::NoAncestor) {
@@ -584,9 +957,9 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
             }
 
             const qint64 partTypeId = partQuery.value(PartQueryTypeIdColumn).toLongLong();
-            auto ptIter = partTypeIdNameCache.find(partTypeId);
-            if (ptIter == partTypeIdNameCache.end()) {
-                ptIter = partTypeIdNameCache.insert(partTypeId, PartTypeHelper::fullName(PartType::retrieveById(partTypeId)).toUtf8());
+            auto ptIter = mPartTypeIdNameCache.find(partTypeId);
+            if (ptIter == mPartTypeIdNameCache.end()) {
+                ptIter = mPartTypeIdNameCache.insert(partTypeId, PartTypeHelper::fullName(PartType::retrieveById(partTypeId)).toUtf8());
             }
             Protocol::PartMetaData metaPart;
             Protocol::StreamPayloadResponse partData;
@@ -636,14 +1009,22 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
             response.setCachedParts(cachedParts);
         }
 
-        if (itemCallback) {
-            itemCallback(std::move(response));
+        if (sortByMTime) {
+            windowResponses.insert(pimItemId, std::move(response));
         } else {
-            mConnection->sendResponse(std::move(response));
+            sendResponse(std::move(response));
         }
 
         itemQuery.next();
     }
+
+    // The auxiliary queries are merged in ID order, restore the order of the window
+    for (const qint64 id : qAsConst(mWindowIds)) {
+        auto it = windowResponses.find(id);
+        if (it != windowResponses.end()) {
+            sendResponse(std::move(*it));
+        }
+    }
     tagQuery.finish();
     flagQuery.finish();
     partQuery.finish();
@@ -651,34 +1032,114 @@ bool ItemFetchHelper::fetchItems(std::function<void(Protocol::FetchItemsResponse
     itemQuery.finish();
     END_TIMER(processing)
 
-    // update atime (only if the payload was actually requested, otherwise a simple resource sync prevents cache clearing)
-    BEGIN_TIMER(aTime)
-    if (mUpdateATimeEnabled &&
-            (needsAccessTimeUpdate(mItemFetchScope.requestedParts()) || mItemFetchScope.fullPayload())) {
-        updateItemAccessTime();
-    }
-    END_TIMER(aTime)
-
-    END_TIMER(fetch)
 #if ENABLE_FETCH_PROFILING
-    qCDebug(AKONADISERVER_LOG) << "ItemFetchHelper execution stats:";
+    qCDebug(AKONADISERVER_LOG) << "ItemFetchHelper window stats:";
     qCDebug(AKONADISERVER_LOG) << "\tItems query:" << itemsElapsed << "ms," << itemsCount << " items in total";
     qCDebug(AKONADISERVER_LOG) << "\tFlags query:" << flagsElapsed << "ms, " << flagsCount << " flags in total";
     qCDebug(AKONADISERVER_LOG) << "\tParts query:" << partsElapsed << "ms, " << partsCount << " parts in total";
     qCDebug(AKONADISERVER_LOG) << "\tTags query: " << tagsElapsed << "ms, " << tagsCount << " tags in total";
     qCDebug(AKONADISERVER_LOG) << "\tVRefs query:" << vRefsElapsed << "ms, " << vRefsCount << " vRefs in total";
+    qCDebug(AKONADISERVER_LOG) << "\tRelations query:" << relationsElapsed << "ms";
     qCDebug(AKONADISERVER_LOG) << "\t------------";
-    qCDebug(AKONADISERVER_LOG) << "\tItem retriever:" << itemRetrieverElapsed << "ms (scope local:" << scopeLocalElapsed << "ms)";
-    qCDebug(AKONADISERVER_LOG) << "\tTotal query:" << (itemsElapsed + flagsElapsed + partsElapsed + tagsElapsed + vRefsElapsed) << "ms";
+    qCDebug(AKONADISERVER_LOG) << "\tTotal query:" << (itemsElapsed + flagsElapsed + partsElapsed + tagsElapsed + vRefsElapsed + relationsElapsed) << "ms";
     qCDebug(AKONADISERVER_LOG) << "\tTotal processing: " << processingElapsed << "ms";
-    qCDebug(AKONADISERVER_LOG) << "\tATime update:" << aTimeElapsed << "ms";
-    qCDebug(AKONADISERVER_LOG) << "\t============";
-    qCDebug(AKONADISERVER_LOG) << "\tTotal FETCH:" << fetchElapsed << "ms";
-    qCDebug(AKONADISERVER_LOG);
-    qCDebug(AKONADISERVER_LOG);
 #endif
+}
 
-    return true;
+namespace Akonadi
+{
+namespace Server
+{
+
+/**
+ * Fetches a single window of items in a worker thread of a parallel fetch
+ * and keeps the responses until they are sent by the connection thread.
+ */
+class ItemFetchWindowTask : public QRunnable
+{
+public:
+    explicit ItemFetchWindowTask(const ItemFetchHelper &helper)
+        : mHelper(helper)
+    {
+        setAutoDelete(false);
+    }
+
+    ~ItemFetchWindowTask() override
+    {
+        // Don't pull the helper from under a running worker
+        waitForDone();
+    }
+
+    void run() override
+    {
+        QByteArray error;
+        QVector<Protocol::FetchItemsResponse> responses;
+        try {
+            mHelper.fetchWindow([&responses](Protocol::FetchItemsResponse &&response) {
+                responses.push_back(std::move(response));
+            });
+        } catch (const Exception &e) {
+            error = e.what();
+        }
+
+        QMutexLocker locker(&mLock);
+        mResponses = std::move(responses);
+        mError = error;
+        mDone = true;
+        mFinished.wakeAll();
+    }
+
+    QVector<Protocol::FetchItemsResponse> takeResponses()
+    {
+        waitForDone();
+        if (!mError.isNull()) {
+            throw HandlerException(mError);
+        }
+        return std::move(mResponses);
+    }
+
+private:
+    void waitForDone()
+    {
+        QMutexLocker locker(&mLock);
+        while (!mDone) {
+            mFinished.wait(&mLock);
+        }
+    }
+
+    ItemFetchHelper mHelper;
+    QMutex mLock;
+    QWaitCondition mFinished;
+    QVector<Protocol::FetchItemsResponse> mResponses;
+    QByteArray mError;
+    bool mDone = false;
+};
+
+} // namespace Server
+} // namespace Akonadi
+
+void ItemFetchHelper::fetchWindowsInParallel(QThreadPool *pool)
+{
+    // Each window is fetched by a copy of this helper in a worker thread, the
+    // connection thread only looks up the windows and sends the responses in
+    // order. At most one window per worker is pending, so the memory needed
+    // for the buffered responses stays bounded.
+    std::deque<std::unique_ptr<ItemFetchWindowTask>> tasks;
+    bool hasItems = true;
+    while (hasItems || !tasks.empty()) {
+        while (hasItems && tasks.size() < static_cast<size_t>(pool->maxThreadCount())) {
+            tasks.push_back(std::make_unique<ItemFetchWindowTask>(*this));
+            pool->start(tasks.back().get());
+            hasItems = nextWindow();
+        }
+
+        std::unique_ptr<ItemFetchWindowTask> task = std::move(tasks.front());
+        tasks.pop_front();
+        auto responses = task->takeResponses();
+        for (auto &response : responses) {
+            mConnection->sendResponse(std::move(response));
+        }
+    }
 }
 
 bool ItemFetchHelper::needsAccessTimeUpdate(const QVector<QByteArray> &parts)
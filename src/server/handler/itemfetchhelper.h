@@ -32,6 +32,7 @@
 
 #include <functional>
 
+class QThreadPool;
 class ItemFetchHelperTest;
 
 namespace Akonadi
@@ -53,6 +54,21 @@ public:
             const Protocol::ItemFetchScope &itemFetchScope,
             const Protocol::TagFetchScope &tagFetchScope);
 
+    /**
+     * Limits the fetch to a single page of items, see Protocol::ItemFetchLimit
+     */
+    void setItemFetchLimit(const Protocol::ItemFetchLimit &itemFetchLimit);
+
+    /**
+     * Returns the position of the next page after fetchItems() returned,
+     * or a limit without a limit set when there are no more items.
+     *
+     * This is positioned after the last item looked at, which is not
+     * necessarily the last one sent: with ignoreErrors items without data
+     * are skipped.
+     */
+    Protocol::ItemFetchLimit nextPage() const;
+
     bool fetchItems(std::function<void(Protocol::FetchItemsResponse &&)> &&callback = {});
 
     void disableATimeUpdates();
@@ -73,10 +89,16 @@ private:
 
     void updateItemAccessTime();
     void triggerOnDemandFetch();
+    bool nextWindow();
+    void windowScopeToQuery(QueryBuilder &qb);
+    void fetchWindow(const std::function<void(Protocol::FetchItemsResponse &&)> &itemCallback);
+    void fetchWindowsInParallel(QThreadPool *pool);
     QSqlQuery buildItemQuery();
     QSqlQuery buildPartQuery(const QVector<QByteArray> &partList, bool allPayload, bool allAttrs);
     QSqlQuery buildFlagQuery();
     QSqlQuery buildTagQuery();
+    void fetchTagResponses(QHash<qint64, Protocol::FetchTagsResponse> &cache);
+    QHash<qint64, QVector<Protocol::FetchRelationsResponse>> fetchRelationResponses();
     QSqlQuery buildVRefQuery();
 
     QVector<Protocol::Ancestor> ancestorsForItem(Collection::Id parentColId);
@@ -91,13 +113,28 @@ private:
     Connection *mConnection = nullptr;
     CommandContext *mContext = nullptr;
     QHash<Collection::Id, QVector<Protocol::Ancestor>> mAncestorCache;
+    QHash<qint64, QString> mMimeTypeIdNameCache;
+    QHash<qint64, QByteArray> mFlagIdNameCache;
+    QHash<qint64, QByteArray> mPartTypeIdNameCache;
+    QHash<qint64, Protocol::FetchTagsResponse> mTagResponseCache;
     Scope mScope;
     Protocol::ItemFetchScope mItemFetchScope;
     Protocol::TagFetchScope mTagFetchScope;
     int mItemQueryColumnMap[ItemQueryColumnCount];
     bool mUpdateATimeEnabled = true;
 
+    Protocol::ItemFetchLimit mItemFetchLimit;
+
+    // IDs of the items of the currently processed window in the order in
+    // which they are sent, and the sort key of the last one, see nextWindow()
+    QVector<qint64> mWindowIds;
+    qint64 mWindowLastId = -1;
+    QDateTime mWindowLastMTime;
+    int mFetchedCount = 0;
+    bool mLastWindow = false;
+
     friend class ::ItemFetchHelperTest;
+    friend class ItemFetchWindowTask;
 };
 
 } // namespace Server
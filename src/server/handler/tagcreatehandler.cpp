@@ -25,6 +25,7 @@
 #include "storage/querybuilder.h"
 #include "storage/countquerybuilder.h"
 #include "storage/transaction.h"
+#include "storage/tagcache.h"
 
 #include <private/scope_p.h>
 #include <private/imapset_p.h>
@@ -124,6 +125,8 @@ bool TagCreateHandler::parseStream()
         }
     }
 
+    TagCache::self()->invalidateTag(tagId);
+
     trx.commit();
 
     Scope scope;
@@ -23,7 +23,9 @@
 #include "connection.h"
 #include "storage/datastore.h"
 #include "storage/querybuilder.h"
+#include "storage/tagcache.h"
 #include <shared/akranges.h>
+#include <shared/akscopeguard.h>
 
 #include <private/imapset_p.h>
 
@@ -39,6 +41,11 @@ bool TagModifyHandler::parseStream()
         return failureResponse("No such tag");
     }
 
+    // Changes written before a failure below are not rolled back
+    const AkScopeGuard invalidateTag([&changedTag]() {
+        TagCache::self()->invalidateTag(changedTag.id());
+    });
+
     QSet<QByteArray> changes;
 
     // Retrieve all tag's attributes
@@ -135,6 +142,7 @@ bool TagModifyHandler::parseStream()
         if (!changedTag.update()) {
             return failureResponse("Failed to store changes");
         }
+        TagCache::self()->invalidateTag(changedTag.id());
         if (!changes.isEmpty()) {
             storageBackend()->notificationCollector()->tagChanged(changedTag);
         }
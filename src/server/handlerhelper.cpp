@@ -24,6 +24,7 @@
 #include "storage/collectionstatistics.h"
 #include "storage/queryhelper.h"
 #include "storage/collectionqueryhelper.h"
+#include "storage/tagcache.h"
 #include "commandcontext.h"
 #include "handler.h"
 #include "connection.h"
@@ -218,54 +219,35 @@ Protocol::FetchTagsResponse HandlerHelper::fetchTagsResponse(const Tag &tag,
     response.setType(tag.tagType().name().toUtf8());
     response.setParentId(tag.parentId());
     response.setGid(tag.gid().toUtf8());
-    if (tagFetchScope.fetchRemoteID() && connection) {
-        // Fail silently if retrieving tag RID is not allowed in current context
-        if (connection->context()->resource().isValid()) {
-            QueryBuilder qb(TagRemoteIdResourceRelation::tableName());
-            qb.addColumn(TagRemoteIdResourceRelation::remoteIdColumn());
-            qb.addValueCondition(TagRemoteIdResourceRelation::resourceIdColumn(),
-                                 Query::Equals,
-                                 connection->context()->resource().id());
-            qb.addValueCondition(TagRemoteIdResourceRelation::tagIdColumn(),
-                                 Query::Equals,
-                                 tag.id());
-            if (!qb.exec()) {
-                throw HandlerException("Unable to query Tag Remote ID");
-            }
-            QSqlQuery query = qb.query();
-            // RID may not be available
-            if (query.next()) {
-                response.setRemoteId(Utils::variantToByteArray(query.value(0)));
-            }
-            query.finish();
-        }
+
+    // Fail silently if retrieving tag RID is not allowed in current context
+    const bool fetchRemoteId = tagFetchScope.fetchRemoteID() && connection
+                               && connection->context()->resource().isValid();
+    const bool fetchAttributes = tagFetchScope.fetchAllAttributes() || !tagFetchScope.attributes().isEmpty();
+    if (!fetchRemoteId && !fetchAttributes) {
+        return response;
+    }
+
+    const TagCache::CachedTag cached = TagCache::self()->tag(tag.id());
+    if (fetchRemoteId) {
+        // RID may not be available
+        response.setRemoteId(cached.remoteIds.value(connection->context()->resource().id()));
     }
 
-    if (tagFetchScope.fetchAllAttributes() || !tagFetchScope.attributes().isEmpty()) {
-        QueryBuilder qb(TagAttribute::tableName());
-        qb.addColumns({ TagAttribute::typeFullColumnName(),
-                        TagAttribute::valueFullColumnName() });
-        Query::Condition cond(Query::And);
-        cond.addValueCondition(TagAttribute::tagIdFullColumnName(), Query::Equals, tag.id());
-        if (!tagFetchScope.fetchAllAttributes() && !tagFetchScope.attributes().isEmpty()) {
-            QVariantList types;
+    if (fetchAttributes) {
+        if (tagFetchScope.fetchAllAttributes()) {
+            response.setAttributes(cached.attributes);
+        } else {
+            Protocol::Attributes attributes;
             const auto scope = tagFetchScope.attributes();
-            std::transform(scope.cbegin(), scope.cend(), std::back_inserter(types),
-                    [](const QByteArray &ba) { return QVariant(ba); });
-            cond.addValueCondition(TagAttribute::typeFullColumnName(), Query::In, types);
-        }
-        qb.addCondition(cond);
-        if (!qb.exec()) {
-            throw HandlerException("Unable to query Tag Attributes");
-        }
-        QSqlQuery query = qb.query();
-        Protocol::Attributes attributes;
-        while (query.next()) {
-            attributes.insert(Utils::variantToByteArray(query.value(0)),
-                              Utils::variantToByteArray(query.value(1)));
+            for (const QByteArray &type : scope) {
+                const auto it = cached.attributes.constFind(type);
+                if (it != cached.attributes.cend()) {
+                    attributes.insert(it.key(), it.value());
+                }
+            }
+            response.setAttributes(attributes);
         }
-        query.finish();
-        response.setAttributes(attributes);
     }
 
     return response;
@@ -387,6 +369,7 @@ Tag::List HandlerHelper::resolveTagsByRID(const QStringList &tagsRIDs, CommandCo
             if (!rel.insert()) {
                 throw HandlerException("Unable to create tag");
             }
+            TagCache::self()->invalidateTag(tag.id());
         } else if (results.count() == 1) {
             tag = results[0];
         } else {
@@ -0,0 +1,310 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "metrics.h"
+#include "storage/dbdeadlockcatcher.h"
+
+#include <QDebug>
+#include <QTextStream>
+
+#include <algorithm>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+/// Statements are tracked separately up to this number, further ones are summed up
+static const int MaxQueryShapes = 1000;
+/// Number of statements listed in the snapshot
+static const int SnapshotQueries = 50;
+
+static thread_local qint64 sThreadQueries = 0;
+
+const std::array<qint64, 15> Metrics::Histogram::Bounds = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+void Metrics::Histogram::record(qint64 usecs)
+{
+    const auto bucket = std::lower_bound(Bounds.cbegin(), Bounds.cend(), usecs) - Bounds.cbegin();
+    ++buckets[bucket];
+    ++count;
+    total += usecs;
+    max = std::max(max, usecs);
+}
+
+qint64 Metrics::Histogram::percentile(int percentile) const
+{
+    const qint64 rank = (count * percentile + 99) / 100;
+    qint64 seen = 0;
+    for (std::size_t i = 0; i < Bounds.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(Bounds[i], max);
+        }
+    }
+    return max;
+}
+
+Metrics *Metrics::self()
+{
+    static Metrics sInstance;
+    return &sInstance;
+}
+
+Metrics::Metrics()
+{
+    mUptime.start();
+}
+
+void Metrics::recordCommand(Protocol::Command::Type type, qint64 usecs)
+{
+    QMutexLocker locker(&mLock);
+    mCommands[type].record(usecs);
+}
+
+void Metrics::QueryStats::record(qint64 usecs)
+{
+    ++count;
+    total += usecs;
+    max = std::max(max, usecs);
+}
+
+void Metrics::QueryStats::merge(const QueryStats &other)
+{
+    count += other.count;
+    total += other.total;
+    max = std::max(max, other.max);
+}
+
+Metrics::ThreadQueries::ThreadQueries()
+{
+    Metrics *metrics = Metrics::self();
+    QMutexLocker locker(&metrics->mThreadQueriesLock);
+    metrics->mThreadQueries.push_back(this);
+}
+
+Metrics::ThreadQueries::~ThreadQueries()
+{
+    Metrics *metrics = Metrics::self();
+    QMutexLocker locker(&metrics->mThreadQueriesLock);
+    metrics->mThreadQueries.removeOne(this);
+    mergeQueries(metrics->mFinishedQueries, metrics->mOtherQueries, queries);
+    metrics->mOtherQueries.merge(other);
+}
+
+Metrics::ThreadQueries &Metrics::threadQueries()
+{
+    static thread_local ThreadQueries sQueries;
+    return sQueries;
+}
+
+void Metrics::mergeQueries(QHash<quint64, QueryStats> &into, QueryStats &other,
+                           const QHash<quint64, QueryStats> &queries)
+{
+    for (auto it = queries.cbegin(), end = queries.cend(); it != end; ++it) {
+        auto intoIt = into.find(it.key());
+        if (intoIt == into.end()) {
+            if (into.size() >= MaxQueryShapes) {
+                other.merge(*it);
+                continue;
+            }
+            intoIt = into.insert(it.key(), QueryStats());
+            intoIt->statement = it->statement;
+        }
+        intoIt->merge(*it);
+    }
+}
+
+void Metrics::recordQuery(quint64 shape, const QString &statement, qint64 usecs)
+{
+    ++sThreadQueries;
+
+    ThreadQueries &thread = threadQueries();
+    QMutexLocker locker(&thread.lock);
+    auto it = thread.queries.find(shape);
+    if (it == thread.queries.end()) {
+        if (thread.queries.size() >= MaxQueryShapes) {
+            thread.other.record(usecs);
+            return;
+        }
+        it = thread.queries.insert(shape, QueryStats());
+        it->statement = statement;
+    }
+    it->record(usecs);
+}
+
+void Metrics::recordNotifications(int notifications, int subscribers)
+{
+    ++mNotificationBatches;
+    mNotifications += notifications;
+    mNotificationsOffered += qint64(notifications) * subscribers;
+}
+
+void Metrics::recordNotificationDelivery()
+{
+    ++mNotificationsDelivered;
+}
+
+void Metrics::recordNotificationPayloads(int notifications, int items, int fetchedItems, qint64 queries)
+{
+    mPayloadNotifications += notifications;
+    mPayloadItems += items;
+    mPayloadFetchedItems += fetchedItems;
+    mPayloadQueries += queries;
+}
+
+qint64 Metrics::threadQueryCount()
+{
+    return sThreadQueries;
+}
+
+void Metrics::recordRetrievalRequest(int queueDepth)
+{
+    ++mRetrievalRequests;
+    mRetrievalQueueDepths += queueDepth;
+    int peak = mRetrievalPeakQueueDepth.loadAcquire();
+    while (queueDepth > peak && !mRetrievalPeakQueueDepth.testAndSetOrdered(peak, queueDepth)) {
+        peak = mRetrievalPeakQueueDepth.loadAcquire();
+    }
+}
+
+void Metrics::reset()
+{
+    {
+        QMutexLocker locker(&mThreadQueriesLock);
+        for (ThreadQueries *thread : qAsConst(mThreadQueries)) {
+            QMutexLocker threadLocker(&thread->lock);
+            thread->queries.clear();
+            thread->other = QueryStats();
+        }
+        mFinishedQueries.clear();
+        mOtherQueries = QueryStats();
+    }
+
+    QMutexLocker locker(&mLock);
+    mCommands.clear();
+    mNotificationBatches.store(0);
+    mNotifications.store(0);
+    mNotificationsOffered.store(0);
+    mNotificationsDelivered.store(0);
+    mPayloadNotifications.store(0);
+    mPayloadItems.store(0);
+    mPayloadFetchedItems.store(0);
+    mPayloadQueries.store(0);
+    mRetrievalRequests.store(0);
+    mRetrievalQueueDepths.store(0);
+    mRetrievalPeakQueueDepth.store(0);
+    mUptime.restart();
+}
+
+QString Metrics::snapshot() const
+{
+    QString out;
+    QTextStream stream(&out);
+
+    QMutexLocker locker(&mLock);
+    stream << "Akonadi server metrics, collected for " << mUptime.elapsed() / 1000 << " s\n";
+
+    stream << "\nCommands (latencies in us):\n";
+    QVector<QPair<QString, Histogram>> commands;
+    for (auto it = mCommands.cbegin(), end = mCommands.cend(); it != end; ++it) {
+        QString name;
+        QDebug(&name).nospace() << static_cast<Protocol::Command::Type>(it.key());
+        commands.push_back({ name.trimmed(), it.value() });
+    }
+    std::sort(commands.begin(), commands.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (const auto &command : qAsConst(commands)) {
+        const Histogram &h = command.second;
+        stream << "  " << command.first << ": count " << h.count << ", avg " << h.total / h.count
+               << ", p50 " << h.percentile(50) << ", p90 " << h.percentile(90) << ", p99 " << h.percentile(99)
+               << ", max " << h.max << "\n    buckets:";
+        for (std::size_t i = 0; i < h.buckets.size(); ++i) {
+            if (h.buckets[i] > 0) {
+                if (i < Histogram::Bounds.size()) {
+                    stream << " <=" << Histogram::Bounds[i];
+                } else {
+                    stream << " >" << Histogram::Bounds.back();
+                }
+                stream << ':' << h.buckets[i];
+            }
+        }
+        stream << '\n';
+    }
+
+    locker.unlock();
+
+    QHash<quint64, QueryStats> merged;
+    QueryStats other;
+    {
+        QMutexLocker threadsLocker(&mThreadQueriesLock);
+        merged = mFinishedQueries;
+        other = mOtherQueries;
+        for (ThreadQueries *thread : qAsConst(mThreadQueries)) {
+            QMutexLocker threadLocker(&thread->lock);
+            mergeQueries(merged, other, thread->queries);
+            other.merge(thread->other);
+        }
+    }
+
+    QVector<QueryStats> queries;
+    queries.reserve(merged.size());
+    qint64 queryCount = other.count;
+    qint64 queryTime = other.total;
+    for (const QueryStats &query : qAsConst(merged)) {
+        queries.push_back(query);
+        queryCount += query.count;
+        queryTime += query.total;
+    }
+
+    std::sort(queries.begin(), queries.end(), [](const auto &a, const auto &b) { return a.total > b.total; });
+    stream << "\nSQL queries: " << queryCount << " in " << queryTime / 1000 << " ms, "
+           << queries.size() << " statements";
+    if (other.count > 0) {
+        stream << " (" << other.count << " queries of further statements not tracked)";
+    }
+    stream << "\n  Top statements by total time (count, total ms, avg us, max us):\n";
+    for (int i = 0, c = std::min(queries.size(), SnapshotQueries); i < c; ++i) {
+        const QueryStats &q = queries[i];
+        stream << "  " << q.count << ", " << q.total / 1000 << ", " << q.total / q.count << ", " << q.max
+               << ": " << q.statement << '\n';
+    }
+
+    stream << "\nNotifications: " << mNotifications.load() << " in " << mNotificationBatches.load() << " batches, "
+           << mNotificationsOffered.load() << " offered to subscribers, "
+           << mNotificationsDelivered.load() << " accepted by subscribers\n";
+
+    const qint64 payloadNotifications = mPayloadNotifications.load();
+    stream << "  Payloads: " << payloadNotifications << " notifications with " << mPayloadItems.load() << " items, "
+           << mPayloadFetchedItems.load() << " distinct items fetched, " << mPayloadQueries.load() << " SQL queries ("
+           << (payloadNotifications > 0 ? double(mPayloadQueries.load()) / payloadNotifications : 0.0)
+           << " per notification)\n";
+
+    const qint64 retrievals = mRetrievalRequests.load();
+    stream << "\nItem retrieval: " << retrievals << " requests, average queue depth "
+           << (retrievals > 0 ? double(mRetrievalQueueDepths.load()) / retrievals : 0.0)
+           << ", peak queue depth " << mRetrievalPeakQueueDepth.load() << '\n';
+
+    const auto deadlocks = DbDeadlockCatcher::statistics();
+    stream << "\nDatabase deadlocks: " << deadlocks.deadlocks << ", retries " << deadlocks.retries
+           << " (" << deadlocks.totalBackoffTime << " ms backoff), failures " << deadlocks.failures << '\n';
+
+    stream.flush();
+    return out;
+}
@@ -0,0 +1,169 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef AKONADI_SERVER_METRICS_H
+#define AKONADI_SERVER_METRICS_H
+
+#include <private/protocol_p.h>
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <array>
+
+namespace Akonadi
+{
+namespace Server
+{
+
+/**
+ * Always-on performance counters of the server.
+ *
+ * Collects per-command latency histograms, SQL query counts and durations
+ * by statement, notification fan-out, the cost of filling in notification
+ * payloads and item retrieval queue depths. The
+ * deadlock retries of DbDeadlockCatcher are added when taking a snapshot().
+ *
+ * SQL queries are recorded for every single statement executed, so they
+ * are counted per thread, keyed by the query shape fingerprint of
+ * QueryBuilder, and only merged when taking a snapshot().
+ *
+ * The snapshot is available through "akonadictl metrics" and can be
+ * written to a file periodically, see AkonadiServer.
+ */
+class Metrics
+{
+public:
+    /// Latency histogram with fixed, roughly logarithmic buckets
+    class Histogram
+    {
+    public:
+        /// Upper bounds of the buckets in microseconds, the last one is open
+        static const std::array<qint64, 15> Bounds;
+
+        void record(qint64 usecs);
+
+        /// Returns the upper bound of the bucket containing the @p percentile
+        qint64 percentile(int percentile) const;
+
+        qint64 count = 0;
+        qint64 total = 0;
+        qint64 max = 0;
+        std::array<qint64, 16> buckets{};
+    };
+
+    static Metrics *self();
+
+    /// Records that handling a command of @p type took @p usecs microseconds
+    void recordCommand(Protocol::Command::Type type, qint64 usecs);
+
+    /**
+     * Records that executing the prepared @p statement took @p usecs microseconds.
+     * @p shape identifies the statement, see QueryBuilder::fingerprint(). The
+     * statement text is only kept for display.
+     */
+    void recordQuery(quint64 shape, const QString &statement, qint64 usecs);
+
+    /// Records that @p notifications were emitted to @p subscribers subscribers
+    void recordNotifications(int notifications, int subscribers);
+
+    /// Records that a subscriber accepted a notification
+    void recordNotificationDelivery();
+
+    /**
+     * Records that the payload of @p notifications item notifications with
+     * @p items items in total was filled in from @p fetchedItems distinct items,
+     * issuing @p queries SQL queries.
+     */
+    void recordNotificationPayloads(int notifications, int items, int fetchedItems, qint64 queries);
+
+    /// Returns the number of SQL queries recorded from the calling thread so far
+    static qint64 threadQueryCount();
+
+    /// Records a new item retrieval request, @p queueDepth requests are pending for its resource now
+    void recordRetrievalRequest(int queueDepth);
+
+    /// Returns all metrics in a human readable form
+    QString snapshot() const;
+
+    void reset();
+
+private:
+    Metrics();
+
+    struct QueryStats {
+        void record(qint64 usecs);
+        void merge(const QueryStats &other);
+
+        qint64 count = 0;
+        qint64 total = 0;
+        qint64 max = 0;
+        QString statement;
+    };
+
+    /// Query statistics of a single thread
+    struct ThreadQueries {
+        ThreadQueries();
+        ~ThreadQueries();
+
+        /// Only contended while a snapshot is taken or the metrics are reset
+        QMutex lock;
+        QHash<quint64, QueryStats> queries;
+        QueryStats other;
+    };
+    static ThreadQueries &threadQueries();
+
+    /// Merges @p queries into @p into, up to the statement limit
+    static void mergeQueries(QHash<quint64, QueryStats> &into, QueryStats &other,
+                             const QHash<quint64, QueryStats> &queries);
+
+    mutable QMutex mLock;
+    QElapsedTimer mUptime;
+    QHash<int, Histogram> mCommands;
+
+    mutable QMutex mThreadQueriesLock;
+    QVector<ThreadQueries *> mThreadQueries;
+    /// Queries of threads that have finished
+    QHash<quint64, QueryStats> mFinishedQueries;
+    QueryStats mOtherQueries;
+
+    QAtomicInteger<qint64> mNotificationBatches;
+    QAtomicInteger<qint64> mNotifications;
+    QAtomicInteger<qint64> mNotificationsOffered;
+    QAtomicInteger<qint64> mNotificationsDelivered;
+
+    QAtomicInteger<qint64> mPayloadNotifications;
+    QAtomicInteger<qint64> mPayloadItems;
+    QAtomicInteger<qint64> mPayloadFetchedItems;
+    QAtomicInteger<qint64> mPayloadQueries;
+
+    QAtomicInteger<qint64> mRetrievalRequests;
+    /// Sum of the queue depths seen by new requests, for the average
+    QAtomicInteger<qint64> mRetrievalQueueDepths;
+    QAtomicInt mRetrievalPeakQueueDepth;
+};
+
+} // namespace Server
+} // namespace Akonadi
+
+#endif
@@ -26,6 +26,7 @@
 #include "aggregatedfetchscope.h"
 #include "storage/collectionstatistics.h"
 #include "handlerhelper.h"
+#include "metrics.h"
 
 #include <shared/akranges.h>
 #include <private/standarddirs_p.h>
@@ -36,6 +37,8 @@
 #include <QPointer>
 #include <QDateTime>
 
+#include <algorithm>
+
 using namespace Akonadi;
 using namespace Akonadi::Server;
 
@@ -183,6 +186,10 @@ void NotificationManager::emitPendingNotifications()
         return;
     }
 
+    const int subscribers = std::count_if(mSubscribers.cbegin(), mSubscribers.cend(),
+                                          [](const auto &subscriber) { return !subscriber.isNull(); });
+    Metrics::self()->recordNotifications(mNotifications.size(), subscribers);
+
     if (mDebugNotifications == 0) {
         mSubscribers
             | filter(IsNotNull)
@@ -21,6 +21,7 @@
 #include "akonadiserver_debug.h"
 #include "notificationmanager.h"
 #include "aggregatedfetchscope.h"
+#include "metrics.h"
 #include "utils.h"
 
 #include <QLocalSocket>
@@ -656,6 +657,7 @@ bool NotificationSubscriber::notify(const Protocol::ChangeNotificationPtr &notif
     if (acceptsNotification(*notification)) {
         QMetaObject::invokeMethod(this, "writeNotification", Qt::QueuedConnection,
                                   Q_ARG(Akonadi::Protocol::ChangeNotificationPtr, notification));
+        Metrics::self()->recordNotificationDelivery();
         return true;
     }
     return false;
@@ -27,8 +27,6 @@
 #include "preprocessormanager.h"
 #include "akonadiserver_debug.h"
 
-#include "entities.h"
-
 #include "agentcontrolinterface.h"
 #include "agentmanagerinterface.h"
 
@@ -36,6 +34,9 @@
 
 #include <private/dbus_p.h>
 
+#include <algorithm>
+#include <iterator>
+
 
 using namespace Akonadi;
 using namespace Akonadi::Server;
@@ -53,7 +54,7 @@ PreprocessorInstance::~PreprocessorInstance()
 
 bool PreprocessorInstance::init()
 {
-    Q_ASSERT(!mBusy);   // must be called very early
+    Q_ASSERT(!isBusy());   // must be called very early
     Q_ASSERT(!mInterface);
 
     mInterface = new OrgFreedesktopAkonadiPreprocessorInterface(
@@ -73,76 +74,71 @@ bool PreprocessorInstance::init()
         return false;
     }
 
-    QObject::connect(mInterface, &OrgFreedesktopAkonadiPreprocessorInterface::itemProcessed, this, &PreprocessorInstance::itemProcessed);
+    QObject::connect(mInterface, &OrgFreedesktopAkonadiPreprocessorInterface::itemsProcessed, this, &PreprocessorInstance::itemsProcessed);
 
     return true;
 }
 
-void PreprocessorInstance::enqueueItem(qint64 itemId)
+void PreprocessorInstance::enqueueItems(const QVector<qint64> &itemIds)
 {
-    qCDebug(AKONADISERVER_LOG) << "PreprocessorInstance::enqueueItem("  << itemId <<  ")";
+    qCDebug(AKONADISERVER_LOG) << "PreprocessorInstance::enqueueItems("  << itemIds.count() << "items )";
 
-    mItemQueue.push_back(itemId);
+    mItemQueue.insert(mItemQueue.end(), itemIds.cbegin(), itemIds.cend());
 
-    // If the preprocessor is already busy processing another item then do nothing.
-    if (mBusy) {
-        // The "head" item is the one being processed and we have just added another one.
-        Q_ASSERT(mItemQueue.size() > 1);
+    // If the preprocessor is already busy processing another batch then do nothing,
+    // the items will be part of the next batch.
+    if (isBusy()) {
         return;
     }
 
-    // Not busy: handle the item.
-    processHeadItem();
+    // Not busy: handle the items.
+    processNextBatch();
 }
 
-void PreprocessorInstance::processHeadItem()
+QVector<qint64> PreprocessorInstance::takeItems()
 {
-    // We shouldn't be called if there are no items in the queue
-    Q_ASSERT(!mItemQueue.empty());
-    // We shouldn't be here with no interface
-    Q_ASSERT(mInterface);
-
-    qint64 itemId = mItemQueue.front();
-
-    // Fetch the actual item data (as it may have changed since it was enqueued)
-    // The fetch will hit the cache if the item wasn't changed.
+    QVector<qint64> items = mBatch;
+    items.reserve(items.size() + static_cast<int>(mItemQueue.size()));
+    items.insert(items.end(), mItemQueue.cbegin(), mItemQueue.cend());
 
-    PimItem actualItem = PimItem::retrieveById(itemId);
-
-    while (!actualItem.isValid()) {
-        // hum... item is gone ?
-        // FIXME: Signal to the manager that the item is no longer valid!
-        PreprocessorManager::instance()->preProcessorFinishedHandlingItem(this, itemId);
-
-        mItemQueue.pop_front();
-        if (mItemQueue.empty()) {
-            // nothing more to process for this instance: jump out
-            mBusy = false;
-            return;
-        }
-
-        // try the next one in the queue
-        itemId = mItemQueue.front();
-        actualItem = PimItem::retrieveById(itemId);
-    }
+    mBatch.clear();
+    mItemQueue.clear();
+    return items;
+}
 
-    // Ok.. got a valid item to process: collection and mimetype is known.
+void PreprocessorInstance::processNextBatch()
+{
+    // We shouldn't be called if there are no items in the queue
+    Q_ASSERT(!mItemQueue.empty());
+    Q_ASSERT(!isBusy());
 
-    qCDebug(AKONADISERVER_LOG) << "PreprocessorInstance::processHeadItem(): about to begin processing item " << itemId;
+    const int batchSize = std::min<int>(PreprocessorManager::instance()->batchSize(), mItemQueue.size());
+    mBatch.reserve(batchSize);
+    const auto batchEnd = mItemQueue.begin() + batchSize;
+    std::copy(mItemQueue.begin(), batchEnd, std::back_inserter(mBatch));
+    mItemQueue.erase(mItemQueue.begin(), batchEnd);
 
-    mBusy = true;
+    // The preprocessor fetches the items itself, items removed since they have
+    // been enqueued are simply acknowledged.
+    qCDebug(AKONADISERVER_LOG) << "PreprocessorInstance::processNextBatch(): about to begin processing" << mBatch.count() << "items";
 
     mItemProcessingStartDateTime = QDateTime::currentDateTime();
 
-    // The beginProcessItem() D-Bus call is asynchronous (marked with NoReply attribute)
-    mInterface->beginProcessItem(itemId, actualItem.collectionId(), actualItem.mimeType().name());
+    beginProcessItems(mBatch);
+}
+
+void PreprocessorInstance::beginProcessItems(const QVector<qint64> &ids)
+{
+    // We shouldn't be here with no interface
+    Q_ASSERT(mInterface);
 
-    qCDebug(AKONADISERVER_LOG) << "PreprocessorInstance::processHeadItem(): processing started for item " << itemId;
+    // The beginProcessItems() D-Bus call is asynchronous (marked with NoReply attribute)
+    mInterface->beginProcessItems(ids.toList());
 }
 
 qint64 PreprocessorInstance::currentProcessingTime()
 {
-    if (!mBusy) {
+    if (!isBusy()) {
         return -1; // nothing being processed
     }
 
@@ -151,7 +147,7 @@ qint64 PreprocessorInstance::currentProcessingTime()
 
 bool PreprocessorInstance::abortProcessing()
 {
-    Q_ASSERT_X(mBusy, "PreprocessorInstance::abortProcessing()", "You shouldn't call this method when isBusy() returns false");
+    Q_ASSERT_X(isBusy(), "PreprocessorInstance::abortProcessing()", "You shouldn't call this method when isBusy() returns false");
 
     OrgFreedesktopAkonadiAgentControlInterface iface(
         DBus::agentServiceName(mId, DBus::Agent),
@@ -177,7 +173,7 @@ bool PreprocessorInstance::abortProcessing()
 
 bool PreprocessorInstance::invokeRestart()
 {
-    Q_ASSERT_X(mBusy, "PreprocessorInstance::invokeRestart()", "You shouldn't call this method when isBusy() returns false");
+    Q_ASSERT_X(isBusy(), "PreprocessorInstance::invokeRestart()", "You shouldn't call this method when isBusy() returns false");
 
     OrgFreedesktopAkonadiAgentManagerInterface iface(
         DBus::serviceName(DBus::Control),
@@ -198,47 +194,53 @@ bool PreprocessorInstance::invokeRestart()
     return true;
 }
 
-void PreprocessorInstance::itemProcessed(qlonglong id)
+void PreprocessorInstance::itemsProcessed(const QList<qlonglong> &ids)
 {
-    qCDebug(AKONADISERVER_LOG) << "PreprocessorInstance::itemProcessed("  << id <<  ")";
+    qCDebug(AKONADISERVER_LOG) << "PreprocessorInstance::itemsProcessed("  << ids.count() << "items )";
 
-    // We shouldn't be called if there are no items in the queue
-    if (mItemQueue.empty()) {
+    // We shouldn't be called if there is no batch being processed
+    if (!isBusy()) {
         Tracer::self()->warning(
             QStringLiteral("PreprocessorInstance"),
-            QStringLiteral("Pre-processor instance '%1' emitted itemProcessed(%2) but we actually have no item in the queue")
+            QStringLiteral("Pre-processor instance '%1' emitted itemsProcessed() for %2 items but we actually have no batch in processing")
             .arg(mId)
-            .arg(id));
-        mBusy = false;
+            .arg(ids.count()));
         return; // preprocessor is buggy (FIXME: What now ?)
     }
 
-    // We should be busy now: this is more likely our fault, not the preprocessor's one.
-    Q_ASSERT(mBusy);
-
-    qlonglong itemId = mItemQueue.front();
+    // Only pass on the items which have actually been processed, the rest
+    // of the batch stays with this preprocessor
+    QVector<qint64> processed;
+    processed.reserve(ids.count());
+    int unknown = 0;
+    for (const qlonglong id : ids) {
+        if (mBatch.removeOne(id)) {
+            processed.push_back(id);
+        } else {
+            ++unknown;
+        }
+    }
 
-    if (itemId != id) {
+    if (unknown > 0) {
         Tracer::self()->warning(
             QStringLiteral("PreprocessorInstance"),
-            QStringLiteral("Pre-processor instance '%1' emitted itemProcessed(%2) but the head item in the queue has id %3")
+            QStringLiteral("Pre-processor instance '%1' emitted itemsProcessed() for %2 items which are not part of the current batch")
             .arg(mId)
-            .arg(id)
-            .arg(itemId));
-
-        // FIXME: And what now ?
+            .arg(unknown));
     }
-
-    mItemQueue.pop_front();
-
-    PreprocessorManager::instance()->preProcessorFinishedHandlingItem(this, itemId);
-
-    if (mItemQueue.empty()) {
-        // Nothing more to do
-        mBusy = false;
+    if (processed.isEmpty()) {
         return;
     }
 
-    // Stay busy and process next item in the queue
-    processHeadItem();
+    if (isBusy()) {
+        // Part of the batch is still being processed, the preprocessor is
+        // making progress so give it the full time for the remaining items
+        mItemProcessingStartDateTime = QDateTime::currentDateTime();
+    } else if (!mItemQueue.empty()) {
+        // Hand the next batch to the preprocessor before passing this one on,
+        // so that both stages of the chain can work at the same time
+        processNextBatch();
+    }
+
+    PreprocessorManager::instance()->preProcessorFinishedHandlingItems(this, processed);
 }
@@ -27,10 +27,12 @@
 
 #include <QObject>
 #include <QDateTime>
+#include <QVector>
 
 #include <deque>
 
 class OrgFreedesktopAkonadiPreprocessorInterface;
+class PreprocessorManagerTest;
 
 namespace Akonadi
 {
@@ -45,12 +47,19 @@ class AgentInstance;
  * Most of the interface of this class is protected and is exposed only
  * to PreprocessorManager (singleton).
  *
- * This class is NOT thread safe. The caller is responsible of protecting
- * against concurrent access.
+ * Items are sent to the preprocessor in batches. The preprocessor usually
+ * acknowledges a batch as a whole, but may also acknowledge parts of it.
+ * Acknowledged items are passed on right away, the next batch is only sent
+ * once all items of the current one have been acknowledged. Meanwhile newly
+ * enqueued items wait in the item queue.
+ *
+ * This class is NOT thread safe, it must only be used from the thread of
+ * the PreprocessorManager.
  */
 class PreprocessorInstance : public QObject
 {
     friend class PreprocessorManager;
+    friend class ::PreprocessorManagerTest;
 
     Q_OBJECT
 
@@ -59,7 +68,7 @@ protected:
     /**
      * Create an instance of a PreprocessorInstance descriptor.
      */
-    PreprocessorInstance(const QString &id);
+    explicit PreprocessorInstance(const QString &id);
 
 public: // This is public only for qDeleteAll() called from PreprocessorManager
     // ...for some reason couldn't convince gcc to have it as friend...
@@ -67,29 +76,27 @@ public: // This is public only for qDeleteAll() called from PreprocessorManager
     /**
      * Destroy this instance of the PreprocessorInstance descriptor.
      */
-    ~PreprocessorInstance();
+    ~PreprocessorInstance() override;
 
 private:
 
     /**
-     * The internal queue if item identifiers.
-     * The head item in the queue is the one currently being processed.
-     * The other ones are waiting.
+     * The internal queue of item identifiers waiting for the current
+     * batch to be acknowledged.
      */
     std::deque< qint64 > mItemQueue;
 
     /**
-     * Is this processor busy ?
-     * This, in fact, *should* be equivalent to "mItemQueue.count() > 0"
-     * as the head item in the queue is the one being processed now.
+     * The batch of items currently being processed by the preprocessor.
+     * The instance is busy as long as this is not empty.
      */
-    bool mBusy = false;
+    QVector< qint64 > mBatch;
 
     /**
      * The date-time at that we have started processing the current
-     * item in the queue. This is used to compute the processing time
+     * batch. This is used to compute the processing time
      * and eventually spot a "dead" preprocessor (which takes longer
-     * than N minutes to process an item).
+     * than N minutes to process a batch).
      */
     QDateTime mItemProcessingStartDateTime;
 
@@ -112,25 +119,39 @@ protected:
      * In case of failure this object should be destroyed as it can't
      * operate properly. The error message is printed via Tracer.
      */
-    bool init();
+    virtual bool init();
+
+    /**
+     * Sends the batch of @p ids to the preprocessor. The preprocessor
+     * acknowledges them with itemsProcessed() once it is done.
+     */
+    virtual void beginProcessItems(const QVector<qint64> &ids);
 
     /**
-     * Returns true if this preprocessor instance is currently processing an item.
-     * That is: if we have called "processItem()" on it and it hasn't emitted
-     * itemProcessed() yet.
+     * Returns true if this preprocessor instance is currently processing a batch.
+     * That is: if we have called "beginProcessItems()" on it and it hasn't emitted
+     * itemsProcessed() yet.
      */
     bool isBusy() const
     {
-        return mBusy;
+        return !mBatch.isEmpty();
     }
 
     /**
-     * Returns the time in seconds elapsed since the current item was submitted
-     * to the slave preprocessor instance. If no item is currently being
+     * Returns the time in seconds elapsed since the current batch was submitted
+     * to the slave preprocessor instance. If no batch is currently being
      * processed then this function returns -1;
      */
     qint64 currentProcessingTime();
 
+    /**
+     * Returns the number of items in the batch currently being processed.
+     */
+    int currentBatchSize() const
+    {
+        return mBatch.size();
+    }
+
     /**
      * Returns the id of this preprocessor. This is actually
      * the AgentInstance identifier but it's not a requirement.
@@ -141,24 +162,17 @@ protected:
     }
 
     /**
-     * Returns a pointer to the internal preprocessor instance
-     * item queue. Don't mess with it unless you *really* know
-     * what you're doing. Use enqueueItem() to add an item
-     * to the queue. This method is provided to the PreprocessorManager
-     * to take over the item queue of a dying preprocessor.
-     *
-     * The returned pointer is granted to be non null.
+     * Removes and returns all the items of this instance, the ones being
+     * processed as well as the waiting ones. This method is provided to the
+     * PreprocessorManager to take over the items of a dying preprocessor.
      */
-    std::deque< qint64 > *itemQueue()
-    {
-        return &mItemQueue;
-    }
+    QVector< qint64 > takeItems();
 
     /**
-     * This is called by PreprocessorManager to enqueue a PimItem
+     * This is called by PreprocessorManager to enqueue PimItems
      * for processing by this preprocessor instance.
      */
-    void enqueueItem(qint64 itemId);
+    void enqueueItems(const QVector< qint64 > &itemIds);
 
     /**
      * Attempts to abort the processing of the current item.
@@ -180,18 +194,19 @@ protected:
 private:
 
     /**
-     * This function starts processing of the first item in mItemQueue.
-     * It's only used internally.
+     * This function sends the next batch of items from mItemQueue
+     * to the preprocessor. It's only used internally.
      */
-    void processHeadItem();
+    void processNextBatch();
 
-private Q_SLOTS:
+protected Q_SLOTS:
 
     /**
-     * This is invoked to signal that the processing of the current (head)
-     * item has terminated and the next item should be processed.
+     * This is invoked to signal that the processing of the given items of
+     * the current batch has terminated. Once the whole batch is done the
+     * next batch is processed.
      */
-    void itemProcessed(qlonglong id);
+    void itemsProcessed(const QList<qlonglong> &ids);
 
 }; // class PreprocessorInstance
 
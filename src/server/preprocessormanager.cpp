@@ -27,10 +27,13 @@
 
 #include "entities.h" // Akonadi::Server::PimItem
 #include "storage/datastore.h"
+#include "storage/transaction.h"
 #include "tracer.h"
 
 #include "preprocessormanageradaptor.h"
 
+#include <algorithm>
+
 namespace Akonadi
 {
 namespace Server
@@ -38,6 +41,9 @@ namespace Server
 
 const int gHeartbeatTimeoutInMSecs = 30000; // 30 sec heartbeat
 
+// The timeouts below are per item, they are multiplied by the number of
+// items in the batch being processed.
+
 // 2 minutes should be really enough to process an item.
 // After this timeout elapses we assume that the preprocessor
 // is "stuck" and we attempt to kick it by requesting an abort().
@@ -59,8 +65,8 @@ PreprocessorManager *PreprocessorManager::mSelf = nullptr;
 
 PreprocessorManager::PreprocessorManager()
     : QObject()
+    , mInstanceCount(0)
     , mEnabled(true)
-    , mMutex(new QMutex())
 {
     mSelf = this; // just to have it set early
     // Hook in our D-Bus interface "shell".
@@ -87,9 +93,6 @@ PreprocessorManager::~PreprocessorManager()
     //        they are "closer to the DB" from this point of view.
 
     qDeleteAll(mPreprocessorChain);
-    qDeleteAll(mTransactionWaitQueueHash);   // this should also disconnect all the signals from the data store objects...
-
-    delete mMutex;
 }
 
 bool PreprocessorManager::init()
@@ -109,15 +112,13 @@ void PreprocessorManager::done()
 
 bool PreprocessorManager::isActive()
 {
-    QMutexLocker locker(mMutex);
-
     if (!mEnabled) {
         return false;
     }
-    return !mPreprocessorChain.isEmpty();
+    return mInstanceCount > 0;
 }
 
-PreprocessorInstance *PreprocessorManager::lockedFindInstance(const QString &id)
+PreprocessorInstance *PreprocessorManager::findInstance(const QString &id)
 {
     for (PreprocessorInstance *instance : qAsConst(mPreprocessorChain)) {
         if (instance->id() == id) {
@@ -130,20 +131,13 @@ PreprocessorInstance *PreprocessorManager::lockedFindInstance(const QString &id)
 
 void PreprocessorManager::registerInstance(const QString &id)
 {
-    QMutexLocker locker(mMutex);
-
     qCDebug(AKONADISERVER_LOG) << "PreprocessorManager::registerInstance(" << id << ")";
 
-    PreprocessorInstance *instance = lockedFindInstance(id);
-    if (instance) {
+    if (findInstance(id)) {
         return; // already registered
     }
 
-    // The PreprocessorInstance objects are actually always added at the end of the queue
-    // TODO: Maybe we need some kind of ordering here ?
-    //       In that case we'll need to fiddle with the items that are currently enqueued for processing...
-
-    instance = new PreprocessorInstance(id);
+    auto *instance = new PreprocessorInstance(id);
     if (!instance->init()) {
         Tracer::self()->warning(
             QStringLiteral("PreprocessorManager"),
@@ -153,53 +147,49 @@ void PreprocessorManager::registerInstance(const QString &id)
         return;
     }
 
-    qCDebug(AKONADISERVER_LOG) << "Registering preprocessor instance " << id;
+    registerInstance(instance);
+}
 
+void PreprocessorManager::registerInstance(PreprocessorInstance *instance)
+{
+    qCDebug(AKONADISERVER_LOG) << "Registering preprocessor instance " << instance->id();
+
+    // The PreprocessorInstance objects are actually always added at the end of the queue
+    // TODO: Maybe we need some kind of ordering here ?
+    //       In that case we'll need to fiddle with the items that are currently enqueued for processing...
     mPreprocessorChain.append(instance);
+    mInstanceCount = mPreprocessorChain.count();
 }
 
 void PreprocessorManager::unregisterInstance(const QString &id)
 {
-    QMutexLocker locker(mMutex);
-
     qCDebug(AKONADISERVER_LOG) << "PreprocessorManager::unregisterInstance(" << id << ")";
 
-    lockedUnregisterInstance(id);
-}
-
-void PreprocessorManager::lockedUnregisterInstance(const QString &id)
-{
-    PreprocessorInstance *instance = lockedFindInstance(id);
+    PreprocessorInstance *instance = findInstance(id);
     if (!instance) {
         return; // not our instance: don't complain (as we might be called for non-preprocessor agents too)
     }
 
     // All of the preprocessor's waiting items must be queued to the next preprocessor (if there is one)
+    const QVector<qint64> items = instance->takeItems();
 
-    std::deque< qint64 > *itemList = instance->itemQueue();
-    Q_ASSERT(itemList);
-
-    int idx = mPreprocessorChain.indexOf(instance);
+    const int idx = mPreprocessorChain.indexOf(instance);
     Q_ASSERT(idx >= 0);   // must be there!
 
-    if (idx < (mPreprocessorChain.count() - 1)) {
-        // This wasn't the last preprocessor: trigger the next one.
-        PreprocessorInstance *nextPreprocessor = mPreprocessorChain[idx + 1];
-        Q_ASSERT(nextPreprocessor);
-        Q_ASSERT(nextPreprocessor != instance);
+    mPreprocessorChain.removeAt(idx);
+    mInstanceCount = mPreprocessorChain.count();
+    delete instance;
 
-        for (qint64 itemId : *itemList) {
-            nextPreprocessor->enqueueItem(itemId);
-        }
+    if (items.isEmpty()) {
+        return;
+    }
+    if (idx < mPreprocessorChain.count()) {
+        // This wasn't the last preprocessor: trigger the next one.
+        mPreprocessorChain[idx]->enqueueItems(items);
     } else {
         // This was the last preprocessor: end handling the items
-        for (qint64 itemId : *itemList) {
-            lockedEndHandleItem(itemId);
-        }
+        endHandleItems(items);
     }
-
-    mPreprocessorChain.removeOne(instance);
-    delete instance;
 }
 
 void PreprocessorManager::beginHandleItem(const PimItem &item, const DataStore *dataStore)
@@ -208,7 +198,6 @@ void PreprocessorManager::beginHandleItem(const PimItem &item, const DataStore *
     Q_ASSERT(item.isValid());
 
     // This is the entry point of the pre-processing chain.
-    QMutexLocker locker(mMutex);
 
     if (!mEnabled) {
         // Preprocessing is disabled: immediately end handling the item.
@@ -219,7 +208,7 @@ void PreprocessorManager::beginHandleItem(const PimItem &item, const DataStore *
 
         qCWarning(AKONADISERVER_LOG) << "PreprocessorManager::beginHandleItem(" << item.id() << ") called with a disabled preprocessor";
 
-        lockedEndHandleItem(item.id());
+        endHandleItems({ item.id() });
         return;
     }
 
@@ -228,9 +217,9 @@ void PreprocessorManager::beginHandleItem(const PimItem &item, const DataStore *
     Q_ASSERT_X(item.hidden(), "PreprocessorManager::beginHandleItem()", "The item you pass to this function should be hidden!");
 #endif
 
-    if (mPreprocessorChain.isEmpty()) {
+    if (mInstanceCount == 0) {
         // No preprocessors at all: immediately end handling the item.
-        lockedEndHandleItem(item.id());
+        endHandleItems({ item.id() });
         return;
     }
 
@@ -238,13 +227,11 @@ void PreprocessorManager::beginHandleItem(const PimItem &item, const DataStore *
         qCDebug(AKONADISERVER_LOG) << "PreprocessorManager::beginHandleItem(" << item.id() << "): the DataStore is in transaction, pushing item to a wait queue";
 
         // The calling thread data store is in a transaction: push the item into a wait queue
-        std::deque< qint64 > *waitQueue = mTransactionWaitQueueHash.value(dataStore, nullptr);
-
-        if (!waitQueue) {
+        QMutexLocker locker(&mWaitQueueLock);
+        auto waitQueue = mTransactionWaitQueueHash.find(dataStore);
+        if (waitQueue == mTransactionWaitQueueHash.end()) {
             // No wait queue for this transaction yet...
-            waitQueue = new std::deque< qint64 >();
-
-            mTransactionWaitQueueHash.insert(dataStore, waitQueue);
+            waitQueue = mTransactionWaitQueueHash.insert(dataStore, {});
 
             // This will usually end up being a queued connection.
             QObject::connect(dataStore, &QObject::destroyed, this, &PreprocessorManager::dataStoreDestroyed);
@@ -258,66 +245,62 @@ void PreprocessorManager::beginHandleItem(const PimItem &item, const DataStore *
         return;
     }
 
-    // The calling thread data store is NOT in a transaction: we can proceed directly.
-    lockedActivateFirstPreprocessor(item.id());
+    // The calling thread data store is NOT in a transaction: we can proceed directly,
+    // but the chain is only touched from our own thread.
+    const qint64 itemId = item.id();
+    QMetaObject::invokeMethod(this, [this, itemId]() {
+        activateFirstPreprocessor({ itemId });
+    }, Qt::QueuedConnection);
 }
 
-void PreprocessorManager::lockedActivateFirstPreprocessor(qint64 itemId)
+void PreprocessorManager::activateFirstPreprocessor(const QVector<qint64> &itemIds)
 {
+    if (!mEnabled || mPreprocessorChain.isEmpty()) {
+        // Preprocessing has been disabled in the meantime or all the preprocessors died
+        endHandleItems(itemIds);
+        return;
+    }
+
     // Activate the first preprocessor.
-    PreprocessorInstance *preProcessor = mPreprocessorChain.first();
-    Q_ASSERT(preProcessor);
-
-    preProcessor->enqueueItem(itemId);
-    // The preprocessor will call our "preProcessorFinishedHandlingItem() method"
-    // when done with the item.
-    //
-    // The call should be asynchronous, that is it should never happen that
-    // preProcessorFinishedHandlingItem() is called from "inside" enqueueItem()...
-    // FIXME: Am I *really* sure of this ? If I'm wrong for some obscure reason then we have a deadlock.
+    // The preprocessor will call our "preProcessorFinishedHandlingItems() method"
+    // when done with the items.
+    mPreprocessorChain.first()->enqueueItems(itemIds);
 }
 
-void PreprocessorManager::lockedKillWaitQueue(const DataStore *dataStore, bool disconnectSlots)
+QVector<qint64> PreprocessorManager::takeWaitQueue(const DataStore *dataStore, bool disconnectSlots)
 {
-    std::deque< qint64 > *waitQueue = mTransactionWaitQueueHash.value(dataStore, nullptr);
-    if (!waitQueue) {
-        qCWarning(AKONADISERVER_LOG) << "PreprocessorManager::lockedKillWaitQueue(): called for dataStore which has no wait queue";
-        return;
+    QVector<qint64> waitQueue;
+    {
+        QMutexLocker locker(&mWaitQueueLock);
+        auto it = mTransactionWaitQueueHash.find(dataStore);
+        if (it == mTransactionWaitQueueHash.end()) {
+            qCWarning(AKONADISERVER_LOG) << "PreprocessorManager::takeWaitQueue(): called for dataStore which has no wait queue";
+            return waitQueue;
+        }
+        waitQueue = std::move(*it);
+        mTransactionWaitQueueHash.erase(it);
     }
 
-    mTransactionWaitQueueHash.remove(dataStore);
-
-    delete waitQueue;
-
-    if (!disconnectSlots) {
-        return;
+    if (disconnectSlots) {
+        QObject::disconnect(dataStore, &QObject::destroyed, this, &PreprocessorManager::dataStoreDestroyed);
+        QObject::disconnect(dataStore, &DataStore::transactionCommitted, this, &PreprocessorManager::dataStoreTransactionCommitted);
+        QObject::disconnect(dataStore, &DataStore::transactionRolledBack, this, &PreprocessorManager::dataStoreTransactionRolledBack);
     }
 
-    QObject::disconnect(dataStore, &QObject::destroyed, this, &PreprocessorManager::dataStoreDestroyed);
-    QObject::disconnect(dataStore, &DataStore::transactionCommitted, this, &PreprocessorManager::dataStoreTransactionCommitted);
-    QObject::disconnect(dataStore, &DataStore::transactionRolledBack, this, &PreprocessorManager::dataStoreTransactionRolledBack);
-
+    return waitQueue;
 }
 
 void PreprocessorManager::dataStoreDestroyed()
 {
-    QMutexLocker locker(mMutex);
-
     qCDebug(AKONADISERVER_LOG) << "PreprocessorManager::dataStoreDestroyed(): killing the wait queue";
 
-    const DataStore *dataStore = dynamic_cast< const DataStore *>(sender());
-    if (!dataStore) {
-        qCWarning(AKONADISERVER_LOG) << "PreprocessorManager::dataStoreDestroyed(): got the signal from a non DataStore object";
-        return;
-    }
-
-    lockedKillWaitQueue(dataStore, false);   // no need to disconnect slots, qt will do that
+    // The object is being destroyed, don't try to cast it, we only use the pointer as a key
+    const auto *dataStore = static_cast<const DataStore *>(sender());
+    takeWaitQueue(dataStore, false);   // no need to disconnect slots, qt will do that
 }
 
 void PreprocessorManager::dataStoreTransactionCommitted()
 {
-    QMutexLocker locker(mMutex);
-
     qCDebug(AKONADISERVER_LOG) << "PreprocessorManager::dataStoreTransactionCommitted(): pushing items in wait queue to the preprocessing chain";
 
     const DataStore *dataStore = dynamic_cast< const DataStore *>(sender());
@@ -326,46 +309,29 @@ void PreprocessorManager::dataStoreTransactionCommitted()
         return;
     }
 
-    std::deque< qint64 > *waitQueue = mTransactionWaitQueueHash.value(dataStore, nullptr);
-    if (!waitQueue) {
-        qCWarning(AKONADISERVER_LOG) << "PreprocessorManager::dataStoreTransactionCommitted(): called for dataStore which has no wait queue";
-        return;
+    // disconnect slots this time
+    const QVector<qint64> waitQueue = takeWaitQueue(dataStore, true);
+    if (!waitQueue.isEmpty()) {
+        activateFirstPreprocessor(waitQueue);
     }
-
-    if (!mEnabled || mPreprocessorChain.isEmpty()) {
-        // Preprocessing has been disabled in the meantime or all the preprocessors died
-        for (qint64 id : *waitQueue) {
-            lockedEndHandleItem(id);
-        }
-    } else {
-        for (qint64 id : *waitQueue) {
-            lockedActivateFirstPreprocessor(id);
-        }
-    }
-
-    lockedKillWaitQueue(dataStore, true);   // disconnect slots this time
 }
 
 void PreprocessorManager::dataStoreTransactionRolledBack()
 {
-    QMutexLocker locker(mMutex);
-
     qCDebug(AKONADISERVER_LOG) << "PreprocessorManager::dataStoreTransactionRolledBack(): killing the wait queue";
 
     const DataStore *dataStore = dynamic_cast< const DataStore *>(sender());
     if (!dataStore) {
-        qCWarning(AKONADISERVER_LOG) << "PreprocessorManager::dataStoreTransactionCommitted(): got the signal from a non DataStore object";
+        qCWarning(AKONADISERVER_LOG) << "PreprocessorManager::dataStoreTransactionRolledBack(): got the signal from a non DataStore object";
         return;
     }
 
-    lockedKillWaitQueue(dataStore, true);   // disconnect slots this time
+    takeWaitQueue(dataStore, true);   // disconnect slots this time
 }
 
-void PreprocessorManager::preProcessorFinishedHandlingItem(PreprocessorInstance *preProcessor, qint64 itemId)
+void PreprocessorManager::preProcessorFinishedHandlingItems(PreprocessorInstance *preProcessor, const QVector<qint64> &itemIds)
 {
-    QMutexLocker locker(mMutex);
-
-    int idx = mPreprocessorChain.indexOf(preProcessor);
+    const int idx = mPreprocessorChain.indexOf(preProcessor);
     Q_ASSERT(idx >= 0);   // must be there!
 
     if (idx < (mPreprocessorChain.count() - 1)) {
@@ -374,47 +340,49 @@ void PreprocessorManager::preProcessorFinishedHandlingItem(PreprocessorInstance
         Q_ASSERT(nextPreprocessor);
         Q_ASSERT(nextPreprocessor != preProcessor);
 
-        nextPreprocessor->enqueueItem(itemId);
+        nextPreprocessor->enqueueItems(itemIds);
     } else {
-        // This was the last preprocessor: end handling the item.
-        lockedEndHandleItem(itemId);
+        // This was the last preprocessor: end handling the items.
+        endHandleItems(itemIds);
     }
 }
 
-void PreprocessorManager::lockedEndHandleItem(qint64 itemId)
+void PreprocessorManager::endHandleItems(const QVector<qint64> &itemIds)
 {
     // The exit point of the pre-processing chain.
 
-    // Refetch the PimItem, the Collection and the MimeType now: preprocessing might have changed them.
-    PimItem item = PimItem::retrieveById(itemId);
-    if (!item.isValid()) {
-        // HUM... the preprocessor killed the item ?
-        // ... or retrieveById() failed ?
-        // Well.. if the preprocessor killed the item then this might be actually OK (spam?).
-        qCDebug(AKONADISERVER_LOG) << "Invalid PIM item id '" << itemId << "' passed to preprocessing chain termination function";
-        return;
-    }
+    // Unhide the whole batch in a single transaction
+    Transaction transaction(DataStore::self(), QStringLiteral("PREPROCESSOR UNHIDE"));
+
+    for (qint64 itemId : itemIds) {
+        // Refetch the PimItem, the Collection and the MimeType now: preprocessing might have changed them.
+        PimItem item = PimItem::retrieveById(itemId);
+        if (!item.isValid()) {
+            // HUM... the preprocessor killed the item ?
+            // ... or retrieveById() failed ?
+            // Well.. if the preprocessor killed the item then this might be actually OK (spam?).
+            qCDebug(AKONADISERVER_LOG) << "Invalid PIM item id '" << itemId << "' passed to preprocessing chain termination function";
+            continue;
+        }
 
-#if 0
-    if (!item.hidden()) {
-        // HUM... the item was already unhidden for some reason: we have nothing more to do here.
-        qCDebug(AKONADISERVER_LOG) << "The PIM item with id '" << itemId << "' reached the preprocessing chain termination function in unhidden state";
-        return;
+        if (!DataStore::self()->unhidePimItem(item)) {
+            Tracer::self()->warning(
+                QStringLiteral("PreprocessorManager"),
+                QStringLiteral("Failed to unhide the PIM item '%1': data is not lost but a server restart is required in order to unhide it")
+                .arg(itemId));
+        }
     }
-#endif
 
-    if (!DataStore::self()->unhidePimItem(item)) {
+    if (!transaction.commit()) {
         Tracer::self()->warning(
             QStringLiteral("PreprocessorManager"),
-            QStringLiteral("Failed to unhide the PIM item '%1': data is not lost but a server restart is required in order to unhide it")
-            .arg(itemId));
+            QStringLiteral("Failed to unhide %1 PIM items: data is not lost but a server restart is required in order to unhide them")
+            .arg(itemIds.count()));
     }
 }
 
 void PreprocessorManager::heartbeat()
 {
-    QMutexLocker locker(mMutex);
-
     // Loop through the processor instances and check their current processing time.
 
     QList< PreprocessorInstance *> firedPreprocessors;
@@ -422,9 +390,10 @@ void PreprocessorManager::heartbeat()
     for (PreprocessorInstance *instance : qAsConst(mPreprocessorChain)) {
         // In this loop we check for "stuck" preprocessors.
 
-        int elapsedTime = instance->currentProcessingTime();
+        const qint64 elapsedTime = instance->currentProcessingTime();
+        const qint64 batchSize = std::max(1, instance->currentBatchSize());
 
-        if (elapsedTime < gWarningItemProcessingTimeInSecs) {
+        if (elapsedTime < gWarningItemProcessingTimeInSecs * batchSize) {
             continue; // ok, still in time.
         }
 
@@ -439,7 +408,7 @@ void PreprocessorManager::heartbeat()
         // - if it doesn't obey, we drop the interface and assume it's dead until
         //   it's effectively restarted.
 
-        if (elapsedTime < gMaximumItemProcessingTimeInSecs) {
+        if (elapsedTime < gMaximumItemProcessingTimeInSecs * batchSize) {
             // Kindly ask the preprocessor to abort the job.
 
             Tracer::self()->warning(
@@ -453,7 +422,7 @@ void PreprocessorManager::heartbeat()
             // If we're here then abortProcessing() failed.
         }
 
-        if (elapsedTime < gDeadlineItemProcessingTimeInSecs) {
+        if (elapsedTime < gDeadlineItemProcessingTimeInSecs * batchSize) {
             // Attempt to restart the preprocessor via AgentManager interface
 
             Tracer::self()->warning(
@@ -478,6 +447,6 @@ void PreprocessorManager::heartbeat()
 
     // Kill the fired preprocessors, if any.
     for (PreprocessorInstance *instance : qAsConst(firedPreprocessors)) {
-        lockedUnregisterInstance(instance->id());
+        unregisterInstance(instance->id());
     }
 }
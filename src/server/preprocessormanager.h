@@ -28,11 +28,13 @@
 #include <QObject>
 #include <QList>
 #include <QHash>
+#include <QMutex>
+#include <QVector>
 
-#include <deque>
+#include <atomic>
 
 class QTimer;
-class QMutex;
+class PreprocessorManagerTest;
 
 #include "preprocessorinstance.h"
 
@@ -67,10 +69,21 @@ class DataStore;
  * from the preprocessor instances (which are separate processes).
  * This class, then, takes care of holding the newly arrived items
  * in a wait queue until their transaction is committed (or rolled back).
+ *
+ * The items are passed along the chain in batches: each preprocessor
+ * receives a list of items and acknowledges them all at once, the
+ * acknowledged batch then moves on to the next preprocessor while the
+ * first one already works on the following batch.
+ *
+ * The preprocessor chain and the queues of the preprocessor instances are
+ * only touched from the thread of the PreprocessorManager, items arriving
+ * from other threads are handed over to it. Only the transaction wait
+ * queues are shared between threads and protected by a mutex.
  */
 class PreprocessorManager : public QObject
 {
     friend class PreprocessorInstance;
+    friend class ::PreprocessorManagerTest;
 
     Q_OBJECT
     Q_CLASSINFO("D-Bus Interface", "org.freedesktop.Akonadi.PreprocessorManager")
@@ -99,7 +112,13 @@ protected:
      * The hashtable of transaction wait queues. There is one wait
      * queue for each DataStore that is currently in a transaction.
      */
-    QHash< const DataStore *, std::deque< qint64 > *> mTransactionWaitQueueHash;
+    QHash< const DataStore *, QVector< qint64 > > mTransactionWaitQueueHash;
+
+    /**
+     * The mutex used to protect mTransactionWaitQueueHash, which is
+     * filled from the connection threads.
+     */
+    QMutex mWaitQueueLock;
 
     /**
      * The preprocessor chain.
@@ -110,6 +129,11 @@ protected:
      */
     QList< PreprocessorInstance *> mPreprocessorChain;
 
+    /**
+     * The number of instances in mPreprocessorChain, readable from any thread.
+     */
+    std::atomic_int mInstanceCount;
+
     /**
      * Is preprocessing enabled at all in this Akonadi server instance?
      * This is true by default and can be set via setEnabled().
@@ -118,10 +142,9 @@ protected:
     bool mEnabled;
 
     /**
-     * The mutex used to protect the internals of this class  (mainly
-     * the mPreprocessorChain member).
+     * The maximum number of items sent to a preprocessor at once.
      */
-    QMutex *mMutex = nullptr;
+    int mBatchSize = 50;
 
     /**
      * The heartbeat timer. Used mainly to expire preprocessor jobs.
@@ -202,6 +225,23 @@ public:
         mEnabled = enabled;
     }
 
+    /**
+     * Returns the maximum number of items a preprocessor receives at once.
+     */
+    int batchSize() const
+    {
+        return mBatchSize;
+    }
+
+    /**
+     * Sets the maximum number of items a preprocessor receives at once.
+     * Only affects the batches that are not sent yet.
+     */
+    void setBatchSize(int batchSize)
+    {
+        mBatchSize = qMax(1, batchSize);
+    }
+
     /**
      * Trigger the preprocessor chain for the specified item.
      * The item should have been added to the Akonadi database via
@@ -222,15 +262,11 @@ public:
 
     /**
      * This is called via D-Bus from AgentManager to register a preprocessor instance.
-     *
-     * This function is thread-safe.
      */
     void registerInstance(const QString &id);
 
     /**
      * This is called via D-Bus from AgentManager to unregister a preprocessor instance.
-     *
-     * This function is thread-safe.
      */
     void unregisterInstance(const QString &id);
 
@@ -238,45 +274,40 @@ protected:
 
     /**
      * This is called by PreprocessorInstance to signal that a certain preprocessor has finished
-     * handling an item.
-     *
-     * This function is thread-safe.
+     * handling a batch of items.
      */
-    void preProcessorFinishedHandlingItem(PreprocessorInstance *preProcessor, qint64 itemId);
+    void preProcessorFinishedHandlingItems(PreprocessorInstance *preProcessor, const QVector<qint64> &itemIds);
 
 private:
 
     /**
-     * Finds the preprocessor instance by its identifier.
-     *
-     * This must be called with mMutex locked.
+     * Appends the initialized @p instance to the preprocessor chain.
      */
-    PreprocessorInstance *lockedFindInstance(const QString &id);
+    void registerInstance(PreprocessorInstance *instance);
 
     /**
-     * Pushes the specified item to the first preprocessor.
-     * The caller *MUST* make sure that there is at least one preprocessor in the chain.
+     * Finds the preprocessor instance by its identifier.
      */
-    void lockedActivateFirstPreprocessor(qint64 itemId);
+    PreprocessorInstance *findInstance(const QString &id);
 
     /**
-     * This is called internally to terminate the pre-processing
-     * chain for the specified Item. All the preprocessors have
-     * been triggered for it.
-     *
-     * This must be called with mMutex locked.
+     * Pushes the specified items to the first preprocessor, or ends handling
+     * them if there is no preprocessor anymore.
      */
-    void lockedEndHandleItem(qint64 itemId);
+    void activateFirstPreprocessor(const QVector<qint64> &itemIds);
 
     /**
-     * This is the unprotected core of the unregisterInstance() function above.
+     * This is called internally to terminate the pre-processing
+     * chain for the specified Items. All the preprocessors have
+     * been triggered for them.
      */
-    void lockedUnregisterInstance(const QString &id);
+    void endHandleItems(const QVector<qint64> &itemIds);
 
     /**
-     * Kill the wait queue for the specific DataStore object.
+     * Removes the wait queue for the specific DataStore object and
+     * returns its items.
      */
-    void lockedKillWaitQueue(const DataStore *dataStore, bool disconnectSlots);
+    QVector<qint64> takeWaitQueue(const DataStore *dataStore, bool disconnectSlots);
 
 private Q_SLOTS:
 
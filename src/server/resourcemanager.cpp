@@ -21,6 +21,7 @@
 #include "tracer.h"
 #include "storage/datastore.h"
 #include "storage/transaction.h"
+#include "storage/tagcache.h"
 #include "resourcemanageradaptor.h"
 
 #include <shared/akranges.h>
@@ -68,6 +69,9 @@ void ResourceManager::removeResourceInstance(const QString &name)
 
         // remove resource
         resource.remove();
+
+        // tag remote IDs of the resource are gone as well
+        TagCache::self()->invalidate();
     }
 }
 
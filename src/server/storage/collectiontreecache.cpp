@@ -21,11 +21,13 @@
 #include "entities.h"
 #include "commandcontext.h"
 #include "selectquerybuilder.h"
+#include "queryhelper.h"
 #include "akonadiserver_debug.h"
 
 #include <private/scope_p.h>
 
 #include <QStack>
+#include <QSqlQuery>
 
 #include <map>
 #include <iterator>
@@ -46,6 +48,20 @@ namespace {
         ReferencedColumn,
         ResourceNameColumn
     };
+
+QVector<Collection> toCollections(const QVector<CollectionTreeCache::CachedCollection> &ancestors,
+                                  const QVector<CollectionTreeCache::CachedCollection> &subtree)
+{
+    QVector<Collection> cols;
+    cols.reserve(ancestors.size() + subtree.size());
+    for (const auto &cached : ancestors) {
+        cols.push_back(cached.collection);
+    }
+    for (const auto &cached : subtree) {
+        cols.push_back(cached.collection);
+    }
+    return cols;
+}
 }
 
 
@@ -91,12 +107,37 @@ CollectionTreeCache::~CollectionTreeCache()
     quitThread();
 }
 
+bool CollectionTreeCache::isPopulated() const
+{
+    return mPopulated.load() == 1;
+}
+
 void CollectionTreeCache::init()
 {
     AkThread::init();
 
+    populate();
+}
+
+void CollectionTreeCache::invalidate()
+{
+    mPopulated = 0;
+    QMetaObject::invokeMethod(this, "populate", Qt::QueuedConnection);
+}
+
+void CollectionTreeCache::clear()
+{
+    delete mRoot;
+    mRoot = nullptr;
+    mNodeLookup.clear();
+}
+
+void CollectionTreeCache::populate()
+{
     QWriteLocker locker(&mLock);
 
+    clear();
+
     mRoot = new Node;
     mRoot->id = 0;
     mRoot->parent = nullptr;
@@ -182,12 +223,55 @@ void CollectionTreeCache::init()
 
     Q_ASSERT(pendingNodes.empty());
     Q_ASSERT(mNodeLookup.size() == collections.count() + 1 /* root */);
+
+    // Mimetypes and attributes of all collections, each in a single query
+    {
+        QueryBuilder qb(CollectionMimeTypeRelation::tableName());
+        qb.addColumn(CollectionMimeTypeRelation::leftFullColumnName());
+        qb.addColumn(CollectionMimeTypeRelation::rightFullColumnName());
+        qb.addSortColumn(CollectionMimeTypeRelation::leftFullColumnName(), Query::Ascending);
+        qb.addSortColumn(CollectionMimeTypeRelation::rightFullColumnName(), Query::Ascending);
+        if (!qb.exec()) {
+            qCCritical(AKONADISERVER_LOG) << "Failed to retrieve collection mimetypes for Collection tree cache!";
+            clear();
+            return;
+        }
+        QSqlQuery query = qb.query();
+        while (query.next()) {
+            if (auto node = mNodeLookup.value(query.value(0).toLongLong(), nullptr)) {
+                node->mimeTypes.push_back(query.value(1).toLongLong());
+            }
+        }
+        query.finish();
+    }
+    {
+        SelectQueryBuilder<CollectionAttribute> qb;
+        qb.addSortColumn(CollectionAttribute::collectionIdFullColumnName(), Query::Ascending);
+        qb.addSortColumn(CollectionAttribute::idFullColumnName(), Query::Ascending);
+        if (!qb.exec()) {
+            qCCritical(AKONADISERVER_LOG) << "Failed to retrieve collection attributes for Collection tree cache!";
+            clear();
+            return;
+        }
+        const auto attributes = qb.result();
+        for (const auto &attr : attributes) {
+            if (auto node = mNodeLookup.value(attr.collectionId(), nullptr)) {
+                node->attributes.push_back(attr);
+            }
+        }
+    }
+
     // Now we should have a complete tree built, yay!
+    mPopulated = 1;
 }
 
 void CollectionTreeCache::quit()
 {
-    delete mRoot;
+    {
+        QWriteLocker locker(&mLock);
+        mPopulated = 0;
+        clear();
+    }
 
     AkThread::quit();
 }
@@ -195,21 +279,40 @@ void CollectionTreeCache::quit()
 void CollectionTreeCache::collectionAdded(const Collection &col)
 {
     QWriteLocker locker(&mLock);
+    if (!mPopulated) {
+        // Will be picked up by populate()
+        return;
+    }
 
     auto parent = mNodeLookup.value(col.parentId(), nullptr);
     if (!parent) {
         qCWarning(AKONADISERVER_LOG) << "Received a new collection (" << col.id() << ") with unknown parent (" << col.parentId() << ")";
+        invalidate();
         return;
     }
 
-    auto node = new Node(col);
-    parent->appendChild(node);
-    mNodeLookup.insert(node->id, node);
+    auto node = mNodeLookup.value(col.id(), nullptr);
+    if (node) {
+        // We already know the collection, the notification was delayed past populate()
+        if (node->parent != parent) {
+            node->parent->removeChild(node);
+            parent->appendChild(node);
+        }
+    } else {
+        node = new Node;
+        node->id = col.id();
+        parent->appendChild(node);
+        mNodeLookup.insert(node->id, node);
+    }
+    node->collection = Collection();
 }
 
 void CollectionTreeCache::collectionChanged(const Collection &col)
 {
     QWriteLocker locker(&mLock);
+    if (!mPopulated) {
+        return;
+    }
 
     auto node = mNodeLookup.value(col.id(), nullptr);
     if (!node) {
@@ -217,19 +320,21 @@ void CollectionTreeCache::collectionChanged(const Collection &col)
         return;
     }
 
-    // Only update non-expired nodes
-    if (node->collection.isValid()) {
-        node->collection = col;
-    }
+    // Reload on next access, the change may have also touched mimetypes or attributes
+    node->collection = Collection();
 }
 
 void CollectionTreeCache::collectionMoved(const Collection &col)
 {
     QWriteLocker locker(&mLock);
+    if (!mPopulated) {
+        return;
+    }
 
     auto node = mNodeLookup.value(col.id(), nullptr);
     if (!node) {
         qCWarning(AKONADISERVER_LOG) << "Received an unknown moved collection (" << col.id() << ")";
+        invalidate();
         return;
     }
     auto oldParent = node->parent;
@@ -237,19 +342,23 @@ void CollectionTreeCache::collectionMoved(const Collection &col)
     auto newParent = mNodeLookup.value(col.parentId(), nullptr);
     if (!newParent) {
         qCWarning(AKONADISERVER_LOG) << "Received a moved collection (" << col.id() << ") with an unknown move destination (" << col.parentId() << ")";
+        invalidate();
         return;
     }
 
-    oldParent->removeChild(node);
-    newParent->appendChild(node);
-    if (node->collection.isValid()) {
-        node->collection = col;
+    if (oldParent != newParent) {
+        oldParent->removeChild(node);
+        newParent->appendChild(node);
     }
+    node->collection = Collection();
 }
 
 void CollectionTreeCache::collectionRemoved(const Collection &col)
 {
     QWriteLocker locker(&mLock);
+    if (!mPopulated) {
+        return;
+    }
 
     auto node = mNodeLookup.value(col.id(), nullptr);
     if (!node) {
@@ -257,19 +366,26 @@ void CollectionTreeCache::collectionRemoved(const Collection &col)
         return;
     }
 
-    auto parent = node->parent;
-    parent->removeChild(node);
-    mNodeLookup.remove(node->id);
-    delete node;
+    removeNode(node);
 }
 
-
+void CollectionTreeCache::removeNode(Node *node)
+{
+    node->parent->removeChild(node);
+
+    // The whole subtree goes away with the node
+    QVector<Node *> toVisit = { node };
+    while (!toVisit.isEmpty()) {
+        auto n = toVisit.takeLast();
+        mNodeLookup.remove(n->id);
+        toVisit += n->children;
+    }
+    delete node;
+}
 
 CollectionTreeCache::Node *CollectionTreeCache::findNode(const QString &rid,
                                                          const QString &resource) const
 {
-    QReadLocker locker(&mLock);
-
     // Find a subtree that belongs to the respective resource
     auto root = std::find_if(mRoot->children.cbegin(), mRoot->children.cend(),
                              [resource](Node *node) {
@@ -285,16 +401,20 @@ CollectionTreeCache::Node *CollectionTreeCache::findNode(const QString &rid,
     return findNode((*root), [rid](Node *node) { return node->collection.remoteId() == rid; });
 }
 
-QVector<Collection> CollectionTreeCache::retrieveCollections(CollectionTreeCache::Node *root,
-                                                             int depth, int ancestorDepth) const
+bool CollectionTreeCache::collectNodes(qint64 id, int depth, int ancestorDepth,
+                                       QVector<Node *> &subtree, QVector<Node *> &ancestors) const
 {
-    QReadLocker locker(&mLock);
+    subtree.clear();
+    ancestors.clear();
+
+    auto root = mNodeLookup.value(id, nullptr);
+    if (!root) {
+        return false;
+    }
 
-    QVector<Node *> nodes;
-    // Get all ancestors for root
     Node *parent = root->parent;
-    for (int i = 0; i < ancestorDepth && parent != nullptr; ++i) {
-        nodes.push_back(parent);
+    for (int i = 0; i < ancestorDepth && parent != nullptr && parent != mRoot; ++i) {
+        ancestors.push_back(parent);
         parent = parent->parent;
     }
 
@@ -305,66 +425,137 @@ QVector<Collection> CollectionTreeCache::retrieveCollections(CollectionTreeCache
     QStack<StackTuple> stack;
     stack.push({ root, 0 });
     while (!stack.isEmpty()) {
-        auto c = stack.pop();
-        if (c.depth > depth) {
-            break;
+        const auto c = stack.pop();
+        if (c.node != mRoot) {
+            subtree.push_back(c.node);
         }
 
-        if (c.node->id > 0) { // skip root
-            nodes.push_back(c.node);
-        }
-
-        for (auto child : qAsConst(c.node->children)) {
-            stack.push({ child, c.depth + 1 });
+        if (c.depth < depth) {
+            for (auto it = c.node->children.crbegin(), end = c.node->children.crend(); it != end; ++it) {
+                stack.push({ *it, c.depth + 1 });
+            }
         }
     }
 
-    QVector<Collection> cols;
-    QVector<Node *> missing;
-    for (auto node : nodes) {
-        if (node->collection.isValid()) {
-            cols.push_back(node->collection);
-        } else {
-            missing.push_back(node);
+    return true;
+}
+
+void CollectionTreeCache::loadNodes(const QVector<Node *> &nodes) const
+{
+    // Chunked, as the backends can't handle arbitrarily large WHERE IN queries
+    const int querySizeLimit = QueryHelper::maxInConditionSize();
+    for (int start = 0; start < nodes.size(); start += querySizeLimit) {
+        QHash<qint64, Node *> chunk;
+        QVariantList ids;
+        for (int i = start, end = std::min<int>(start + querySizeLimit, nodes.size()); i < end; ++i) {
+            chunk.insert(nodes[i]->id, nodes[i]);
+            ids << nodes[i]->id;
         }
-    }
 
-    if (!missing.isEmpty()) {
-        // TODO: Check if no-one else is currently retrieving the same collections
         SelectQueryBuilder<Collection> qb;
-        Query::Condition cond(Query::Or);
-        for (auto node : qAsConst(missing)) {
-            cond.addValueCondition(Collection::idFullColumnName(), Query::Equals, node->id);
-        }
-        qb.addCondition(cond);
+        qb.addValueCondition(Collection::idFullColumnName(), Query::In, ids);
         if (!qb.exec()) {
             qCWarning(AKONADISERVER_LOG) << "Failed to retrieve collections from the database";
-            return {};
+            return;
         }
-
         const auto results = qb.result();
-        if (results.size() != missing.size()) {
+        if (results.size() != chunk.size()) {
             qCWarning(AKONADISERVER_LOG) << "Could not obtain all missing collections! Node tree refers to a non-existent collection";
         }
+        for (const auto &col : results) {
+            auto node = chunk.value(col.id());
+            node->collection = col;
+            node->mimeTypes.clear();
+            node->attributes.clear();
+        }
 
-        cols += results;
-
-        // Relock for write
-        // TODO: Needs a better lock-upgrade mechanism
-        locker.unlock();
-        QWriteLocker wLocker(&mLock);
-        for (auto node : qAsConst(missing)) {
-            auto it = std::find_if(results.cbegin(), results.cend(),
-                                   [node](const Collection &col) { return node->id == col.id(); });
-            if (Q_UNLIKELY(it == results.cend())) {
-                continue;
+        QueryBuilder mtQb(CollectionMimeTypeRelation::tableName());
+        mtQb.addColumn(CollectionMimeTypeRelation::leftFullColumnName());
+        mtQb.addColumn(CollectionMimeTypeRelation::rightFullColumnName());
+        mtQb.addValueCondition(CollectionMimeTypeRelation::leftFullColumnName(), Query::In, ids);
+        mtQb.addSortColumn(CollectionMimeTypeRelation::leftFullColumnName(), Query::Ascending);
+        mtQb.addSortColumn(CollectionMimeTypeRelation::rightFullColumnName(), Query::Ascending);
+        if (!mtQb.exec()) {
+            qCWarning(AKONADISERVER_LOG) << "Failed to retrieve collection mimetypes from the database";
+            return;
+        }
+        QSqlQuery query = mtQb.query();
+        while (query.next()) {
+            chunk.value(query.value(0).toLongLong())->mimeTypes.push_back(query.value(1).toLongLong());
+        }
+        query.finish();
+
+        SelectQueryBuilder<CollectionAttribute> attrQb;
+        attrQb.addValueCondition(CollectionAttribute::collectionIdFullColumnName(), Query::In, ids);
+        attrQb.addSortColumn(CollectionAttribute::collectionIdFullColumnName(), Query::Ascending);
+        attrQb.addSortColumn(CollectionAttribute::idFullColumnName(), Query::Ascending);
+        if (!attrQb.exec()) {
+            qCWarning(AKONADISERVER_LOG) << "Failed to retrieve collection attributes from the database";
+            return;
+        }
+        const auto attributes = attrQb.result();
+        for (const auto &attr : attributes) {
+            chunk.value(attr.collectionId())->attributes.push_back(attr);
+        }
+    }
+}
+
+bool CollectionTreeCache::retrieveSubtree(qint64 id, int depth, int ancestorDepth,
+                                          QVector<CachedCollection> &subtree,
+                                          QVector<CachedCollection> &ancestors) const
+{
+    const auto isOutdated = [](Node *node) { return !node->collection.isValid(); };
+    const auto toCached = [](const QVector<Node *> &nodes, QVector<CachedCollection> &out) {
+        out.clear();
+        out.reserve(nodes.size());
+        for (auto node : nodes) {
+            if (node->collection.isValid()) {
+                out.push_back({ node->collection, node->mimeTypes, node->attributes });
             }
+        }
+    };
 
-            node->collection = *it;
+    QVector<Node *> subtreeNodes;
+    QVector<Node *> ancestorNodes;
+    {
+        QReadLocker locker(&mLock);
+        if (!collectNodes(id, depth, ancestorDepth, subtreeNodes, ancestorNodes)) {
+            return false;
+        }
+        if (std::none_of(subtreeNodes.cbegin(), subtreeNodes.cend(), isOutdated)
+                && std::none_of(ancestorNodes.cbegin(), ancestorNodes.cend(), isOutdated)) {
+            toCached(subtreeNodes, subtree);
+            toCached(ancestorNodes, ancestors);
+            return true;
         }
     }
 
-    return cols;
+    // Some nodes need to be reloaded. QReadWriteLock cannot be upgraded, so
+    // collect the nodes again, the tree might have changed in the meantime.
+    QWriteLocker locker(&mLock);
+    if (!collectNodes(id, depth, ancestorDepth, subtreeNodes, ancestorNodes)) {
+        return false;
+    }
+    QVector<Node *> outdated;
+    std::copy_if(subtreeNodes.cbegin(), subtreeNodes.cend(), std::back_inserter(outdated), isOutdated);
+    std::copy_if(ancestorNodes.cbegin(), ancestorNodes.cend(), std::back_inserter(outdated), isOutdated);
+    loadNodes(outdated);
+
+    toCached(subtreeNodes, subtree);
+    toCached(ancestorNodes, ancestors);
+    return true;
+}
+
+QVector<Collection> CollectionTreeCache::retrieveCollections(CollectionTreeCache::Node *root,
+                                                             int depth, int ancestorDepth) const
+{
+    QVector<CachedCollection> subtree;
+    QVector<CachedCollection> ancestors;
+    if (!retrieveSubtree(root->id, depth, ancestorDepth, subtree, ancestors)) {
+        return {};
+    }
+
+    return toCollections(ancestors, subtree);
 }
 
 
@@ -374,30 +565,32 @@ QVector<Collection> CollectionTreeCache::retrieveCollections(const Scope &scope,
                                                              const QString &resource,
                                                              CommandContext *context) const
 {
+    qint64 id = -1;
     if (scope.isEmpty()) {
-        return retrieveCollections(mRoot, depth, ancestorDepth);
+        id = 0;
     } else if (scope.scope() == Scope::Rid) {
         // Caller must ensure!
         Q_ASSERT(!resource.isEmpty() || (context && context->resource().isValid()));
 
+        QReadLocker locker(&mLock);
         Node *node = nullptr;
         if (!resource.isEmpty()) {
             node = findNode(scope.rid(), resource);
         } else if (context && context->resource().isValid()) {
             node = findNode(scope.rid(), context->resource().name());
-        } else {
-            return {};
         }
-
         if (Q_LIKELY(node)) {
-            return retrieveCollections(node, depth, ancestorDepth);
+            id = node->id;
         }
     } else if (scope.scope() == Scope::Uid) {
-        Node *node = mNodeLookup.value(scope.uid());
-        if (Q_LIKELY(node)) {
-            return retrieveCollections(node, depth, ancestorDepth);
-        }
+        id = scope.uid();
+    }
+
+    QVector<CachedCollection> subtree;
+    QVector<CachedCollection> ancestors;
+    if (id < 0 || !retrieveSubtree(id, depth, ancestorDepth, subtree, ancestors)) {
+        return {};
     }
 
-    return {};
+    return toCollections(ancestors, subtree);
 }
@@ -38,6 +38,17 @@ namespace Server {
 
 class CommandContext;
 
+/**
+ * In-memory copy of the collection tree, used to serve collection listings
+ * without hitting the database.
+ *
+ * Besides the tree structure, each node holds the Collection together with its
+ * mimetypes and attributes. The cache is populated in its own thread on start,
+ * afterwards it is kept up-to-date by NotificationCollector, which passes it all
+ * collection changes once they have been committed. Changed collections are
+ * only marked as outdated and reloaded from the database the next time they
+ * are requested.
+ */
 class CollectionTreeCache : public AkThread
 {
     Q_OBJECT
@@ -59,18 +70,55 @@ protected:
         QAtomicInt lruCounter;
         qint64 id;
 
+        /// Invalid when the node is outdated and must be reloaded from the database
         Collection collection;
+        QVector<MimeType::Id> mimeTypes;
+        CollectionAttribute::List attributes;
     };
 
 public:
+    /**
+     * A collection with its mimetypes and attributes.
+     */
+    struct CachedCollection {
+        Collection collection;
+        QVector<MimeType::Id> mimeTypes;
+        CollectionAttribute::List attributes;
+    };
+
     explicit CollectionTreeCache();
     ~CollectionTreeCache() override;
 
+    /**
+     * Returns whether the cache has been populated and can be used to serve
+     * listings. The cache is not populated while it is being (re)built.
+     */
+    bool isPopulated() const;
+
     QVector<Collection> retrieveCollections(const Scope &scope,
                                             int depth, int ancestorDepth,
                                             const QString &resource = QString(),
                                             CommandContext *context = nullptr) const;
 
+    /**
+     * Retrieves collection @p id and its descendants up to @p depth levels below
+     * it (0 meaning just the collection itself) into @p subtree, in depth-first
+     * order, and up to @p ancestorDepth of its ancestors into @p ancestors,
+     * starting with its parent. The root (id 0) is never returned itself.
+     *
+     * Returns false when @p id is not in the cache.
+     */
+    bool retrieveSubtree(qint64 id, int depth, int ancestorDepth,
+                         QVector<CachedCollection> &subtree,
+                         QVector<CachedCollection> &ancestors) const;
+
+    /**
+     * Drops the whole cache and schedules it to be populated from the database
+     * again. Use after modifying collections without going through
+     * NotificationCollector.
+     */
+    void invalidate();
+
 public Q_SLOTS:
     void collectionAdded(const Collection &col);
     void collectionChanged(const Collection &col);
@@ -81,6 +129,7 @@ protected:
     void init() override;
     void quit() override;
 
+    /** Caller must hold mLock. */
     Node *findNode(const QString &rid, const QString &resource) const;
 
     template<typename Predicate>
@@ -88,12 +137,25 @@ protected:
 
     QVector<Collection> retrieveCollections(Node *root, int depth, int ancestorDepth) const;
 
+private Q_SLOTS:
+    void populate();
+
+private:
+    void clear();
+    void removeNode(Node *node);
+    bool collectNodes(qint64 id, int depth, int ancestorDepth,
+                      QVector<Node *> &subtree, QVector<Node *> &ancestors) const;
+    /** Loads outdated @p nodes from the database. Caller must hold mLock for writing. */
+    void loadNodes(const QVector<Node *> &nodes) const;
+
 protected:
     mutable QReadWriteLock mLock;
 
     Node *mRoot = nullptr;
 
     QHash<qint64 /* col ID */, Node *> mNodeLookup;
+
+    QAtomicInt mPopulated;
 };
 
 
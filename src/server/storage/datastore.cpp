@@ -22,7 +22,9 @@
 
 #include "akonadi.h"
 #include "collectionstatistics.h"
+#include "tagcache.h"
 #include "dbconfig.h"
+#include "dbexception.h"
 #include "dbinitializer.h"
 #include "dbupdater.h"
 #include "notificationmanager.h"
@@ -54,6 +56,7 @@
 #include <QVariant>
 #include <QSqlDatabase>
 #include <QSqlDriver>
+#include <QSqlError>
 #include <QSqlQuery>
 #include <QFile>
 #include <QElapsedTimer>
@@ -158,6 +161,82 @@ QSqlDatabase DataStore::database()
     return m_database;
 }
 
+QString DataStore::idSetTable(const ImapSet &set)
+{
+    static const int IdSetTableCount = 4;
+    // Values per INSERT statement, SQLite versions before 3.8.8 refuse more
+    static const int InsertChunkSize = 500;
+
+    if (m_idSetTables.isEmpty()) {
+        m_idSetTables.resize(IdSetTableCount);
+    }
+
+    // Reuse a table filled with the same set, otherwise overwrite the least recently used one
+    int slot = 0;
+    for (int i = 0; i < m_idSetTables.size(); ++i) {
+        IdSetTable &table = m_idSetTables[i];
+        if (table.valid && table.set == set) {
+            table.lastUse = ++m_idSetTableUse;
+            return QStringLiteral("akonadi_idset_%1").arg(i);
+        }
+        if (table.lastUse < m_idSetTables[slot].lastUse) {
+            slot = i;
+        }
+    }
+
+    const QString tableName = QStringLiteral("akonadi_idset_%1").arg(slot);
+    IdSetTable &table = m_idSetTables[slot];
+    table.valid = false;
+
+    QSqlQuery query(database());
+    if (!query.exec(QStringLiteral("CREATE TEMPORARY TABLE IF NOT EXISTS %1 (id BIGINT PRIMARY KEY)").arg(tableName))) {
+        debugLastQueryError(query, "Failed to create temporary id table");
+        return QString();
+    }
+    if (!query.exec(QStringLiteral("DELETE FROM %1").arg(tableName))) {
+        debugLastQueryError(query, "Failed to clear temporary id table");
+        return QString();
+    }
+
+    // The ids are plain integers, so they go into the statement directly
+    // instead of binding thousands of values
+    const QString insertStatement = QStringLiteral("INSERT INTO %1 (id) VALUES ").arg(tableName);
+    QString statement;
+    int count = 0;
+    const auto flush = [&]() {
+        const bool ok = query.exec(statement);
+        if (!ok) {
+            debugLastQueryError(query, "Failed to fill temporary id table");
+        }
+        count = 0;
+        return ok;
+    };
+    Q_FOREACH (const ImapInterval &interval, set.intervals()) {
+        if (!interval.hasDefinedBegin() || !interval.hasDefinedEnd()) {
+            continue;
+        }
+        for (qint64 id = interval.begin(); id <= interval.end(); ++id) {
+            if (count == 0) {
+                statement = insertStatement;
+            } else {
+                statement += QLatin1String(", ");
+            }
+            statement += QLatin1Char('(') + QString::number(id) + QLatin1Char(')');
+            if (++count == InsertChunkSize && !flush()) {
+                return QString();
+            }
+        }
+    }
+    if (count > 0 && !flush()) {
+        return QString();
+    }
+
+    table.set = set;
+    table.lastUse = ++m_idSetTableUse;
+    table.valid = true;
+    return tableName;
+}
+
 void DataStore::close()
 {
 
@@ -177,6 +256,7 @@ void DataStore::close()
     }
 
     QueryCache::clear();
+    m_idSetTables.clear();
     m_database.close();
     m_database = QSqlDatabase();
     QSqlDatabase::removeDatabase(m_connectionName);
@@ -218,6 +298,7 @@ bool DataStore::init()
     Resource::enableCache(true);
     Collection::enableCache(true);
     PartType::enableCache(true);
+    TagType::enableCache(true);
 
     return true;
 }
@@ -732,6 +813,10 @@ bool DataStore::removeTags(const Tag::List &tags, bool silent)
         return false;
     }
 
+    for (const qint64 tagId : qAsConst(removedTags)) {
+        TagCache::self()->invalidateTag(tagId);
+    }
+
     return true;
 }
 
@@ -1447,10 +1532,18 @@ bool DataStore::rollbackTransaction()
 
     --m_transactionLevel;
 
-    if (m_transactionLevel == 0 && !m_transactionKilledByDB) {
-        doRollback();
-        cleanupAfterRollback();
-        Q_EMIT transactionRolledBack();
+    if (m_transactionLevel == 0) {
+        if (m_transactionKilledByDB) {
+            // The changes are gone already, but the transaction may still be
+            // open on the server (PostgreSQL keeps it in aborted state, MySQL
+            // after a lock wait timeout), it would be joined by the next one
+            doRollback();
+            m_transactionKilledByDB = false;
+        } else {
+            doRollback();
+            cleanupAfterRollback();
+            Q_EMIT transactionRolledBack();
+        }
     }
 
     return true;
@@ -1469,8 +1562,9 @@ bool DataStore::commitTransaction()
 
     if (m_transactionLevel == 1) {
         if (m_transactionKilledByDB) {
-            qCWarning(AKONADISERVER_LOG) << "DataStore::commitTransaction(): Cannot commit, transaction was killed by mysql deadlock handling!";
-            return false;
+            qCWarning(AKONADISERVER_LOG) << "DataStore::commitTransaction(): Cannot commit, transaction was killed by deadlock handling!";
+            rollbackTransaction();
+            throw DbDeadlockException(QSqlError(), QStringLiteral("COMMIT"));
         }
         QSqlDriver *driver = m_database.driver();
         QElapsedTimer timer;
@@ -1481,7 +1575,12 @@ bool DataStore::commitTransaction()
                                                        m_database.lastError().text());
         if (m_database.lastError().isValid()) {
             debugLastDbError("DataStore::commitTransaction");
+            const QSqlError error = m_database.lastError();
             rollbackTransaction();
+            if (DbType::isTransactionConflict(m_database, error)) {
+                // Let DbDeadlockCatcher repeat the whole transaction
+                throw DbDeadlockException(error, QStringLiteral("COMMIT"));
+            }
             return false;
         } else {
             TRANSACTION_MUTEX_UNLOCK;
@@ -1514,6 +1613,10 @@ void DataStore::cleanupAfterRollback()
     Resource::invalidateCompleteCache();
     Collection::invalidateCompleteCache();
     PartType::invalidateCompleteCache();
+    TagType::invalidateCompleteCache();
+    TagCache::self()->invalidate();
     CollectionStatistics::self()->expireCache();
     QueryCache::clear();
+    // Changes to the temporary tables have been rolled back as well
+    m_idSetTables.clear();
 }
@@ -32,6 +32,8 @@ class QTimer;
 #include "entities.h"
 #include "notificationcollector.h"
 
+#include <private/imapset_p.h>
+
 #include <memory>
 
 namespace Akonadi
@@ -273,6 +275,17 @@ public:
     */
     QSqlDatabase database();
 
+    /**
+      Fills a temporary table of this connection with the ids of all bounded
+      intervals of @p set and returns the name of the table, or an empty
+      string on error. The table has a single column called "id".
+
+      The tables of the last few sets are kept, repeated calls with the same
+      set are cheap. The content of a table can change with the next call
+      for a different set, so use it right away.
+    */
+    QString idSetTable(const ImapSet &set);
+
     /**
       Sets the current session id.
     */
@@ -354,6 +367,13 @@ private:
         QVector<QVariant> boundValues;
         bool isBatch;
     };
+    struct IdSetTable {
+        ImapSet set;
+        quint64 lastUse = 0;
+        bool valid = false;
+    };
+    QVector<IdSetTable> m_idSetTables;
+    quint64 m_idSetTableUse = 0;
     QByteArray mSessionId;
     QTimer *m_keepAliveTimer = nullptr;
     static bool s_hasForeignKeyConstraints;
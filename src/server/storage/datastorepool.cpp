@@ -0,0 +1,256 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "datastorepool.h"
+#include "akonadiserver_debug.h"
+
+#include <QMetaObject>
+#include <QObject>
+#include <QTimer>
+
+#include <algorithm>
+
+using namespace Akonadi::Server;
+
+DataStorePool::DataStorePool(int capacity, int maxWaitTime)
+    : mMaxWaitTime(maxWaitTime)
+{
+    mStats.capacity = std::max(1, capacity);
+}
+
+DataStorePool::~DataStorePool()
+{
+}
+
+bool DataStorePool::acquire(QObject *holder, const EvictCallback &evict, const GrantCallback &granted)
+{
+    QMutexLocker locker(&mLock);
+
+    auto it = mLeases.find(holder);
+    if (it != mLeases.end()) {
+        if (it->idle) {
+            it->idle = false;
+            mIdleQueue.removeOne(holder);
+        }
+        if (it->evicting) {
+            it->evicting = false;
+            --mPendingEvictions;
+        }
+        // Drop evictions still queued for the idle lease
+        it->generation = ++mGeneration;
+        return true;
+    }
+
+    const bool queued = std::any_of(mRequests.cbegin(), mRequests.cend(),
+                                    [holder](const Request &request) { return request.holder == holder; });
+    if (queued) {
+        qCWarning(AKONADISERVER_LOG) << "Database connection requested again by" << holder << "while waiting for one";
+        return false;
+    }
+
+    // Don't overtake holders that are already waiting
+    if (mLeases.size() < mStats.capacity && mRequests.isEmpty()) {
+        Lease lease;
+        lease.evict = evict;
+        lease.generation = ++mGeneration;
+        mLeases.insert(holder, lease);
+        ++mStats.leases;
+        mStats.peak = std::max(mStats.peak, mLeases.size());
+        return true;
+    }
+
+    Request request;
+    request.holder = holder;
+    request.evict = evict;
+    request.granted = granted;
+    request.waitTimer.start();
+    request.generation = ++mGeneration;
+    mRequests.append(request);
+    ++mStats.waits;
+    ++mStats.waiting;
+
+    if (mPendingEvictions < mStats.waiting) {
+        evictIdleLease();
+    }
+
+    const quint64 generation = request.generation;
+    locker.unlock();
+
+    QTimer::singleShot(mMaxWaitTime, holder, [this, holder, generation]() {
+        requestTimedOut(holder, generation);
+    });
+    return false;
+}
+
+void DataStorePool::setIdle(QObject *holder)
+{
+    QMutexLocker locker(&mLock);
+
+    auto it = mLeases.find(holder);
+    if (it == mLeases.end() || it->idle) {
+        return;
+    }
+    it->idle = true;
+    mIdleQueue.append(holder);
+
+    // Someone is already waiting for a lease, don't keep this one idle
+    if (mStats.waiting > mPendingEvictions) {
+        evictIdleLease();
+    }
+}
+
+void DataStorePool::release(QObject *holder)
+{
+    QMutexLocker locker(&mLock);
+
+    auto it = mLeases.find(holder);
+    if (it == mLeases.end()) {
+        // Not granted yet, give up waiting
+        for (auto request = mRequests.begin(); request != mRequests.end(); ++request) {
+            if (request->holder == holder) {
+                mRequests.erase(request);
+                --mStats.waiting;
+                break;
+            }
+        }
+        return;
+    }
+    if (it->idle) {
+        mIdleQueue.removeOne(holder);
+    }
+    if (it->evicting) {
+        --mPendingEvictions;
+    }
+    mLeases.erase(it);
+
+    grantRequests();
+}
+
+bool DataStorePool::hasLease(QObject *holder) const
+{
+    QMutexLocker locker(&mLock);
+    return mLeases.contains(holder);
+}
+
+DataStorePool::Statistics DataStorePool::statistics() const
+{
+    QMutexLocker locker(&mLock);
+
+    Statistics stats = mStats;
+    stats.idle = mIdleQueue.size();
+    stats.active = mLeases.size() - stats.idle;
+    return stats;
+}
+
+bool DataStorePool::evictIdleLease()
+{
+    // mLock must be held by caller
+
+    for (QObject *holder : qAsConst(mIdleQueue)) {
+        auto it = mLeases.find(holder);
+        Q_ASSERT(it != mLeases.end());
+        if (it->evicting) {
+            continue;
+        }
+
+        it->evicting = true;
+        ++mPendingEvictions;
+        ++mStats.evictions;
+        // Run the callback in the holder's thread, the DataStore can only be
+        // closed from there. If the holder is destroyed in the meantime, the
+        // call is simply dropped (and the lease released from its destructor).
+        const quint64 generation = it->generation;
+        QMetaObject::invokeMethod(holder, [this, holder, generation]() {
+            evictLease(holder, generation);
+        }, Qt::QueuedConnection);
+        return true;
+    }
+
+    return false;
+}
+
+void DataStorePool::evictLease(QObject *holder, quint64 generation)
+{
+    EvictCallback evict;
+    {
+        QMutexLocker locker(&mLock);
+        auto it = mLeases.find(holder);
+        // The holder has used the lease again, or released it, since
+        if (it == mLeases.end() || !it->evicting || it->generation != generation) {
+            return;
+        }
+        evict = it->evict;
+    }
+
+    // Not under the lock, the callback calls release()
+    if (evict) {
+        evict();
+    }
+}
+
+void DataStorePool::requestTimedOut(QObject *holder, quint64 generation)
+{
+    QMutexLocker locker(&mLock);
+
+    for (auto request = mRequests.begin(); request != mRequests.end(); ++request) {
+        if (request->holder == holder && request->generation == generation) {
+            qCWarning(AKONADISERVER_LOG) << "Timeout while waiting for a free database connection,"
+                                         << mLeases.size() << "connections are busy";
+            ++mStats.overcommits;
+            const Request timedOut = *request;
+            mRequests.erase(request);
+            grant(timedOut, false);
+            return;
+        }
+    }
+}
+
+void DataStorePool::grantRequests()
+{
+    // mLock must be held by caller
+
+    while (mLeases.size() < mStats.capacity && !mRequests.isEmpty()) {
+        grant(mRequests.takeFirst(), true);
+    }
+}
+
+void DataStorePool::grant(const Request &request, bool granted)
+{
+    // mLock must be held by caller
+
+    Lease lease;
+    lease.evict = request.evict;
+    lease.generation = request.generation;
+    mLeases.insert(request.holder, lease);
+    ++mStats.leases;
+    mStats.peak = std::max(mStats.peak, mLeases.size());
+
+    --mStats.waiting;
+    const qint64 waitTime = request.waitTimer.elapsed();
+    mStats.totalWaitTime += waitTime;
+    mStats.maxWaitTime = std::max(mStats.maxWaitTime, waitTime);
+
+    if (request.granted) {
+        const GrantCallback callback = request.granted;
+        QMetaObject::invokeMethod(request.holder, [callback, granted]() {
+            callback(granted);
+        }, Qt::QueuedConnection);
+    }
+}
@@ -0,0 +1,149 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef DATASTOREPOOL_H
+#define DATASTOREPOOL_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QHash>
+#include <QList>
+
+#include <functional>
+
+class QObject;
+
+namespace Akonadi
+{
+namespace Server
+{
+
+/**
+ * Limits the number of database connections held open by client connections.
+ *
+ * QtSql connections cannot be moved between threads, so every Connection keeps
+ * its own DataStore (and its prepared statements in QueryCache). The pool hands
+ * out leases for those per-thread DataStores: a Connection must hold a lease
+ * while its DataStore is open, and marks the lease as idle between commands.
+ *
+ * When all leases are taken, acquire() queues the request and asks the longest
+ * idle holder to close its DataStore. The lease is granted asynchronously once
+ * one is returned, so the waiting thread keeps running its event loop. Holders
+ * that stay busy for longer than the maximum wait time are not waited for any
+ * longer, the lease is then granted over the capacity rather than failing the
+ * command.
+ *
+ * Every lease and request carries a generation, so that evictions and timeouts
+ * queued for an earlier lease of the same holder are ignored.
+ */
+class DataStorePool
+{
+public:
+    typedef std::function<void()> EvictCallback;
+    typedef std::function<void(bool granted)> GrantCallback;
+
+    struct Statistics {
+        int capacity = 0;
+        int active = 0;
+        int idle = 0;
+        int peak = 0;
+        int waiting = 0;
+        qint64 leases = 0;
+        qint64 waits = 0;
+        qint64 overcommits = 0;
+        qint64 evictions = 0;
+        qint64 totalWaitTime = 0;
+        qint64 maxWaitTime = 0;
+    };
+
+    /**
+     * Creates a pool of @p capacity leases. Waiting for a lease in acquire() is
+     * given up after @p maxWaitTime milliseconds.
+     */
+    explicit DataStorePool(int capacity, int maxWaitTime = 30000);
+    ~DataStorePool();
+
+    /**
+     * Obtains a lease for @p holder and marks it busy. @p evict is invoked in
+     * the thread of @p holder when the pool needs the lease back; it should close
+     * the DataStore and call release() if the holder is still idle.
+     *
+     * Returns @c true when the lease has been granted right away, which is
+     * always the case when @p holder already has one. Otherwise the request is
+     * queued and @p granted is invoked in the thread of @p holder once the lease
+     * is available, with @c false when it has been granted over the capacity
+     * after waiting for too long. Calling release() cancels a queued request.
+     *
+     * Must be called from the thread of @p holder, which has to run an event
+     * loop while waiting.
+     */
+    bool acquire(QObject *holder, const EvictCallback &evict, const GrantCallback &granted);
+
+    /**
+     * Marks the lease of @p holder as idle, making it a candidate for eviction.
+     */
+    void setIdle(QObject *holder);
+
+    /**
+     * Returns the lease of @p holder to the pool, or cancels its queued request,
+     * and grants the lease to the next waiting holder.
+     */
+    void release(QObject *holder);
+
+    bool hasLease(QObject *holder) const;
+
+    Statistics statistics() const;
+
+private:
+    struct Request {
+        QObject *holder = nullptr;
+        EvictCallback evict;
+        GrantCallback granted;
+        QElapsedTimer waitTimer;
+        quint64 generation = 0;
+    };
+
+    bool evictIdleLease();
+    void evictLease(QObject *holder, quint64 generation);
+    void requestTimedOut(QObject *holder, quint64 generation);
+    void grantRequests();
+    void grant(const Request &request, bool granted);
+
+    struct Lease {
+        EvictCallback evict;
+        quint64 generation = 0;
+        bool idle = false;
+        bool evicting = false;
+    };
+
+    mutable QMutex mLock;
+    QHash<QObject *, Lease> mLeases;
+    QList<QObject *> mIdleQueue;
+    QList<Request> mRequests;
+    Statistics mStats;
+    quint64 mGeneration = 0;
+    int mPendingEvictions = 0;
+    int mMaxWaitTime;
+};
+
+} // namespace Server
+} // namespace Akonadi
+
+#endif // DATASTOREPOOL_H
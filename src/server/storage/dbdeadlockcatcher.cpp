@@ -0,0 +1,93 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "dbdeadlockcatcher.h"
+#include "datastore.h"
+#include "akonadiserver_debug.h"
+
+#include <private/externalpartstorage_p.h>
+
+#include <QMutex>
+#include <QRandomGenerator>
+#include <QThread>
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+/// Delay before the first retry in milliseconds, doubled with every further retry
+static const int InitialBackoff = 10;
+
+static QMutex sStatisticsLock;
+static DbDeadlockCatcher::Statistics sStatistics;
+
+DbDeadlockCatcher::Statistics DbDeadlockCatcher::statistics()
+{
+    QMutexLocker locker(&sStatisticsLock);
+    return sStatistics;
+}
+
+bool DbDeadlockCatcher::inTransaction()
+{
+    return DataStore::hasDataStore() && DataStore::self()->inTransaction();
+}
+
+bool DbDeadlockCatcher::prepareRetry(int attempt, bool retry)
+{
+    // Anything between half and all of the exponential delay
+    const int backoff = InitialBackoff << attempt;
+    const int delay = retry ? backoff / 2 + QRandomGenerator::global()->bounded(backoff / 2 + 1) : 0;
+
+    {
+        QMutexLocker locker(&sStatisticsLock);
+        ++sStatistics.deadlocks;
+        if (retry) {
+            ++sStatistics.retries;
+            sStatistics.totalBackoffTime += delay;
+        } else {
+            ++sStatistics.failures;
+        }
+    }
+
+    if (!retry) {
+        qCWarning(AKONADISERVER_LOG) << "Database deadlock, giving up after" << attempt << "retries";
+        return false;
+    }
+
+    // Transactions are normally rolled back while the exception unwinds the
+    // stack, make sure nothing is left over that the next attempt would join
+    if (DataStore::hasDataStore()) {
+        DataStore *store = DataStore::self();
+        if (store->inTransaction()) {
+            qCWarning(AKONADISERVER_LOG) << "Rolling back transaction left over by a deadlocked command";
+            while (store->inTransaction()) {
+                if (!store->rollbackTransaction()) {
+                    break;
+                }
+            }
+        }
+    }
+    if (ExternalPartStorage::self()->inTransaction()) {
+        qCWarning(AKONADISERVER_LOG) << "Rolling back part file transaction left over by a deadlocked command";
+        ExternalPartStorage::self()->rollbackTransaction();
+    }
+
+    qCDebug(AKONADISERVER_LOG) << "Database deadlock, retrying in" << delay << "ms";
+    QThread::msleep(delay);
+    return true;
+}
@@ -22,6 +22,8 @@
 
 #include "dbexception.h"
 
+#include <functional>
+
 namespace Akonadi
 {
 
@@ -29,30 +31,74 @@ namespace Server
 {
 
 /**
-  This class catches DbDeadlockException (as emitted by QueryBuilder)
-  and retries execution of the method when it happens, as required by
-  SQL databases.
+  This class catches DbDeadlockException (as emitted by QueryBuilder and
+  DataStore::commitTransaction()) and retries execution of the method when
+  it happens, as required by SQL databases.
+
+  Retries are delayed by a randomized, exponentially growing interval, so
+  that the transactions which ran into each other don't collide again
+  right away. Before each retry any transaction left over by the failed
+  attempt is rolled back, including part files created in an
+  ExternalPartStorageTransaction.
 */
 class DbDeadlockCatcher
 {
 public:
+    struct Statistics {
+        qint64 deadlocks = 0;
+        qint64 retries = 0;
+        qint64 failures = 0;
+        qint64 totalBackoffTime = 0;
+    };
+
+    /**
+      Runs @p func, repeating it when it fails because of a deadlock.
+      If given, @p canRetry is asked before every retry, so that the caller
+      can prevent repeating a method that has side effects which can't be
+      undone, like responses already sent to the client.
+    */
     template <typename Func>
-    explicit DbDeadlockCatcher(Func &&func) { callFunc(func, 0); }
+    explicit DbDeadlockCatcher(Func &&func, const std::function<bool()> &canRetry = std::function<bool()>())
+    {
+        callFunc(func, canRetry);
+    }
+
+    /**
+      Returns the number of deadlocks seen, retries done and methods that
+      failed anyway, summed up over all threads.
+    */
+    static Statistics statistics();
 
 private:
-    static const int MaxRecursion = 5;
+    static const int MaxRetries = 5;
+
     template <typename Func>
-    void callFunc(Func &&func, int recursionCounter) {
-        try {
-            func();
-        } catch(const DbDeadlockException &) {
-            if (recursionCounter == MaxRecursion) {
-                throw;
-             } else {
-                callFunc(func, ++recursionCounter); // recurse
+    void callFunc(Func &&func, const std::function<bool()> &canRetry)
+    {
+        // A deadlock kills the whole transaction, when the method runs inside
+        // a transaction started earlier (by the client), only the caller can
+        // repeat all of it
+        const bool nested = inTransaction();
+        for (int attempt = 0; ; ++attempt) {
+            try {
+                func();
+                return;
+            } catch (const DbDeadlockException &) {
+                const bool retry = !nested && attempt < MaxRetries && (!canRetry || canRetry());
+                if (!prepareRetry(attempt, retry)) {
+                    throw;
+                }
             }
         }
     }
+
+    static bool inTransaction();
+
+    /**
+      Records the deadlock. Cleans up and waits before the next attempt and
+      returns true when @p retry is true, returns false otherwise.
+    */
+    static bool prepareRetry(int attempt, bool retry);
 };
 
 } // namespace Server
@@ -25,10 +25,15 @@
 using namespace Akonadi::Server;
 
 DbException::DbException(const QSqlQuery &query, const char *what)
+    : DbException(query.lastError(), query.lastQuery(), what)
+{
+}
+
+DbException::DbException(const QSqlError &error, const QString &query, const char *what)
     : Exception(what)
 {
-    mWhat += "\nSql error: " + query.lastError().text().toUtf8();
-    mWhat += "\nQuery: " + query.lastQuery().toUtf8();
+    mWhat += "\nSql error: " + error.text().toUtf8();
+    mWhat += "\nQuery: " + query.toUtf8();
 }
 
 const char *DbException::type() const throw()
@@ -40,3 +45,8 @@ DbDeadlockException::DbDeadlockException(const QSqlQuery &query)
     : DbException(query, "Database deadlock, unsuccessful after multiple retries")
 {
 }
+
+DbDeadlockException::DbDeadlockException(const QSqlError &error, const QString &query)
+    : DbException(error, query, "Database deadlock, unsuccessful after multiple retries")
+{
+}
@@ -22,6 +22,7 @@
 
 #include "exception.h"
 
+class QSqlError;
 class QSqlQuery;
 
 namespace Akonadi
@@ -34,6 +35,7 @@ class DbException : public Exception
 {
 public:
     explicit DbException(const QSqlQuery &query, const char *what = nullptr);
+    explicit DbException(const QSqlError &error, const QString &query, const char *what = nullptr);
     const char *type() const throw() override;
 };
 
@@ -41,6 +43,7 @@ class DbDeadlockException : public DbException
 {
 public:
     explicit DbDeadlockException(const QSqlQuery &query);
+    explicit DbDeadlockException(const QSqlError &error, const QString &query);
 };
 
 } // namespace Server
@@ -19,6 +19,8 @@
 
 #include "dbtype.h"
 
+#include <QSqlError>
+
 using namespace Akonadi::Server;
 
 DbType::Type DbType::type(const QSqlDatabase &db)
@@ -44,3 +46,39 @@ bool DbType::isSystemSQLite(const QSqlDatabase &db)
 {
     return db.driverName() == QLatin1String("QSQLITE");
 }
+
+bool DbType::isTransactionConflict(const QSqlDatabase &db, const QSqlError &error)
+{
+    return isTransactionConflictForDriverName(db.driverName(), error);
+}
+
+bool DbType::isTransactionConflictForDriverName(const QString &driverName, const QSqlError &error)
+{
+    const QString errorCode = error.nativeErrorCode();
+    switch (typeForDriverName(driverName)) {
+    case PostgreSQL:
+        // The SQLSTATE is not part of the error code with older drivers
+        return errorCode == QLatin1String("40P01") /* deadlock_detected */
+               || errorCode == QLatin1String("40001") /* serialization_failure */
+               || error.databaseText().contains(QLatin1String("40P01"));
+    case MySQL: {
+        const int code = errorCode.isEmpty() ? -1 : errorCode.toInt();
+        return code == 1213 /* ER_LOCK_DEADLOCK */
+               || code == 1205 /* ER_LOCK_WAIT_TIMEOUT */;
+    }
+    case Sqlite: {
+        // We can't have a transaction deadlock in SQLite when using driver shipped
+        // with Qt, because it does not support concurrent transactions and DataStore
+        // serializes them through a global lock.
+        if (driverName == QLatin1String("QSQLITE")) {
+            return false;
+        }
+        const int code = errorCode.isEmpty() ? -1 : errorCode.toInt();
+        return code == 6 /* SQLITE_LOCKED */
+               || code == 5 /* SQLITE_BUSY */;
+    }
+    case Unknown:
+        break;
+    }
+    return false;
+}
@@ -22,6 +22,8 @@
 
 #include <QSqlDatabase>
 
+class QSqlError;
+
 namespace Akonadi
 {
 namespace Server
@@ -48,6 +50,16 @@ Type typeForDriverName(const QString &driverName);
 /** Returns true when using QSQLITE driver shipped with Qt, FALSE otherwise */
 bool isSystemSQLite(const QSqlDatabase &db);
 
+/**
+  Returns true if @p error means that the database aborted the transaction
+  because of a deadlock or a lock timeout, so that repeating the transaction
+  can succeed.
+*/
+bool isTransactionConflict(const QSqlDatabase &db, const QSqlError &error);
+
+/** Same as above, for the given driver name. */
+bool isTransactionConflictForDriverName(const QString &driverName, const QSqlError &error);
+
 } // namespace DbType
 } // namespace Server
 } // namespace Akonadi
@@ -21,6 +21,7 @@
 #include "itemretrievalrequest.h"
 #include "itemretrievaljob.h"
 #include "dbusconnectionpool.h"
+#include "metrics.h"
 #include "akonadiserver_debug.h"
 
 #include "resourceinterface.h"
@@ -133,6 +134,7 @@ void ItemRetrievalManager::requestItemDelivery(ItemRetrievalRequest *req)
                                << "to" <<req->resourceId << ". There are" << mPendingRequests.size() << "request queues and"
                                << mPendingRequests[req->resourceId].size() << "items mine";
     mPendingRequests[req->resourceId].append(req);
+    Metrics::self()->recordRetrievalRequest(mPendingRequests[req->resourceId].size());
     locker.unlock();
 
     Q_EMIT requestAdded();
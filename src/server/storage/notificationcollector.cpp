@@ -21,6 +21,8 @@
 #include "storage/datastore.h"
 #include "storage/entity.h"
 #include "storage/collectionstatistics.h"
+#include "storage/collectiontreecache.h"
+#include "storage/tagcache.h"
 #include "handlerhelper.h"
 #include "cachecleaner.h"
 #include "intervalcheck.h"
@@ -31,6 +33,7 @@
 #include "selectquerybuilder.h"
 #include "handler/itemfetchhelper.h"
 #include "connection.h"
+#include "metrics.h"
 #include "shared/akranges.h"
 
 #include "akonadiserver_debug.h"
@@ -464,27 +467,18 @@ void NotificationCollector::tagNotification(Protocol::TagChangeNotification::Ope
     if (auto mgr = AkonadiServer::instance()->notificationManager()) {
         auto fetchScope = mgr->tagFetchScope();
         if (!fetchScope->fetchIdOnly() && msgTag.gid().isEmpty()) {
-            msgTag = HandlerHelper::fetchTagsResponse(Tag::retrieveById(msgTag.id()), fetchScope->toFetchScope(), mConnection);
+            msgTag = HandlerHelper::fetchTagsResponse(TagCache::self()->tag(msgTag.id()).tag, fetchScope->toFetchScope(), mConnection);
         }
 
         const auto requestedAttrs = fetchScope->attributes();
         auto msgTagAttrs = msgTag.attributes();
         if (msgTagAttrs.isEmpty() && !requestedAttrs.isEmpty()) {
-            SelectQueryBuilder<TagAttribute> qb;
-            qb.addColumn(TagAttribute::typeFullColumnName());
-            qb.addColumn(TagAttribute::valueFullColumnName());
-            qb.addValueCondition(TagAttribute::tagIdFullColumnName(), Query::Equals, msgTag.id());
-            Query::Condition cond(Query::Or);
+            const auto attrs = TagCache::self()->tag(msgTag.id()).attributes;
             for (const auto &attr : requestedAttrs) {
-                cond.addValueCondition(TagAttribute::typeFullColumnName(), Query::Equals, attr);
-            }
-            qb.addCondition(cond);
-            if (!qb.exec()) {
-                qCWarning(AKONADISERVER_LOG) << "NotificationCollection failed to query attributes for Tag" << tag.id();
-            }
-            const auto attrs = qb.result();
-            for (const auto &attr : attrs) {
-                msgTagAttrs.insert(attr.type(), attr.value());
+                const auto it = attrs.constFind(attr);
+                if (it != attrs.cend()) {
+                    msgTagAttrs.insert(it.key(), it.value());
+                }
             }
             msgTag.setAttributes(msgTagAttrs);
         }
@@ -507,78 +501,134 @@ void NotificationCollector::relationNotification(Protocol::RelationChangeNotific
     dispatchNotification(msg);
 }
 
-void NotificationCollector::completeNotification(const Protocol::ChangeNotificationPtr &changeMsg)
+void NotificationCollector::completeNotifications(const Protocol::ChangeNotificationList &msgs)
 {
-    if (changeMsg->type() == Protocol::Command::ItemChangeNotification) {
+    const auto mgr = AkonadiServer::instance()->notificationManager();
+    if (!mgr) {
+        return;
+    }
+
+    // Several notifications of one transaction often refer to the same items
+    // (e.g. an item is added, then its flags are changed), so first collect
+    // all of them and fetch every item only once.
+    QVector<Protocol::ItemChangeNotificationPtr> toFetch;
+    QVector<qint64> ids;
+    QSet<qint64> seenIds;
+    int itemCount = 0;
+    for (const auto &changeMsg : msgs) {
+        if (changeMsg->type() != Protocol::Command::ItemChangeNotification) {
+            continue;
+        }
         const auto msg = changeMsg.staticCast<Protocol::ItemChangeNotification>();
-        const auto mgr = AkonadiServer::instance()->notificationManager();
-        if (mgr && msg->operation() != Protocol::ItemChangeNotification::Remove) {
-            if (mDb->inTransaction()) {
-                qCWarning(AKONADISERVER_LOG) << "NotificationCollector requested FetchHelper from within a transaction."
-                                             << "Aborting since this would deadlock!";
-                return;
+        if (msg->operation() == Protocol::ItemChangeNotification::Remove) {
+            continue;
+        }
+        if (mDb->inTransaction()) {
+            qCWarning(AKONADISERVER_LOG) << "NotificationCollector requested FetchHelper from within a transaction."
+                                         << "Aborting since this would deadlock!";
+            return;
+        }
+
+        const auto items = msg->items();
+        bool allHaveRID = true;
+        for (const auto &item : items) {
+            allHaveRID &= !item.remoteId().isEmpty();
+        }
+
+        // FetchHelper may trigger ItemRetriever, which needs RemoteID. If we
+        // dont have one (maybe because the Resource has not stored it yet,
+        // we emit a notification without it and leave it up to the Monitor
+        // to retrieve the Item on demand - we should have a RID stored in
+        // Akonadi by then.
+        if (mConnection && (allHaveRID || msg->operation() != Protocol::ItemChangeNotification::Add)) {
+            toFetch.push_back(msg);
+            itemCount += items.size();
+            for (const auto &item : items) {
+                if (!seenIds.contains(item.id())) {
+                    seenIds.insert(item.id());
+                    ids.push_back(item.id());
+                }
             }
-            auto fetchScope = mgr->itemFetchScope();
-            // NOTE: Checking and retrieving missing elements for each Item manually
-            // here would require a complex code (and I'm too lazy), so instead we simply
-            // feed the Items to FetchHelper and retrieve them all with the setup from
-            // the aggregated fetch scope. The worst case is that we re-fetch everything
-            // we already have, but that's stil better than the pre-ntf-payload situation
-            QVector<qint64> ids;
-            const auto items = msg->items();
-            ids.reserve(items.size());
-            bool allHaveRID = true;
+        } else {
+            QVector<Protocol::FetchItemsResponse> fetchedItems;
             for (const auto &item : items) {
-                ids.push_back(item.id());
-                allHaveRID &= !item.remoteId().isEmpty();
+                Protocol::FetchItemsResponse resp;
+                resp.setId(item.id());
+                resp.setRevision(item.revision());
+                resp.setMimeType(item.mimeType());
+                resp.setParentId(item.parentId());
+                resp.setGid(item.gid());
+                resp.setSize(item.size());
+                resp.setMTime(item.mTime());
+                resp.setFlags(item.flags());
+                fetchedItems.push_back(std::move(resp));
             }
+            msg->setItems(fetchedItems);
+            msg->setMustRetrieve(true);
+        }
+    }
 
-            // FetchHelper may trigger ItemRetriever, which needs RemoteID. If we
-            // dont have one (maybe because the Resource has not stored it yet,
-            // we emit a notification without it and leave it up to the Monitor
-            // to retrieve the Item on demand - we should have a RID stored in
-            // Akonadi by then.
-            if (mConnection && (allHaveRID || msg->operation() != Protocol::ItemChangeNotification::Add)) {
-
-                // Prevent transactions inside FetchHelper to recursively call our slot
-                QScopedValueRollback<bool> ignoreTransactions(mIgnoreTransactions);
-                mIgnoreTransactions = true;
-                CommandContext context;
-                auto itemFetchScope = fetchScope->toFetchScope();
-                auto tagFetchScope = mgr->tagFetchScope()->toFetchScope();
-                itemFetchScope.setFetch(Protocol::ItemFetchScope::CacheOnly);
-                ItemFetchHelper helper(mConnection, &context, Scope(ids), itemFetchScope, tagFetchScope);
-                // The Item was just changed, which means the atime was
-                // updated, no need to do it again a couple milliseconds later.
-                helper.disableATimeUpdates();
-                QVector<Protocol::FetchItemsResponse> fetchedItems;
-                auto callback = [&fetchedItems](Protocol::FetchItemsResponse &&cmd) {
-                    fetchedItems.push_back(std::move(cmd));
-                };
-                if (helper.fetchItems(std::move(callback))) {
-                    msg->setItems(fetchedItems);
-                } else {
-                    qCWarning(AKONADISERVER_LOG) << "NotificationCollector railed to retrieve Items for notification!";
-                }
+    if (toFetch.isEmpty()) {
+        return;
+    }
+
+    const qint64 queriesBefore = Metrics::threadQueryCount();
+    QHash<qint64, Protocol::FetchItemsResponse> payloads;
+    if (!fetchPayloads(ids, payloads)) {
+        qCWarning(AKONADISERVER_LOG) << "NotificationCollector railed to retrieve Items for notification!";
+        return;
+    }
+
+    for (const auto &msg : qAsConst(toFetch)) {
+        const auto items = msg->items();
+        QVector<Protocol::FetchItemsResponse> fetchedItems;
+        fetchedItems.reserve(items.size());
+        for (const auto &item : items) {
+            const auto payload = payloads.constFind(item.id());
+            if (payload != payloads.cend()) {
+                fetchedItems.push_back(*payload);
             } else {
-                QVector<Protocol::FetchItemsResponse> fetchedItems;
-                for (const auto &item : items) {
-                    Protocol::FetchItemsResponse resp;
-                    resp.setId(item.id());
-                    resp.setRevision(item.revision());
-                    resp.setMimeType(item.mimeType());
-                    resp.setParentId(item.parentId());
-                    resp.setGid(item.gid());
-                    resp.setSize(item.size());
-                    resp.setMTime(item.mTime());
-                    resp.setFlags(item.flags());
-                    fetchedItems.push_back(std::move(resp));
-                }
-                msg->setItems(fetchedItems);
+                // Items removed later within the same transaction are not found
+                // anymore, keep what we have and let the Monitor retrieve them
+                fetchedItems.push_back(item);
                 msg->setMustRetrieve(true);
             }
         }
+        msg->setItems(fetchedItems);
     }
+
+    Metrics::self()->recordNotificationPayloads(toFetch.size(), itemCount, payloads.size(),
+                                                Metrics::threadQueryCount() - queriesBefore);
+}
+
+bool NotificationCollector::fetchPayloads(const QVector<qint64> &ids, QHash<qint64, Protocol::FetchItemsResponse> &payloads)
+{
+    const auto mgr = AkonadiServer::instance()->notificationManager();
+    // NOTE: Checking and retrieving missing elements for each Item manually
+    // here would require a complex code (and I'm too lazy), so instead we simply
+    // feed the Items to FetchHelper and retrieve them all with the setup from
+    // the aggregated fetch scope. The worst case is that we re-fetch everything
+    // we already have, but that's stil better than the pre-ntf-payload situation
+
+    // Prevent transactions inside FetchHelper to recursively call our slot
+    QScopedValueRollback<bool> ignoreTransactions(mIgnoreTransactions);
+    mIgnoreTransactions = true;
+    CommandContext context;
+    auto itemFetchScope = mgr->itemFetchScope()->toFetchScope();
+    auto tagFetchScope = mgr->tagFetchScope()->toFetchScope();
+    itemFetchScope.setFetch(Protocol::ItemFetchScope::CacheOnly);
+    // Items removed later within the same transaction are not found anymore
+    itemFetchScope.setFetch(Protocol::ItemFetchScope::IgnoreErrors);
+    ItemFetchHelper helper(mConnection, &context, Scope(ids), itemFetchScope, tagFetchScope);
+    // The Item was just changed, which means the atime was
+    // updated, no need to do it again a couple milliseconds later.
+    helper.disableATimeUpdates();
+    payloads.reserve(ids.size());
+    auto callback = [&payloads](Protocol::FetchItemsResponse &&cmd) {
+        const qint64 id = cmd.id();
+        payloads.insert(id, std::move(cmd));
+    };
+    return helper.fetchItems(std::move(callback));
 }
 
 void NotificationCollector::dispatchNotification(const Protocol::ChangeNotificationPtr &msg)
@@ -590,7 +640,8 @@ void NotificationCollector::dispatchNotification(const Protocol::ChangeNotificat
             mNotifications.append(msg);
         }
     } else {
-        completeNotification(msg);
+        completeNotifications({msg});
+        updateCollectionTreeCache({msg});
         notify({msg});
     }
 }
@@ -598,14 +649,50 @@ void NotificationCollector::dispatchNotification(const Protocol::ChangeNotificat
 void NotificationCollector::dispatchNotifications()
 {
     if (!mNotifications.isEmpty()) {
-        for (auto &ntf : mNotifications) {
-            completeNotification(ntf);
-        }
+        completeNotifications(mNotifications);
+        updateCollectionTreeCache(mNotifications);
         notify(std::move(mNotifications));
         clear();
     }
 }
 
+void NotificationCollector::updateCollectionTreeCache(const Protocol::ChangeNotificationList &msgs)
+{
+    auto cache = AkonadiServer::instance()->collectionTreeCache();
+    if (!cache) {
+        return;
+    }
+
+    for (const auto &msg : msgs) {
+        if (msg->type() != Protocol::Command::CollectionChangeNotification) {
+            continue;
+        }
+        const auto &ntf = Protocol::cmdCast<Protocol::CollectionChangeNotification>(msg);
+        Collection col;
+        col.setId(ntf.collection().id());
+        switch (ntf.operation()) {
+        case Protocol::CollectionChangeNotification::Add:
+            col.setParentId(ntf.parentCollection());
+            cache->collectionAdded(col);
+            break;
+        case Protocol::CollectionChangeNotification::Move:
+            col.setParentId(ntf.parentDestCollection());
+            cache->collectionMoved(col);
+            break;
+        case Protocol::CollectionChangeNotification::Remove:
+            cache->collectionRemoved(col);
+            break;
+        case Protocol::CollectionChangeNotification::Modify:
+        case Protocol::CollectionChangeNotification::Subscribe:
+        case Protocol::CollectionChangeNotification::Unsubscribe:
+            cache->collectionChanged(col);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 void NotificationCollector::notify(Protocol::ChangeNotificationList msgs)
 {
     if (auto mgr = AkonadiServer::instance()->notificationManager()) {
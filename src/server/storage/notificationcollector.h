@@ -25,8 +25,10 @@
 #include <private/protocol_p.h>
 
 #include <QByteArray>
+#include <QHash>
 #include <QList>
 #include <QString>
+#include <QVector>
 
 namespace Akonadi
 {
@@ -245,7 +247,14 @@ private:
     void dispatchNotification(const Protocol::ChangeNotificationPtr &msg);
     void clear();
 
-    void completeNotification(const Protocol::ChangeNotificationPtr &msg);
+    /**
+      Fills in the item payload of all item notifications in @p msgs, fetching
+      every item once with the aggregated fetch scope of all subscribers.
+    */
+    void completeNotifications(const Protocol::ChangeNotificationList &msgs);
+    bool fetchPayloads(const QVector<qint64> &ids, QHash<qint64, Protocol::FetchItemsResponse> &payloads);
+    /** Applies committed collection changes to the CollectionTreeCache. */
+    void updateCollectionTreeCache(const Protocol::ChangeNotificationList &msgs);
 
 protected:
     virtual void notify(Protocol::ChangeNotificationList ntfs);
@@ -25,13 +25,14 @@
 #include "storage/datastore.h"
 #include "storage/querycache.h"
 #include "storage/storagedebugger.h"
+#include "metrics.h"
 #endif
 
 #include <shared/akranges.h>
 
 #include <QSqlRecord>
 #include <QSqlError>
-#include <QTime>
+#include <QElapsedTimer>
 
 using namespace Akonadi::Server;
 
@@ -99,6 +100,33 @@ static void appendJoined(QString *statement, const QStringList &strings, const Q
     }
 }
 
+// 64-bit FNV-1a, applied to UTF-16 code units rather than bytes
+static const quint64 FingerprintOffsetBasis = 14695981039346656037ULL;
+static const quint64 FingerprintPrime = 1099511628211ULL;
+
+static inline void fingerprintValue(quint64 *hash, quint64 value)
+{
+    *hash ^= value;
+    *hash *= FingerprintPrime;
+}
+
+static inline void fingerprintString(quint64 *hash, const QString &string)
+{
+    // The length keeps adjacent strings from running into each other
+    fingerprintValue(hash, string.size());
+    for (const QChar c : string) {
+        fingerprintValue(hash, c.unicode());
+    }
+}
+
+static inline void fingerprintStrings(quint64 *hash, const QStringList &strings)
+{
+    fingerprintValue(hash, strings.size());
+    for (const QString &string : strings) {
+        fingerprintString(hash, string);
+    }
+}
+
 QueryBuilder::QueryBuilder(const QString &table, QueryBuilder::QueryType type)
     : mTable(table)
 #ifndef QUERYBUILDER_UNITTEST
@@ -349,15 +377,27 @@ void QueryBuilder::buildQuery(QString *statement)
 
 bool QueryBuilder::exec()
 {
-    QString statement;
-    statement.reserve(1024);
-    buildQuery(&statement);
-
 #ifndef QUERYBUILDER_UNITTEST
-    auto query = QueryCache::query(statement);
+    // Prepared queries are not cached for SQLite (see QueryCache::insert()),
+    // the fingerprint still identifies the statement in the metrics
+    const bool useCache = (mDatabaseType != DbType::Sqlite);
+    const int boundValues = mBindValues.size();
+    const quint64 shape = fingerprint();
+    // Guards against fingerprint collisions
+    const QueryCache::Discriminator discriminator = { mType, mTable, mBindValues.size() };
+    Akonadi::akOptional<QSqlQuery> query;
+    if (useCache) {
+        query = QueryCache::query(shape, discriminator);
+    }
     if (query.has_value()) {
         mQuery = std::move(*query);
     } else {
+        // buildQuery() binds the values again
+        mBindValues.resize(boundValues);
+        QString statement;
+        statement.reserve(1024);
+        buildQuery(&statement);
+
         mQuery.clear();
         if (!mQuery.prepare(statement)) {
             qCCritical(AKONADISERVER_LOG) << "DATABASE ERROR while PREPARING QUERY:";
@@ -367,7 +407,9 @@ bool QueryBuilder::exec()
             qCCritical(AKONADISERVER_LOG) << "  Query:" << statement;
             return false;
         }
-        QueryCache::insert(statement, mQuery);
+        if (useCache) {
+            QueryCache::insert(shape, discriminator, mQuery);
+        }
     }
 
     //too heavy debug info but worths to have from time to time
@@ -383,69 +425,29 @@ bool QueryBuilder::exec()
 
     bool ret;
 
-    if (StorageDebugger::instance()->isSQLDebuggingEnabled()) {
-        QTime t;
-        t.start();
-        if (isBatch) {
-            ret = mQuery.execBatch();
-        } else {
-            ret = mQuery.exec();
-        }
-        StorageDebugger::instance()->queryExecuted(reinterpret_cast<qint64>(DataStore::self()),
-                                                   mQuery, t.elapsed());
-    } else {
+    const bool sqlDebugging = StorageDebugger::instance()->isSQLDebuggingEnabled();
+    if (!sqlDebugging) {
         StorageDebugger::instance()->incSequence();
-        if (isBatch) {
-            ret = mQuery.execBatch();
-        } else {
-            ret = mQuery.exec();
-        }
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if (isBatch) {
+        ret = mQuery.execBatch();
+    } else {
+        ret = mQuery.exec();
+    }
+    const qint64 elapsed = timer.nsecsElapsed() / 1000;
+    Metrics::self()->recordQuery(shape, mQuery.lastQuery(), elapsed);
+    if (sqlDebugging) {
+        StorageDebugger::instance()->queryExecuted(reinterpret_cast<qint64>(DataStore::self()),
+                                                   mQuery, elapsed / 1000);
     }
 
     if (!ret) {
-        bool needsRetry = false;
         // Handle transaction deadlocks and timeouts by attempting to replay the transaction.
-        if (mDatabaseType == DbType::PostgreSQL) {
-            const QString dbError = mQuery.lastError().databaseText();
-            if (dbError.contains(QLatin1String("40P01" /* deadlock_detected */))) {
-                qCWarning(AKONADISERVER_LOG) << "QueryBuilder::exec(): database reported transaction deadlock, retrying transaction";
-                qCWarning(AKONADISERVER_LOG) << mQuery.lastError().text();
-                needsRetry = true;
-            }
-        } else if (mDatabaseType == DbType::MySQL) {
-            const QString lastErrorStr = mQuery.lastError().nativeErrorCode();
-            const int error = lastErrorStr.isEmpty() ? -1 : lastErrorStr.toInt();
-            if (error == 1213 /* ER_LOCK_DEADLOCK */) {
-                qCWarning(AKONADISERVER_LOG) << "QueryBuilder::exec(): database reported transaction deadlock, retrying transaction";
-                qCWarning(AKONADISERVER_LOG) << mQuery.lastError().text();
-                needsRetry = true;
-            } else if (error == 1205 /* ER_LOCK_WAIT_TIMEOUT */) {
-                qCWarning(AKONADISERVER_LOG) << "QueryBuilder::exec(): database reported transaction timeout, retrying transaction";
-                qCWarning(AKONADISERVER_LOG) << mQuery.lastError().text();
-                // Not sure retrying helps, maybe error is good enough.... but doesn't hurt to retry a few times before giving up.
-                needsRetry = true;
-            }
-        } else if (mDatabaseType == DbType::Sqlite && !DbType::isSystemSQLite(DataStore::self()->database())) {
-            const QString lastErrorStr = mQuery.lastError().nativeErrorCode();
-            const int error = lastErrorStr.isEmpty() ? -1 : lastErrorStr.toInt();
-            if (error == 6 /* SQLITE_LOCKED */) {
-                qCWarning(AKONADISERVER_LOG) << "QueryBuilder::exec(): database reported transaction deadlock, retrying transaction";
-                qCWarning(AKONADISERVER_LOG) << mQuery.lastError().text();
-                DataStore::self()->doRollback();
-                needsRetry = true;
-            } else if (error == 5 /* SQLITE_BUSY */) {
-                qCWarning(AKONADISERVER_LOG) << "QueryBuilder::exec(): database reported transaction timeout, retrying transaction";
-                qCWarning(AKONADISERVER_LOG) << mQuery.lastError().text();
-                DataStore::self()->doRollback();
-                needsRetry = true;
-            }
-        } else if (mDatabaseType == DbType::Sqlite) {
-            // We can't have a transaction deadlock in SQLite when using driver shipped
-            // with Qt, because it does not support concurrent transactions and DataStore
-            // serializes them through a global lock.
-        }
-
-        if (needsRetry) {
+        if (DbType::isTransactionConflict(DataStore::self()->database(), mQuery.lastError())) {
+            qCWarning(AKONADISERVER_LOG) << "QueryBuilder::exec(): database reported transaction deadlock or timeout, retrying transaction";
+            qCWarning(AKONADISERVER_LOG) << mQuery.lastError().text();
             DataStore::self()->transactionKilledByDB();
             throw DbDeadlockException(mQuery);
         }
@@ -455,10 +457,13 @@ bool QueryBuilder::exec()
         qCCritical(AKONADISERVER_LOG) << "  DB error: " << mQuery.lastError().databaseText();
         qCCritical(AKONADISERVER_LOG) << "  Error text:" << mQuery.lastError().text();
         qCCritical(AKONADISERVER_LOG) << "  Values:" << mQuery.boundValues();
-        qCCritical(AKONADISERVER_LOG) << "  Query:" << statement;
+        qCCritical(AKONADISERVER_LOG) << "  Query:" << mQuery.lastQuery();
         return false;
     }
 #else
+    QString statement;
+    statement.reserve(1024);
+    buildQuery(&statement);
     mStatement = statement;
 #endif
     return true;
@@ -543,6 +548,95 @@ void QueryBuilder::buildWhereCondition(QString *query, const Query::Condition &c
     }
 }
 
+quint64 QueryBuilder::fingerprint()
+{
+    // Must cover everything buildQuery() turns into the statement, and bind
+    // the values in the same order
+    quint64 hash = FingerprintOffsetBasis;
+    fingerprintValue(&hash, mType);
+    fingerprintValue(&hash, mDatabaseType);
+    fingerprintString(&hash, mTable);
+
+    Query::Condition whereCondition = mRootCondition[WhereCondition];
+    switch (mType) {
+    case Select:
+        fingerprintValue(&hash, mDistinct);
+        fingerprintValue(&hash, mForUpdate);
+        fingerprintStrings(&hash, mColumns);
+        fingerprintValue(&hash, mJoinedTables.size());
+        for (const QString &joinedTable : qAsConst(mJoinedTables)) {
+            const QPair<JoinType, Query::Condition> &join = mJoins.value(joinedTable);
+            fingerprintValue(&hash, join.first);
+            fingerprintString(&hash, joinedTable);
+            fingerprintCondition(&hash, join.second);
+        }
+        break;
+    case Insert:
+        fingerprintString(&hash, mIdentificationColumn);
+        Q_FALLTHROUGH();
+    case Update:
+        fingerprintValue(&hash, mColumnValues.size());
+        for (const auto &columnValue : qAsConst(mColumnValues)) {
+            fingerprintString(&hash, columnValue.first);
+            mBindValues << columnValue.second;
+        }
+        if (mType == Update) {
+            fingerprintStrings(&hash, mJoinedTables);
+            for (const QString &table : qAsConst(mJoinedTables)) {
+                whereCondition.addCondition(mJoins.value(table).second);
+            }
+        }
+        break;
+    case Delete:
+        break;
+    }
+
+    fingerprintCondition(&hash, whereCondition);
+    fingerprintStrings(&hash, mGroupColumns);
+    fingerprintCondition(&hash, mRootCondition[HavingCondition]);
+    fingerprintValue(&hash, mSortColumns.size());
+    for (const auto &sortColumn : qAsConst(mSortColumns)) {
+        fingerprintString(&hash, sortColumn.first);
+        fingerprintValue(&hash, sortColumn.second);
+    }
+    fingerprintValue(&hash, mLimit);
+
+    return hash;
+}
+
+void QueryBuilder::fingerprintCondition(quint64 *hash, const Query::Condition &cond)
+{
+    if (!cond.isEmpty()) {
+        fingerprintValue(hash, cond.mSubConditions.size());
+        fingerprintValue(hash, cond.mCombineOp);
+        for (const Query::Condition &subCondition : cond.mSubConditions) {
+            fingerprintCondition(hash, subCondition);
+        }
+        return;
+    }
+
+    fingerprintString(hash, cond.mColumn);
+    fingerprintValue(hash, cond.mCompareOp);
+    fingerprintString(hash, cond.mComparedColumn);
+    if (!cond.mComparedColumn.isEmpty()) {
+        return;
+    }
+    if (!cond.mComparedValue.isValid()) {
+        // NULL
+        fingerprintValue(hash, 0);
+    } else if (cond.mComparedValue.canConvert(QVariant::List)) {
+        // The number of values determines the number of placeholders
+        const QVariantList entries = cond.mComparedValue.toList();
+        fingerprintValue(hash, entries.size() + 1);
+        for (const QVariant &entry : entries) {
+            mBindValues << entry;
+        }
+    } else {
+        fingerprintValue(hash, 1);
+        mBindValues << cond.mComparedValue;
+    }
+}
+
 void QueryBuilder::buildCaseStatement(QString *query, const Query::Case &caseStmt)
 {
     *query += QLatin1String("CASE ");
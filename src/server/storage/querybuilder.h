@@ -264,6 +264,17 @@ private:
     void buildWhereCondition(QString *query, const Query::Condition &cond);
     void buildCaseStatement(QString *query, const Query::Case &caseStmt);
 
+    /**
+     * Returns a fingerprint of the shape of the query, i.e. of everything that
+     * ends up in the statement except for the bound values. Queries with the
+     * same fingerprint have the same statement, so the statement does not have
+     * to be built to look up the prepared query.
+     * The values to bind are appended to mBindValues in the order in which
+     * buildQuery() binds them.
+     */
+    quint64 fingerprint();
+    void fingerprintCondition(quint64 *hash, const Query::Condition &cond);
+
     /**
      * SQLite does not support JOINs with UPDATE, so we have to convert it into
      * subqueries
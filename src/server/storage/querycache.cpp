@@ -20,6 +20,7 @@
 #include "querycache.h"
 #include "dbtype.h"
 #include "datastore.h"
+#include "akonadiserver_debug.h"
 
 #include <QSqlQuery>
 #include <QThreadStorage>
@@ -50,13 +51,17 @@ public:
         m_cleanupTimer.setSingleShot(true);
     }
 
-    akOptional<QSqlQuery> query(const QString &queryStatement)
+    akOptional<QSqlQuery> query(quint64 fingerprint, const QueryCache::Discriminator &discriminator)
     {
         m_cleanupTimer.start(CleanupTimeout);
-        auto it = m_keys.find(queryStatement);
+        auto it = m_keys.find(fingerprint);
         if (it == m_keys.end()) {
             return nullopt;
         }
+        if ((*it)->discriminator != discriminator) {
+            qCWarning(AKONADISERVER_LOG) << "Query fingerprint collision on table" << discriminator.table;
+            return nullopt;
+        }
 
         auto node = **it;
         m_queries.erase(*it);
@@ -65,15 +70,19 @@ public:
         return node.query;
     }
 
-    void insert(const QString &queryStatement, const QSqlQuery &query)
+    void insert(quint64 fingerprint, const QueryCache::Discriminator &discriminator, const QSqlQuery &query)
     {
-        if (m_queries.size() >= MaxCacheSize) {
-            m_keys.remove(m_queries.back().queryStatement);
+        const auto it = m_keys.find(fingerprint);
+        if (it != m_keys.end()) {
+            m_queries.erase(*it);
+            m_keys.erase(it);
+        } else if (m_queries.size() >= MaxCacheSize) {
+            m_keys.remove(m_queries.back().fingerprint);
             m_queries.pop_back();
         }
 
-        m_queries.emplace_front(Node{queryStatement, query});
-        m_keys.insert(queryStatement, m_queries.begin());
+        m_queries.emplace_front(Node{fingerprint, discriminator, query});
+        m_keys.insert(fingerprint, m_queries.begin());
     }
 
     void cleanup()
@@ -84,11 +93,12 @@ public:
 
 public: // public, this is just a helper class
     struct Node {
-        QString queryStatement;
+        quint64 fingerprint;
+        QueryCache::Discriminator discriminator;
         QSqlQuery query;
     };
     std::list<Node> m_queries;
-    QHash<QString, std::list<Node>::iterator> m_keys;
+    QHash<quint64, std::list<Node>::iterator> m_keys;
     QTimer m_cleanupTimer;
 };
 
@@ -105,15 +115,15 @@ static Cache *perThreadCache()
 
 }
 
-akOptional<QSqlQuery> QueryCache::query(const QString &queryStatement)
+akOptional<QSqlQuery> QueryCache::query(quint64 fingerprint, const Discriminator &discriminator)
 {
-    return perThreadCache()->query(queryStatement);
+    return perThreadCache()->query(fingerprint, discriminator);
 }
 
-void QueryCache::insert(const QString &queryStatement, const QSqlQuery &query)
+void QueryCache::insert(quint64 fingerprint, const Discriminator &discriminator, const QSqlQuery &query)
 {
     if (DbType::type(DataStore::self()->database()) != DbType::Sqlite) {
-        perThreadCache()->insert(queryStatement, query);
+        perThreadCache()->insert(fingerprint, discriminator, query);
     }
 }
 
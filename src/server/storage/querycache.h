@@ -22,7 +22,8 @@
 
 #include <shared/akoptional.h>
 
-class QString;
+#include <QString>
+
 class QSqlQuery;
 
 namespace Akonadi
@@ -37,11 +38,33 @@ namespace Server
 namespace QueryCache
 {
 
-/// Returns the cached (and prepared) query for @p queryStatement
-akOptional<QSqlQuery> query(const QString &queryStatement);
+/**
+ * Cheap properties of a query which are stored along with the cached query
+ * and compared on lookup, so that two different queries whose fingerprints
+ * collide don't end up sharing a prepared statement.
+ */
+struct Discriminator {
+    int type;
+    QString table;
+    int boundValues;
+
+    bool operator==(const Discriminator &other) const
+    {
+        return type == other.type && boundValues == other.boundValues && table == other.table;
+    }
+    bool operator!=(const Discriminator &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/// Returns the cached (and prepared) query for a query with the shape @p fingerprint
+/// (see QueryBuilder::fingerprint()), unless it was cached for a different @p discriminator
+akOptional<QSqlQuery> query(quint64 fingerprint, const Discriminator &discriminator);
 
-/// Insert @p query into the cache for @p queryStatement.
-void insert(const QString &queryStatement, const QSqlQuery &query);
+/// Insert @p query into the cache for a query with the shape @p fingerprint,
+/// replacing any query cached for it before.
+void insert(quint64 fingerprint, const Discriminator &discriminator, const QSqlQuery &query);
 
 /// Clears all queries from current thread
 void clear();
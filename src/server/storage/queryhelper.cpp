@@ -19,6 +19,8 @@
 
 #include "queryhelper.h"
 
+#include "storage/datastore.h"
+#include "storage/dbtype.h"
 #include "storage/querybuilder.h"
 
 #include <private/imapset_p.h>
@@ -26,21 +28,42 @@
 using namespace Akonadi;
 using namespace Akonadi::Server;
 
+int QueryHelper::maxInConditionSize()
+{
+    // SQLite refuses statements with more than 999 host parameters, so leave
+    // some room for the other conditions of the query there
+    if (DbType::type(DataStore::self()->database()) == DbType::Sqlite) {
+        return 500;
+    }
+    return 5000;
+}
+
 void QueryHelper::setToQuery(const ImapSet &set, const QString &column, QueryBuilder &qb)
 {
+    // Filling the temporary table for larger sets takes longer than the
+    // range conditions cost in the query
+    static const qint64 MaxIdSetTableSize = 1000000;
+
     Query::Condition cond(Query::Or);
+    Query::Condition rangeCond(Query::Or);
+    QVector<ImapSet::Id> ids;
+    qint64 setSize = 0;
+    int rangeValues = 0;
     Q_FOREACH (const ImapInterval &i, set.intervals()) {
         if (i.hasDefinedBegin() && i.hasDefinedEnd()) {
+            setSize += i.size();
             if (i.size() == 1) {
-                cond.addValueCondition(column, Query::Equals, i.begin());
+                ids << i.begin();
             } else {
                 if (i.begin() != 1) {   // 1 is our standard lower bound, so we don't have to check for it explicitly
                     Query::Condition subCond(Query::And);
                     subCond.addValueCondition(column, Query::GreaterOrEqual, i.begin());
                     subCond.addValueCondition(column, Query::LessOrEqual, i.end());
-                    cond.addCondition(subCond);
+                    rangeCond.addCondition(subCond);
+                    rangeValues += 2;
                 } else {
-                    cond.addValueCondition(column, Query::LessOrEqual, i.end());
+                    rangeCond.addValueCondition(column, Query::LessOrEqual, i.end());
+                    ++rangeValues;
                 }
             }
         } else if (i.hasDefinedBegin()) {
@@ -51,6 +74,41 @@ void QueryHelper::setToQuery(const ImapSet &set, const QString &column, QueryBui
             cond.addValueCondition(column, Query::LessOrEqual, i.end());
         }
     }
+
+    const int maxValues = maxInConditionSize();
+    QString idSetTable;
+    bool keepRanges = true;
+    if (ids.size() + rangeValues > maxValues) {
+        if (rangeValues <= maxValues) {
+            // Only the single ids go into the table, the ranges stay cheap
+            // range conditions no matter how many ids they cover
+            ImapSet singleIds;
+            singleIds.add(ids);
+            idSetTable = DataStore::self()->idSetTable(singleIds);
+        } else if (setSize <= MaxIdSetTableSize) {
+            // Too many ranges as well
+            idSetTable = DataStore::self()->idSetTable(set);
+            keepRanges = idSetTable.isEmpty();
+        }
+    }
+    if (!idSetTable.isEmpty()) {
+        cond.addColumnCondition(column, Query::In, QLatin1String("( SELECT id FROM ") + idSetTable + QLatin1String(" )"));
+    } else if (ids.size() == 1) {
+        cond.addValueCondition(column, Query::Equals, ids.first());
+    } else if (!ids.isEmpty()) {
+        QVariantList values;
+        values.reserve(ids.size());
+        for (ImapSet::Id id : qAsConst(ids)) {
+            values << id;
+        }
+        cond.addValueCondition(column, Query::In, values);
+    }
+    if (keepRanges) {
+        for (const Query::Condition &range : rangeCond.subConditions()) {
+            cond.addCondition(range);
+        }
+    }
+
     if (!cond.isEmpty()) {
         qb.addCondition(cond);
     }
@@ -37,8 +37,22 @@ class QueryBuilder;
 */
 namespace QueryHelper
 {
+/**
+  Returns the largest number of values a single IN condition should bind on
+  the current database backend. Larger value lists have to be split into
+  chunks of at most this size.
+*/
+int maxInConditionSize();
+
 /**
   Add conditions to @p qb for the given uid set @p set applied to @p column.
+
+  Contiguous ranges are turned into range conditions and single ids are
+  combined into an IN condition. If the resulting condition would bind more
+  than maxInConditionSize() values, the single ids are written into a
+  temporary table (see DataStore::idSetTable()) and matched against that
+  instead, next to the range conditions. Only if there are too many ranges
+  as well, the whole set goes into the table.
 */
 void setToQuery(const ImapSet &set, const QString &column, QueryBuilder &qb);
 
@@ -0,0 +1,434 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "storagesnapshot.h"
+#include "datastore.h"
+#include "dbtype.h"
+#include "transaction.h"
+#include "collectionstatistics.h"
+#include "tagcache.h"
+#include "entities.h"
+#include "akonadiserver_debug.h"
+
+#include <private/externalpartstorage_p.h>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlRecord>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+using namespace Akonadi::Server;
+
+namespace
+{
+
+static const quint32 SnapshotMagic = 0x414b534e; // "AKSN"
+static const quint32 SnapshotFormatVersion = 1;
+static const int BlockSize = 1024;
+
+QString schemaVersionTable()
+{
+    return SchemaVersion::tableName();
+}
+
+/*
+ * External part files are immutable: modifying a part creates a file with
+ * a new revision suffix. That makes it safe to share them between the store
+ * and the snapshot by hardlinking.
+ */
+bool linkOrCopyFile(const QString &src, const QString &dest)
+{
+    if (!QDir().mkpath(QFileInfo(dest).absolutePath())) {
+        return false;
+    }
+    QFile::remove(dest);
+#ifdef Q_OS_UNIX
+    if (::link(QFile::encodeName(src).constData(), QFile::encodeName(dest).constData()) == 0) {
+        return true;
+    }
+#endif
+    return QFile::copy(src, dest);
+}
+
+}
+
+StorageSnapshot::StorageSnapshot(DataStore *store, const MessageHandler &handler)
+    : mStore(store)
+    , mHandler(handler)
+{
+}
+
+QString StorageSnapshot::databaseFileName()
+{
+    return QStringLiteral("database.snapshot");
+}
+
+QString StorageSnapshot::externalPartsDirName()
+{
+    return QStringLiteral("file_db_data");
+}
+
+QString StorageSnapshot::errorString() const
+{
+    return mError;
+}
+
+bool StorageSnapshot::setError(const QString &error)
+{
+    mError = error;
+    qCWarning(AKONADISERVER_LOG) << "Snapshot:" << error;
+    return false;
+}
+
+void StorageSnapshot::inform(const QString &msg)
+{
+    if (mHandler) {
+        mHandler(msg);
+    }
+}
+
+bool StorageSnapshot::create(const QString &path)
+{
+    mError.clear();
+
+    const QDir dir(path);
+    if (!dir.mkpath(QStringLiteral("."))) {
+        return setError(QStringLiteral("Failed to create directory %1").arg(path));
+    }
+    if (dir.exists(databaseFileName())) {
+        return setError(QStringLiteral("%1 already contains a snapshot").arg(path));
+    }
+
+    QFile file(dir.absoluteFilePath(databaseFileName()));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return setError(QStringLiteral("Failed to open %1: %2").arg(file.fileName(), file.errorString()));
+    }
+
+    // Nothing is written to the database, the transaction only gives us a
+    // consistent view of all tables and is rolled back when leaving.
+    Transaction transaction(mStore, QStringLiteral("JANITOR SNAPSHOT"));
+
+    const SchemaVersion::List versions = SchemaVersion::retrieveAll();
+    if (versions.isEmpty()) {
+        file.remove();
+        return setError(QStringLiteral("Failed to determine database schema version"));
+    }
+
+    QVector<QString> tables = allDatabaseTables();
+    tables.removeOne(schemaVersionTable());
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_11);
+    stream << SnapshotMagic << SnapshotFormatVersion << versions.first().version() << tables.size();
+
+    const QString partsPath = dir.absoluteFilePath(externalPartsDirName());
+    const bool partsPathExisted = QDir(partsPath).exists();
+    // Don't leave a half-written snapshot behind, including the part files
+    // linked into it so far
+    const auto removePartialSnapshot = [&]() {
+        file.remove();
+        if (!partsPathExisted) {
+            QDir(partsPath).removeRecursively();
+        }
+    };
+    for (const QString &table : qAsConst(tables)) {
+        inform(QStringLiteral("Writing table %1...").arg(table));
+        if (!dumpTable(stream, table, partsPath)) {
+            removePartialSnapshot();
+            return false;
+        }
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.flush()) {
+        removePartialSnapshot();
+        return setError(QStringLiteral("Failed to write %1: %2").arg(file.fileName(), file.errorString()));
+    }
+
+    inform(QStringLiteral("Snapshot written to %1").arg(dir.absolutePath()));
+    return true;
+}
+
+bool StorageSnapshot::dumpTable(QDataStream &stream, const QString &table, const QString &snapshotPartsPath)
+{
+    QSqlQuery query(mStore->database());
+    query.setForwardOnly(true);
+    if (!query.exec(QStringLiteral("SELECT * FROM %1").arg(table))) {
+        return setError(QStringLiteral("Failed to read table %1: %2").arg(table, query.lastError().text()));
+    }
+
+    const QSqlRecord record = query.record();
+    QStringList columns;
+    columns.reserve(record.count());
+    for (int i = 0; i < record.count(); ++i) {
+        columns << record.fieldName(i);
+    }
+    stream << table << columns;
+
+    int dataColumn = -1;
+    int storageColumn = -1;
+    if (table == Part::tableName()) {
+        dataColumn = record.indexOf(Part::dataColumn());
+        storageColumn = record.indexOf(Part::storageColumn());
+    }
+    const QString storagePath = ExternalPartStorage::akonadiStoragePath();
+
+    QVector<QVariantList> block(columns.size());
+    int rows = 0;
+    const auto writeBlock = [&]() {
+        stream << static_cast<qint32>(rows);
+        for (QVariantList &values : block) {
+            stream << values;
+            values.clear();
+        }
+        rows = 0;
+    };
+
+    while (query.next()) {
+        for (int i = 0; i < columns.size(); ++i) {
+            block[i].append(query.value(i));
+        }
+
+        if (storageColumn >= 0 && query.value(storageColumn).toInt() == Part::External) {
+            const QString partFile = ExternalPartStorage::resolveAbsolutePath(query.value(dataColumn).toByteArray());
+            const QString target = snapshotPartsPath + QLatin1Char('/') + QDir(storagePath).relativeFilePath(partFile);
+            if (!linkOrCopyFile(partFile, target)) {
+                // The snapshot would restore without this payload
+                return setError(QStringLiteral("Failed to store external part file %1").arg(partFile));
+            }
+        }
+
+        if (++rows == BlockSize) {
+            writeBlock();
+        }
+    }
+    if (rows > 0) {
+        writeBlock();
+    }
+    stream << static_cast<qint32>(0);
+
+    return true;
+}
+
+bool StorageSnapshot::restore(const QString &path)
+{
+    mError.clear();
+
+    const QDir dir(path);
+    QFile file(dir.absoluteFilePath(databaseFileName()));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return setError(QStringLiteral("Failed to open %1: %2").arg(file.fileName(), file.errorString()));
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_11);
+
+    quint32 magic = 0;
+    quint32 formatVersion = 0;
+    int schemaVersion = 0;
+    int tableCount = 0;
+    stream >> magic >> formatVersion >> schemaVersion >> tableCount;
+    if (magic != SnapshotMagic || formatVersion != SnapshotFormatVersion) {
+        return setError(QStringLiteral("%1 is not a valid snapshot").arg(file.fileName()));
+    }
+
+    Transaction transaction(mStore, QStringLiteral("JANITOR RESTORE"));
+
+    SchemaVersion::List versions = SchemaVersion::retrieveAll();
+    if (versions.isEmpty() || versions.first().version() != schemaVersion) {
+        return setError(QStringLiteral("Snapshot was created with database schema version %1, cannot restore it").arg(schemaVersion));
+    }
+
+    QSqlDatabase db = mStore->database();
+    QSqlQuery query(db);
+    const DbType::Type dbType = DbType::type(db);
+    // PostgreSQL constraints are already deferred by DataStore::beginTransaction()
+    if (dbType == DbType::MySQL) {
+        query.exec(QStringLiteral("SET FOREIGN_KEY_CHECKS = 0"));
+    } else if (dbType == DbType::Sqlite) {
+        query.exec(QStringLiteral("PRAGMA defer_foreign_keys = ON"));
+    }
+    const auto restoreForeignKeyChecks = [&]() {
+        if (dbType == DbType::MySQL) {
+            QSqlQuery(db).exec(QStringLiteral("SET FOREIGN_KEY_CHECKS = 1"));
+        }
+    };
+
+    inform(QStringLiteral("Removing current content of the store..."));
+    QVector<QString> tables = allDatabaseTables();
+    tables.removeOne(schemaVersionTable());
+    for (auto it = tables.crbegin(), end = tables.crend(); it != end; ++it) {
+        if (!query.exec(QStringLiteral("DELETE FROM %1").arg(*it))) {
+            restoreForeignKeyChecks();
+            return setError(QStringLiteral("Failed to clear table %1: %2").arg(*it, query.lastError().text()));
+        }
+    }
+
+    for (int i = 0; i < tableCount; ++i) {
+        QString table;
+        if (!loadTable(stream, &table)) {
+            restoreForeignKeyChecks();
+            return false;
+        }
+        inform(QStringLiteral("Restored table %1").arg(table));
+    }
+
+    // Stage the external parts next to the live ones, they are only swapped
+    // in once the database has been committed
+    const QString stagingPath = ExternalPartStorage::akonadiStoragePath() + QStringLiteral(".restore");
+    if (!stageExternalParts(dir.absoluteFilePath(externalPartsDirName()), stagingPath)) {
+        restoreForeignKeyChecks();
+        QDir(stagingPath).removeRecursively();
+        return false;
+    }
+
+    // The content of the store has changed entirely, so clients must not
+    // trust anything they have cached from the previous one.
+    SchemaVersion version = versions.first();
+    version.setGeneration(QDateTime::currentDateTimeUtc().toTime_t());
+    version.update();
+
+    const bool committed = transaction.commit();
+    restoreForeignKeyChecks();
+    if (!committed) {
+        QDir(stagingPath).removeRecursively();
+        return setError(QStringLiteral("Failed to commit the restored snapshot"));
+    }
+
+    if (!swapExternalParts(stagingPath)) {
+        return false;
+    }
+
+    MimeType::invalidateCompleteCache();
+    Flag::invalidateCompleteCache();
+    Resource::invalidateCompleteCache();
+    Collection::invalidateCompleteCache();
+    PartType::invalidateCompleteCache();
+    TagType::invalidateCompleteCache();
+    TagCache::self()->invalidate();
+    CollectionStatistics::self()->expireCache();
+
+    inform(QStringLiteral("Snapshot restored, restart the Akonadi server to pick up all changes."));
+    return true;
+}
+
+bool StorageSnapshot::loadTable(QDataStream &stream, QString *table)
+{
+    QStringList columns;
+    stream >> *table >> columns;
+    if (stream.status() != QDataStream::Ok || columns.isEmpty()) {
+        return setError(QStringLiteral("Corrupted snapshot"));
+    }
+
+    QStringList placeholders;
+    placeholders.reserve(columns.size());
+    for (int i = 0; i < columns.size(); ++i) {
+        placeholders << QStringLiteral("?");
+    }
+
+    QSqlQuery query(mStore->database());
+    if (!query.prepare(QStringLiteral("INSERT INTO %1 (%2) VALUES (%3)").arg(*table,
+                                                                            columns.join(QLatin1Char(',')),
+                                                                            placeholders.join(QLatin1Char(','))))) {
+        return setError(QStringLiteral("Failed to prepare insertion into %1: %2").arg(*table, query.lastError().text()));
+    }
+
+    Q_FOREVER {
+        qint32 rows = 0;
+        stream >> rows;
+        if (stream.status() != QDataStream::Ok) {
+            return setError(QStringLiteral("Corrupted snapshot"));
+        }
+        if (rows == 0) {
+            break;
+        }
+
+        for (int i = 0; i < columns.size(); ++i) {
+            QVariantList values;
+            stream >> values;
+            if (values.size() != rows) {
+                return setError(QStringLiteral("Corrupted snapshot"));
+            }
+            query.addBindValue(values);
+        }
+        if (!query.execBatch()) {
+            return setError(QStringLiteral("Failed to restore table %1: %2").arg(*table, query.lastError().text()));
+        }
+    }
+
+    // Explicitly inserted IDs don't advance PostgreSQL sequences
+    if (columns.contains(QLatin1String("id")) && DbType::type(mStore->database()) == DbType::PostgreSQL) {
+        QSqlQuery seqQuery(mStore->database());
+        if (!seqQuery.exec(QStringLiteral("SELECT setval(pg_get_serial_sequence('%1', 'id'), COALESCE(MAX(id), 0) + 1, false) FROM %1").arg(*table))) {
+            return setError(QStringLiteral("Failed to update sequence of table %1: %2").arg(*table, seqQuery.lastError().text()));
+        }
+    }
+
+    return true;
+}
+
+bool StorageSnapshot::stageExternalParts(const QString &snapshotPartsPath, const QString &stagingPath)
+{
+    inform(QStringLiteral("Restoring external parts..."));
+    QDir(stagingPath).removeRecursively();
+
+    const QDir snapshotDir(snapshotPartsPath);
+    QDirIterator parts(snapshotPartsPath, QDir::Files, QDirIterator::Subdirectories);
+    while (parts.hasNext()) {
+        const QString part = parts.next();
+        const QString target = stagingPath + QLatin1Char('/') + snapshotDir.relativeFilePath(part);
+        if (!linkOrCopyFile(part, target)) {
+            return setError(QStringLiteral("Failed to restore external part %1").arg(part));
+        }
+    }
+
+    return true;
+}
+
+bool StorageSnapshot::swapExternalParts(const QString &stagingPath)
+{
+    const QString storagePath = ExternalPartStorage::akonadiStoragePath();
+    const QString oldPath = storagePath + QStringLiteral(".old");
+
+    QDir(oldPath).removeRecursively();
+    if (QDir(storagePath).exists() && !QDir().rename(storagePath, oldPath)) {
+        QDir(stagingPath).removeRecursively();
+        return setError(QStringLiteral("Failed to move away the external parts in %1, "
+                                       "the database has been restored but the payload files have not").arg(storagePath));
+    }
+    if (QDir(stagingPath).exists() && !QDir().rename(stagingPath, storagePath)) {
+        QDir().rename(oldPath, storagePath);
+        return setError(QStringLiteral("Failed to move the restored external parts from %1 to %2").arg(stagingPath, storagePath));
+    }
+    if (!QDir(storagePath).exists()) {
+        // The snapshot had no external parts
+        QDir().mkpath(storagePath);
+    }
+    QDir(oldPath).removeRecursively();
+
+    return true;
+}
@@ -0,0 +1,95 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef STORAGESNAPSHOT_H
+#define STORAGESNAPSHOT_H
+
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+
+class QDataStream;
+
+namespace Akonadi
+{
+namespace Server
+{
+
+class DataStore;
+
+/**
+ * Creates and restores binary snapshots of the whole Akonadi store.
+ *
+ * A snapshot is a directory containing a single database dump file and
+ * a copy of the external payload parts. The dump stores every table of the
+ * schema in blocks of rows, each block laid out column by column, so that
+ * restoring a table boils down to one batched INSERT per block.
+ *
+ * The database is read within a single transaction, so the snapshot is
+ * consistent even when taken from a running server. External part files are
+ * never modified in place (every change creates a new revision file), so they
+ * are hardlinked into the snapshot when possible and copied otherwise.
+ *
+ * When restoring, the part files are first linked into a staging directory
+ * next to the live storage and only swapped in after the database transaction
+ * has been committed, so a failed restore leaves the old payloads untouched.
+ */
+class StorageSnapshot
+{
+public:
+    typedef std::function<void(const QString &)> MessageHandler;
+
+    explicit StorageSnapshot(DataStore *store, const MessageHandler &handler = MessageHandler());
+
+    /**
+     * Writes a snapshot of the current store into directory @p path. The
+     * directory is created if needed and must not contain a snapshot yet.
+     * Fails if any external part file can't be stored in the snapshot.
+     */
+    bool create(const QString &path);
+
+    /**
+     * Replaces the content of the store by the snapshot in @p path. The
+     * snapshot must have been created with the same database schema version.
+     */
+    bool restore(const QString &path);
+
+    QString errorString() const;
+
+    static QString databaseFileName();
+    static QString externalPartsDirName();
+
+private:
+    bool dumpTable(QDataStream &stream, const QString &table, const QString &snapshotPartsPath);
+    bool loadTable(QDataStream &stream, QString *table);
+    bool stageExternalParts(const QString &snapshotPartsPath, const QString &stagingPath);
+    bool swapExternalParts(const QString &stagingPath);
+    bool setError(const QString &error);
+    void inform(const QString &msg);
+
+    DataStore *mStore;
+    MessageHandler mHandler;
+    QString mError;
+};
+
+} // namespace Server
+} // namespace Akonadi
+
+#endif // STORAGESNAPSHOT_H
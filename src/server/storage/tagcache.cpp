@@ -0,0 +1,167 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "tagcache.h"
+#include "datastore.h"
+
+using namespace Akonadi;
+using namespace Akonadi::Server;
+
+/// Drop the whole cache once it holds that many tags
+static const int MaxCacheSize = 10000;
+
+TagCache *TagCache::sInstance = nullptr;
+
+TagCache *TagCache::self()
+{
+    if (sInstance == nullptr) {
+        sInstance = new TagCache();
+    }
+    return sInstance;
+}
+
+void TagCache::destroy()
+{
+    delete sInstance;
+    sInstance = nullptr;
+}
+
+TagCache::TagCache()
+{
+}
+
+TagCache::CachedTag TagCache::tag(qint64 tagId)
+{
+    quint64 generation;
+    {
+        QMutexLocker lock(&mCacheLock);
+        auto it = mCache.constFind(tagId);
+        if (it != mCache.cend()) {
+            return *it;
+        }
+        generation = mGeneration;
+    }
+
+    CachedTag cached;
+    if (!loadTag(tagId, cached)) {
+        return cached;
+    }
+
+    QMutexLocker lock(&mCacheLock);
+    if (generation != mGeneration) {
+        // Some tag has been invalidated while we were loading ours, don't
+        // risk caching an outdated copy
+        return cached;
+    }
+    for (const auto &pending : qAsConst(mPending)) {
+        if (pending.contains(tagId)) {
+            // The tag is being changed in a transaction, what we just loaded
+            // might be outdated soon
+            return cached;
+        }
+    }
+    if (mCache.size() >= MaxCacheSize) {
+        mCache.clear();
+    }
+    mCache.insert(tagId, cached);
+    return cached;
+}
+
+bool TagCache::loadTag(qint64 tagId, CachedTag &cached)
+{
+    cached.tag = Tag::retrieveById(tagId);
+    if (!cached.tag.isValid()) {
+        return false;
+    }
+    cached.type = cached.tag.tagType().name().toUtf8();
+
+    const auto attributes = TagAttribute::retrieveFiltered(TagAttribute::tagIdColumn(), tagId);
+    for (const TagAttribute &attribute : attributes) {
+        cached.attributes.insert(attribute.type(), attribute.value());
+    }
+
+    const auto remoteIds = TagRemoteIdResourceRelation::retrieveFiltered(TagRemoteIdResourceRelation::tagIdColumn(), tagId);
+    for (const TagRemoteIdResourceRelation &remoteId : remoteIds) {
+        cached.remoteIds.insert(remoteId.resourceId(), remoteId.remoteId().toUtf8());
+    }
+
+    return true;
+}
+
+void TagCache::invalidateTag(qint64 tagId)
+{
+    DataStore *store = DataStore::hasDataStore() ? DataStore::self() : nullptr;
+
+    QMutexLocker lock(&mCacheLock);
+    mCache.remove(tagId);
+    ++mGeneration;
+
+    if (store && store->inTransaction()) {
+        mPending[store].insert(tagId);
+        trackTransaction(store);
+    }
+}
+
+void TagCache::invalidate()
+{
+    QMutexLocker lock(&mCacheLock);
+    mCache.clear();
+    ++mGeneration;
+}
+
+void TagCache::trackTransaction(DataStore *store)
+{
+    // mCacheLock must be held by caller
+
+    if (mTrackedStores.contains(store)) {
+        return;
+    }
+    mTrackedStores.insert(store);
+
+    QObject::connect(store, &DataStore::transactionCommitted,
+                     store, [store]() { transactionFinished(store); });
+    QObject::connect(store, &DataStore::transactionRolledBack,
+                     store, [store]() { transactionFinished(store); });
+    QObject::connect(store, &QObject::destroyed,
+                     [store]() {
+                         if (sInstance) {
+                             QMutexLocker lock(&sInstance->mCacheLock);
+                             sInstance->mPending.remove(store);
+                             sInstance->mTrackedStores.remove(store);
+                         }
+                     });
+}
+
+void TagCache::transactionFinished(DataStore *store)
+{
+    if (!sInstance) {
+        return;
+    }
+
+    QMutexLocker lock(&sInstance->mCacheLock);
+    const QSet<qint64> tags = sInstance->mPending.take(store);
+    for (const qint64 tagId : tags) {
+        // Someone may have cached the tag before our changes became visible
+        sInstance->mCache.remove(tagId);
+    }
+    if (!tags.isEmpty()) {
+        ++sInstance->mGeneration;
+    }
+}
@@ -0,0 +1,107 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef AKONADI_SERVER_TAGCACHE_H
+#define AKONADI_SERVER_TAGCACHE_H
+
+#include "entities.h"
+
+#include <private/protocol_p.h>
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+
+namespace Akonadi
+{
+namespace Server
+{
+
+class DataStore;
+
+/**
+ * Provides cache for tags, their attributes and remote IDs
+ *
+ * Tags are applied to large numbers of items, so the same tag is looked up over
+ * and over again when listing items or emitting notifications. The cache holds
+ * the tag itself together with its attributes and remote IDs of all resources.
+ *
+ * Tag handlers invalidate a tag whenever they change it. When that happens inside
+ * a transaction, the tag is not cached again until the transaction is finished,
+ * so that other connections cannot cache the old version in the meantime.
+ */
+class TagCache
+{
+public:
+    struct CachedTag {
+        Tag tag;
+        QByteArray type;
+        Protocol::Attributes attributes;
+        /// Remote IDs indexed by resource ID
+        QHash<qint64, QByteArray> remoteIds;
+
+        bool isValid() const
+        {
+            return tag.isValid();
+        }
+    };
+
+    static TagCache *self();
+    static void destroy();
+
+    /**
+     * Returns the tag with given @p tagId, loading it from the database if
+     * needed. The returned tag is invalid if no such tag exists.
+     */
+    CachedTag tag(qint64 tagId);
+
+    /**
+     * Removes the tag from the cache. Must be called after the tag, its attributes
+     * or remote IDs have been changed.
+     */
+    void invalidateTag(qint64 tagId);
+
+    /**
+     * Removes all tags from the cache.
+     */
+    void invalidate();
+
+private:
+    explicit TagCache();
+
+    bool loadTag(qint64 tagId, CachedTag &cached);
+    void trackTransaction(DataStore *store);
+    static void transactionFinished(DataStore *store);
+
+    QMutex mCacheLock;
+    QHash<qint64, CachedTag> mCache;
+    /// Tags invalidated within transactions that have not been finished yet
+    QHash<DataStore *, QSet<qint64>> mPending;
+    QSet<DataStore *> mTrackedStores;
+    /// Bumped on every invalidation, see tag()
+    quint64 mGeneration = 0;
+
+    static TagCache *sInstance;
+};
+
+} // namespace Server
+} // namespace Akonadi
+
+#endif // AKONADI_SERVER_TAGCACHE_H
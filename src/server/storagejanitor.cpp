@@ -25,10 +25,16 @@
 #include "storage/selectquerybuilder.h"
 #include "storage/parthelper.h"
 #include "storage/dbconfig.h"
+#include "storage/dbtype.h"
+#include "storage/datastorepool.h"
 #include "storage/collectionstatistics.h"
+#include "storage/storagesnapshot.h"
+#include "storage/collectiontreecache.h"
+#include "storage/dbdeadlockcatcher.h"
 #include "search/searchrequest.h"
 #include "search/searchmanager.h"
 #include "resourcemanager.h"
+#include "akonadi.h"
 #include "entities.h"
 #include "dbusconnectionpool.h"
 #include "agentmanagerinterface.h"
@@ -47,20 +53,53 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QDateTime>
+#include <QRunnable>
+#include <QSettings>
+#include <QThreadPool>
+#include <QTimer>
 
 #include <algorithm>
 
 using namespace Akonadi;
 using namespace Akonadi::Server;
 
+namespace {
+
+class JanitorTask : public QRunnable
+{
+public:
+    explicit JanitorTask(const std::function<void()> &task)
+        : mTask(task)
+    {
+    }
+
+    void run() override
+    {
+        mTask();
+    }
+
+private:
+    std::function<void()> mTask;
+};
+
+}
+
 StorageJanitor::StorageJanitor(QObject *parent)
-    : AkThread(QStringLiteral("StorageJanitor"), QThread::IdlePriority, parent)
+    : StorageJanitor(AutoStart, parent)
+{
+}
+
+StorageJanitor::StorageJanitor(StartMode startMode, QObject *parent)
+    : AkThread(QStringLiteral("StorageJanitor"), startMode, QThread::IdlePriority, parent)
     , m_lostFoundCollectionId(-1)
+    , m_aborted(false)
 {
 }
 
 StorageJanitor::~StorageJanitor()
 {
+    // Let a running check stop after its current chunk
+    m_aborted = true;
     quitThread();
 }
 
@@ -72,6 +111,31 @@ void StorageJanitor::init()
     conn.registerService(DBus::serviceName(DBus::StorageJanitor));
     conn.registerObject(QStringLiteral(AKONADI_DBUS_STORAGEJANITOR_PATH), this,
                         QDBusConnection::ExportScriptableSlots | QDBusConnection::ExportScriptableSignals);
+
+    QSettings settings(StandardDirs::serverConfigFile(), QSettings::IniFormat);
+    settings.beginGroup(QStringLiteral("Janitor"));
+    m_chunkSize = qMax(1, settings.value(QStringLiteral("ChunkSize"), m_chunkSize).toInt());
+    m_backgroundChunks = qMax(1, settings.value(QStringLiteral("BackgroundChunks"), m_backgroundChunks).toInt());
+    m_backgroundRepair = settings.value(QStringLiteral("BackgroundRepair"), false).toBool();
+    // SQLite serializes all writers, parallel checks would only wait for each other
+    const bool isSqlite = DbType::typeForDriverName(DbConfig::configuredDatabase()->driverName()) == DbType::Sqlite;
+    const int workerThreads = settings.value(QStringLiteral("WorkerThreads"), isSqlite ? 0 : 3).toInt();
+    const int backgroundInterval = settings.value(QStringLiteral("BackgroundInterval"), 0).toInt();
+    settings.endGroup();
+
+    if (workerThreads > 0) {
+        m_workers = new QThreadPool();
+        m_workers->setMaxThreadCount(workerThreads);
+    }
+
+    m_checkpoints = std::make_unique<QSettings>(StandardDirs::saveDir("data") + QStringLiteral("/janitor_checkpoints"),
+                                                QSettings::IniFormat);
+
+    if (backgroundInterval > 0) {
+        m_backgroundTimer = new QTimer();
+        connect(m_backgroundTimer, &QTimer::timeout, this, &StorageJanitor::backgroundCheck);
+        m_backgroundTimer->start(backgroundInterval * 1000);
+    }
 }
 
 void StorageJanitor::quit()
@@ -81,6 +145,17 @@ void StorageJanitor::quit()
     conn.unregisterService(DBus::serviceName(DBus::StorageJanitor));
     conn.disconnectFromBus(conn.name());
 
+    delete m_backgroundTimer;
+    m_backgroundTimer = nullptr;
+
+    if (m_workers) {
+        // Joins the worker threads, which closes their database connections
+        m_workers->waitForDone();
+        delete m_workers;
+        m_workers = nullptr;
+    }
+    m_checkpoints.reset();
+
     // Make sure all children are deleted within context of this thread
     qDeleteAll(children());
 
@@ -103,38 +178,56 @@ void StorageJanitor::check() // implementation of `akonadictl fsck`
         checkPathToRoot(col);
     });
 
-    inform("Looking for items not belonging to a valid collection...");
-    findOrphanedItems();
-
-    inform("Looking for item parts not belonging to a valid item...");
-    findOrphanedParts();
-
-    inform("Looking for item flags not belonging to a valid item...");
-    findOrphanedPimItemFlags();
-
-    inform("Looking for overlapping external parts...");
-    findOverlappingParts();
-
-    inform("Verifying external parts...");
-    verifyExternalParts();
-
-    inform("Checking size treshold changes...");
-    checkSizeTreshold();
-
-    inform("Looking for dirty objects...");
-    findDirtyObjects();
+    // The checks within a lane depend on each other, the lanes don't
+    const auto itemsLane = [this]() {
+        inform("Looking for items not belonging to a valid collection...");
+        runChunkedCheck(OrphanedItemsCheck);
+
+        inform("Looking for dirty objects...");
+        findDirtyObjects();
+
+        inform("Looking for rid-duplicates not matching the content mime-type of the parent collection");
+        runChunkedCheck(RIDDuplicatesCheck);
+    };
+    const auto partsLane = [this]() {
+        inform("Looking for item parts not belonging to a valid item...");
+        runChunkedCheck(OrphanedPartsCheck);
+
+        inform("Looking for item flags not belonging to a valid item...");
+        runChunkedCheck(OrphanedPimItemFlagsCheck);
+    };
+    const auto externalPartsLane = [this]() {
+        inform("Looking for overlapping external parts...");
+        findOverlappingParts();
+
+        inform("Verifying external parts...");
+        if (runChunkedCheck(MissingExternalPartsCheck)) {
+            findUnreferencedExternalFiles();
+        }
 
-    inform("Looking for rid-duplicates not matching the content mime-type of the parent collection");
-    findRIDDuplicates();
+        inform("Checking size treshold changes...");
+        checkSizeTreshold();
 
-    inform("Migrating parts to new cache hierarchy...");
-    migrateToLevelledCacheHierarchy();
+        inform("Migrating parts to new cache hierarchy...");
+        migrateToLevelledCacheHierarchy();
+    };
+    runInParallel({ itemsLane, partsLane, externalPartsLane }, [this]() {
+        // Talks to the indexing agent over the janitor thread's D-Bus connection
+        inform("Checking search index consistency...");
+        findOrphanSearchIndexEntries();
+    });
 
-    inform("Checking search index consistency...");
-    findOrphanSearchIndexEntries();
+    if (m_aborted) {
+        inform("Consistency check interrupted, it will be resumed next time.");
+        Q_EMIT done();
+        return;
+    }
 
     inform("Flushing collection statistics memory cache...");
     CollectionStatistics::self()->expireCache();
+    if (auto cache = AkonadiServer::instance()->collectionTreeCache()) {
+        cache->invalidate();
+    }
 
     inform("Making sure virtual search resource and collections exist");
     ensureSearchCollection();
@@ -153,6 +246,16 @@ void StorageJanitor::check() // implementation of `akonadictl fsck`
     Q_EMIT done();
 }
 
+void StorageJanitor::restartCheck() // implementation of `akonadictl fsck --restart`
+{
+    {
+        QMutexLocker locker(&m_checkpointLock);
+        m_checkpoints->remove(QStringLiteral("Fsck"));
+        m_checkpoints->sync();
+    }
+    check();
+}
+
 qint64 StorageJanitor::lostAndFoundCollection()
 {
     if (m_lostFoundCollectionId > 0) {
@@ -291,11 +394,13 @@ void StorageJanitor::checkPathToRoot(const Collection &col)
     checkPathToRoot(parent);
 }
 
-void StorageJanitor::findOrphanedItems()
+void StorageJanitor::findOrphanedItems(qint64 from, qint64 to, bool repair)
 {
     SelectQueryBuilder<PimItem> qb;
     qb.addJoin(QueryBuilder::LeftJoin, Collection::tableName(), PimItem::collectionIdFullColumnName(), Collection::idFullColumnName());
     qb.addValueCondition(Collection::idFullColumnName(), Query::Is, QVariant());
+    qb.addValueCondition(PimItem::idFullColumnName(), Query::GreaterOrEqual, from);
+    qb.addValueCondition(PimItem::idFullColumnName(), Query::Less, to);
     if (!qb.exec()) {
         inform("Failed to query orphaned items, skipping test");
         return;
@@ -303,6 +408,9 @@ void StorageJanitor::findOrphanedItems()
     const PimItem::List orphans = qb.result();
     if (!orphans.isEmpty()) {
         inform(QLatin1Literal("Found ") + QString::number(orphans.size()) + QLatin1Literal(" orphan items."));
+        if (!repair) {
+            return;
+        }
         // Attach to lost+found collection
         Transaction transaction(DataStore::self(), QStringLiteral("JANITOR ORPHANS"));
         QueryBuilder qb(PimItem::tableName(), QueryBuilder::Update);
@@ -327,11 +435,14 @@ void StorageJanitor::findOrphanedItems()
     }
 }
 
-void StorageJanitor::findOrphanedParts()
+void StorageJanitor::findOrphanedParts(qint64 from, qint64 to, bool repair)
 {
+    Q_UNUSED(repair); // only reports so far
     SelectQueryBuilder<Part> qb;
     qb.addJoin(QueryBuilder::LeftJoin, PimItem::tableName(), Part::pimItemIdFullColumnName(), PimItem::idFullColumnName());
     qb.addValueCondition(PimItem::idFullColumnName(), Query::Is, QVariant());
+    qb.addValueCondition(Part::idFullColumnName(), Query::GreaterOrEqual, from);
+    qb.addValueCondition(Part::idFullColumnName(), Query::Less, to);
     if (!qb.exec()) {
         inform("Failed to query orphaned parts, skipping test");
         return;
@@ -343,12 +454,14 @@ void StorageJanitor::findOrphanedParts()
     }
 }
 
-void StorageJanitor:: findOrphanedPimItemFlags()
+void StorageJanitor::findOrphanedPimItemFlags(qint64 from, qint64 to, bool repair)
 {
     QueryBuilder sqb(PimItemFlagRelation::tableName(), QueryBuilder::Select);
     sqb.addColumn(PimItemFlagRelation::leftFullColumnName());
     sqb.addJoin(QueryBuilder::LeftJoin, PimItem::tableName(), PimItemFlagRelation::leftFullColumnName(), PimItem::idFullColumnName());
     sqb.addValueCondition(PimItem::idFullColumnName(), Query::Is, QVariant());
+    sqb.addValueCondition(PimItemFlagRelation::leftFullColumnName(), Query::GreaterOrEqual, from);
+    sqb.addValueCondition(PimItemFlagRelation::leftFullColumnName(), Query::Less, to);
     if (!sqb.exec()) {
         inform("Failed to query orphaned item flags, skipping test");
         return;
@@ -360,7 +473,9 @@ void StorageJanitor:: findOrphanedPimItemFlags()
         imapIds.append(sqb.query().value(0).toInt());
     }
     sqb.query().finish();
-    if (count > 0) {
+    if (count > 0 && !repair) {
+        inform(QLatin1Literal("Found ") + QString::number(count) + QLatin1Literal(" orphan pim item flags."));
+    } else if (count > 0) {
         ImapSet set;
         set.add(imapIds);
         QueryBuilder qb(PimItemFlagRelation::tableName(), QueryBuilder::Delete);
@@ -401,21 +516,8 @@ void StorageJanitor::findOverlappingParts()
     }
 }
 
-void StorageJanitor::verifyExternalParts()
+void StorageJanitor::findMissingExternalParts(qint64 from, qint64 to, bool repair)
 {
-    QSet<QString> existingFiles;
-    QSet<QString> usedFiles;
-
-    // list all files
-    const QString dataDir = StandardDirs::saveDir("data", QStringLiteral("file_db_data"));
-    QDirIterator it(dataDir, QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        existingFiles.insert(it.next());
-    }
-    existingFiles.remove(dataDir + QDir::separator() + QLatin1Char('.'));
-    existingFiles.remove(dataDir + QDir::separator() + QLatin1String(".."));
-    inform(QLatin1Literal("Found ") + QString::number(existingFiles.size()) + QLatin1Literal(" external files."));
-
     // list all parts from the db which claim to have an associated file
     QueryBuilder qb(Part::tableName(), QueryBuilder::Select);
     qb.addColumn(Part::dataColumn());
@@ -423,6 +525,8 @@ void StorageJanitor::verifyExternalParts()
     qb.addColumn(Part::idColumn());
     qb.addValueCondition(Part::storageColumn(), Query::Equals, Part::External);
     qb.addValueCondition(Part::dataColumn(), Query::IsNot, QVariant());
+    qb.addValueCondition(Part::idColumn(), Query::GreaterOrEqual, from);
+    qb.addValueCondition(Part::idColumn(), Query::Less, to);
     if (!qb.exec()) {
         inform("Failed to query existing parts, skipping test");
         return;
@@ -431,15 +535,16 @@ void StorageJanitor::verifyExternalParts()
         const auto filename = qb.query().value(0).toByteArray();
         const Entity::Id pimItemId = qb.query().value(1).value<Entity::Id>();
         const Entity::Id partId = qb.query().value(2).value<Entity::Id>();
+        bool exists = false;
         QString partPath;
         if (!filename.isEmpty()) {
-            partPath = ExternalPartStorage::resolveAbsolutePath(filename);
+            partPath = ExternalPartStorage::resolveAbsolutePath(filename, &exists);
         } else {
-            partPath = ExternalPartStorage::resolveAbsolutePath(ExternalPartStorage::nameForPartId(partId));
+            partPath = ExternalPartStorage::resolveAbsolutePath(ExternalPartStorage::nameForPartId(partId), &exists);
         }
-        if (existingFiles.contains(partPath)) {
-            usedFiles.insert(partPath);
-        } else {
+        if (!exists && !repair) {
+            inform(QLatin1Literal("Missing external file: ") + partPath + QLatin1Literal(" for item: ") + QString::number(pimItemId) + QLatin1Literal(" on part: ") + QString::number(partId));
+        } else if (!exists) {
             inform(QLatin1Literal("Cleaning up missing external file: ") + partPath + QLatin1Literal(" for item: ") + QString::number(pimItemId) + QLatin1Literal(" on part: ") + QString::number(partId));
 
             Part part;
@@ -452,10 +557,46 @@ void StorageJanitor::verifyExternalParts()
         }
     }
     qb.query().finish();
-    inform(QLatin1Literal("Found ") + QString::number(usedFiles.size()) + QLatin1Literal(" external parts."));
+}
+
+void StorageJanitor::findUnreferencedExternalFiles()
+{
+    QSet<QString> existingFiles;
+
+    // list all files
+    const QString dataDir = StandardDirs::saveDir("data", QStringLiteral("file_db_data"));
+    QDirIterator it(dataDir, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        existingFiles.insert(it.next());
+    }
+    existingFiles.remove(dataDir + QDir::separator() + QLatin1Char('.'));
+    existingFiles.remove(dataDir + QDir::separator() + QLatin1String(".."));
+    inform(QLatin1Literal("Found ") + QString::number(existingFiles.size()) + QLatin1Literal(" external files."));
+
+    QueryBuilder qb(Part::tableName(), QueryBuilder::Select);
+    qb.addColumn(Part::dataColumn());
+    qb.addColumn(Part::idColumn());
+    qb.addValueCondition(Part::storageColumn(), Query::Equals, Part::External);
+    qb.addValueCondition(Part::dataColumn(), Query::IsNot, QVariant());
+    if (!qb.exec()) {
+        inform("Failed to query existing parts, skipping test");
+        return;
+    }
+    int usedFiles = 0;
+    while (qb.query().next()) {
+        const auto filename = qb.query().value(0).toByteArray();
+        const Entity::Id partId = qb.query().value(1).value<Entity::Id>();
+        const QString partPath = filename.isEmpty() ? ExternalPartStorage::resolveAbsolutePath(ExternalPartStorage::nameForPartId(partId))
+                                                    : ExternalPartStorage::resolveAbsolutePath(filename);
+        if (existingFiles.remove(partPath)) {
+            ++usedFiles;
+        }
+    }
+    qb.query().finish();
+    inform(QLatin1Literal("Found ") + QString::number(usedFiles) + QLatin1Literal(" external parts."));
 
     // see what's left and move it to lost+found
-    const QSet<QString> unreferencedFiles = existingFiles - usedFiles;
+    const QSet<QString> &unreferencedFiles = existingFiles;
     if (!unreferencedFiles.isEmpty()) {
         const QString lfDir = StandardDirs::saveDir("data", QStringLiteral("file_lost+found"));
         for (const QString &file : unreferencedFiles) {
@@ -516,11 +657,13 @@ void StorageJanitor::findDirtyObjects()
     inform(QLatin1Literal("Found ") + QString::number(dirtyItems.size()) + QLatin1Literal(" dirty items."));
 }
 
-void StorageJanitor::findRIDDuplicates()
+void StorageJanitor::findRIDDuplicates(qint64 from, qint64 to, bool repair)
 {
     QueryBuilder qb(Collection::tableName(), QueryBuilder::Select);
     qb.addColumn(Collection::idColumn());
     qb.addColumn(Collection::nameColumn());
+    qb.addValueCondition(Collection::idColumn(), Query::GreaterOrEqual, from);
+    qb.addValueCondition(Collection::idColumn(), Query::Less, to);
     qb.exec();
 
     while (qb.query().next()) {
@@ -571,6 +714,9 @@ void StorageJanitor::findRIDDuplicates()
             }
 
             inform(QStringLiteral("Found duplicates ") + rid);
+            if (!repair) {
+                continue;
+            }
 
             SelectQueryBuilder<Part> parts;
             parts.addValueCondition(Part::pimItemIdFullColumnName(), Query::In, QVariant::fromValue(itemsIds));
@@ -626,6 +772,28 @@ void StorageJanitor::vacuum()
     Q_EMIT done();
 }
 
+void StorageJanitor::snapshot(const QString &path)
+{
+    StorageSnapshot snapshot(DataStore::self(), [this](const QString &msg) { inform(msg); });
+    if (!snapshot.create(path)) {
+        inform(QStringLiteral("ERROR: ") + snapshot.errorString());
+    }
+
+    Q_EMIT done();
+}
+
+void StorageJanitor::restore(const QString &path)
+{
+    StorageSnapshot snapshot(DataStore::self(), [this](const QString &msg) { inform(msg); });
+    if (!snapshot.restore(path)) {
+        inform(QStringLiteral("ERROR: ") + snapshot.errorString());
+    } else if (auto cache = AkonadiServer::instance()->collectionTreeCache()) {
+        cache->invalidate();
+    }
+
+    Q_EMIT done();
+}
+
 void StorageJanitor::checkSizeTreshold()
 {
     {
@@ -868,6 +1036,178 @@ void StorageJanitor::ensureSearchCollection()
 }
 
 
+const StorageJanitor::ChunkedCheck &StorageJanitor::chunkedCheck(ChunkedCheckType type)
+{
+    static const ChunkedCheck checks[ChunkedCheckCount] = {
+        { QStringLiteral("OrphanedItems"), PimItem::tableName(), PimItem::idColumn(), &StorageJanitor::findOrphanedItems },
+        { QStringLiteral("OrphanedParts"), Part::tableName(), Part::idColumn(), &StorageJanitor::findOrphanedParts },
+        { QStringLiteral("OrphanedPimItemFlags"), PimItemFlagRelation::tableName(), PimItemFlagRelation::leftColumn(), &StorageJanitor::findOrphanedPimItemFlags },
+        { QStringLiteral("MissingExternalParts"), Part::tableName(), Part::idColumn(), &StorageJanitor::findMissingExternalParts },
+        { QStringLiteral("RIDDuplicates"), Collection::tableName(), Collection::idColumn(), &StorageJanitor::findRIDDuplicates }
+    };
+    return checks[type];
+}
+
+static qint64 maxIdOf(const QString &table, const QString &idColumn, bool *ok)
+{
+    QueryBuilder qb(table, QueryBuilder::Select);
+    qb.addColumn(QLatin1Literal("max(") + idColumn + QLatin1Literal(")"));
+    *ok = qb.exec();
+    if (!*ok) {
+        return 0;
+    }
+    const qint64 maxId = qb.query().next() ? qb.query().value(0).toLongLong() : 0;
+    qb.query().finish();
+    return maxId;
+}
+
+bool StorageJanitor::runChunkedCheck(ChunkedCheckType type)
+{
+    const ChunkedCheck &check = chunkedCheck(type);
+
+    bool ok = false;
+    const qint64 maxId = maxIdOf(check.table, check.idColumn, &ok);
+    if (!ok) {
+        inform(QStringLiteral("Failed to query the id range of %1, skipping test").arg(check.table));
+        return false;
+    }
+
+    // Separate from the background checkpoints, see runBackgroundChunks()
+    const QString key = QStringLiteral("Fsck/") + check.name;
+    qint64 from = 0;
+    {
+        QMutexLocker locker(&m_checkpointLock);
+        from = m_checkpoints->value(key, 0).toLongLong();
+    }
+    if (from > 0) {
+        inform(QStringLiteral("Resuming %1 at id %2 of %3").arg(check.name).arg(from).arg(maxId));
+    }
+
+    while (from <= maxId) {
+        if (m_aborted) {
+            return false;
+        }
+        const qint64 to = from + m_chunkSize;
+        (this->*check.step)(from, to, true);
+        from = to;
+
+        QMutexLocker locker(&m_checkpointLock);
+        m_checkpoints->setValue(key, from);
+        m_checkpoints->sync();
+    }
+
+    // Done, start from the beginning next time
+    QMutexLocker locker(&m_checkpointLock);
+    m_checkpoints->remove(key);
+    m_checkpoints->sync();
+    return true;
+}
+
+bool StorageJanitor::runBackgroundChunks(ChunkedCheckType type, int maxChunks, const std::function<bool()> &canContinue)
+{
+    const ChunkedCheck &check = chunkedCheck(type);
+
+    bool ok = false;
+    const qint64 maxId = maxIdOf(check.table, check.idColumn, &ok);
+    if (!ok) {
+        return false;
+    }
+
+    // Separate from anything else, a background round must never make
+    // another check skip part of a table
+    const QString key = QStringLiteral("Background/") + check.name;
+    qint64 from = 0;
+    {
+        QMutexLocker locker(&m_checkpointLock);
+        from = m_checkpoints->value(key, 0).toLongLong();
+    }
+
+    for (int chunks = 0; from <= maxId; ++chunks) {
+        if (m_aborted || chunks == maxChunks || (canContinue && !canContinue())) {
+            return false;
+        }
+        const qint64 to = from + m_chunkSize;
+        (this->*check.step)(from, to, m_backgroundRepair);
+        from = to;
+
+        QMutexLocker locker(&m_checkpointLock);
+        m_checkpoints->setValue(key, from);
+        m_checkpoints->sync();
+    }
+
+    // Done, start from the beginning next time
+    QMutexLocker locker(&m_checkpointLock);
+    m_checkpoints->remove(key);
+    m_checkpoints->sync();
+    return true;
+}
+
+void StorageJanitor::runGuarded(const std::function<void()> &task)
+{
+    try {
+        DbDeadlockCatcher catcher(task);
+    } catch (const Exception &e) {
+        inform(QStringLiteral("Check aborted because of a database error: %1").arg(QString::fromUtf8(e.what())));
+    }
+}
+
+void StorageJanitor::runInParallel(const QVector<std::function<void()>> &lanes, const std::function<void()> &local)
+{
+    if (!m_workers) {
+        for (const auto &lane : lanes) {
+            runGuarded(lane);
+        }
+        runGuarded(local);
+        return;
+    }
+
+    for (const auto &lane : lanes) {
+        m_workers->start(new JanitorTask([this, lane]() {
+            runGuarded(lane);
+        }));
+    }
+    runGuarded(local);
+    while (!m_workers->waitForDone(100)) {
+        flushMessages();
+    }
+    flushMessages();
+}
+
+void StorageJanitor::backgroundCheck()
+{
+    // Only do work while no client command is being processed. Without
+    // a pool we can't tell, so don't do anything at all.
+    const auto serverIdle = []() {
+        auto pool = AkonadiServer::instance()->dataStorePool();
+        return pool && pool->statistics().active == 0;
+    };
+    if (!serverIdle()) {
+        return;
+    }
+
+    // All checks take turns, they only report problems unless BackgroundRepair is set
+    const QString key = QStringLiteral("Background/CurrentCheck");
+    int current = 0;
+    {
+        QMutexLocker locker(&m_checkpointLock);
+        current = m_checkpoints->value(key, 0).toInt();
+    }
+    if (current < 0 || current >= ChunkedCheckCount) {
+        current = 0;
+    }
+
+    bool finished = false;
+    runGuarded([&]() {
+        finished = runBackgroundChunks(static_cast<ChunkedCheckType>(current), m_backgroundChunks, serverIdle);
+    });
+    flushMessages();
+    if (finished) {
+        QMutexLocker locker(&m_checkpointLock);
+        m_checkpoints->setValue(key, (current + 1) % ChunkedCheckCount);
+        m_checkpoints->sync();
+    }
+}
+
 void StorageJanitor::inform(const char *msg)
 {
     inform(QLatin1String(msg));
@@ -876,5 +1216,25 @@ void StorageJanitor::inform(const char *msg)
 void StorageJanitor::inform(const QString &msg)
 {
     qCDebug(AKONADISERVER_LOG) << msg;
+    if (QThread::currentThread() != thread()) {
+        // Signals are passed on from the janitor thread only, so that they
+        // reach D-Bus in order
+        QMutexLocker locker(&m_messageLock);
+        m_pendingMessages.push_back(msg);
+        return;
+    }
+    flushMessages();
     Q_EMIT information(msg);
 }
+
+void StorageJanitor::flushMessages()
+{
+    QStringList messages;
+    {
+        QMutexLocker locker(&m_messageLock);
+        messages.swap(m_pendingMessages);
+    }
+    for (const QString &message : qAsConst(messages)) {
+        Q_EMIT information(message);
+    }
+}
@@ -23,6 +23,18 @@
 #include "akthread.h"
 
 #include <QDBusConnection>
+#include <QMutex>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+class QSettings;
+class QThreadPool;
+class QTimer;
+class StorageJanitorTest;
 
 namespace Akonadi
 {
@@ -33,6 +45,15 @@ class Collection;
 
 /**
  * Various database checking/maintenance features.
+ *
+ * The checks which walk whole tables process them in ranges of ids.
+ * Independent checks run concurrently on worker threads, each of them with its
+ * own database connection. The last processed id of each chunked check is
+ * persisted, so that an interrupted check continues where it stopped.
+ * The chunked checks can also be run in the background, doing a bounded amount
+ * of work whenever the server is idle, with their own checkpoints. In the
+ * background the checks only report problems, unless the BackgroundRepair
+ * option is enabled.
  */
 class StorageJanitor : public AkThread
 {
@@ -41,13 +62,23 @@ class StorageJanitor : public AkThread
 
 public:
     explicit StorageJanitor(QObject *parent = nullptr);
+    explicit StorageJanitor(StartMode startMode, QObject *parent = nullptr);
     ~StorageJanitor() override;
 
 public Q_SLOTS:
-    /** Triggers a consistency check of the internal storage. */
+    /**
+     * Triggers a consistency check of the internal storage. The chunked
+     * checks continue where an interrupted previous check stopped.
+     */
     Q_SCRIPTABLE Q_NOREPLY void check();
+    /** Like check(), but discards the progress of an interrupted check first. */
+    Q_SCRIPTABLE Q_NOREPLY void restartCheck();
     /** Triggers a vacuuming of the database, that is compacting of unused space. */
     Q_SCRIPTABLE Q_NOREPLY void vacuum();
+    /** Writes a binary snapshot of the whole storage into directory @p path. */
+    Q_SCRIPTABLE Q_NOREPLY void snapshot(const QString &path);
+    /** Replaces the content of the storage by the snapshot in directory @p path. */
+    Q_SCRIPTABLE Q_NOREPLY void restore(const QString &path);
 
 Q_SIGNALS:
     /** Sends informational messages to a possible UI for this. */
@@ -58,9 +89,63 @@ protected:
     void init() override;
     void quit() override;
 
+private Q_SLOTS:
+    void backgroundCheck();
+
 private:
+    enum ChunkedCheckType {
+        OrphanedItemsCheck,
+        OrphanedPartsCheck,
+        OrphanedPimItemFlagsCheck,
+        MissingExternalPartsCheck,
+        RIDDuplicatesCheck,
+        ChunkedCheckCount
+    };
+
+    struct ChunkedCheck {
+        QString name;
+        QString table;
+        QString idColumn;
+        /// Only reports the problems found unless @c repair is set
+        void (StorageJanitor::*step)(qint64 from, qint64 to, bool repair);
+    };
+    static const ChunkedCheck &chunkedCheck(ChunkedCheckType type);
+
+    /**
+     * Runs @p type over all id ranges of its table, starting at the checkpoint
+     * persisted by a previous, interrupted run. The checkpoint is updated after
+     * each range and removed once the end of the table has been reached.
+     *
+     * @return false when the check has been aborted or failed
+     */
+    bool runChunkedCheck(ChunkedCheckType type);
+
+    /**
+     * Runs at most @p maxChunks id ranges of @p type, starting at the
+     * checkpoint persisted by the previous background round. @p canContinue
+     * is asked before each range. Problems are only repaired with the
+     * BackgroundRepair option.
+     *
+     * @return true when the end of the table has been reached
+     */
+    bool runBackgroundChunks(ChunkedCheckType type, int maxChunks, const std::function<bool()> &canContinue);
+
+    /**
+     * Runs each of @p lanes on a worker thread while @p local runs in the
+     * janitor thread, and waits for all of them to finish.
+     */
+    void runInParallel(const QVector<std::function<void()>> &lanes, const std::function<void()> &local);
+
+    /**
+     * Runs @p task, retrying it on deadlocks. Any other database error aborts
+     * the task and is reported as a message, it must not escape a worker thread.
+     */
+    void runGuarded(const std::function<void()> &task);
+
     void inform(const char *msg);
     void inform(const QString &msg);
+    /** Passes on the messages queued by the worker threads. */
+    void flushMessages();
     /** Create a lost+found collection if necessary. */
     qint64 lostAndFoundCollection();
 
@@ -81,19 +166,21 @@ private:
     void checkPathToRoot(const Collection &col);
 
     /**
-     * Look for items belonging to non-existing collections.
+     * Look for items with ids in [@p from, @p to) belonging to non-existing collections
+     * and move them to lost+found if @p repair is set.
      */
-    void findOrphanedItems();
+    void findOrphanedItems(qint64 from, qint64 to, bool repair);
 
     /**
-     * Look for parts belonging to non-existing items.
+     * Look for parts with ids in [@p from, @p to) belonging to non-existing items.
      */
-    void findOrphanedParts();
+    void findOrphanedParts(qint64 from, qint64 to, bool repair);
 
     /**
-     * Look for item flags belonging to non-existing items.
+     * Look for flags of items with ids in [@p from, @p to) belonging to non-existing items
+     * and delete them if @p repair is set.
      */
-    void findOrphanedPimItemFlags();
+    void findOrphanedPimItemFlags(qint64 from, qint64 to, bool repair);
 
     /**
      * Look for parts referring to the same external file.
@@ -101,9 +188,15 @@ private:
     void findOverlappingParts();
 
     /**
-     * Verify fs and db part state.
+     * Verify that the external parts with ids in [@p from, @p to) have their file,
+     * and clear the parts without one if @p repair is set.
      */
-    void verifyExternalParts();
+    void findMissingExternalParts(qint64 from, qint64 to, bool repair);
+
+    /**
+     * Look for external part files not referenced by any part.
+     */
+    void findUnreferencedExternalFiles();
 
     /**
      * Look for dirty objects.
@@ -111,11 +204,12 @@ private:
     void findDirtyObjects();
 
     /**
-     * Look for duplicates by RID.
+     * Look for duplicates by RID in collections with ids in [@p from, @p to).
      *
-     * ..and remove the one that doesn't match the parent collections content mimetype.
+     * ..and remove the one that doesn't match the parent collections content mimetype
+     * if @p repair is set.
      */
-    void findRIDDuplicates();
+    void findRIDDuplicates(qint64 from, qint64 to, bool repair);
 
     /**
      * Check whether part sizes match what's in database.
@@ -146,6 +240,21 @@ private:
 
 private:
     qint64 m_lostFoundCollectionId;
+
+    std::atomic_bool m_aborted;
+    QThreadPool *m_workers = nullptr;
+    QTimer *m_backgroundTimer = nullptr;
+    int m_chunkSize = 10000;
+    int m_backgroundChunks = 1;
+    bool m_backgroundRepair = false;
+
+    QMutex m_checkpointLock;
+    std::unique_ptr<QSettings> m_checkpoints;
+
+    QMutex m_messageLock;
+    QStringList m_pendingMessages;
+
+    friend class ::StorageJanitorTest;
 };
 
 } // namespace Server
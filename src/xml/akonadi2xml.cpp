@@ -45,6 +45,10 @@ int main(int argc, char *argv[])
     KAboutData::setApplicationData(aboutData);
 
     aboutData.setupCommandLine(&parser);
+    parser.addOption(QCommandLineOption({ QStringLiteral("c"), QStringLiteral("collection") },
+                                        i18n("Path or id of the collection to dump"), QStringLiteral("collection")));
+    parser.addOption(QCommandLineOption({ QStringLiteral("o"), QStringLiteral("output") },
+                                        i18n("Output file"), QStringLiteral("file")));
     parser.process(app);
     aboutData.processCommandLine(&parser);
 
@@ -61,10 +65,13 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    // The collection tree is written incrementally, so memory use does not
+    // depend on the size of the dumped collections
     XmlWriteJob writer(root, parser.value(QStringLiteral("output")));
     if (!writer.exec()) {
-        qCritical() << writer.exec();
+        qCritical() << writer.errorString();
         return -1;
     }
+    return 0;
 }
 
@@ -0,0 +1,200 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "xmlstreamreader.h"
+#include "xmlstreamwriter.h"
+
+#include "collection.h"
+#include "item.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QObject>
+#include <QTemporaryFile>
+#include <QTest>
+
+using namespace Akonadi;
+
+class XmlStreamTest : public QObject
+{
+    Q_OBJECT
+
+    static void writeDocument(QIODevice *device, int itemCount)
+    {
+        XmlStreamWriter writer(device);
+        writer.writeStartDocument();
+        Collection col;
+        col.setRemoteId(QStringLiteral("c1"));
+        col.setName(QStringLiteral("Inbox"));
+        col.setContentMimeTypes({ QStringLiteral("application/octet-stream") });
+        writer.writeStartCollection(col);
+        Collection child;
+        child.setRemoteId(QStringLiteral("c11"));
+        child.setName(QStringLiteral("Child"));
+        writer.writeStartCollection(child);
+        writer.writeEndCollection();
+        for (int i = 0; i < itemCount; ++i) {
+            Item item(QStringLiteral("application/octet-stream"));
+            item.setRemoteId(QString::number(i));
+            item.setFlag("\\SEEN");
+            item.setPayload<QByteArray>("Payload of item " + QByteArray::number(i));
+            writer.writeItem(item);
+        }
+        writer.writeEndCollection();
+        writer.writeEndDocument();
+    }
+
+private Q_SLOTS:
+    void testRoundTrip()
+    {
+        QBuffer buffer;
+        buffer.open(QIODevice::ReadWrite);
+        writeDocument(&buffer, 3);
+        buffer.seek(0);
+
+        XmlStreamReader reader(&buffer);
+        QCOMPARE(reader.readNext(), XmlStreamReader::StartCollection);
+        QCOMPARE(reader.collection().remoteId(), QStringLiteral("c1"));
+        QCOMPARE(reader.collection().name(), QStringLiteral("Inbox"));
+        QCOMPARE(reader.readNext(), XmlStreamReader::StartCollection);
+        QCOMPARE(reader.collection().remoteId(), QStringLiteral("c11"));
+        QCOMPARE(reader.collection().parentCollection().remoteId(), QStringLiteral("c1"));
+        QCOMPARE(reader.collectionPath(), QStringList({ QStringLiteral("c1"), QStringLiteral("c11") }));
+        QCOMPARE(reader.readNext(), XmlStreamReader::EndCollection);
+        for (int i = 0; i < 3; ++i) {
+            QCOMPARE(reader.readNext(), XmlStreamReader::ItemToken);
+            const Item item = reader.item();
+            QCOMPARE(item.remoteId(), QString::number(i));
+            QVERIFY(item.hasFlag("\\SEEN"));
+            QCOMPARE(item.payload<QByteArray>(), QByteArray("Payload of item " + QByteArray::number(i)));
+        }
+        QCOMPARE(reader.readNext(), XmlStreamReader::EndCollection);
+        QCOMPARE(reader.readNext(), XmlStreamReader::EndDocument);
+    }
+
+    void testPayloadFromFile()
+    {
+        QTemporaryFile payloadFile;
+        QVERIFY(payloadFile.open());
+        // Larger than a single copy chunk, with a multibyte character at the chunk boundary
+        const QByteArray payload = QByteArray(64 * 1024 - 1, 'a') + QStringLiteral("ä").toUtf8() + QByteArray(100, 'b');
+        payloadFile.write(payload);
+        payloadFile.close();
+
+        Item item(QStringLiteral("application/octet-stream"));
+        item.setRemoteId(QStringLiteral("file"));
+        item.setPayloadPath(payloadFile.fileName());
+
+        QBuffer buffer;
+        buffer.open(QIODevice::ReadWrite);
+        {
+            XmlStreamWriter writer(&buffer);
+            writer.writeStartDocument();
+            writer.writeItem(item);
+            writer.writeEndDocument();
+        }
+        buffer.seek(0);
+
+        XmlStreamReader reader(&buffer);
+        QCOMPARE(reader.readNext(), XmlStreamReader::ItemToken);
+        QCOMPARE(reader.item().payload<QByteArray>(), payload);
+    }
+
+    void testMissingPayloadFile()
+    {
+        QTemporaryFile payloadFile;
+        QVERIFY(payloadFile.open());
+        const QString fileName = payloadFile.fileName();
+        payloadFile.close();
+        QVERIFY(payloadFile.remove());
+
+        Item item(QStringLiteral("application/octet-stream"));
+        item.setRemoteId(QStringLiteral("missing"));
+        item.setPayloadPath(fileName);
+        QVERIFY(!item.hasPayload());
+
+        QBuffer buffer;
+        buffer.open(QIODevice::ReadWrite);
+        XmlStreamWriter writer(&buffer);
+        writer.writeStartDocument();
+        QVERIFY(!writer.writeItem(item));
+        QVERIFY(writer.errorString().contains(fileName));
+    }
+
+    void testReadDemoDocument()
+    {
+        QFile file(QStringLiteral(KDESRCDIR "/knutdemo.xml"));
+        QVERIFY(file.open(QIODevice::ReadOnly));
+
+        XmlStreamReader reader(&file);
+        int collections = 0;
+        int items = 0;
+        XmlStreamReader::TokenType token;
+        while ((token = reader.readNext()) != XmlStreamReader::EndDocument) {
+            QVERIFY2(token != XmlStreamReader::Invalid, qPrintable(reader.errorString()));
+            if (token == XmlStreamReader::StartCollection) {
+                ++collections;
+                if (reader.collection().remoteId() == QLatin1String("c11")) {
+                    QCOMPARE(reader.collection().attributes().count(), 1);
+                }
+            } else if (token == XmlStreamReader::ItemToken) {
+                ++items;
+                QVERIFY(reader.item().hasPayload());
+            }
+        }
+        QCOMPARE(collections, 9);
+        QVERIFY(items > 0);
+    }
+
+    void benchmarkWrite()
+    {
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        QBENCHMARK {
+            file.resize(0);
+            file.seek(0);
+            writeDocument(&file, 10000);
+        }
+    }
+
+    void benchmarkRead()
+    {
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        writeDocument(&file, 10000);
+        QBENCHMARK {
+            file.seek(0);
+            XmlStreamReader reader(&file);
+            int items = 0;
+            XmlStreamReader::TokenType token;
+            while ((token = reader.readNext()) != XmlStreamReader::EndDocument) {
+                QVERIFY(token != XmlStreamReader::Invalid);
+                if (token == XmlStreamReader::ItemToken) {
+                    ++items;
+                }
+            }
+            QCOMPARE(items, 10000);
+        }
+    }
+};
+
+QTEST_MAIN(XmlStreamTest)
+
+#include "xmlstreamtest.moc"
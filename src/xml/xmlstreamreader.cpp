@@ -0,0 +1,220 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "xmlstreamreader.h"
+#include "format_p.h"
+
+#include "attributefactory.h"
+#include "collection.h"
+#include "item.h"
+#include "tag.h"
+
+#include <KLocalizedString>
+
+#include <QStringList>
+#include <QXmlStreamReader>
+
+using namespace Akonadi;
+
+namespace Akonadi
+{
+
+class XmlStreamReaderPrivate
+{
+public:
+    explicit XmlStreamReaderPrivate(QIODevice *device)
+        : reader(device)
+    {
+    }
+
+    Attribute *readAttribute()
+    {
+        const QByteArray type = reader.attributes().value(Format::Attr::attributeType()).toUtf8();
+        const QByteArray data = reader.readElementText().toUtf8();
+        Attribute *attr = AttributeFactory::createAttribute(type);
+        Q_ASSERT(attr);
+        attr->deserialize(data);
+        return attr;
+    }
+
+    void readCollection()
+    {
+        const QXmlStreamAttributes attrs = reader.attributes();
+        collection = Collection();
+        collection.setRemoteId(attrs.value(Format::Attr::remoteId()).toString());
+        collection.setName(attrs.value(Format::Attr::collectionName()).toString());
+        collection.setContentMimeTypes(attrs.value(Format::Attr::collectionContentTypes()).toString().split(QLatin1Char(',')));
+        if (!collectionPath.isEmpty()) {
+            collection.parentCollection().setRemoteId(collectionPath.last());
+        }
+        collectionPath.push_back(collection.remoteId());
+
+        // Consume the attributes directly following the start of the collection, the
+        // first other child element is kept as the current token for the next readNext()
+        while (!reader.atEnd()) {
+            const QXmlStreamReader::TokenType token = reader.readNext();
+            if (token == QXmlStreamReader::StartElement) {
+                if (reader.name() == Format::Tag::attribute()) {
+                    collection.addAttribute(readAttribute());
+                    continue;
+                }
+                reuseToken = true;
+                return;
+            } else if (token == QXmlStreamReader::EndElement || token == QXmlStreamReader::Invalid) {
+                reuseToken = true;
+                return;
+            }
+        }
+    }
+
+    void readItem()
+    {
+        const QXmlStreamAttributes attrs = reader.attributes();
+        item = Item(attrs.hasAttribute(Format::Attr::itemMimeType())
+                    ? attrs.value(Format::Attr::itemMimeType()).toString()
+                    : QStringLiteral("application/octet-stream"));
+        item.setRemoteId(attrs.value(Format::Attr::remoteId()).toString());
+
+        while (reader.readNextStartElement()) {
+            const QStringRef name = reader.name();
+            if (name == Format::Tag::flag()) {
+                item.setFlag(reader.readElementText().toUtf8());
+            } else if (name == Format::Tag::tag()) {
+                Tag tag;
+                tag.setRemoteId(reader.readElementText().toUtf8());
+                item.setTag(tag);
+            } else if (name == Format::Tag::attribute()) {
+                item.addAttribute(readAttribute());
+            } else if (includePayload && name == Format::Tag::payload()) {
+                item.setPayloadFromData(reader.readElementText().toUtf8());
+            } else {
+                reader.skipCurrentElement();
+            }
+        }
+    }
+
+    void readTag()
+    {
+        const QXmlStreamAttributes attrs = reader.attributes();
+        tag = Tag();
+        tag.setRemoteId(attrs.value(Format::Attr::remoteId()).toUtf8());
+        tag.setName(attrs.value(Format::Attr::name()).toString());
+        tag.setGid(attrs.value(Format::Attr::gid()).toUtf8());
+        tag.setType(attrs.value(Format::Attr::type()).toUtf8());
+    }
+
+    QXmlStreamReader reader;
+    Collection collection;
+    Item item;
+    Tag tag;
+    QStringList collectionPath;
+    QString error;
+    bool includePayload = true;
+    bool reuseToken = false;
+};
+
+}
+
+XmlStreamReader::XmlStreamReader(QIODevice *device)
+    : d(new XmlStreamReaderPrivate(device))
+{
+}
+
+XmlStreamReader::~XmlStreamReader()
+{
+    delete d;
+}
+
+void XmlStreamReader::setIncludePayload(bool include)
+{
+    d->includePayload = include;
+}
+
+XmlStreamReader::TokenType XmlStreamReader::readNext()
+{
+    while (d->reuseToken || !d->reader.atEnd()) {
+        const QXmlStreamReader::TokenType token = d->reuseToken ? d->reader.tokenType() : d->reader.readNext();
+        d->reuseToken = false;
+
+        switch (token) {
+        case QXmlStreamReader::StartElement: {
+            const QStringRef name = d->reader.name();
+            if (name == Format::Tag::collection()) {
+                d->readCollection();
+                return StartCollection;
+            } else if (name == Format::Tag::item()) {
+                d->readItem();
+                return ItemToken;
+            } else if (name == Format::Tag::tag()) {
+                // Nested tags are returned as separate tokens, the element is not skipped
+                d->readTag();
+                return TagToken;
+            } else if (name != Format::Tag::root()) {
+                d->reader.skipCurrentElement();
+            }
+            break;
+        }
+        case QXmlStreamReader::EndElement:
+            if (d->reader.name() == Format::Tag::collection()) {
+                d->collectionPath.removeLast();
+                return EndCollection;
+            }
+            break;
+        case QXmlStreamReader::EndDocument:
+            return EndDocument;
+        case QXmlStreamReader::Invalid:
+            d->error = i18n("Unable to parse data file: %1", d->reader.errorString());
+            return Invalid;
+        default:
+            break;
+        }
+    }
+
+    if (d->reader.hasError()) {
+        d->error = i18n("Unable to parse data file: %1", d->reader.errorString());
+        return Invalid;
+    }
+    return EndDocument;
+}
+
+Collection XmlStreamReader::collection() const
+{
+    return d->collection;
+}
+
+Item XmlStreamReader::item() const
+{
+    return d->item;
+}
+
+Tag XmlStreamReader::tag() const
+{
+    return d->tag;
+}
+
+QStringList XmlStreamReader::collectionPath() const
+{
+    return d->collectionPath;
+}
+
+QString XmlStreamReader::errorString() const
+{
+    return d->error;
+}
@@ -0,0 +1,131 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef AKONADI_XMLSTREAMREADER_H
+#define AKONADI_XMLSTREAMREADER_H
+
+#include "akonadi-xml_export.h"
+
+#include <QStringList>
+
+class QIODevice;
+
+namespace Akonadi
+{
+
+class Collection;
+class Item;
+class Tag;
+class XmlStreamReaderPrivate;
+
+/**
+  Incrementally parses a document in the KNUT XML format.
+
+  Unlike XmlDocument, the reader never holds more than the current object in
+  memory, which makes it suitable for consumers reading a document once from
+  start to end. The document is read as a sequence of tokens, the object
+  belonging to the current token is available through collection(), item()
+  or tag().
+
+  Users which look up or modify objects of the document, like the KNUT
+  resource, need XmlDocument and keep the whole document in memory.
+
+  @code
+  XmlStreamReader reader(&file);
+  while (true) {
+    switch (reader.readNext()) {
+    case XmlStreamReader::StartCollection:
+      // reader.collection() is a child of the previous StartCollection that has not been ended yet
+      break;
+    case XmlStreamReader::ItemToken:
+      // reader.item() belongs to the innermost open collection
+      break;
+    ...
+    }
+  }
+  @endcode
+
+  Schema validation is not performed, use XmlDocument for that.
+
+  @see Akonadi::XmlStreamWriter
+*/
+class AKONADI_XML_EXPORT XmlStreamReader
+{
+public:
+    enum TokenType {
+        Invalid,            ///< An error occurred, see errorString()
+        StartCollection,    ///< A collection starts, see collection()
+        EndCollection,      ///< The innermost open collection ends
+        ItemToken,          ///< An item was read, see item()
+        TagToken,           ///< A tag was read, see tag()
+        EndDocument         ///< The end of the document was reached
+    };
+
+    /**
+      Creates a new reader reading from @p device, which must already be open.
+    */
+    explicit XmlStreamReader(QIODevice *device);
+    ~XmlStreamReader();
+
+    /**
+      Sets whether item payloads shall be deserialized. Defaults to @c true.
+      When disabled, payload data is skipped without being kept in memory.
+    */
+    void setIncludePayload(bool include);
+
+    /**
+      Reads the next token from the document.
+    */
+    TokenType readNext();
+
+    /**
+      Returns the collection read by the last StartCollection token.
+      The parent collection is identified by its remote id.
+    */
+    Q_REQUIRED_RESULT Collection collection() const;
+
+    /**
+      Returns the item read by the last ItemToken.
+    */
+    Q_REQUIRED_RESULT Item item() const;
+
+    /**
+      Returns the tag read by the last TagToken.
+    */
+    Q_REQUIRED_RESULT Tag tag() const;
+
+    /**
+      Returns the remote ids of all currently open collections, outermost first.
+    */
+    Q_REQUIRED_RESULT QStringList collectionPath() const;
+
+    /**
+      Returns the error message after an Invalid token.
+    */
+    Q_REQUIRED_RESULT QString errorString() const;
+
+private:
+    Q_DISABLE_COPY(XmlStreamReader)
+    XmlStreamReaderPrivate *const d;
+};
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "xmlstreamwriter.h"
+#include "format_p.h"
+
+#include "attribute.h"
+#include "collection.h"
+#include "item.h"
+
+#include <QFile>
+#include <QTextCodec>
+#include <QXmlStreamWriter>
+
+#include <memory>
+
+using namespace Akonadi;
+
+namespace Akonadi
+{
+
+class XmlStreamWriterPrivate
+{
+public:
+    explicit XmlStreamWriterPrivate(QIODevice *device)
+        : writer(device)
+    {
+    }
+
+    template<typename T>
+    void writeAttributes(const T &entity)
+    {
+        Q_FOREACH (Attribute *attr, entity.attributes()) {
+            writer.writeStartElement(Format::Tag::attribute());
+            writer.writeAttribute(Format::Attr::attributeType(), QString::fromUtf8(attr->type()));
+            writer.writeCharacters(QString::fromUtf8(attr->serialized()));
+            writer.writeEndElement();
+        }
+    }
+
+    bool writePayloadFromFile(QFile &file)
+    {
+        // The decoder keeps state between chunks, so multibyte sequences
+        // split at a chunk boundary are decoded correctly
+        std::unique_ptr<QTextDecoder> decoder(QTextCodec::codecForName("UTF-8")->makeDecoder());
+        writer.writeStartElement(Format::Tag::payload());
+        bool ok = true;
+        while (!file.atEnd()) {
+            const QByteArray chunk = file.read(ChunkSize);
+            if (chunk.isEmpty()) {
+                error = QStringLiteral("Failed to read payload file %1: %2").arg(file.fileName(), file.errorString());
+                ok = false;
+                break;
+            }
+            writer.writeCharacters(decoder->toUnicode(chunk));
+        }
+        writer.writeEndElement();
+        return ok;
+    }
+
+    static const qint64 ChunkSize = 64 * 1024;
+
+    QXmlStreamWriter writer;
+    QString error;
+};
+
+}
+
+XmlStreamWriter::XmlStreamWriter(QIODevice *device)
+    : d(new XmlStreamWriterPrivate(device))
+{
+    d->writer.setAutoFormatting(true);
+    d->writer.setAutoFormattingIndent(2);
+}
+
+XmlStreamWriter::~XmlStreamWriter()
+{
+    delete d;
+}
+
+void XmlStreamWriter::writeStartDocument()
+{
+    d->writer.writeStartDocument();
+    d->writer.writeStartElement(Format::Tag::root());
+}
+
+void XmlStreamWriter::writeEndDocument()
+{
+    d->writer.writeEndDocument();
+}
+
+void XmlStreamWriter::writeStartCollection(const Collection &collection)
+{
+    d->writer.writeStartElement(Format::Tag::collection());
+    d->writer.writeAttribute(Format::Attr::remoteId(), collection.remoteId());
+    d->writer.writeAttribute(Format::Attr::collectionName(), collection.name());
+    d->writer.writeAttribute(Format::Attr::collectionContentTypes(), collection.contentMimeTypes().join(QLatin1Char(',')));
+    d->writeAttributes(collection);
+}
+
+void XmlStreamWriter::writeEndCollection()
+{
+    d->writer.writeEndElement();
+}
+
+bool XmlStreamWriter::writeItem(const Item &item)
+{
+    d->writer.writeStartElement(Format::Tag::item());
+    d->writer.writeAttribute(Format::Attr::remoteId(), item.remoteId());
+    d->writer.writeAttribute(Format::Attr::itemMimeType(), item.mimeType());
+
+    bool ok = true;
+    QFile file(item.payloadPath());
+    if (!item.payloadPath().isEmpty() && file.open(QIODevice::ReadOnly)) {
+        ok = d->writePayloadFromFile(file);
+    } else if (item.hasPayload()) {
+        d->writer.writeTextElement(Format::Tag::payload(), QString::fromUtf8(item.payloadData()));
+    } else if (!item.payloadPath().isEmpty()) {
+        d->error = QStringLiteral("Failed to open payload file %1: %2").arg(file.fileName(), file.errorString());
+        ok = false;
+    }
+
+    d->writeAttributes(item);
+
+    Q_FOREACH (const Item::Flag &flag, item.flags()) {
+        d->writer.writeTextElement(Format::Tag::flag(), QString::fromUtf8(flag));
+    }
+
+    d->writer.writeEndElement();
+    return ok;
+}
+
+bool XmlStreamWriter::hasError() const
+{
+    return d->writer.hasError();
+}
+
+QString XmlStreamWriter::errorString() const
+{
+    return d->error;
+}
@@ -0,0 +1,105 @@
+/*
+    Copyright (c) 2019 The Akonadi developers
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef AKONADI_XMLSTREAMWRITER_H
+#define AKONADI_XMLSTREAMWRITER_H
+
+#include "akonadi-xml_export.h"
+
+#include <QString>
+
+class QIODevice;
+
+namespace Akonadi
+{
+
+class Collection;
+class Item;
+class XmlStreamWriterPrivate;
+
+/**
+  Incrementally serializes Akonadi objects into the KNUT XML format.
+
+  Unlike XmlDocument, the writer does not keep the document in memory, every
+  element is written to the output device right away. Collections are written
+  by enclosing their child collections and items in writeStartCollection() and
+  writeEndCollection(); child collections must be written before the items.
+
+  @see Akonadi::XmlStreamReader
+*/
+class AKONADI_XML_EXPORT XmlStreamWriter
+{
+public:
+    /**
+      Creates a new writer writing into @p device, which must already be open.
+    */
+    explicit XmlStreamWriter(QIODevice *device);
+    ~XmlStreamWriter();
+
+    /**
+      Writes the document header and opens the root element.
+    */
+    void writeStartDocument();
+
+    /**
+      Closes all open elements and the document.
+    */
+    void writeEndDocument();
+
+    /**
+      Opens a collection element and writes the collection's attributes into it.
+    */
+    void writeStartCollection(const Collection &collection);
+
+    /**
+      Closes the collection element opened by the last writeStartCollection().
+    */
+    void writeEndCollection();
+
+    /**
+      Serializes the given item into the current collection.
+
+      If the payload of @p item is stored in a file (see Item::payloadPath()),
+      it is copied from the file in chunks instead of being loaded into memory.
+
+      @return @c false if the payload file could not be read and the item has
+      no payload in memory, see errorString(). The item is written without its
+      complete payload then.
+    */
+    bool writeItem(const Item &item);
+
+    /**
+      Returns @c true if writing into the device has failed.
+    */
+    Q_REQUIRED_RESULT bool hasError() const;
+
+    /**
+      Returns the reason why the last failed writeItem() could not read the payload.
+    */
+    Q_REQUIRED_RESULT QString errorString() const;
+
+private:
+    Q_DISABLE_COPY(XmlStreamWriter)
+    XmlStreamWriterPrivate *const d;
+};
+
+}
+
+#endif
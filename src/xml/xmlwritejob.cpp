@@ -18,8 +18,7 @@
 */
 
 #include "xmlwritejob.h"
-#include "xmldocument.h"
-#include "xmlwriter.h"
+#include "xmlstreamwriter.h"
 
 #include "collection.h"
 #include "collectionfetchjob.h"
@@ -29,11 +28,14 @@
 
 #include <QDebug>
 
-#include <QDomElement>
+#include <QFile>
+#include <QScopedPointer>
 #include <QStack>
 
 using namespace Akonadi;
 
+static const int ItemPageSize = 1000;
+
 namespace Akonadi
 {
 
@@ -45,14 +47,15 @@ public:
     XmlWriteJob *const q;
     Collection::List roots;
     QStack<Collection::List> pendingSiblings;
-    QStack<QDomElement> elementStack;
     QString fileName;
-    XmlDocument document;
+    QFile file;
+    QScopedPointer<XmlStreamWriter> writer;
+    QString error;
 
     void collectionFetchResult(KJob *job);
     void processCollection();
     void itemFetchResult(KJob *job);
-    void processItems();
+    void processItems(const QByteArray &continuation = QByteArray());
 };
 
 }
@@ -90,18 +93,27 @@ void XmlWriteJobPrivate::processCollection()
     }
 
     const Collection current = pendingSiblings.top().first();
-    qDebug() << "Writing " << current.name() << "into" << elementStack.top().attribute(QStringLiteral("name"));
-    elementStack.push(XmlWriter::writeCollection(current, elementStack.top()));
+    qDebug() << "Writing " << current.name();
+    // Child collections are written before the items of the collection, as
+    // required by the schema
+    writer->writeStartCollection(current);
     CollectionFetchJob *subfetch = new CollectionFetchJob(current, CollectionFetchJob::FirstLevel, q);
     q->connect(subfetch, &CollectionFetchJob::result, q, [this](KJob *job) {collectionFetchResult(job); });
 }
 
-void XmlWriteJobPrivate::processItems()
+void XmlWriteJobPrivate::processItems(const QByteArray &continuation)
 {
     const Collection collection = pendingSiblings.top().first();
     ItemFetchJob *fetch = new ItemFetchJob(collection, q);
     fetch->fetchScope().fetchAllAttributes();
     fetch->fetchScope().fetchFullPayload();
+    // Payloads stored in files are copied from the file by the writer
+    // instead of being loaded into memory
+    fetch->fetchScope().setPayloadFileReferences(true);
+    // Page through the collection so that only one page of items is kept
+    // in memory at a time
+    fetch->fetchScope().setLimit(ItemPageSize);
+    fetch->fetchScope().setContinuation(continuation);
     q->connect(fetch, &ItemFetchJob::result, q, [this](KJob *job) { itemFetchResult(job); } );
 }
 
@@ -112,12 +124,24 @@ void XmlWriteJobPrivate::itemFetchResult(KJob *job)
     }
     ItemFetchJob *fetch = qobject_cast<ItemFetchJob *>(job);
     Q_ASSERT(fetch);
-    const Akonadi::Item::List lstItems = fetch->items();
-    for (const Item &item : lstItems) {
-        XmlWriter::writeItem(item, elementStack.top());
+    const Item::List items = fetch->items();
+    for (const Item &item : items) {
+        if (!writer->writeItem(item)) {
+            // Don't silently export an item without its payload
+            error = writer->errorString();
+            q->done();
+            return;
+        }
+    }
+
+    const QByteArray continuation = fetch->continuation();
+    if (!continuation.isEmpty()) {
+        processItems(continuation);
+        return;
     }
+
     pendingSiblings.top().removeFirst();
-    elementStack.pop();
+    writer->writeEndCollection();
     processCollection();
 }
 
@@ -144,17 +168,31 @@ XmlWriteJob::~XmlWriteJob()
 
 void XmlWriteJob::doStart()
 {
-    d->elementStack.push(d->document.document().documentElement());
+    d->file.setFileName(d->fileName);
+    if (!d->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        setError(Unknown);
+        setErrorText(d->file.errorString());
+        emitResult();
+        return;
+    }
+    d->writer.reset(new XmlStreamWriter(&d->file));
+    d->writer->writeStartDocument();
+
     CollectionFetchJob *job = new CollectionFetchJob(d->roots, this);
     connect(job, &CollectionFetchJob::result, this, [this](KJob *job) {d->collectionFetchResult(job);});
 }
 
 void XmlWriteJob::done() // cannot be in the private class due to emitResult()
 {
-    if (!d->document.writeToFile(d->fileName)) {
+    d->writer->writeEndDocument();
+    if (!d->error.isEmpty()) {
+        setError(Unknown);
+        setErrorText(d->error);
+    } else if (d->writer->hasError()) {
         setError(Unknown);
-        setErrorText(d->document.lastError());
+        setErrorText(d->file.errorString());
     }
+    d->file.close();
     emitResult();
 }
 